@@ -58,6 +58,104 @@ namespace engine {
     };
 
 
+    struct Render_Stats
+    {
+        int instance_count;
+        int draw_calls;
+
+        // Entities that passed and failed frustum culling. These are only
+        // counted when culling on the CPU.
+        int visible_count;
+        int culled_count;
+
+        // Instances and triangles rejected by occlusion culling. The GPU
+        // driven path reports these a few frames late.
+        int occluded_count;
+        int occluded_triangles;
+
+        // Instances drawn into the shadow maps summed over every cascade.
+        int shadow_casters;
+
+        // Pipeline, material and vertex buffer binds avoided by sorting the
+        // draws of the CPU path by state.
+        int binds_skipped;
+
+        // CPU time in milliseconds spent recording the frames commands.
+        float record_time;
+    };
+
+
+    enum struct Present_Mode
+    {
+        // Waits for the display. No tearing but frames queue up when the CPU
+        // and GPU are faster than the display.
+        vsync,
+
+        // Synchronized to the display without blocking. Newer frames replace
+        // queued ones which lowers latency at the cost of wasted frames.
+        mailbox,
+
+        // Presents as soon as a frame is ready which may tear.
+        immediate
+    };
+
+
+    // Latency markers of the most recently presented frame in milliseconds.
+    struct Latency_Stats
+    {
+        // From sampling input for a frame until the frame was queued for
+        // presentation. Time spent by the display itself is not included.
+        float input_to_present;
+        float input_to_present_avg;
+
+        // The CPU waiting for the GPU to finish a frame in flight or for the
+        // swapchain to release an image.
+        float frame_wait;
+
+        // Sleeping to hold the frame limit.
+        float limiter_wait;
+    };
+
+
+    // Rolling GPU time in milliseconds of a pass over the most recent frames.
+    struct Gpu_Timing
+    {
+        const char* name;
+        float last;
+        float min;
+        float avg;
+        float max;
+    };
+
+
+    // Result of comparing a frame against a reference image.
+    struct Image_Diff
+    {
+        int pixel_count;
+        int differing_pixels;
+
+        // Largest difference of any channel in the range 0 to 255.
+        int max_difference;
+    };
+
+
+    // Describes how preview images of a batch of models are rendered. Each
+    // model is framed by its bounding box and rendered from angle_count
+    // directions spread evenly around its vertical axis.
+    struct Thumbnail_Settings
+    {
+        // Images are written as <output_directory>/<file name>_<angle>.png
+        const char* output_directory;
+        int angle_count;
+
+        // Degrees above the model that the camera looks down from.
+        float elevation;
+        float fovy;
+
+        bool flip_uvs;
+    };
+
+
     struct Callbacks
     {
         void (*key_callback)(int keycode, bool control, bool alt, bool shift);
@@ -76,6 +174,42 @@ namespace engine {
     // which provides the required information the engine needs to initialize.
     bool initialize(const char* name, int width, int height);
 
+    //
+    // Initializes the engine without a window, audio or UI. There is no surface
+    // or swapchain so present only submits the frame. Every pass renders into
+    // framebuffers of width by height which can be copied to the CPU using
+    // read_frame_pixels. Intended for benchmarks and image regression tests on
+    // machines without a display.
+    bool initialize_headless(int width, int height);
+
+    //
+    // Waits for the GPU and copies the lit result of the most recently presented
+    // frame into pixels as tightly packed RGBA8. pixels must hold width *
+    // height * 4 bytes where the size is returned by get_frame_size. Returns
+    // false if no frame has been presented yet.
+    bool read_frame_pixels(unsigned char* pixels);
+    void get_frame_size(int* width, int* height);
+
+    //
+    // Writes the lit result of the most recently presented frame to a PNG.
+    // Used to create the reference images for compare_frame_pixels.
+    bool save_frame_pixels(const char* path);
+
+    //
+    // Compares the most recently presented frame against a PNG of the same
+    // size. Pixels where any channel differs by more than tolerance are
+    // counted as differing. Returns false if the image cannot be read or is
+    // a different size.
+    bool compare_frame_pixels(const char* path, int tolerance, Image_Diff* diff);
+
+    //
+    // Renders preview images of every model in paths using the current frame
+    // size. The next model is read on a worker thread while the current one is
+    // rendered and images are encoded in the background. The models are only
+    // loaded for the duration of the batch and the scene is left untouched.
+    // Requires initialize_headless. Returns the number of models rendered.
+    int render_thumbnails(const char* const* paths, int path_count, const Thumbnail_Settings* settings);
+
     //
     // The final engine related function call that will terminate all sub-systems
     // and free all engine managed memory. Engine* should be a valid pointer 
@@ -103,6 +237,96 @@ namespace engine {
 
     void set_vsync(bool enabled);
 
+    //
+    // Present mode, buffering and frames in flight changes are applied at the
+    // start of the next frame since they require the GPU to be idle.
+    void set_present_mode(Present_Mode mode);
+    Present_Mode get_present_mode();
+
+    //
+    // Uses three swapchain images instead of two so that the GPU can start
+    // the next frame while one image is being displayed and another waits.
+    void set_triple_buffering(bool enabled);
+
+    //
+    // Sets how many frames the CPU may record ahead of the GPU between one
+    // and three. More frames keep the GPU busy at the cost of input latency.
+    void set_frames_in_flight(int count);
+    int get_frames_in_flight();
+
+    //
+    // Caps the frame rate by sleeping after presenting. Zero disables the
+    // limiter. Sleeping before input is sampled rather than queueing frames
+    // keeps latency low when the limit is below what the GPU can render.
+    void set_frame_limit(float frames_per_second);
+
+    //
+    // Waits for the GPU to finish the next frame in flight before input is
+    // sampled instead of afterwards. Lowers latency when the GPU is the
+    // bottleneck at the cost of no longer overlapping CPU and GPU work.
+    void set_low_latency(bool enabled);
+
+    //
+    // Fills out the latency markers of the most recently presented frame.
+    void get_latency_stats(Latency_Stats* stats);
+
+    //
+    // Switches between culling and generating draw commands on the GPU and
+    // the CPU instanced path. Returns false if the GPU does not support
+    // indirect count draws in which case the CPU path remains active.
+    bool set_gpu_culling(bool enabled);
+
+    //
+    // Enables testing instances against the depth of the previous frame so
+    // that instances hidden behind other geometry are not drawn.
+    void set_occlusion_culling(bool enabled);
+
+    //
+    // Enables cascaded shadows from the sun.
+    void set_shadows(bool enabled);
+
+    //
+    // Enables perturbing the surface normals using the normal textures.
+    void set_normal_mapping(bool enabled);
+
+    //
+    // Sets the maximum number of threads that cull and record the geometry
+    // pass when culling on the CPU. Fewer threads are used for small scenes.
+    void set_record_threads(int count);
+    int get_record_threads();
+
+    //
+    // Fills out statistics about the most recently recorded frame.
+    void get_render_stats(Render_Stats* stats);
+
+    //
+    // Fills out the GPU timings of each render pass and returns the number
+    // written. Timings lag a couple of frames behind so that reading them
+    // never waits on the GPU.
+    int get_gpu_timings(Gpu_Timing* timings, int max_count);
+
+    //
+    // Writes the GPU timings of each render pass to a CSV file.
+    bool export_gpu_timings(const char* path);
+
+    //
+    // Records CPU profile zones for the next frame_count frames and then
+    // writes them to path as Chrome trace JSON. Returns false if a capture
+    // is already running or the profiler has been compiled out.
+    bool capture_cpu_profile(int frame_count, const char* path);
+    bool is_capturing_cpu_profile();
+
+    //
+    // Captures view for the next frame_count frames without stalling the
+    // renderer. Each frame is copied into a readback buffer, read once its
+    // fence has signalled and encoded on a worker thread. Depth is written as
+    // a float EXR and every other view as a PNG. A sequence appends the frame
+    // number to the file name. Frames are dropped if encoding falls behind.
+    // Views other than full and depth replace the displayed view while the
+    // capture runs.
+    bool capture_viewport(Viewport_View view, const char* path, int frame_count);
+    bool is_capturing_viewport();
+
     //
     // Updates the internal state of the engine. This is called every frame before
     // any rendering related function calls. The boolean return value returns true
@@ -135,8 +359,8 @@ namespace engine {
     // Environment
 
     //
-    //
-    //
+    // Loads the environment model. An existing environment is replaced and
+    // released once the frames in flight that drew it have finished.
     //
     void set_environment_map(const char* path);
 
@@ -152,8 +376,9 @@ namespace engine {
 
 
     //
-    // Removes a model by deallocating all resources a model.
-    //
+    // Removes a model and every instance of it. Models after it move down
+    // by one. Its GPU resources are released once the frames in flight that
+    // may have drawn it have finished so removing does not stall rendering.
     //
     void remove_model(int modelID);
 
@@ -184,11 +409,76 @@ namespace engine {
     void add_entity(int modelID, float x, float y, float z);
 
     //
+    // Adds a point light and returns its index or -1 if the maximum number
+    // of lights has been reached. The lighting pass bins lights into screen
+    // tiles so the cost per pixel depends on the lights that affect it.
     //
+    int add_point_light(float x, float y, float z, float r, float g, float b, float radius, float intensity);
+
     //
+    // Removes all point lights.
+    //
+    void clear_point_lights();
+
+    //
+    // Returns the number of point lights added since the last clear.
+    //
+    int get_point_light_count();
+
+    //
+    // Adds count instances of a model laid out in a grid. Intended for
+    // benchmarking the renderer with large numbers of instances.
+    //
+    void add_stress_test(int modelID, int count);
+
+    struct Transform_Benchmark_Result
+    {
+        int object_count;
+
+        // Milliseconds to compose the world matrices and bounding boxes of
+        // every object.
+        float glm_time;
+        float batch_time;
+
+        // Largest difference between any matrix element or box coordinate
+        // of the two paths.
+        float max_error;
+    };
+
+    //
+    // Times composing world matrices and bounding boxes of count random
+    // transforms with a glm call per object against the batch kernels used
+    // by the renderer. The scene is left untouched.
+    //
+    void run_transform_benchmark(int count, Transform_Benchmark_Result* result);
+
+    //
+    // Instances are listed by index from 0 to get_instance_count() but
+    // every other function takes an instance id. Removing instances or
+    // changing the hierarchy moves instances to other indices at the next
+    // transform update while ids never change.
+    //
+    // Returns the current index of the instance or -1 if it does not exist.
+    //
+    int find_instance(int instanceID);
+
+    //
+    // Removes the instance in constant time. The last instance is moved into
+    // its index.
     //
     void remove_instance(int instanceID);
 
+    //
+    // Attaches an instance to a parent instance so that it follows the
+    // parent's transform, or detaches it when parentID is -1. The instance
+    // keeps its current world transform. Fails if the parent is the instance
+    // itself or one of its descendants.
+    //
+    bool set_instance_parent(int instanceID, int parentID);
+
+    // Returns the id of the parent or -1 if the instance has no parent.
+    int get_instance_parent(int instanceID);
+
     //
     //
     //
@@ -205,26 +495,28 @@ namespace engine {
     const char* get_instance_name(int instanceIndex);
 
 
-    void get_entity_matrix(int instance_index, float* matrix);
-    void set_entity_matrix(int instance_index, const float* matrix);
+    // Column major world space matrices. The position, rotation and scale
+    // setters below apply to the transform relative to the parent instead.
+    void get_entity_matrix(int instanceID, float* matrix);
+    void set_entity_matrix(int instanceID, const float* matrix);
     //
     //
     //
     //
 
-    void set_instance_position(int instanceIndex, float x, float y, float z);
+    void set_instance_position(int instanceID, float x, float y, float z);
     //
     //
     //
     //
 
-    void set_instance_rotation(int instanceIndex, float x, float y, float z);
+    void set_instance_rotation(int instanceID, float x, float y, float z);
     //
     //
     //
     //
-    void set_instance_scale(int instanceIndex, float scale);
-    void set_instance_scale(int instanceIndex, float x, float y, float z);
+    void set_instance_scale(int instanceID, float scale);
+    void set_instance_scale(int instanceID, float x, float y, float z);
     // Timing
 
     //
@@ -286,6 +578,11 @@ namespace engine {
     //
     void create_camera(float fovy, float speed);
 
+    //
+    // Moves the camera so that the bounding box of a model fills the frame
+    // when viewed from the given direction. Angles are in degrees.
+    void frame_camera_to_model(int modelID, float azimuth, float elevation);
+
     //
     //
     //
@@ -361,7 +658,24 @@ namespace engine {
     void end_ui_pass();
 
     // Viewport
-    void* get_viewport_texture(Viewport_View view);
+    // Selects what the viewport displays. Must be called before render() for
+    // the view to be rendered that frame.
+    void set_viewport_view(Viewport_View view);
+
+    // Returns the texture of the view selected with set_viewport_view().
+    void* get_viewport_texture();
+
+    //
+    // Sets the size in pixels that the viewport is rendered at from the next
+    // frame. The attachments are allocated once at the monitor resolution and
+    // only the rendered area changes so the size can be updated every frame.
+    // Larger sizes are clamped and the viewport is scaled when displayed.
+    void set_render_size(int width, int height);
+
+    //
+    // Only part of the viewport texture is rendered to. Returns the texture
+    // coordinate of the bottom right corner of that part for the last frame.
+    void get_viewport_uv(float* u, float* v);
 
     // Audio
     void set_master_volume(float master_volume);
@@ -17,6 +17,10 @@ namespace engine {
     std::string get_window_name(const Platform_Window* window);
     glm::u32vec2 get_window_size(const Platform_Window* window);
     float get_window_dpi_scale(const Platform_Window* window);
+
+    // Resolution of the monitor the window is on or the primary monitor when
+    // windowed.
+    glm::u32vec2 get_monitor_size(const Platform_Window* window);
     void show_window(const Platform_Window* window);
 
     void update_window(Platform_Window* window);
@@ -315,6 +315,22 @@ namespace engine {
         return x;
     }
 
+    glm::u32vec2 get_monitor_size(const Platform_Window* window)
+    {
+        GLFWmonitor* monitor = glfwGetWindowMonitor(window->handle);
+
+        // Is nullptr if in windowed mode
+        if (!monitor)
+            monitor = glfwGetPrimaryMonitor();
+
+        if (!monitor)
+            return window->size;
+
+        const GLFWvidmode* mode = glfwGetVideoMode(monitor);
+
+        return { static_cast<uint32_t>(mode->width), static_cast<uint32_t>(mode->height) };
+    }
+
     void show_window(const Platform_Window* window)
     {
         glfwShowWindow(window->handle);
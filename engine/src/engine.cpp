@@ -7,6 +7,9 @@
 
 #if defined(_WIN32)
 #include "../src/core/windows/win32_memory.h"
+#elif defined(__linux__)
+#include <sys/sysinfo.h>
+#include <unistd.h>
 #endif
 
 #include "../src/rendering/api/vulkan/vk_common.h"
@@ -16,7 +19,12 @@
 #include "../src/rendering/vertex.h"
 #include "../src/rendering/material.h"
 #include "../src/rendering/camera.h"
+#include "../src/rendering/culling.h"
+#include "../src/rendering/render_queue.h"
+#include "../src/rendering/gpu_profiler.h"
+#include "../src/rendering/frame_capture.h"
 #include "../src/rendering/entity.h"
+#include "../src/rendering/transforms.h"
 #include "../src/rendering/model.h"
 #include "../src/rendering/shaders/shaders.h"
 
@@ -33,10 +41,15 @@
 
 #include "../src/utils/logging.h"
 #include "../src/utils/time.h"
+#include "../src/utils/profiler.h"
 
 
 #include "../src/rendering/terrain/quad_tree.h"
 
+#include <stb_image_write.h>
+
+#include <random>
+
 namespace engine {
 
 #if 0
@@ -103,6 +116,15 @@ namespace engine {
     }
 #endif
 
+    // Matches point_light in the lighting shaders.
+    struct Point_Light
+    {
+        // xyz = world position, w = radius
+        glm::vec4 position;
+        // rgb = color, a = intensity
+        glm::vec4 color;
+    };
+
     struct My_Engine
     {
         Platform_Window* window;
@@ -122,28 +144,51 @@ namespace engine {
         //float delta_time;
 
         // Resources
-        Vk_Buffer scene_buffer;
         Vk_Buffer sun_buffer;
-        Vk_Buffer camera_buffer;
 
         // Scene information
         perspective_camera camera;
 
 
         std::vector<Model_Old> models;
-        std::vector<Entity> entities;
-        int entity_id = 0;
+        Entity_Storage entities;
+
+        Render_Stats stats;
 
         bool swapchain_ready;
+        bool frame_presented;
+
+        // Frame pacing. Changes to the swapchain or frames in flight are
+        // deferred to the start of the next frame.
+        Present_Mode present_mode;
+        bool triple_buffering;
+        uint32_t frames_in_flight;
+        bool pacing_changed;
+        float frame_limit;
+        bool low_latency;
+
+        Latency_Stats latency;
+        std::chrono::time_point<std::chrono::high_resolution_clock> input_time;
+        std::chrono::time_point<std::chrono::high_resolution_clock> next_frame_time;
 
 
         bool using_skybox;
         bool ui_pass_enabled;
+        bool gpu_culling;
+        bool occlusion_culling;
+        bool shadows;
+        bool normal_mapping;
+        uint32_t record_threads;
+
+        std::vector<Point_Light> lights;
     };
 
 
     static My_Engine* g_engine = nullptr;
 
+    // Must match SHADOW_CASCADE_COUNT in the lighting shader.
+    static constexpr uint32_t shadow_cascade_count = 4;
+
     //
     // Global scene information that will be accessed by the shaders to perform
     // various computations. The order of the variables cannot be changed! This
@@ -160,7 +205,26 @@ namespace engine {
         glm::vec4 camera_pos = glm::vec4(0.0f, 2.0f, -5.0f, 0.0f);
 
         glm::vec3 sun_dir = glm::vec3(0.01f, -0.5f, 0.01f);
-        glm::vec3 sun_pos = glm::vec3(0.01f, 200.0f, 0.01f);
+        alignas(16) glm::vec3 sun_pos = glm::vec3(0.01f, 200.0f, 0.01f);
+
+        // Used to reconstruct world positions from the depth buffer.
+        alignas(16) glm::mat4 inverse_view_proj = glm::mat4(1.0f);
+
+        // First light, light count and the number of horizontal light tiles.
+        alignas(16) glm::uvec4 light_info = glm::uvec4(0);
+
+        // World to shadow map transform of each cascade.
+        alignas(16) std::array<glm::mat4, shadow_cascade_count> shadow_matrices{};
+
+        // World space size of a shadow map texel in each cascade.
+        glm::vec4 shadow_texel_sizes = glm::vec4(0.0f);
+
+        // empty, 1 / shadow map size, empty, empty
+        glm::vec4 shadow_params = glm::vec4(0.0f);
+
+        // Rendered width and height in pixels followed by the fraction of
+        // the attachments that they cover.
+        glm::vec4 render_size = glm::vec4(0.0f);
     } scene;
 
 
@@ -172,9 +236,31 @@ namespace engine {
 
     static VkExtent2D shadow_map_size = { 2048, 2048 };
 
-    // Default framebuffer at startup
+    // Cascades cover the view up to shadow_distance. The split lambda blends
+    // between logarithmic (1.0) and uniform (0.0) split distances.
+    static constexpr float shadow_distance = 150.0f;
+    static constexpr float shadow_split_lambda = 0.75f;
+
+    struct Shadow_Cascade
+    {
+        camera_projection vp;
+        camera_frustum frustum;
+    };
+
+    static std::array<Shadow_Cascade, shadow_cascade_count> shadow_cascades;
+    static std::array<Vk_Render_Pass, shadow_cascade_count> shadow_passes{};
+    static Vk_Pipeline shadow_pipeline;
+    static VkSampler shadow_sampler;
+
+    // Size the offscreen attachments are allocated at. A windowed engine
+    // raises it to the monitor resolution so the viewport can be resized up
+    // to the whole screen without reallocating anything.
     static VkExtent2D framebuffer_size = { 1920, 1080 };
 
+    // The area of the attachments that is rendered to. Changes are applied
+    // when the next frame is recorded.
+    static VkExtent2D render_size = framebuffer_size;
+
     static VkSampler g_framebuffer_sampler;
 
 
@@ -189,10 +275,8 @@ namespace engine {
     static std::vector<VkDescriptorSet> composite_ds;
 
     static std::vector<Vk_Image> viewport;
-    static std::vector<Vk_Image> positions;
     static std::vector<Vk_Image> normals;
     static std::vector<Vk_Image> colors;
-    static std::vector<Vk_Image> speculars;
     static std::vector<Vk_Image> depths;
 
     static VkDescriptorSetLayout skybox_ds_layout;
@@ -205,29 +289,264 @@ namespace engine {
     static VkPipelineLayout composite_pipeline_layout;
     static VkPipelineLayout skybox_pipeline_layout;
 
-    static Vk_Pipeline offscreen_pipeline;
+    // Renderer features are compiled into separate pipelines using
+    // specialization constants so that the shaders of the active pipeline
+    // contain no branches for disabled features.
+    //
+    // Geometry pass indexed by whether normal mapping is enabled.
+    static std::array<Vk_Pipeline, 2> offscreen_pipelines;
     static Vk_Pipeline wireframe_pipeline;
-    static Vk_Pipeline composite_pipeline;
+    // Lighting pass where index 0 and 1 are the lit result without and with
+    // shadows and the remaining each output a single G-buffer component.
+    static std::array<Vk_Pipeline, 6> composite_pipelines;
     static Vk_Pipeline skybox_pipeline;
 
-    static Vk_Pipeline* current_pipeline = &offscreen_pipeline;
+    static int render_mode = 0;
+    static Viewport_View viewport_view = Viewport_View::full;
+
+    // Viewport captures are copied into readback buffers and encoded once the
+    // frame has finished. Extra slots give encoding a few frames of slack.
+    static constexpr uint32_t frame_capture_slots = max_frames_in_flight + 4;
+    static Frame_Capture frame_capture;
+
+    // Captures of anything other than depth go through the lighting pass so
+    // the captured view replaces the displayed view until it has finished.
+    static Viewport_View capture_view = Viewport_View::full;
+
+    static Vk_Pipeline& get_geometry_pipeline()
+    {
+        if (render_mode == 1)
+            return wireframe_pipeline;
+
+        return offscreen_pipelines[g_engine->normal_mapping];
+    }
+
+    // With bindless materials the material set is bound once per pass and
+    // draws only push the index of their material.
+    static void bind_bindless_materials(std::vector<VkCommandBuffer>& buffers)
+    {
+        const Vk_Bindless_Set& bindless = g_engine->renderer->bindless;
+        if (bindless.set)
+            bind_descriptor_set(buffers, offscreen_pipeline_layout, bindless.set);
+    }
+
+    // The view the lighting pass outputs this frame. Depth is copied from the
+    // G-buffer so the lighting pass renders the full view for it.
+    static Viewport_View get_output_view()
+    {
+        const bool capturing = is_frame_capturing(frame_capture) && !frame_capture.depth;
+        const Viewport_View view = capturing ? capture_view : viewport_view;
+        if (view == Viewport_View::depth)
+            return Viewport_View::full;
+
+        return view;
+    }
+
+    static Vk_Pipeline& get_composite_pipeline()
+    {
+        const Viewport_View view = get_output_view();
+        if (view == Viewport_View::full)
+            return composite_pipelines[g_engine->shadows];
+
+        return composite_pipelines[static_cast<std::size_t>(view) + 1];
+    }
+
+    // GPU driven rendering. Entities are culled by a compute shader which
+    // also writes the draw commands that are consumed by indirect draws.
+    static VkDescriptorSetLayout cull_ds_layout;
+    static std::vector<VkDescriptorSet> cull_ds;
+    static std::vector<VkDescriptorSet> gpu_offscreen_ds;
+    static VkPipelineLayout cull_pipeline_layout;
+    static VkPipeline cull_pipeline;
+    static VkPipeline cull_finalize_pipeline;
+    static Vk_Buffer visible_instances;
+
+    // The matrix and model of every entity are kept in device memory where
+    // only the entities that changed are copied each frame.
+    static Vk_Buffer gpu_instance_matrices;
+    static Vk_Buffer gpu_instance_models;
+    static uint32_t gpu_instance_capacity;
+
+    // Hierarchical depth buffer built from the depth of the previous frame.
+    // Instances whose bounds are completely behind it are not drawn. The
+    // pyramid is only ever accessed by compute and transfers so it is kept in
+    // the general layout.
+    static Vk_Image depth_pyramid;
+    static std::vector<VkImageView> depth_pyramid_views;
+    static VkSampler depth_pyramid_sampler;
+    static VkDescriptorSetLayout depth_pyramid_ds_layout;
+    static std::vector<VkDescriptorSet> depth_pyramid_ds;
+    static std::vector<VkDescriptorSet> depth_pyramid_mip_ds;
+    static VkPipelineLayout depth_pyramid_pipeline_layout;
+    static VkPipeline depth_pyramid_pipeline;
+    static glm::mat4 depth_pyramid_view_proj;
+    static bool depth_pyramid_valid = false;
+
+    // The CPU path tests against a single coarse level of the pyramid that is
+    // read back for each frame in flight.
+    static uint32_t depth_readback_level;
+    static Vk_Buffer depth_readback;
+    static std::vector<glm::mat4> depth_readback_view_proj;
+    static std::vector<bool> depth_readback_valid;
+
+    static Vk_Buffer cull_stats;
+
+    // Point lights are binned into screen tiles by a compute shader that
+    // shares the descriptor set of the lighting pass. Must match the values
+    // in the lighting shaders.
+    static constexpr uint32_t light_tile_size = 16;
+    static constexpr uint32_t max_lights_per_tile = 255;
+    static constexpr std::size_t max_point_lights = 4096;
+    static uint32_t light_tiles_x;
+    static uint32_t light_tiles_y;
+    static Vk_Buffer light_tiles;
+    static VkPipelineLayout light_cull_pipeline_layout;
+    static VkPipeline light_cull_pipeline;
+
+    struct Depth_Pyramid_Constants
+    {
+        glm::ivec2 source_size;
+        glm::ivec2 destination_size;
+    };
+
+    // Matches cull_data in the culling shaders.
+    struct Cull_Data
+    {
+        camera_frustum frustum;
+        glm::mat4 view_proj;
+        glm::vec4 pyramid_size;
+        glm::uvec4 params;
+    };
+
+    // Matches the push constant block of the culling compute shaders. The
+    // first_* members index into views of the frame's instance memory.
+    struct Cull_Constants
+    {
+        uint32_t instance_count;
+        uint32_t first_model;
+        uint32_t first_draw;
+        uint32_t draw_count;
+        uint32_t first_compacted;
+        uint32_t first_count;
+    };
+
+    // Matches model_data in the culling shaders. Padded to the size of a
+    // matrix so that the table starts on an instance memory boundary.
+    struct Gpu_Model
+    {
+        glm::vec4 aabb_min;
+        glm::vec4 aabb_max;
+        uint32_t leader;
+        uint32_t output_offset;
+        uint32_t triangle_count;
+        uint32_t padding[5];
+    };
+
+    // Matches draw_command in the culling shaders. The leader is the draw
+    // whose instance count is used as the append counter for its model.
+    // Draws with visible instances are compacted into the range of their
+    // bucket which starts at bucket_first.
+    struct Gpu_Draw_Command
+    {
+        VkDrawIndexedIndirectCommand command;
+        uint32_t leader;
+        uint32_t bucket;
+        uint32_t bucket_first;
+    };
+
+    // The meshes of every model ordered by geometry block and material so
+    // that meshes sharing both are drawn by one indirect draw per bucket.
+    // Only rebuilt when models are added or removed.
+    struct Gpu_Draw
+    {
+        uint32_t model;
+        uint32_t mesh;
+        uint32_t bucket;
+    };
+
+    struct Gpu_Draw_Bucket
+    {
+        uint32_t first;
+        uint32_t count;
+
+        // Mesh whose geometry block and material the bucket binds
+        uint32_t model;
+        uint32_t mesh;
+    };
+
+    struct Gpu_Draw_List
+    {
+        std::vector<Gpu_Draw> draws;
+        std::vector<Gpu_Draw_Bucket> buckets;
+
+        // Draw index of the first mesh and total triangles of each model
+        std::vector<uint32_t> leaders;
+        std::vector<uint32_t> triangle_counts;
+        bool dirty = true;
+
+        // Compacted draw commands and the draw count of each bucket written
+        // by the culling shaders this frame. Buckets without instances are
+        // not drawn.
+        Vk_Buffer_Slice compacted;
+        Vk_Buffer_Slice counts;
+        std::vector<uint8_t> active_buckets;
+    };
+
+    static Gpu_Draw_List gpu_draws;
+
+    // Per-frame instance data of the CPU path. Model i owns the sorted
+    // entities in the range [offsets[i], offsets[i + 1]).
+    struct Instance_Batches
+    {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> entities;
+    };
+
+    static Instance_Batches batches;
+
+    // The geometry pass is split into contiguous ranges of sorted instances
+    // which are culled and recorded into secondary command buffers on worker
+    // threads. Each worker keeps its own scratch memory and statistics so
+    // that the threads share nothing but the instance allocator.
+    static constexpr uint32_t max_record_threads = 8;
+
+    // Below this many instances per thread the cost of starting the threads
+    // outweighs the time saved.
+    static constexpr uint32_t min_instances_per_record_thread = 2048;
+
+    struct Record_Worker
+    {
+        Vk_Command_Worker commands;
+
+        Cull_Bounds bounds;
+        std::vector<uint32_t> visible;
+        std::vector<uint32_t> visible_meshes;
+        Render_Queue queue;
+
+        Render_Stats stats;
+    };
+
+    static std::array<Record_Worker, max_record_threads> record_workers;
 
     static std::vector<VkCommandBuffer> cmd_buffer;
     //static std::vector<VkCommandBuffer> composite_cmd_buffer;
 
+    // GPU time spent in each pass. Timings are read back once the frame's
+    // fence has signalled so that reading them never waits on the GPU.
+    static constexpr uint32_t max_gpu_scopes = 16;
+    static Gpu_Profiler gpu_profiler;
+
     static Model_Old skybox_model;
 
     // UI related stuff
     static Vk_Render_Pass ui_pass{};
     static std::vector<VkDescriptorSet> viewport_ui;
-    static std::vector<VkDescriptorSet> positions_ui;
-    static std::vector<VkDescriptorSet> colors_ui;
-    static std::vector<VkDescriptorSet> normals_ui;
-    static std::vector<VkDescriptorSet> speculars_ui;
     static std::vector<VkDescriptorSet> depths_ui;
     static std::vector<VkCommandBuffer> ui_cmd_buffer;
+    static uint32_t ui_scope = UINT32_MAX;
 
-    static float shadowNear = 1.0f, shadowFar = 2000.0f;
+    // How far behind each cascade, towards the sun, casters are still
+    // rendered into the shadow map.
     static float sunDistance = 400.0f;
 
 
@@ -237,8 +556,20 @@ namespace engine {
 
     static void event_callback(Basic_Event& e);
 
-    static bool initialize_core(My_Engine* engine, const char* name, int width, int height)
+    static bool initialize_core(My_Engine* engine, const char* name, int width, int height, bool headless)
     {
+        // A headless engine only needs a renderer. Without a swapchain there
+        // is nothing to synchronise presentation with so vsync is disabled.
+        if (headless) {
+            engine->renderer = create_renderer(nullptr, buffer_mode::double_buffering, vsync_mode::disabled);
+            if (!engine->renderer) {
+                error("Failed to create headless renderer.");
+                return false;
+            }
+
+            return true;
+        }
+
         // Initialize core systems
         engine->window = create_platform_window(name, { width, height });
         if (!engine->window) {
@@ -267,21 +598,124 @@ namespace engine {
         return true;
     }
 
+    static void create_depth_pyramid()
+    {
+        // Level 0 is the largest power of two that fits within the depth
+        // buffer so that every following level is exactly half the size.
+        const VkExtent2D size{
+            1u << static_cast<uint32_t>(std::floor(std::log2(framebuffer_size.width))),
+            1u << static_cast<uint32_t>(std::floor(std::log2(framebuffer_size.height)))
+        };
+        const uint32_t mip_levels = static_cast<uint32_t>(std::floor(std::log2(std::max(size.width, size.height)))) + 1;
+
+        depth_pyramid = create_image(size, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, mip_levels);
+        set_image_layout(depth_pyramid, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+        depth_pyramid_sampler = create_image_sampler(VK_FILTER_NEAREST, 0.0f, static_cast<float>(mip_levels), VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+
+        depth_pyramid_views.resize(mip_levels);
+        for (uint32_t i = 0; i < mip_levels; ++i)
+            depth_pyramid_views[i] = create_image_mip_view(depth_pyramid, i);
+
+        const std::vector<VkDescriptorSetLayoutBinding> pyramid_bindings{
+            { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+            { 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT }
+        };
+
+        depth_pyramid_ds_layout = create_descriptor_layout(pyramid_bindings);
+
+        // Level 0 reads from whichever depth attachment was rendered to.
+        std::vector<Vk_Image> depth_images = attachments_to_images(offscreen_pass.attachments, 2);
+        depth_pyramid_ds = allocate_descriptor_sets(depth_pyramid_ds_layout);
+        update_binding(depth_pyramid_ds, pyramid_bindings[0], depth_images, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, depth_pyramid_sampler);
+        for (VkDescriptorSet set : depth_pyramid_ds)
+            update_binding(set, pyramid_bindings[1], depth_pyramid_views[0], VK_IMAGE_LAYOUT_GENERAL, nullptr);
+
+        depth_pyramid_mip_ds.resize(mip_levels - 1);
+        for (uint32_t i = 1; i < mip_levels; ++i) {
+            depth_pyramid_mip_ds[i - 1] = allocate_descriptor_set(depth_pyramid_ds_layout);
+            update_binding(depth_pyramid_mip_ds[i - 1], pyramid_bindings[0], depth_pyramid_views[i - 1], VK_IMAGE_LAYOUT_GENERAL, depth_pyramid_sampler);
+            update_binding(depth_pyramid_mip_ds[i - 1], pyramid_bindings[1], depth_pyramid_views[i], VK_IMAGE_LAYOUT_GENERAL, nullptr);
+        }
+
+        depth_pyramid_pipeline_layout = create_pipeline_layout(
+            { depth_pyramid_ds_layout },
+            sizeof(Depth_Pyramid_Constants),
+            VK_SHADER_STAGE_COMPUTE_BIT
+        );
+
+        vk_shader depth_pyramid_cs = create_compute_shader(depth_pyramid_cs_spirv);
+        depth_pyramid_pipeline = create_compute_pipeline(depth_pyramid_pipeline_layout, depth_pyramid_cs);
+        destroy_shader(depth_pyramid_cs);
+
+        // Reading back the full pyramid is unnecessary as the CPU test only
+        // needs a coarse approximation of the scene depth.
+        depth_readback_level = 0;
+        while ((size.width >> depth_readback_level) > 256 && depth_readback_level + 1 < mip_levels)
+            ++depth_readback_level;
+
+        const VkDeviceSize readback_size = std::max(size.width >> depth_readback_level, 1u) *
+            std::max(size.height >> depth_readback_level, 1u) * sizeof(float);
+
+        depth_readback = create_readback_buffer(readback_size * max_frames_in_flight, 0);
+        depth_readback_view_proj.assign(max_frames_in_flight, glm::mat4(1.0f));
+        depth_readback_valid.assign(max_frames_in_flight, false);
+    }
+
+    static void destroy_depth_pyramid()
+    {
+        destroy_buffer(depth_readback);
+
+        destroy_pipeline(depth_pyramid_pipeline);
+        destroy_pipeline_layout(depth_pyramid_pipeline_layout);
+        destroy_descriptor_layout(depth_pyramid_ds_layout);
+
+        for (VkImageView view : depth_pyramid_views)
+            destroy_image_view(view);
+
+        destroy_image_sampler(depth_pyramid_sampler);
+        destroy_image(depth_pyramid);
+    }
+
+    static std::filesystem::path get_pipeline_cache_path()
+    {
+        return std::filesystem::path(g_engine->app_location) / "pipeline_cache.bin";
+    }
+
     static void configure_renderer(My_Engine* engine)
     {
+        // Both caches must exist before any shader or pipeline is created,
+        // including the compute pipelines created alongside their resources.
+        const bool warm_start = load_pipeline_cache(get_pipeline_cache_path());
+#if defined(MY_ENGINE_COMPILE_SHADERS)
+        set_shader_cache_directory(std::filesystem::path(g_engine->app_location) / "shader_cache");
+#endif
+
+        if (engine->window) {
+            const glm::u32vec2 monitor_size = get_monitor_size(engine->window);
+            framebuffer_size.width = std::max(framebuffer_size.width, monitor_size.x);
+            framebuffer_size.height = std::max(framebuffer_size.height, monitor_size.y);
+        }
+        render_size = framebuffer_size;
+
         // Create rendering passes and render targets
         g_framebuffer_sampler = create_image_sampler(VK_FILTER_LINEAR, 0, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER);
 
         {
-            add_framebuffer_attachment(offscreen_pass, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_FORMAT_R32G32B32A32_SFLOAT, framebuffer_size);
-            add_framebuffer_attachment(offscreen_pass, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_FORMAT_R16G16B16A16_SFLOAT, framebuffer_size);
+            // Octahedral normals and albedo with specular in the alpha channel.
+            // Positions are reconstructed from depth in the lighting pass.
+            add_framebuffer_attachment(offscreen_pass, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_FORMAT_R16G16_SNORM, framebuffer_size);
             add_framebuffer_attachment(offscreen_pass, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_FORMAT_R8G8B8A8_SRGB, framebuffer_size);
-            add_framebuffer_attachment(offscreen_pass, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_FORMAT_R8_SRGB, framebuffer_size);
-            add_framebuffer_attachment(offscreen_pass, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_FORMAT_D32_SFLOAT, framebuffer_size);
+            add_framebuffer_attachment(offscreen_pass, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_FORMAT_D32_SFLOAT, framebuffer_size);
             create_offscreen_render_pass(offscreen_pass);
         }
+        for (Vk_Render_Pass& shadow_pass : shadow_passes) {
+            add_framebuffer_attachment(shadow_pass, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_FORMAT_D32_SFLOAT, shadow_map_size);
+            create_shadow_render_pass(shadow_pass);
+        }
+        shadow_sampler = create_image_sampler(VK_FILTER_NEAREST, 0.0f, 0.0f, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
         {
-            add_framebuffer_attachment(composite_pass, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_FORMAT_R8G8B8A8_SRGB, framebuffer_size);
+            add_framebuffer_attachment(composite_pass, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_FORMAT_R8G8B8A8_SRGB, framebuffer_size);
             create_composite_render_pass(composite_pass);
         }
         {
@@ -292,42 +726,99 @@ namespace engine {
 
 
         //out_engine->sun_buffer = create_uniform_buffer(sizeof(sun_data));
-        engine->camera_buffer = create_uniform_buffer(sizeof(camera_projection));
-        engine->scene_buffer = create_uniform_buffer(sizeof(Scene_Data));
+
+        // Camera and scene data are written each frame into the renderers
+        // uniform allocator and selected using dynamic offsets at bind time.
+        Vk_Buffer& uniform_buffer = engine->renderer->uniform_allocator.buffer;
 
 
         const std::vector<VkDescriptorSetLayoutBinding> offscreen_bindings{
-            { 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT }
+            { 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT },
+            { 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT }
         };
 
         offscreen_ds_layout = create_descriptor_layout(offscreen_bindings);
         offscreen_ds = allocate_descriptor_sets(offscreen_ds_layout);
-        update_binding(offscreen_ds, offscreen_bindings[0], engine->camera_buffer, sizeof(camera_projection));
+        update_binding(offscreen_ds, offscreen_bindings[0], uniform_buffer, sizeof(camera_projection));
+        update_binding(offscreen_ds, offscreen_bindings[1], engine->renderer->instance_allocator);
+
+        // The GPU driven path reads the compacted list of visible instances
+        // instead of the instances written by the CPU.
+        const VkDeviceSize max_instances = engine->renderer->instance_allocator.frame_size / sizeof(glm::mat4);
+        visible_instances = create_gpu_buffer(max_instances * sizeof(glm::mat4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+        gpu_instance_capacity = u32(max_instances);
+        gpu_instance_matrices = create_gpu_buffer(max_instances * sizeof(glm::mat4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        gpu_instance_models = create_gpu_buffer(max_instances * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+        gpu_offscreen_ds = allocate_descriptor_sets(offscreen_ds_layout);
+        update_binding(gpu_offscreen_ds, offscreen_bindings[0], uniform_buffer, sizeof(camera_projection));
+        update_binding(gpu_offscreen_ds, offscreen_bindings[1], visible_instances, visible_instances.size);
+
+        create_depth_pyramid();
+
+        // Occluded instance and triangle counts written by the culling shader
+        // for each frame in flight.
+        cull_stats = create_readback_buffer(max_frames_in_flight * 2 * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        std::memset(cull_stats.mapped, 0, cull_stats.size);
+
+        const std::vector<VkDescriptorSetLayoutBinding> cull_bindings{
+            { 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+            { 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+            { 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+            { 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+            { 4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+            { 5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+            { 6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+            { 7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+            { 8, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT }
+        };
+
+        cull_ds_layout = create_descriptor_layout(cull_bindings);
+        cull_ds = allocate_descriptor_sets(cull_ds_layout);
+        update_binding(cull_ds, cull_bindings[0], uniform_buffer, sizeof(Cull_Data));
+        update_binding(cull_ds, cull_bindings[1], gpu_instance_matrices, gpu_instance_matrices.size);
+        update_binding(cull_ds, cull_bindings[2], gpu_instance_models, gpu_instance_models.size);
+        update_binding(cull_ds, cull_bindings[3], engine->renderer->instance_allocator);
+        update_binding(cull_ds, cull_bindings[4], engine->renderer->instance_allocator);
+        update_binding(cull_ds, cull_bindings[5], engine->renderer->instance_allocator);
+        update_binding(cull_ds, cull_bindings[6], visible_instances, visible_instances.size);
+        update_binding(cull_ds, cull_bindings[7], cull_stats, cull_stats.size);
+        update_binding(cull_ds, cull_bindings[8], depth_pyramid, VK_IMAGE_LAYOUT_GENERAL, depth_pyramid_sampler);
 
         //////////////////////////////////////////////////////////////////////////
+        light_tiles_x = (framebuffer_size.width + light_tile_size - 1) / light_tile_size;
+        light_tiles_y = (framebuffer_size.height + light_tile_size - 1) / light_tile_size;
+        light_tiles = create_gpu_buffer(light_tiles_x * light_tiles_y * (max_lights_per_tile + 1) * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+        const VkShaderStageFlags lighting_stages = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
         const std::vector<VkDescriptorSetLayoutBinding> composite_bindings{
-            { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT },
-            { 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT },
-            { 2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT },
-            { 3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT },
-            { 4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT },
-            { 5, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT }
+            { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, lighting_stages },
+            { 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, lighting_stages },
+            { 2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, lighting_stages },
+            { 3, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, lighting_stages },
+            { 4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, lighting_stages },
+            { 5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, lighting_stages },
+            { 6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, shadow_cascade_count, lighting_stages }
         };
 
         composite_ds_layout = create_descriptor_layout(composite_bindings);
         composite_ds = allocate_descriptor_sets(composite_ds_layout);
         // Convert render target attachments into flat arrays for descriptor binding
-        positions = attachments_to_images(offscreen_pass.attachments, 0);
-        normals = attachments_to_images(offscreen_pass.attachments, 1);
-        colors = attachments_to_images(offscreen_pass.attachments, 2);
-        speculars = attachments_to_images(offscreen_pass.attachments, 3);
-        depths = attachments_to_images(offscreen_pass.attachments, 4);
-        update_binding(composite_ds, composite_bindings[0], positions, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, g_framebuffer_sampler);
-        update_binding(composite_ds, composite_bindings[1], normals, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, g_framebuffer_sampler);
-        update_binding(composite_ds, composite_bindings[2], colors, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, g_framebuffer_sampler);
-        update_binding(composite_ds, composite_bindings[3], speculars, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, g_framebuffer_sampler);
-        update_binding(composite_ds, composite_bindings[4], depths, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, g_framebuffer_sampler);
-        update_binding(composite_ds, composite_bindings[5], engine->scene_buffer, sizeof(Scene_Data));
+        normals = attachments_to_images(offscreen_pass.attachments, 0);
+        colors = attachments_to_images(offscreen_pass.attachments, 1);
+        depths = attachments_to_images(offscreen_pass.attachments, 2);
+        update_binding(composite_ds, composite_bindings[0], normals, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, g_framebuffer_sampler);
+        update_binding(composite_ds, composite_bindings[1], colors, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, g_framebuffer_sampler);
+        update_binding(composite_ds, composite_bindings[2], depths, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, g_framebuffer_sampler);
+        update_binding(composite_ds, composite_bindings[3], uniform_buffer, sizeof(Scene_Data));
+        update_binding(composite_ds, composite_bindings[4], engine->renderer->instance_allocator);
+        update_binding(composite_ds, composite_bindings[5], light_tiles, light_tiles.size);
+        for (uint32_t i = 0; i < shadow_cascade_count; ++i) {
+            std::vector<Vk_Image> shadow_maps = attachments_to_images(shadow_passes[i].attachments, 0);
+            update_binding(composite_ds, composite_bindings[6], shadow_maps, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, shadow_sampler, i);
+        }
 
 
         const std::vector<VkDescriptorSetLayoutBinding> skybox_bindings{
@@ -337,7 +828,7 @@ namespace engine {
 
         skybox_ds_layout = create_descriptor_layout(skybox_bindings);
         skybox_ds = allocate_descriptor_sets(skybox_ds_layout);
-        update_binding(skybox_ds, skybox_bindings[0], engine->camera_buffer, sizeof(camera_projection));
+        update_binding(skybox_ds, skybox_bindings[0], uniform_buffer, sizeof(camera_projection));
 
         //////////////////////////////////////////////////////////////////////////
         material_ds_binding = {
@@ -353,16 +844,35 @@ namespace engine {
             { skybox_ds_layout, material_ds_layout }
         );
 
-        offscreen_pipeline_layout = create_pipeline_layout(
-            { offscreen_ds_layout, material_ds_layout },
-            sizeof(glm::mat4),
-            VK_SHADER_STAGE_VERTEX_BIT
-        );
+        // The skybox keeps its own material set since it is not drawn
+        // through the geometry pass.
+        const Vk_Bindless_Set& bindless = g_engine->renderer->bindless;
+        if (bindless.set) {
+            offscreen_pipeline_layout = create_pipeline_layout(
+                { offscreen_ds_layout, bindless.layout },
+                sizeof(uint32_t),
+                VK_SHADER_STAGE_FRAGMENT_BIT
+            );
+        } else {
+            offscreen_pipeline_layout = create_pipeline_layout(
+                { offscreen_ds_layout, material_ds_layout }
+            );
+        }
 
         composite_pipeline_layout = create_pipeline_layout(
             { composite_ds_layout }
         );
 
+        cull_pipeline_layout = create_pipeline_layout(
+            { cull_ds_layout },
+            sizeof(Cull_Constants),
+            VK_SHADER_STAGE_COMPUTE_BIT
+        );
+
+        light_cull_pipeline_layout = create_pipeline_layout(
+            { composite_ds_layout }
+        );
+
         vk_vertex_binding<vertex> vertex_binding(VK_VERTEX_INPUT_RATE_VERTEX);
         vertex_binding.add_attribute(VK_FORMAT_R32G32B32_SFLOAT, "Position");
         vertex_binding.add_attribute(VK_FORMAT_R32G32B32_SFLOAT, "Normal");
@@ -372,13 +882,17 @@ namespace engine {
         //Shader shadowMappingVS = create_vertex_shader(shadowMappingVSCode);
         //Shader shadowMappingFS = create_fragment_shader(shadowMappingFSCode);
 
-        vk_shader geometry_vs = create_vertex_shader(geometry_vs_code);
-        vk_shader geometry_fs = create_pixel_shader(geometry_fs_code);
-        vk_shader lighting_vs = create_vertex_shader(lighting_vs_code);
-        vk_shader lighting_fs = create_pixel_shader(lighting_fs_code);
-        vk_shader skybox_vs = create_vertex_shader(skybox_vs_code);
-        vk_shader skybox_fs = create_pixel_shader(skybox_fs_code);
-
+        vk_shader geometry_vs = create_vertex_shader(geometry_vs_spirv);
+        vk_shader geometry_fs = create_pixel_shader(bindless.set ? geometry_bindless_fs_spirv : geometry_fs_spirv);
+        vk_shader lighting_vs = create_vertex_shader(lighting_vs_spirv);
+        vk_shader lighting_fs = create_pixel_shader(lighting_fs_spirv);
+        vk_shader skybox_vs = create_vertex_shader(skybox_vs_spirv);
+        vk_shader skybox_fs = create_pixel_shader(skybox_fs_spirv);
+        vk_shader cull_cs = create_compute_shader(cull_cs_spirv);
+        vk_shader cull_finalize_cs = create_compute_shader(cull_finalize_cs_spirv);
+        vk_shader light_cull_cs = create_compute_shader(light_cull_cs_spirv);
+
+        Vk_Pipeline& offscreen_pipeline = offscreen_pipelines[0];
         offscreen_pipeline.m_Layout = offscreen_pipeline_layout;
         offscreen_pipeline.m_RenderPass = &offscreen_pass;
         offscreen_pipeline.enable_vertex_binding(vertex_binding);
@@ -386,8 +900,24 @@ namespace engine {
         offscreen_pipeline.set_input_assembly(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
         offscreen_pipeline.set_rasterization(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_CLOCKWISE);
         offscreen_pipeline.enable_depth_stencil(VK_COMPARE_OP_GREATER_OR_EQUAL);
-        offscreen_pipeline.set_color_blend(4);
-        offscreen_pipeline.create_pipeline();
+        offscreen_pipeline.set_color_blend(2);
+
+        offscreen_pipelines[1] = offscreen_pipeline;
+        offscreen_pipelines[0].set_specialization_constants(VK_SHADER_STAGE_FRAGMENT_BIT, { VK_FALSE });
+        offscreen_pipelines[1].set_specialization_constants(VK_SHADER_STAGE_FRAGMENT_BIT, { VK_TRUE });
+
+        // Shadow maps reuse the geometry vertex shader with the camera data
+        // replaced by the view and projection of the cascade. The projection
+        // is orthographic so no culling is done as the winding differs from
+        // the camera.
+        shadow_pipeline.m_Layout = offscreen_pipeline_layout;
+        shadow_pipeline.m_RenderPass = &shadow_passes[0];
+        shadow_pipeline.enable_vertex_binding(vertex_binding);
+        shadow_pipeline.set_shader_pipeline({ geometry_vs });
+        shadow_pipeline.set_input_assembly(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+        shadow_pipeline.set_rasterization(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+        shadow_pipeline.enable_depth_stencil(VK_COMPARE_OP_GREATER_OR_EQUAL);
+        shadow_pipeline.set_color_blend(0);
 
         wireframe_pipeline.m_Layout = offscreen_pipeline_layout;
         wireframe_pipeline.m_RenderPass = &offscreen_pass;
@@ -396,16 +926,26 @@ namespace engine {
         wireframe_pipeline.set_input_assembly(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
         wireframe_pipeline.set_rasterization(VK_POLYGON_MODE_LINE, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_CLOCKWISE);
         wireframe_pipeline.enable_depth_stencil(VK_COMPARE_OP_GREATER_OR_EQUAL);
-        wireframe_pipeline.set_color_blend(4);
-        wireframe_pipeline.create_pipeline();
+        wireframe_pipeline.set_color_blend(2);
+        wireframe_pipeline.set_specialization_constants(VK_SHADER_STAGE_FRAGMENT_BIT, { VK_FALSE });
 
+        Vk_Pipeline& composite_pipeline = composite_pipelines[0];
         composite_pipeline.m_Layout = composite_pipeline_layout;
         composite_pipeline.m_RenderPass = &composite_pass;
         composite_pipeline.set_shader_pipeline({ lighting_vs, lighting_fs });
         composite_pipeline.set_input_assembly(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
         composite_pipeline.set_rasterization(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_CLOCKWISE);
         composite_pipeline.set_color_blend(1);
-        composite_pipeline.create_pipeline();
+
+        // Specialization constants: shadows, viewport view
+        for (std::size_t i = 1; i < composite_pipelines.size(); ++i)
+            composite_pipelines[i] = composite_pipeline;
+        for (std::size_t i = 0; i < composite_pipelines.size(); ++i) {
+            const uint32_t shadows = i == 1 ? VK_TRUE : VK_FALSE;
+            const uint32_t view = i < 2 ? 0 : u32(i - 1);
+
+            composite_pipelines[i].set_specialization_constants(VK_SHADER_STAGE_FRAGMENT_BIT, { shadows, view });
+        }
 
         skybox_pipeline.m_Layout = skybox_pipeline_layout;
         skybox_pipeline.m_RenderPass = &skybox_pass;
@@ -415,9 +955,29 @@ namespace engine {
         skybox_pipeline.set_rasterization(VK_POLYGON_MODE_FILL, VK_CULL_MODE_FRONT_BIT, VK_FRONT_FACE_CLOCKWISE);
         skybox_pipeline.enable_depth_stencil(VK_COMPARE_OP_GREATER_OR_EQUAL);
         skybox_pipeline.set_color_blend(1);
-        skybox_pipeline.create_pipeline();
+
+        const auto pipeline_start = std::chrono::high_resolution_clock::now();
+
+        std::vector<Vk_Pipeline*> pipelines{ &shadow_pipeline, &wireframe_pipeline, &skybox_pipeline };
+        for (Vk_Pipeline& pipeline : offscreen_pipelines)
+            pipelines.push_back(&pipeline);
+        for (Vk_Pipeline& pipeline : composite_pipelines)
+            pipelines.push_back(&pipeline);
+
+        create_pipelines(pipelines);
+
+        cull_pipeline = create_compute_pipeline(cull_pipeline_layout, cull_cs);
+        cull_finalize_pipeline = create_compute_pipeline(cull_pipeline_layout, cull_finalize_cs);
+        light_cull_pipeline = create_compute_pipeline(light_cull_pipeline_layout, light_cull_cs);
+
+        const auto pipeline_end = std::chrono::high_resolution_clock::now();
+        const float pipeline_duration = std::chrono::duration<float, std::milli>(pipeline_end - pipeline_start).count();
+        info("Created pipelines in {:.2f}ms ({} start)", pipeline_duration, warm_start ? "warm" : "cold");
 
         // Delete all individual shaders since they are now part of the various pipelines
+        destroy_shader(light_cull_cs);
+        destroy_shader(cull_finalize_cs);
+        destroy_shader(cull_cs);
         destroy_shader(skybox_fs);
         destroy_shader(skybox_vs);
         destroy_shader(lighting_fs);
@@ -429,10 +989,17 @@ namespace engine {
         // Create required command buffers
         cmd_buffer = create_command_buffers();
         //composite_cmd_buffer = create_command_buffers();
+
+        for (Record_Worker& worker : record_workers)
+            worker.commands = create_command_worker();
+
+        create_gpu_profiler(gpu_profiler, max_gpu_scopes);
+        create_frame_capture(frame_capture, frame_capture_slots);
     }
 
     static std::string get_executable_directory()
     {
+#if defined(_WIN32)
         // Get the current path of the executable
         // TODO: MAX_PATH is ok to use however, for a long term solution another
         // method should used since some paths can go beyond this limit.
@@ -442,20 +1009,30 @@ namespace engine {
         // TODO: Might be overkill to convert into filesystem just to get the parent path.
         // Test speed compared to simply doing a quick parse by finding the last '/'.
         return std::filesystem::path(directory).parent_path().string();
+#elif defined(__linux__)
+        std::error_code ec;
+        const std::filesystem::path executable = std::filesystem::read_symlink("/proc/self/exe", ec);
+        if (!ec)
+            return executable.parent_path().string();
+
+        warn("Failed to find the executable path: {}", ec.message());
+        return std::filesystem::current_path().string();
+#else
+        return std::filesystem::current_path().string();
+#endif
     }
 
 
-    // Main entry point of the engine
-    bool initialize(const char* name, int width, int height)
+    static bool initialize_engine(const char* name, int width, int height, bool headless)
     {
         g_engine = new My_Engine();
 
         g_engine->start_time = std::chrono::high_resolution_clock::now();
         g_engine->app_location = get_executable_directory();
 
-        info("Initializing engine {}", g_engine->app_location);
+        info("Initializing {}engine {}", headless ? "headless " : "", g_engine->app_location);
 
-        if (!initialize_core(g_engine, name, width, height)) {
+        if (!initialize_core(g_engine, name, width, height, headless)) {
             return false;
         }
 
@@ -464,230 +1041,1500 @@ namespace engine {
         g_engine->running = true;
         g_engine->swapchain_ready = true;
         g_engine->using_skybox = false;
+        g_engine->gpu_culling = false;
+        g_engine->occlusion_culling = true;
+        g_engine->shadows = true;
+        g_engine->normal_mapping = true;
+        g_engine->record_threads = std::clamp(std::thread::hardware_concurrency(), 1u, max_record_threads);
+        g_engine->present_mode = headless ? Present_Mode::immediate : Present_Mode::vsync;
+        g_engine->triple_buffering = false;
+        g_engine->frames_in_flight = get_frame_in_flight_count();
+        g_engine->pacing_changed = false;
+        g_engine->frame_limit = 0.0f;
+        g_engine->low_latency = false;
+        g_engine->input_time = std::chrono::high_resolution_clock::now();
+        g_engine->next_frame_time = g_engine->input_time;
 
         const auto current_time = std::chrono::high_resolution_clock::now();
         const float startup_duration = std::chrono::duration_cast<std::chrono::milliseconds>(current_time - g_engine->start_time).count();
         info("Successfully initialized engine in {:.2f}ms", startup_duration);
 
-#if 0
-        model test;
-        test.create("C:/Users/zakar/Downloads/container.glb");
+        return true;
+    }
 
-        struct transform_component
-        {
-            glm::mat4 transform;
-        };
-        Entity e;
-        e.add_component<mesh_component>();
-        struct mesh_component
-        {
-            void* model;
-        };
-        entt::registry registry;
-        entt::entity player_entity = registry.create();
-        registry.emplace<transform_component>(player_entity, glm::mat4(0.5f));
-        registry.emplace<mesh_component>(player_entity);
-        entt::entity enemy_entity = registry.create();
-        registry.emplace<transform_component>(enemy_entity);
-        auto t = registry.get<transform_component>(player_entity);
-        // render all meshes
-        for (entt::entity mesh_component : registry.view<mesh_component>()) {
-            std::cout << "transform\n";
+    // Main entry point of the engine
+    bool initialize(const char* name, int width, int height)
+    {
+        return initialize_engine(name, width, height, false);
+    }
+
+    bool initialize_headless(int width, int height)
+    {
+        if (width <= 0 || height <= 0) {
+            error("Invalid headless framebuffer size {}x{}.", width, height);
+            return false;
         }
-#endif
 
-        return true;
+        // The offscreen framebuffers are normally a fixed size independent
+        // of the window. Without a window they are the size of the output.
+        framebuffer_size = { u32(width), u32(height) };
+
+        return initialize_engine("Headless", width, height, true);
     }
 
     bool update()
     {
+        // The previous frame ends where the next one begins.
+        PROFILE_FRAME();
+        PROFILE_ZONE("update");
+
         // Calculate the amount that has passed since the last frame. This value
         // is then used with inputs and physics to ensure that the result is the
         // same no matter how fast the CPU is running.
         g_engine->timer.calculate_delta_time();
 
-        scene.sun_dir.x = glm::sin((float)glfwGetTime()) * 2.0f;
-        scene.sun_dir.z = glm::cos((float)glfwGetTime()) * 2.0f;
+        // Measured from engine start rather than glfw's timer since glfw is
+        // not initialized when headless. Headless frames are compared against
+        // reference images so the sun does not move.
+        const auto current_time = std::chrono::high_resolution_clock::now();
+        const float time = g_engine->window ? std::chrono::duration<float>(current_time - g_engine->start_time).count() : 0.0f;
 
-        set_buffer_data(g_engine->camera_buffer, &g_engine->camera.vp, sizeof(camera_projection));
-        set_buffer_data(g_engine->scene_buffer, &scene);
+        scene.sun_dir.x = glm::sin(time) * 2.0f;
+        scene.sun_dir.z = glm::cos(time) * 2.0f;
 
         return g_engine->running;
     }
 
+    static vsync_mode get_vsync_mode(Present_Mode mode)
+    {
+        switch (mode) {
+        case Present_Mode::mailbox:
+            return vsync_mode::mailbox;
+        case Present_Mode::immediate:
+            return vsync_mode::disabled;
+        default:
+            return vsync_mode::enabled;
+        }
+    }
+
+    static void apply_frame_pacing()
+    {
+        if (!g_engine->pacing_changed)
+            return;
+
+        g_engine->pacing_changed = false;
+
+        // Both the swapchain and the frames in flight can only change once
+        // every frame has finished. Captures of frames that will no longer
+        // be waited on are read now.
+        wait_for_gpu();
+        flush_frame_captures(frame_capture);
+
+        set_frame_in_flight_count(g_engine->frames_in_flight);
+
+        const buffer_mode buffering = g_engine->triple_buffering ? buffer_mode::triple_buffering : buffer_mode::double_buffering;
+        recreate_swapchain(buffering, get_vsync_mode(g_engine->present_mode));
+
+        if (g_engine->ui_pass_enabled)
+            resize_framebuffer(ui_pass, get_swapchain_extent());
+
+        info("Frame pacing: {} frames in flight, {} buffering.",
+            g_engine->frames_in_flight, g_engine->triple_buffering ? "triple" : "double");
+    }
+
     bool begin_render()
     {
+        PROFILE_ZONE("begin_render");
+
+        apply_frame_pacing();
+
+        const auto wait_start = std::chrono::high_resolution_clock::now();
         g_engine->swapchain_ready = get_next_swapchain_image();
 
-        // If the swapchain is not ready the swapchain will be resized and then we
-        // need to resize any framebuffers.
-        if (!g_engine->swapchain_ready) {
-            wait_for_gpu();
+        // With low latency enabled the fence was already waited on before
+        // input was sampled and that wait is reported instead.
+        const auto wait_end = std::chrono::high_resolution_clock::now();
+        if (!g_engine->low_latency)
+            g_engine->latency.frame_wait = std::chrono::duration<float, std::milli>(wait_end - wait_start).count();
 
-            const glm::u32vec2 size = get_window_size(g_engine->window);
-            resize_framebuffer(ui_pass, { size.x, size.y });
-        }
+        // The frame's fence has been waited on so its timings and captures
+        // are ready.
+        read_gpu_timings(gpu_profiler);
+        read_frame_captures(frame_capture);
+
+        // If the swapchain is not ready it has been recreated and the UI pass
+        // needs framebuffers for the new images. The old ones are destroyed
+        // once the frames using them have finished so the GPU keeps running.
+        if (!g_engine->swapchain_ready && g_engine->ui_pass_enabled)
+            resize_framebuffer(ui_pass, get_swapchain_extent());
 
         return g_engine->swapchain_ready;
     }
 
-    void render()
+    // Groups all entities by the model they use so that each mesh is drawn
+    // only once regardless of how many entities share it.
+    static void prepare_instances()
     {
-        begin_command_buffer(cmd_buffer);
-        {
-            begin_render_pass(cmd_buffer, offscreen_pass);
-
-            bind_descriptor_set(cmd_buffer, offscreen_pipeline_layout, offscreen_ds, { sizeof(camera_projection) });
-            bind_pipeline(cmd_buffer, *current_pipeline);
-
-            // TODO: Currently we are rendering each instance individually
-            // which is a very naive. Firstly, instances should be rendered
-            // in batches using instanced rendering. We are also constantly
-            // rebinding the descriptor sets (material) and vertex buffers
-            // for each instance even though the data is exactly the same.
-            //
-            // A proper solution should be designed and implemented in the
-            // near future.
-            for (std::size_t i = 0; i < g_engine->entities.size(); ++i) {
-                const Entity& instance = g_engine->entities[i];
-                render_model(g_engine->models[instance.model_index], instance.matrix, cmd_buffer, offscreen_pipeline_layout);
-            }
-            end_render_pass(cmd_buffer);
+        // Only the render component is read so the sort streams through a
+        // single dense array.
+        const std::vector<uint32_t>& model_indices = g_engine->entities.model_indices;
+        if (model_indices.empty())
+            return;
 
-            begin_render_pass(cmd_buffer, composite_pass);
+        // Counting sort by model index. The prefix sum of the counts gives
+        // each model a contiguous range of instances.
+        std::vector<uint32_t>& offsets = batches.offsets;
+        offsets.assign(g_engine->models.size() + 1, 0);
 
-            // lighting calculations
-            bind_descriptor_set(cmd_buffer, composite_pipeline_layout, composite_ds);
-            bind_pipeline(cmd_buffer, composite_pipeline);
-            render(cmd_buffer);
-            end_render_pass(cmd_buffer);
+        for (uint32_t model_index : model_indices)
+            ++offsets[model_index + 1];
+        for (std::size_t i = 1; i < offsets.size(); ++i)
+            offsets[i] += offsets[i - 1];
 
-#if 1
-            if (g_engine->using_skybox) {
-                begin_render_pass(cmd_buffer, skybox_pass);
+        static std::vector<uint32_t> cursor;
+        cursor.assign(offsets.begin(), offsets.end() - 1);
 
-                bind_descriptor_set(cmd_buffer, skybox_pipeline_layout, skybox_ds, { sizeof(camera_projection) });
-                bind_pipeline(cmd_buffer, skybox_pipeline);
-                render_model(skybox_model, cmd_buffer, skybox_pipeline_layout);
-                end_render_pass(cmd_buffer);
+        batches.entities.resize(model_indices.size());
+        for (std::size_t i = 0; i < model_indices.size(); ++i)
+            batches.entities[cursor[model_indices[i]]++] = u32(i);
+    }
+
+    // Orders the meshes of every model by geometry block and material and
+    // groups meshes that share both into buckets.
+    static void build_gpu_draws()
+    {
+        const std::vector<Model_Old>& models = g_engine->models;
+        std::vector<Gpu_Draw>& draws = gpu_draws.draws;
+        std::vector<Gpu_Draw_Bucket>& buckets = gpu_draws.buckets;
+
+        draws.clear();
+        buckets.clear();
+        gpu_draws.leaders.assign(models.size(), UINT32_MAX);
+        gpu_draws.triangle_counts.assign(models.size(), 0);
+
+        for (uint32_t i = 0; i < u32(models.size()); ++i) {
+            for (uint32_t j = 0; j < u32(models[i].meshes.size()); ++j) {
+                draws.push_back({ i, j, 0 });
+                gpu_draws.triangle_counts[i] += models[i].meshes[j].geometry.index_count / 3;
             }
-#endif
+        }
 
+        const auto get_mesh = [&models](uint32_t model, uint32_t mesh) -> const Mesh_Old& {
+            return models[model].meshes[mesh];
+        };
+        const auto same_bucket = [](const Mesh_Old& a, const Mesh_Old& b) {
+            return a.geometry.block == b.geometry.block && a.material_id == b.material_id;
+        };
 
+        std::sort(draws.begin(), draws.end(), [&](const Gpu_Draw& a, const Gpu_Draw& b) {
+            const Mesh_Old& x = get_mesh(a.model, a.mesh);
+            const Mesh_Old& y = get_mesh(b.model, b.mesh);
+            if (x.geometry.block != y.geometry.block)
+                return x.geometry.block < y.geometry.block;
 
+            return x.material_id < y.material_id;
+        });
 
+        for (uint32_t i = 0; i < u32(draws.size()); ++i) {
+            Gpu_Draw& draw = draws[i];
+            const Mesh_Old& mesh = get_mesh(draw.model, draw.mesh);
 
+            if (buckets.empty() || !same_bucket(mesh, get_mesh(buckets.back().model, buckets.back().mesh)))
+                buckets.push_back({ i, 0, draw.model, draw.mesh });
 
+            draw.bucket = u32(buckets.size() - 1);
+            ++buckets.back().count;
 
+            if (draw.mesh == 0)
+                gpu_draws.leaders[draw.model] = i;
         }
-        end_command_buffer(cmd_buffer);
+
+        gpu_draws.dirty = false;
     }
 
-    void present()
+    // Copies the matrix and model of every entity that changed since the
+    // last upload into the device copy that the culling shader reads. Runs
+    // of consecutive entities are copied as a single region. On failure the
+    // changes are kept for the next frame.
+    static bool upload_instances()
     {
-        if (g_engine->ui_pass_enabled)
-            submit_gpu_work({ cmd_buffer, ui_cmd_buffer });
-        else
-            submit_gpu_work({ cmd_buffer });
+        Entity_Storage& entities = g_engine->entities;
+        const uint32_t count = u32(get_entity_count(entities));
 
-        if (!present_swapchain_image()) {
-            wait_for_gpu();
+        if (count > gpu_instance_capacity) {
+            static bool reported = false;
+            if (!reported)
+                error("GPU culling supports at most {} instances.", gpu_instance_capacity);
+            reported = true;
+            return false;
+        }
 
-            const glm::u32vec2 size = get_window_size(g_engine->window);
-            resize_framebuffer(ui_pass, { size.x, size.y });
+        std::vector<uint32_t>& changed = entities.changed;
+        if (entities.all_changed) {
+            changed.resize(count);
+            std::iota(changed.begin(), changed.end(), 0u);
+        } else {
+            // Entities may have changed more than once and removals leave
+            // indices past the end.
+            std::sort(changed.begin(), changed.end());
+            changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+            changed.erase(std::lower_bound(changed.begin(), changed.end(), count), changed.end());
         }
 
-        update_window(g_engine->window);
-    }
+        if (changed.empty()) {
+            clear_changed_entities(entities);
+            return true;
+        }
 
-    void terminate()
-    {
-        assert(g_engine);
+        Vk_Buffer_Slice matrix_slice, model_slice;
+        uint32_t first = 0;
+        if (!allocate_instance_memory(changed.size() * sizeof(glm::mat4), matrix_slice, first) ||
+            !allocate_instance_memory(changed.size() * sizeof(uint32_t), model_slice, first))
+            return false;
 
-        info("Terminating engine.");
+        static std::vector<VkBufferCopy> matrix_regions;
+        static std::vector<VkBufferCopy> model_regions;
+        matrix_regions.clear();
+        model_regions.clear();
+
+        glm::mat4* matrices = static_cast<glm::mat4*>(matrix_slice.data);
+        uint32_t* model_indices = static_cast<uint32_t*>(model_slice.data);
+        for (std::size_t i = 0; i < changed.size(); ++i) {
+            const uint32_t index = changed[i];
+            matrices[i] = entities.world_transforms[index];
+            model_indices[i] = entities.model_indices[index];
+
+            if (i > 0 && changed[i - 1] + 1 == index) {
+                matrix_regions.back().size += sizeof(glm::mat4);
+                model_regions.back().size += sizeof(uint32_t);
+                continue;
+            }
 
-        wait_for_gpu();
+            matrix_regions.push_back({ matrix_slice.offset + i * sizeof(glm::mat4), index * sizeof(glm::mat4), sizeof(glm::mat4) });
+            model_regions.push_back({ model_slice.offset + i * sizeof(uint32_t), index * sizeof(uint32_t), sizeof(uint32_t) });
+        }
 
-        for (auto& framebuffer : viewport_ui)
-            ImGui_ImplVulkan_RemoveTexture(framebuffer);
+        clear_changed_entities(entities);
 
-        destroy_model(skybox_model);
+        // The culling of the previous frame may still be reading the copy.
+        memory_barrier(cmd_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, 0);
 
-        for (auto& model : g_engine->models)
-            destroy_model(model);
+        copy_buffer(cmd_buffer, matrix_slice.buffer, gpu_instance_matrices.buffer, matrix_regions);
+        copy_buffer(cmd_buffer, model_slice.buffer, gpu_instance_models.buffer, model_regions);
 
-        // Destroy rendering resources
-        destroy_buffer(g_engine->camera_buffer);
-        destroy_buffer(g_engine->scene_buffer);
-        destroy_buffer(g_engine->sun_buffer);
+        memory_barrier(cmd_buffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
 
-        destroy_descriptor_layout(material_ds_layout);
-        destroy_descriptor_layout(composite_ds_layout);
-        destroy_descriptor_layout(offscreen_ds_layout);
-        destroy_descriptor_layout(skybox_ds_layout);
+        return true;
+    }
 
-        destroy_pipeline(skybox_pipeline.m_Pipeline);
-        destroy_pipeline(wireframe_pipeline.m_Pipeline);
-        destroy_pipeline(composite_pipeline.m_Pipeline);
-        destroy_pipeline(offscreen_pipeline.m_Pipeline);
+    // Culls the instances of each model against the camera frustum and the
+    // depth of a previous frame and draws every mesh once for the instances
+    // that remain. The matrices of the visible instances are written once per
+    // model and shared by all of its meshes. Meshes of models made up of more
+    // than one mesh are skipped when none of their instances are visible.
+    // Only the sorted instances within [first, last) are processed so that
+    // the work can be split up.
+    static void render_entities(const Cull_Depth_Buffer& depth, uint32_t first, uint32_t last,
+        Record_Worker& worker, std::vector<VkCommandBuffer>& buffers)
+    {
+        Cull_Bounds& bounds = worker.bounds;
+        Render_Queue& queue = worker.queue;
+        const Vk_Pipeline& pipeline = get_geometry_pipeline();
+        std::vector<uint32_t>& visible = worker.visible;
+        std::vector<uint32_t>& visible_meshes = worker.visible_meshes;
+
+        const std::vector<glm::mat4>& transforms = g_engine->entities.world_transforms;
+        const camera_frustum& frustum = g_engine->camera.frustum;
+        Render_Stats& stats = worker.stats;
+
+        clear_render_queue(queue);
+
+        for (std::size_t i = 0; i < g_engine->models.size(); ++i) {
+            const uint32_t begin = std::max(batches.offsets[i], first);
+            const uint32_t end = std::min(batches.offsets[i + 1], last);
+            if (begin >= end)
+                continue;
+
+            const uint32_t count = end - begin;
+            const Model_Old& model = g_engine->models[i];
+
+            clear_bounds(bounds);
+            add_bounds(bounds, model.bounds, transforms.data(), &batches.entities[begin], count);
+            const uint32_t in_frustum = cull_bounds(frustum, bounds, visible);
+            const uint32_t visible_count = cull_occluded_bounds(depth, bounds, visible);
+            const uint32_t occluded_count = in_frustum - visible_count;
+
+            uint32_t model_triangles = 0;
+            for (const Mesh_Old& mesh : model.meshes)
+                model_triangles += mesh.geometry.index_count / 3;
+
+            stats.visible_count += static_cast<int>(visible_count);
+            stats.culled_count += static_cast<int>(count - in_frustum);
+            stats.occluded_count += static_cast<int>(occluded_count);
+            stats.occluded_triangles += static_cast<int>(occluded_count * model_triangles);
+
+            if (visible_count == 0)
+                continue;
+
+            uint32_t first_instance = 0;
+            Vk_Buffer_Slice slice;
+            if (!allocate_instance_memory(visible_count * sizeof(glm::mat4), slice, first_instance))
+                continue;
+
+            glm::mat4* matrices = static_cast<glm::mat4*>(slice.data);
+            for (uint32_t j = 0; j < visible_count; ++j)
+                matrices[j] = transforms[batches.entities[begin + visible[j]]];
+
+            for (const Mesh_Old& mesh : model.meshes) {
+                if (model.meshes.size() > 1) {
+                    // Read from the entities as instance memory may be
+                    // uncached.
+                    clear_bounds(bounds);
+                    for (uint32_t index : visible)
+                        add_bounds(bounds, mesh.bounds, transforms[batches.entities[begin + index]]);
+                    if (cull_bounds(frustum, bounds, visible_meshes) == 0 || cull_occluded_bounds(depth, bounds, visible_meshes) == 0)
+                        continue;
+                }
 
-        destroy_pipeline_layout(composite_pipeline_layout);
-        destroy_pipeline_layout(offscreen_pipeline_layout);
-        destroy_pipeline_layout(skybox_pipeline_layout);
+                add_draw(queue, pipeline, mesh, visible_count, first_instance);
+                ++stats.draw_calls;
+            }
+        }
 
+        sort_render_queue(queue);
+        stats.binds_skipped += static_cast<int>(submit_render_queue(queue, buffers, offscreen_pipeline_layout));
+    }
 
-        destroy_render_pass(ui_pass);
-        destroy_render_pass(composite_pass);
-        destroy_render_pass(offscreen_pass);
-        destroy_render_pass(skybox_pass);
+    static uint32_t get_record_thread_count()
+    {
+        const uint32_t instance_count = u32(batches.entities.size());
+        const uint32_t useful_threads = std::max(instance_count / min_instances_per_record_thread, 1u);
+
+        return std::min(g_engine->record_threads, useful_threads);
+    }
+
+    static void add_record_stats(const Record_Worker& worker)
+    {
+        Render_Stats& stats = g_engine->stats;
+        stats.draw_calls += worker.stats.draw_calls;
+        stats.visible_count += worker.stats.visible_count;
+        stats.culled_count += worker.stats.culled_count;
+        stats.occluded_count += worker.stats.occluded_count;
+        stats.occluded_triangles += worker.stats.occluded_triangles;
+        stats.binds_skipped += worker.stats.binds_skipped;
+    }
+
+    // Records the geometry pass into a secondary command buffer per thread
+    // and executes them in order. Must be called within the offscreen pass
+    // begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+    static void render_entities_parallel(const Cull_Depth_Buffer& depth, uint32_t thread_count, const Vk_Buffer_Slice& camera_ubo)
+    {
+        const uint32_t instance_count = u32(batches.entities.size());
+        const uint32_t frame = get_frame_buffer_index();
+
+        std::vector<std::future<void>> tasks;
+        std::vector<VkCommandBuffer> secondary_buffers;
+
+        for (uint32_t i = 0; i < thread_count; ++i) {
+            const uint32_t first = u32(uint64_t(instance_count) * i / thread_count);
+            const uint32_t last = u32(uint64_t(instance_count) * (i + 1) / thread_count);
+
+            Record_Worker& worker = record_workers[i];
+            worker.stats = {};
+            secondary_buffers.push_back(worker.commands.buffers[frame]);
+
+            tasks.push_back(std::async(std::launch::async, [&depth, &camera_ubo, &worker, first, last]() {
+                PROFILE_ZONE("record_geometry");
+
+                std::vector<VkCommandBuffer>& buffers = worker.commands.buffers;
+
+                begin_secondary_command_buffer(buffers, offscreen_pass);
+                bind_descriptor_set(buffers, offscreen_pipeline_layout, offscreen_ds, { u32(camera_ubo.offset) });
+                bind_bindless_materials(buffers);
+                render_entities(depth, first, last, worker, buffers);
+                end_command_buffer(buffers);
+            }));
+        }
+
+        for (std::future<void>& task : tasks)
+            task.wait();
+
+        execute_command_buffers(cmd_buffer, secondary_buffers);
+
+        for (uint32_t i = 0; i < thread_count; ++i)
+            add_record_stats(record_workers[i]);
+    }
+
+    // Copies the instances that changed, writes a draw command for every
+    // mesh and records one dispatch that culls all instances followed by one
+    // that compacts the draw commands of each bucket. The CPU cost depends on
+    // the number of models and meshes rather than the number of entities.
+    // Must be recorded outside of a render pass.
+    static void cull_entities_gpu(const Vk_Buffer_Slice& cull_ubo)
+    {
+        const std::vector<Model_Old>& models = g_engine->models;
+        const std::vector<uint32_t>& model_counts = g_engine->entities.model_counts;
+        const uint32_t instance_count = u32(get_entity_count(g_engine->entities));
+
+        if (gpu_draws.dirty)
+            build_gpu_draws();
+
+        const uint32_t draw_count = u32(gpu_draws.draws.size());
+        const uint32_t bucket_count = u32(gpu_draws.buckets.size());
+        if (draw_count == 0 || !upload_instances())
+            return;
+
+        // The model table, draw commands and counts are sub-allocated from
+        // instance memory so their indices are converted from instance (mat4)
+        // units.
+        Vk_Buffer_Slice model_slice, draw_slice;
+        uint32_t models_first = 0, draws_first = 0, compacted_first = 0, counts_first = 0;
+        if (!allocate_instance_memory(models.size() * sizeof(Gpu_Model), model_slice, models_first) ||
+            !allocate_instance_memory(draw_count * sizeof(Gpu_Draw_Command), draw_slice, draws_first) ||
+            !allocate_instance_memory(draw_count * sizeof(Gpu_Draw_Command), gpu_draws.compacted, compacted_first) ||
+            !allocate_instance_memory(bucket_count * sizeof(uint32_t), gpu_draws.counts, counts_first))
+            return;
+
+        // The visible instances of each model are written after those of the
+        // models before it.
+        static std::vector<uint32_t> output_offsets;
+        output_offsets.resize(models.size());
+
+        Gpu_Model* table = static_cast<Gpu_Model*>(model_slice.data);
+        uint32_t output_offset = 0;
+        for (std::size_t i = 0; i < models.size(); ++i) {
+            Gpu_Model model{};
+            model.aabb_min = glm::vec4(models[i].bounds.min, 0.0f);
+            model.aabb_max = glm::vec4(models[i].bounds.max, 0.0f);
+            model.leader = gpu_draws.leaders[i];
+            model.output_offset = output_offset;
+            model.triangle_count = gpu_draws.triangle_counts[i];
+            table[i] = model;
+
+            output_offsets[i] = output_offset;
+            output_offset += i < model_counts.size() ? model_counts[i] : 0;
+        }
+
+        gpu_draws.active_buckets.assign(bucket_count, 0);
+
+        Gpu_Draw_Command* commands = static_cast<Gpu_Draw_Command*>(draw_slice.data);
+        for (uint32_t i = 0; i < draw_count; ++i) {
+            const Gpu_Draw& draw = gpu_draws.draws[i];
+            const vk_geometry_range& geometry = models[draw.model].meshes[draw.mesh].geometry;
+
+            Gpu_Draw_Command command{};
+            command.command.indexCount = geometry.index_count;
+            command.command.instanceCount = 0;
+            command.command.firstIndex = geometry.first_index;
+            command.command.vertexOffset = geometry.vertex_offset;
+            command.command.firstInstance = output_offsets[draw.model];
+            command.leader = gpu_draws.leaders[draw.model];
+            command.bucket = draw.bucket;
+            command.bucket_first = gpu_draws.buckets[draw.bucket].first;
+            commands[i] = command;
+
+            if (draw.model < model_counts.size() && model_counts[draw.model] > 0)
+                gpu_draws.active_buckets[draw.bucket] = 1;
+        }
+
+        std::memset(gpu_draws.counts.data, 0, bucket_count * sizeof(uint32_t));
+
+        // The previous frame may still be reading the visible instances.
+        memory_barrier(cmd_buffer,
+            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0);
+
+        Cull_Constants constants{};
+        constants.instance_count = instance_count;
+        constants.first_model = models_first * (sizeof(glm::mat4) / sizeof(Gpu_Model));
+        constants.first_draw = draws_first * (sizeof(glm::mat4) / sizeof(Gpu_Draw_Command));
+        constants.draw_count = draw_count;
+        constants.first_compacted = compacted_first * (sizeof(glm::mat4) / sizeof(Gpu_Draw_Command));
+        constants.first_count = counts_first * (sizeof(glm::mat4) / sizeof(uint32_t));
+
+        bind_compute_pipeline(cmd_buffer, cull_pipeline);
+        bind_compute_descriptor_set(cmd_buffer, cull_pipeline_layout, cull_ds, { u32(cull_ubo.offset) });
+        push_constants(cmd_buffer, cull_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(Cull_Constants), &constants);
+        dispatch(cmd_buffer, (instance_count + 63) / 64);
+
+        memory_barrier(cmd_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+        bind_compute_pipeline(cmd_buffer, cull_finalize_pipeline);
+        dispatch(cmd_buffer, (draw_count + 63) / 64);
+
+        // Occlusion statistics are read by the CPU once the frame completes.
+        memory_barrier(cmd_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+            VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT);
+    }
+
+    // Draws the compacted commands of each bucket with a single indirect
+    // draw. Buckets only differ in geometry block and material.
+    static void render_entities_gpu()
+    {
+        const vk_geometry_buffer& geometry = g_engine->renderer->geometry;
+        uint32_t bound_block = UINT32_MAX;
+
+        for (uint32_t i = 0; i < u32(gpu_draws.active_buckets.size()); ++i) {
+            if (!gpu_draws.active_buckets[i])
+                continue;
+
+            const Gpu_Draw_Bucket& bucket = gpu_draws.buckets[i];
+            const Mesh_Old& mesh = g_engine->models[bucket.model].meshes[bucket.mesh];
+
+            if (mesh.geometry.block != bound_block) {
+                bind_geometry_block(cmd_buffer, geometry, mesh.geometry.block);
+                bound_block = mesh.geometry.block;
+            }
+
+            if (mesh.descriptor_set)
+                bind_descriptor_set(cmd_buffer, offscreen_pipeline_layout, mesh.descriptor_set);
+            else
+                push_constants(cmd_buffer, offscreen_pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(uint32_t), &mesh.material_id);
+
+            render_indirect_count(cmd_buffer,
+                gpu_draws.compacted.buffer,
+                gpu_draws.compacted.offset + bucket.first * sizeof(Gpu_Draw_Command),
+                gpu_draws.counts.buffer,
+                gpu_draws.counts.offset + i * sizeof(uint32_t),
+                bucket.count,
+                sizeof(Gpu_Draw_Command));
+
+            ++g_engine->stats.draw_calls;
+        }
+    }
+
+    // Builds the depth pyramid from the depth attachment that was just
+    // rendered. The result is used to cull instances in the next frame.
+    static void build_depth_pyramid()
+    {
+        // Wait for depth writes as well as any reads of the pyramid from
+        // culling or readback copies that were recorded earlier.
+        memory_barrier(cmd_buffer,
+            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+        bind_compute_pipeline(cmd_buffer, depth_pyramid_pipeline);
+
+        VkExtent2D source_size = render_size;
+        for (uint32_t i = 0; i < depth_pyramid.mip_levels; ++i) {
+            const VkExtent2D size{
+                std::max(depth_pyramid.extent.width >> i, 1u),
+                std::max(depth_pyramid.extent.height >> i, 1u)
+            };
+
+            if (i == 0)
+                bind_compute_descriptor_set(cmd_buffer, depth_pyramid_pipeline_layout, depth_pyramid_ds[get_frame_image_index()]);
+            else
+                bind_compute_descriptor_set(cmd_buffer, depth_pyramid_pipeline_layout, depth_pyramid_mip_ds[i - 1]);
+
+            Depth_Pyramid_Constants constants{};
+            constants.source_size = glm::ivec2(source_size.width, source_size.height);
+            constants.destination_size = glm::ivec2(size.width, size.height);
+
+            push_constants(cmd_buffer, depth_pyramid_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(Depth_Pyramid_Constants), &constants);
+            dispatch(cmd_buffer, (size.width + 7) / 8, (size.height + 7) / 8);
+
+            memory_barrier(cmd_buffer,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT);
+
+            source_size = size;
+        }
+
+        depth_pyramid_view_proj = g_engine->camera.vp.proj * g_engine->camera.vp.view;
+        depth_pyramid_valid = true;
+
+        // The CPU path reads this frames copy once its fence has been
+        // signaled i.e. once every other frame in flight has been rendered.
+        const uint32_t frame = get_frame_buffer_index();
+        if (!g_engine->gpu_culling) {
+            const VkDeviceSize region_size = depth_readback.size / max_frames_in_flight;
+            copy_image_to_buffer(cmd_buffer, depth_pyramid, depth_readback_level, VK_IMAGE_LAYOUT_GENERAL, depth_readback.buffer, region_size * frame);
+
+            memory_barrier(cmd_buffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+
+            depth_readback_view_proj[frame] = depth_pyramid_view_proj;
+        }
+
+        depth_readback_valid[frame] = !g_engine->gpu_culling;
+    }
+
+    // Returns the depth that was read back the last time the current frame
+    // was recorded or an empty depth buffer if there is none.
+    static Cull_Depth_Buffer get_readback_depth()
+    {
+        Cull_Depth_Buffer depth{};
+
+        const uint32_t frame = get_frame_buffer_index();
+        if (!g_engine->occlusion_culling || !depth_readback_valid[frame])
+            return depth;
+
+        depth.width = std::max(depth_pyramid.extent.width >> depth_readback_level, 1u);
+        depth.height = std::max(depth_pyramid.extent.height >> depth_readback_level, 1u);
+        depth.depths = static_cast<const float*>(depth_readback.mapped) + depth.width * depth.height * frame;
+        depth.view_proj = depth_readback_view_proj[frame];
+
+        return depth;
+    }
+
+    // Splits the view into shadow cascades and fits an orthographic projection
+    // from the sun to the bounding sphere of each slice. A sphere keeps the
+    // size of the projection constant as the camera rotates and snapping its
+    // origin to whole texels keeps it stable as the camera moves. Together
+    // these stop shadow edges from shimmering.
+    static void update_shadow_cascades()
+    {
+        const perspective_camera& camera = g_engine->camera;
+        const glm::mat4 inverse_view_proj = glm::inverse(camera.vp.proj * camera.vp.view);
+        const glm::vec3 sun_dir = glm::normalize(scene.sun_dir);
+        const glm::vec3 up = std::abs(sun_dir.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        const float map_size = static_cast<float>(shadow_map_size.width);
+
+        const auto distance_to_depth = [&](float distance) {
+            const glm::vec4 clip = camera.vp.proj * glm::vec4(0.0f, 0.0f, distance, 1.0f);
+            return clip.z / clip.w;
+        };
+
+        float split_near = camera.near_plane;
+        for (uint32_t i = 0; i < shadow_cascade_count; ++i) {
+            const float t = static_cast<float>(i + 1) / shadow_cascade_count;
+            const float log_split = camera.near_plane * std::pow(shadow_distance / camera.near_plane, t);
+            const float uniform_split = camera.near_plane + (shadow_distance - camera.near_plane) * t;
+            const float split_far = glm::mix(uniform_split, log_split, shadow_split_lambda);
+
+            std::array<glm::vec3, 8> corners;
+            glm::vec3 center(0.0f);
+            for (int j = 0; j < 8; ++j) {
+                const glm::vec4 ndc(j & 1 ? 1.0f : -1.0f, j & 2 ? 1.0f : -1.0f,
+                    distance_to_depth(j & 4 ? split_far : split_near), 1.0f);
+                const glm::vec4 world = inverse_view_proj * ndc;
+                corners[j] = glm::vec3(world) / world.w;
+                center += corners[j] / 8.0f;
+            }
+
+            float radius = 0.0f;
+            for (const glm::vec3& corner : corners)
+                radius = std::max(radius, glm::length(corner - center));
+            radius = std::ceil(radius * 16.0f) / 16.0f;
+
+            // Reversed Z to match the rest of the renderer. The near plane is
+            // pulled back towards the sun so that casters outside of the
+            // slice still cast shadows into it.
+            Shadow_Cascade& cascade = shadow_cascades[i];
+            cascade.vp.view = glm::lookAt(center - sun_dir * radius, center, up);
+            cascade.vp.proj = glm::ortho(-radius, radius, -radius, radius, 2.0f * radius, -sunDistance);
+
+            glm::vec4 origin = cascade.vp.proj * cascade.vp.view * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            origin *= map_size / 2.0f;
+            const glm::vec2 offset = (glm::round(glm::vec2(origin)) - glm::vec2(origin)) * (2.0f / map_size);
+            cascade.vp.proj[3][0] += offset.x;
+            cascade.vp.proj[3][1] += offset.y;
+
+            const glm::mat4 shadow_matrix = cascade.vp.proj * cascade.vp.view;
+            cascade.frustum = extract_frustum_planes(shadow_matrix);
+            scene.shadow_matrices[i] = shadow_matrix;
+            scene.shadow_texel_sizes[i] = 2.0f * radius / map_size;
+
+            split_near = split_far;
+        }
+
+        scene.shadow_params = glm::vec4(0.0f, 1.0f / map_size, 0.0f, 0.0f);
+    }
+
+    // Renders each shadow cascade with only the instances whose bounds
+    // intersect that cascade so that the cost scales with the number of
+    // casters rather than the size of the scene.
+    static void render_shadows()
+    {
+        static Cull_Bounds bounds;
+        static std::vector<uint32_t> visible;
+        static Render_Queue queue;
+
+        const std::vector<glm::mat4>& transforms = g_engine->entities.world_transforms;
+        const std::vector<Model_Old>& models = g_engine->models;
+
+        // World space bounds in the same order as the sorted instances.
+        clear_bounds(bounds);
+        if (!transforms.empty()) {
+            for (std::size_t i = 0; i < models.size(); ++i) {
+                const uint32_t begin = batches.offsets[i];
+                add_bounds(bounds, models[i].bounds, transforms.data(), batches.entities.data() + begin, batches.offsets[i + 1] - begin);
+            }
+        }
+
+        for (uint32_t i = 0; i < shadow_cascade_count; ++i) {
+            const Shadow_Cascade& cascade = shadow_cascades[i];
+
+            // Without uniform memory the cascade is only cleared.
+            Vk_Buffer_Slice cascade_ubo;
+            if (!allocate_uniform_memory(sizeof(camera_projection), cascade_ubo)) {
+                begin_render_pass(cmd_buffer, shadow_passes[i]);
+                end_render_pass(cmd_buffer);
+                continue;
+            }
+
+            std::memcpy(cascade_ubo.data, &cascade.vp, sizeof(camera_projection));
+
+            begin_render_pass(cmd_buffer, shadow_passes[i]);
+            bind_descriptor_set(cmd_buffer, offscreen_pipeline_layout, offscreen_ds, { u32(cascade_ubo.offset) });
+            clear_render_queue(queue);
+
+            const uint32_t caster_count = cull_bounds(cascade.frustum, bounds, visible);
+            g_engine->stats.shadow_casters += static_cast<int>(caster_count);
+
+            uint32_t first_instance = 0;
+            Vk_Buffer_Slice slice;
+            if (caster_count > 0 && allocate_instance_memory(caster_count * sizeof(glm::mat4), slice, first_instance)) {
+                glm::mat4* matrices = static_cast<glm::mat4*>(slice.data);
+                for (uint32_t j = 0; j < caster_count; ++j)
+                    matrices[j] = transforms[batches.entities[visible[j]]];
+
+                // The visible indices are in ascending order so the casters
+                // of each model are contiguous.
+                uint32_t begin = 0;
+                for (std::size_t model = 0; model < models.size() && begin < caster_count; ++model) {
+                    uint32_t end = begin;
+                    while (end < caster_count && visible[end] < batches.offsets[model + 1])
+                        ++end;
+
+                    // Shadows only write depth so the material is not bound.
+                    if (end > begin) {
+                        for (const Mesh_Old& mesh : models[model].meshes)
+                            add_draw(queue, shadow_pipeline, mesh, end - begin, first_instance + begin, false);
+                    }
+
+                    begin = end;
+                }
+            }
+
+            sort_render_queue(queue);
+            g_engine->stats.binds_skipped += static_cast<int>(submit_render_queue(queue, cmd_buffer, offscreen_pipeline_layout));
+            g_engine->stats.draw_calls += static_cast<int>(queue.packets.size());
+
+            end_render_pass(cmd_buffer);
+        }
+    }
+
+    // Copies the point lights into instance memory. Returns the index of the
+    // first light in the light buffer and the number of lights.
+    static glm::uvec2 write_lights()
+    {
+        const std::vector<Point_Light>& lights = g_engine->lights;
+        if (lights.empty())
+            return glm::uvec2(0);
+
+        uint32_t first = 0;
+        Vk_Buffer_Slice slice;
+        if (!allocate_instance_memory(lights.size() * sizeof(Point_Light), slice, first))
+            return glm::uvec2(0);
+
+        std::memcpy(slice.data, lights.data(), lights.size() * sizeof(Point_Light));
+
+        return glm::uvec2(first * (sizeof(glm::mat4) / sizeof(Point_Light)), u32(lights.size()));
+    }
+
+    // Bins the point lights into screen tiles using the depth that was just
+    // rendered so that the lighting pass only loops over nearby lights.
+    static void cull_lights(const Vk_Buffer_Slice& scene_ubo)
+    {
+        // Wait for depth writes and for the previous lighting pass to finish
+        // reading the light tiles.
+        memory_barrier(cmd_buffer,
+            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+        bind_compute_pipeline(cmd_buffer, light_cull_pipeline);
+        bind_compute_descriptor_set(cmd_buffer, light_cull_pipeline_layout, composite_ds, { u32(scene_ubo.offset) });
+
+        // The tiles keep the row stride of the full attachments but only
+        // those covering the rendered area are binned and read.
+        dispatch(cmd_buffer,
+            (render_size.width + light_tile_size - 1) / light_tile_size,
+            (render_size.height + light_tile_size - 1) / light_tile_size);
+
+        memory_barrier(cmd_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    }
+
+    void render()
+    {
+        PROFILE_ZONE("render");
+
+        const auto record_start = std::chrono::high_resolution_clock::now();
+
+        // Every pass of a frame renders the same area so the render size is
+        // only applied once recording begins.
+        offscreen_pass.render_extent = render_size;
+        composite_pass.render_extent = render_size;
+        skybox_pass.render_extent = render_size;
+        scene.render_size = glm::vec4(
+            render_size.width,
+            render_size.height,
+            static_cast<float>(render_size.width) / static_cast<float>(framebuffer_size.width),
+            static_cast<float>(render_size.height) / static_cast<float>(framebuffer_size.height));
+
+        // Uniform data must be written after begin_render() as that is where
+        // the renderer waits for the GPU to release this frames memory. The
+        // frame is submitted empty if there is none left as nothing can be
+        // drawn without the camera.
+        Vk_Buffer_Slice camera_ubo, scene_ubo;
+        if (!allocate_uniform_memory(sizeof(camera_projection), camera_ubo) || !allocate_uniform_memory(sizeof(Scene_Data), scene_ubo)) {
+            begin_command_buffer(cmd_buffer);
+            end_command_buffer(cmd_buffer);
+            return;
+        }
+
+        scene.camera_pos = glm::vec4(g_engine->camera.position, 0.0f);
+        scene.inverse_view_proj = glm::inverse(g_engine->camera.vp.proj * g_engine->camera.vp.view);
+        scene.light_info = glm::uvec4(write_lights(), light_tiles_x, 0);
+        if (g_engine->shadows)
+            update_shadow_cascades();
+        std::memcpy(camera_ubo.data, &g_engine->camera.vp, sizeof(camera_projection));
+        std::memcpy(scene_ubo.data, &scene, sizeof(Scene_Data));
+
+        g_engine->camera.frustum = extract_frustum_planes(g_engine->camera.vp.proj * g_engine->camera.vp.view);
+
+        g_engine->stats.instance_count = static_cast<int>(get_entity_count(g_engine->entities));
+        g_engine->stats.draw_calls = 0;
+        g_engine->stats.visible_count = 0;
+        g_engine->stats.culled_count = 0;
+        g_engine->stats.occluded_count = 0;
+        g_engine->stats.occluded_triangles = 0;
+        g_engine->stats.shadow_casters = 0;
+        g_engine->stats.binds_skipped = 0;
+
+        // The GPU driven path writes its occlusion results into memory that
+        // can only be read once the frame has finished.
+        if (g_engine->gpu_culling) {
+            uint32_t* occluded = static_cast<uint32_t*>(cull_stats.mapped) + get_frame_buffer_index() * 2;
+            g_engine->stats.occluded_count = static_cast<int>(occluded[0]);
+            g_engine->stats.occluded_triangles = static_cast<int>(occluded[1]);
+            occluded[0] = 0;
+            occluded[1] = 0;
+        }
+
+        // Only entities whose transform or ancestors changed are updated.
+        update_entity_transforms(g_engine->entities);
+
+        // The GPU driven path culls the entities where they are. Only the CPU
+        // path and shadows need them grouped by model.
+        const bool has_instances = get_entity_count(g_engine->entities) > 0;
+        if (has_instances && (!g_engine->gpu_culling || g_engine->shadows))
+            prepare_instances();
+
+        begin_command_buffer(cmd_buffer);
+        {
+            reset_gpu_timings(gpu_profiler, cmd_buffer);
+
+            gpu_draws.active_buckets.clear();
+            if (has_instances && g_engine->gpu_culling) {
+                Cull_Data cull_data{};
+                cull_data.frustum = g_engine->camera.frustum;
+                cull_data.view_proj = depth_pyramid_view_proj;
+                cull_data.pyramid_size = glm::vec4(depth_pyramid.extent.width, depth_pyramid.extent.height, 0.0f, 0.0f);
+                cull_data.params.x = depth_pyramid.mip_levels;
+                cull_data.params.y = g_engine->occlusion_culling && depth_pyramid_valid;
+                cull_data.params.z = get_frame_buffer_index();
+
+                // Nothing is drawn without the cull data as no draw commands
+                // are written.
+                Vk_Buffer_Slice cull_ubo;
+                if (allocate_uniform_memory(sizeof(Cull_Data), cull_ubo)) {
+                    std::memcpy(cull_ubo.data, &cull_data, sizeof(Cull_Data));
+
+                    const uint32_t cull_scope = begin_gpu_scope(gpu_profiler, cmd_buffer, "Culling");
+                    cull_entities_gpu(cull_ubo);
+                    end_gpu_scope(gpu_profiler, cmd_buffer, cull_scope);
+                }
+            }
+
+            if (g_engine->shadows) {
+                const uint32_t shadow_scope = begin_gpu_scope(gpu_profiler, cmd_buffer, "Shadows");
+                render_shadows();
+                end_gpu_scope(gpu_profiler, cmd_buffer, shadow_scope);
+            }
+
+            const uint32_t geometry_scope = begin_gpu_scope(gpu_profiler, cmd_buffer, "Geometry");
+            const uint32_t record_threads = has_instances && !g_engine->gpu_culling ? get_record_thread_count() : 1;
+
+            if (record_threads > 1) {
+                begin_render_pass(cmd_buffer, offscreen_pass, { 0.0f, 0.0f, 0.0f, 1.0f }, { 0.0f, 0 },
+                    VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+                render_entities_parallel(get_readback_depth(), record_threads, camera_ubo);
+            } else {
+                begin_render_pass(cmd_buffer, offscreen_pass);
+
+                // The CPU path binds the pipeline as part of its render queue.
+                if (g_engine->gpu_culling) {
+                    bind_descriptor_set(cmd_buffer, offscreen_pipeline_layout, gpu_offscreen_ds, { u32(camera_ubo.offset) });
+                    bind_bindless_materials(cmd_buffer);
+                    bind_pipeline(cmd_buffer, get_geometry_pipeline());
+
+                    if (has_instances)
+                        render_entities_gpu();
+                } else if (has_instances) {
+                    Record_Worker& worker = record_workers[0];
+                    worker.stats = {};
+
+                    bind_descriptor_set(cmd_buffer, offscreen_pipeline_layout, offscreen_ds, { u32(camera_ubo.offset) });
+                    bind_bindless_materials(cmd_buffer);
+                    render_entities(get_readback_depth(), 0, u32(batches.entities.size()), worker, cmd_buffer);
+                    add_record_stats(worker);
+                }
+            }
+            end_render_pass(cmd_buffer);
+            end_gpu_scope(gpu_profiler, cmd_buffer, geometry_scope);
+
+            if (g_engine->occlusion_culling) {
+                const uint32_t pyramid_scope = begin_gpu_scope(gpu_profiler, cmd_buffer, "Depth pyramid");
+                build_depth_pyramid();
+                end_gpu_scope(gpu_profiler, cmd_buffer, pyramid_scope);
+            }
+
+            const uint32_t lighting_scope = begin_gpu_scope(gpu_profiler, cmd_buffer, "Lighting");
+
+            if (scene.light_info.y > 0)
+                cull_lights(scene_ubo);
+
+            begin_render_pass(cmd_buffer, composite_pass);
+
+            // lighting calculations
+            bind_descriptor_set(cmd_buffer, composite_pipeline_layout, composite_ds, { u32(scene_ubo.offset) });
+            bind_pipeline(cmd_buffer, get_composite_pipeline());
+            render(cmd_buffer);
+            end_render_pass(cmd_buffer);
+            end_gpu_scope(gpu_profiler, cmd_buffer, lighting_scope);
+
+#if 1
+            // The skybox would cover the background of the debug views.
+            if (g_engine->using_skybox && get_output_view() == Viewport_View::full) {
+                const uint32_t skybox_scope = begin_gpu_scope(gpu_profiler, cmd_buffer, "Skybox");
+                begin_render_pass(cmd_buffer, skybox_pass);
+
+                bind_descriptor_set(cmd_buffer, skybox_pipeline_layout, skybox_ds, { u32(camera_ubo.offset) });
+                bind_pipeline(cmd_buffer, skybox_pipeline);
+                render_model(skybox_model, cmd_buffer, skybox_pipeline_layout);
+                end_render_pass(cmd_buffer);
+                end_gpu_scope(gpu_profiler, cmd_buffer, skybox_scope);
+            }
+#endif
+
+            if (is_frame_capturing(frame_capture)) {
+                const uint32_t image = get_frame_image_index();
+                record_frame_capture(frame_capture, cmd_buffer, frame_capture.depth ? depths[image] : viewport[image], render_size);
+            }
+        }
+        end_command_buffer(cmd_buffer);
+
+        const auto record_end = std::chrono::high_resolution_clock::now();
+        g_engine->stats.record_time = std::chrono::duration<float, std::milli>(record_end - record_start).count();
+    }
+
+    // Sleeping is only accurate to a millisecond or worse on some platforms
+    // so the last part of the wait spins.
+    static void sleep_until(std::chrono::time_point<std::chrono::high_resolution_clock> time)
+    {
+        constexpr auto spin_time = std::chrono::milliseconds(2);
+
+        const auto now = std::chrono::high_resolution_clock::now();
+        if (time - now > spin_time)
+            std::this_thread::sleep_for(time - now - spin_time);
+
+        while (std::chrono::high_resolution_clock::now() < time)
+            std::this_thread::yield();
+    }
+
+    static void limit_frame_rate()
+    {
+        PROFILE_ZONE("limit_frame_rate");
+
+        const auto start = std::chrono::high_resolution_clock::now();
+        const auto period = std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+            std::chrono::duration<double>(1.0 / g_engine->frame_limit));
+
+        // Frames that run over their deadline start the next one from now
+        // rather than rendering faster to catch up.
+        g_engine->next_frame_time += period;
+        if (g_engine->next_frame_time < start)
+            g_engine->next_frame_time = start;
+        else
+            sleep_until(g_engine->next_frame_time);
+
+        const auto end = std::chrono::high_resolution_clock::now();
+        g_engine->latency.limiter_wait = std::chrono::duration<float, std::milli>(end - start).count();
+    }
+
+    void present()
+    {
+        PROFILE_ZONE("present");
+
+        if (g_engine->ui_pass_enabled)
+            submit_gpu_work({ cmd_buffer, ui_cmd_buffer });
+        else
+            submit_gpu_work({ cmd_buffer });
+
+        if (!present_swapchain_image() && g_engine->ui_pass_enabled)
+            resize_framebuffer(ui_pass, get_swapchain_extent());
+
+        g_engine->frame_presented = true;
+
+        Latency_Stats& latency = g_engine->latency;
+        const auto present_time = std::chrono::high_resolution_clock::now();
+        latency.input_to_present = std::chrono::duration<float, std::milli>(present_time - g_engine->input_time).count();
+        latency.input_to_present_avg = latency.input_to_present_avg == 0.0f ? latency.input_to_present :
+            latency.input_to_present_avg + (latency.input_to_present - latency.input_to_present_avg) * 0.05f;
+
+        // Everything that blocks happens before input is sampled for the
+        // next frame so that it is not included in the next frame's latency.
+        if (g_engine->low_latency) {
+            PROFILE_ZONE("wait_for_frame");
+
+            wait_for_frame();
+
+            const auto wait_end = std::chrono::high_resolution_clock::now();
+            latency.frame_wait = std::chrono::duration<float, std::milli>(wait_end - present_time).count();
+        }
+
+        if (g_engine->frame_limit > 0.0f)
+            limit_frame_rate();
+        else
+            latency.limiter_wait = 0.0f;
+
+        if (g_engine->window)
+            update_window(g_engine->window);
+
+        g_engine->input_time = std::chrono::high_resolution_clock::now();
+    }
+
+    void terminate()
+    {
+        assert(g_engine);
+
+        info("Terminating engine.");
+
+        wait_for_gpu();
+
+        for (auto& framebuffer : viewport_ui)
+            ImGui_ImplVulkan_RemoveTexture(framebuffer);
+
+        destroy_model(skybox_model);
+
+        for (auto& model : g_engine->models)
+            destroy_model(model);
+
+        // Destroy rendering resources
+        destroy_buffer(g_engine->sun_buffer);
+
+        destroy_descriptor_layout(material_ds_layout);
+        destroy_descriptor_layout(composite_ds_layout);
+        destroy_descriptor_layout(offscreen_ds_layout);
+        destroy_descriptor_layout(skybox_ds_layout);
+        destroy_descriptor_layout(cull_ds_layout);
+
+        save_pipeline_cache(get_pipeline_cache_path());
+
+        for (Record_Worker& worker : record_workers)
+            destroy_command_worker(worker.commands);
+
+        destroy_gpu_profiler(gpu_profiler);
+        destroy_frame_capture(frame_capture);
+
+        destroy_pipeline(light_cull_pipeline);
+        destroy_pipeline(cull_finalize_pipeline);
+        destroy_pipeline(cull_pipeline);
+        destroy_pipeline(shadow_pipeline.m_Pipeline);
+        destroy_pipeline(skybox_pipeline.m_Pipeline);
+        destroy_pipeline(wireframe_pipeline.m_Pipeline);
+        for (Vk_Pipeline& pipeline : composite_pipelines)
+            destroy_pipeline(pipeline.m_Pipeline);
+        for (Vk_Pipeline& pipeline : offscreen_pipelines)
+            destroy_pipeline(pipeline.m_Pipeline);
+
+        destroy_pipeline_layout(composite_pipeline_layout);
+        destroy_pipeline_layout(offscreen_pipeline_layout);
+        destroy_pipeline_layout(skybox_pipeline_layout);
+        destroy_pipeline_layout(cull_pipeline_layout);
+        destroy_pipeline_layout(light_cull_pipeline_layout);
+
+        destroy_buffer(light_tiles);
+        destroy_buffer(gpu_instance_models);
+        destroy_buffer(gpu_instance_matrices);
+        destroy_buffer(visible_instances);
+        destroy_buffer(cull_stats);
+        destroy_depth_pyramid();
+
+
+        destroy_render_pass(ui_pass);
+        destroy_render_pass(composite_pass);
+        destroy_render_pass(offscreen_pass);
+        destroy_render_pass(skybox_pass);
+        for (Vk_Render_Pass& shadow_pass : shadow_passes)
+            destroy_render_pass(shadow_pass);
+        destroy_image_sampler(shadow_sampler);
+
+        //destroy_image_sampler(g_texture_sampler);
+        destroy_image_sampler(g_framebuffer_sampler);
+
+        // Destroy core systems
+        terminate_audio(g_engine->audio);
+        destroy_ui(g_engine->ui);
+        destroy_renderer(g_engine->renderer);
+        destroy_platform_window(g_engine->window);
+
+        delete g_engine;
+    }
+
+
+
+
+
+
+
+
+    //////////////////////////////////////////////////////////////////////////////
+    // All the functions below are defined in engine.h which provides the engine 
+    // API to the client application.
+    //////////////////////////////////////////////////////////////////////////////
+
+
+    void set_render_mode(int mode)
+    {
+        render_mode = mode;
+    }
+
+    void set_vsync(bool enabled)
+    {
+        set_present_mode(enabled ? Present_Mode::vsync : Present_Mode::immediate);
+    }
+
+    void set_present_mode(Present_Mode mode)
+    {
+        if (g_engine->present_mode == mode)
+            return;
+
+        g_engine->present_mode = mode;
+        g_engine->pacing_changed = true;
+    }
+
+    Present_Mode get_present_mode()
+    {
+        return g_engine->present_mode;
+    }
+
+    void set_triple_buffering(bool enabled)
+    {
+        if (g_engine->triple_buffering == enabled)
+            return;
+
+        g_engine->triple_buffering = enabled;
+        g_engine->pacing_changed = true;
+    }
+
+    void set_frames_in_flight(int count)
+    {
+        const uint32_t frames = static_cast<uint32_t>(std::clamp(count, 1, static_cast<int>(max_frames_in_flight)));
+        if (g_engine->frames_in_flight == frames)
+            return;
+
+        g_engine->frames_in_flight = frames;
+        g_engine->pacing_changed = true;
+    }
+
+    int get_frames_in_flight()
+    {
+        return static_cast<int>(g_engine->frames_in_flight);
+    }
+
+    void set_frame_limit(float frames_per_second)
+    {
+        g_engine->frame_limit = std::max(frames_per_second, 0.0f);
+        g_engine->next_frame_time = std::chrono::high_resolution_clock::now();
+    }
+
+    void set_low_latency(bool enabled)
+    {
+        g_engine->low_latency = enabled;
+    }
+
+    void get_latency_stats(Latency_Stats* stats)
+    {
+        *stats = g_engine->latency;
+    }
+
+    bool set_gpu_culling(bool enabled)
+    {
+        if (enabled && !g_engine->renderer->ctx.device->draw_indirect_count) {
+            warn("GPU culling requires drawIndirectCount which is not supported.");
+            return false;
+        }
+
+        g_engine->gpu_culling = enabled;
+
+        return true;
+    }
+
+    void set_occlusion_culling(bool enabled)
+    {
+        g_engine->occlusion_culling = enabled;
+
+        // The pyramid is stale once it stops being rebuilt every frame.
+        if (!enabled) {
+            depth_pyramid_valid = false;
+            std::fill(depth_readback_valid.begin(), depth_readback_valid.end(), false);
+        }
+    }
+
+    void set_shadows(bool enabled)
+    {
+        g_engine->shadows = enabled;
+    }
+
+    void set_normal_mapping(bool enabled)
+    {
+        g_engine->normal_mapping = enabled;
+    }
+
+    void set_record_threads(int count)
+    {
+        g_engine->record_threads = static_cast<uint32_t>(std::clamp(count, 1, static_cast<int>(max_record_threads)));
+    }
+
+    int get_record_threads()
+    {
+        return static_cast<int>(g_engine->record_threads);
+    }
+
+    int add_point_light(float x, float y, float z, float r, float g, float b, float radius, float intensity)
+    {
+        if (g_engine->lights.size() >= max_point_lights) {
+            warn("Unable to add point light as the maximum of {} has been reached.", max_point_lights);
+            return -1;
+        }
+
+        Point_Light light{};
+        light.position = glm::vec4(x, y, z, std::max(radius, 0.001f));
+        light.color = glm::vec4(r, g, b, intensity);
+        g_engine->lights.push_back(light);
+
+        return static_cast<int>(g_engine->lights.size() - 1);
+    }
+
+    void clear_point_lights()
+    {
+        g_engine->lights.clear();
+    }
+
+    int get_point_light_count()
+    {
+        return static_cast<int>(g_engine->lights.size());
+    }
+
+    void get_render_stats(Render_Stats* stats)
+    {
+        *stats = g_engine->stats;
+    }
+
+    int get_gpu_timings(Gpu_Timing* timings, int max_count)
+    {
+        const int count = std::min(static_cast<int>(gpu_profiler.scopes.size()), max_count);
+
+        for (int i = 0; i < count; ++i) {
+            const Gpu_Scope& scope = gpu_profiler.scopes[i];
+            const Gpu_Scope_Stats stats = get_gpu_scope_stats(scope);
+
+            timings[i].name = scope.name.c_str();
+            timings[i].last = stats.last;
+            timings[i].min = stats.min;
+            timings[i].avg = stats.avg;
+            timings[i].max = stats.max;
+        }
+
+        return count;
+    }
+
+    bool export_gpu_timings(const char* path)
+    {
+        return export_gpu_timings(gpu_profiler, path);
+    }
+
+    bool capture_cpu_profile(int frame_count, const char* path)
+    {
+        if (frame_count <= 0)
+            return false;
+
+        return begin_profile_capture(static_cast<uint32_t>(frame_count), path);
+    }
+
+    bool is_capturing_cpu_profile()
+    {
+        return is_profile_capturing();
+    }
 
-        //destroy_image_sampler(g_texture_sampler);
-        destroy_image_sampler(g_framebuffer_sampler);
+    bool capture_viewport(Viewport_View view, const char* path, int frame_count)
+    {
+        if (frame_count <= 0)
+            return false;
 
-        // Destroy core systems
-        terminate_audio(g_engine->audio);
-        destroy_ui(g_engine->ui);
-        destroy_renderer(g_engine->renderer);
-        destroy_platform_window(g_engine->window);
+        if (!begin_frame_capture(frame_capture, path, static_cast<uint32_t>(frame_count), view == Viewport_View::depth))
+            return false;
 
-        delete g_engine;
+        capture_view = view;
+
+        return true;
     }
 
+    bool is_capturing_viewport()
+    {
+        return is_frame_capturing(frame_capture);
+    }
+
+    // Copies the lit result of the current image into a readback buffer. The
+    // copy is submitted to the same queue after the frame and waited on so
+    // the buffer can be read as soon as this returns.
+    static void copy_frame_to_buffer(const Vk_Buffer& buffer)
+    {
+        // Presenting only advances the frame in flight so the current image
+        // is still the one that was last rendered to.
+        const Vk_Image& image = viewport[get_frame_image_index()];
+        const VkExtent2D extent = get_render_extent(composite_pass);
+
+        submit_to_gpu([&](VkCommandBuffer cmd) {
+            VkImageMemoryBarrier barrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+            barrier.image = image.handle;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            barrier.subresourceRange.levelCount = 1;
+            barrier.subresourceRange.layerCount = 1;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            vkCmdPipelineBarrier(cmd,
+                VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+            VkBufferImageCopy region{};
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.layerCount = 1;
+            region.imageExtent = { extent.width, extent.height, 1 };
+            vkCmdCopyImageToBuffer(cmd, image.handle, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer.buffer, 1, &region);
+
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            vkCmdPipelineBarrier(cmd,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                0, 0, nullptr, 0, nullptr, 1, &barrier);
+        });
+
+        // Host visible memory is not guaranteed to be coherent.
+        vmaInvalidateAllocation(get_vulkan_context().allocator, buffer.allocation, 0, VK_WHOLE_SIZE);
+    }
+
+    bool read_frame_pixels(unsigned char* pixels)
+    {
+        if (!g_engine->frame_presented) {
+            warn("Unable to read frame pixels before a frame has been presented.");
+            return false;
+        }
 
+        const VkExtent2D extent = get_render_extent(composite_pass);
+        const VkDeviceSize size = VkDeviceSize(extent.width) * extent.height * 4;
 
+        // Regression tests and benchmarks read back rarely so a stall and a
+        // temporary buffer are acceptable here.
+        Vk_Buffer readback = create_readback_buffer(size, 0);
+        copy_frame_to_buffer(readback);
+        std::memcpy(pixels, readback.mapped, size);
+        destroy_buffer(readback);
 
+        return true;
+    }
 
+    void get_frame_size(int* width, int* height)
+    {
+        // The size of the area that was last rendered.
+        const VkExtent2D extent = get_render_extent(composite_pass);
+        *width = static_cast<int>(extent.width);
+        *height = static_cast<int>(extent.height);
+    }
 
+    bool save_frame_pixels(const char* path)
+    {
+        int width = 0, height = 0;
+        get_frame_size(&width, &height);
 
+        std::vector<unsigned char> pixels(std::size_t(width) * height * 4);
+        if (!read_frame_pixels(pixels.data()))
+            return false;
 
-    //////////////////////////////////////////////////////////////////////////////
-    // All the functions below are defined in engine.h which provides the engine 
-    // API to the client application.
-    //////////////////////////////////////////////////////////////////////////////
+        if (!stbi_write_png(path, width, height, 4, pixels.data(), width * 4)) {
+            error("Failed to write frame to {}.", path);
+            return false;
+        }
 
+        return true;
+    }
 
-    void set_render_mode(int mode)
+    bool compare_frame_pixels(const char* path, int tolerance, Image_Diff* diff)
     {
-        if (mode == 0) {
-            current_pipeline = &offscreen_pipeline;
+        int width = 0, height = 0;
+        get_frame_size(&width, &height);
+
+        int image_width = 0, image_height = 0, channels = 0;
+        unsigned char* image = stbi_load(path, &image_width, &image_height, &channels, 4);
+        if (!image) {
+            error("Failed to load reference image {}.", path);
+            return false;
         }
-        else if (mode == 1) {
-            current_pipeline = &wireframe_pipeline;
+
+        if (image_width != width || image_height != height) {
+            error("Reference image {} is {}x{} but the frame is {}x{}.", path, image_width, image_height, width, height);
+            stbi_image_free(image);
+            return false;
         }
-    }
 
-    void set_vsync(bool enabled)
-    {
-        warn("Vsync toggling not yet implemented.");
+        std::vector<unsigned char> pixels(std::size_t(width) * height * 4);
+        if (!read_frame_pixels(pixels.data())) {
+            stbi_image_free(image);
+            return false;
+        }
 
-        // TODO: We might need to recreate swapchain at the end and not in the middle?
-#if 0
-        wait_for_gpu();
+        *diff = {};
+        diff->pixel_count = width * height;
 
-        recreate_swapchain(buffer_mode::double_buffering, static_cast<vsync_mode>(enabled));
-        VkExtent2D new_size{ g_engine->window->width, g_engine->window->height };
-        resize_framebuffer(ui_pass, new_size);
-#endif
+        for (std::size_t i = 0; i < pixels.size(); i += 4) {
+            int pixel_difference = 0;
+            for (std::size_t channel = 0; channel < 4; ++channel)
+                pixel_difference = std::max(pixel_difference, std::abs(int(pixels[i + channel]) - int(image[i + channel])));
+
+            diff->max_difference = std::max(diff->max_difference, pixel_difference);
+            if (pixel_difference > tolerance)
+                ++diff->differing_pixels;
+        }
+
+        stbi_image_free(image);
+
+        return true;
     }
 
     void should_terminate()
@@ -716,8 +2563,22 @@ namespace engine {
     }
 
 
+    // Models use the bindless material set when the GPU supports it.
+    static bool upload_model(Model_Old& model)
+    {
+        Vk_Bindless_Set& bindless = g_engine->renderer->bindless;
+        if (bindless.set)
+            return upload_model_to_gpu(model, bindless);
+
+        upload_model_to_gpu(model, material_ds_layout, material_ds_binding);
+
+        return true;
+    }
+
     void load_model(const char* path, bool flipUVs)
     {
+        PROFILE_ZONE("load_model");
+
         Model_Old model{};
 
         // todo: continue from here
@@ -727,12 +2588,19 @@ namespace engine {
             return;
         }
 
-        upload_model_to_gpu(model, material_ds_layout, material_ds_binding);
+        if (!upload_model(model)) {
+            destroy_model(model);
+            return;
+        }
+
         g_engine->models.push_back(model);
+        gpu_draws.dirty = true;
     }
 
     void add_model(const char* path, const char* data, int size, bool flipUVs)
     {
+        PROFILE_ZONE("add_model");
+
         Model_Old model;
 
         bool model_created = create_model(model, path, data, size, flipUVs);
@@ -741,175 +2609,503 @@ namespace engine {
             return;
         }
 
-        upload_model_to_gpu(model, material_ds_layout, material_ds_binding);
+        if (!upload_model(model)) {
+            destroy_model(model);
+            return;
+        }
+
         g_engine->models.push_back(model);
+        gpu_draws.dirty = true;
     }
 
-    void remove_model(int modelID)
+    // Moves the camera so that the bounding sphere of the model fills the
+    // frame when viewed from the given direction. Angles are in radians.
+    static void frame_camera_to_bounds(perspective_camera& camera, const Bounding_Box& bounds, float azimuth, float elevation)
     {
-        // Remove all instances which use the current model
-#if 0
-        std::size_t size = engine->instances.size();
-        for (std::size_t i = 0; i < size; ++i)
-        {
-            if (engine->instances[i].model == &engine->models[modelID])
-            {
-                engine->instances.erase(engine->instances.begin() + i);
-                size--;
+        const glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+        const float radius = std::max(glm::length(bounds.max - bounds.min) * 0.5f, 0.001f);
+
+        // The sphere must fit within the narrower of the two fields of view.
+        const float aspect = static_cast<float>(render_size.width) / static_cast<float>(render_size.height);
+        const float half_fovy = glm::radians(camera.fovy) * 0.5f;
+        const float half_fov = std::min(half_fovy, std::atan(std::tan(half_fovy) * aspect));
+        const float distance = radius / std::sin(half_fov);
+
+        const glm::vec3 direction(
+            std::cos(elevation) * std::sin(azimuth),
+            std::sin(elevation),
+            std::cos(elevation) * std::cos(azimuth)
+        );
+
+        camera.position = center + direction * distance;
+        camera.front_vector = -direction;
+        camera.near_plane = std::max(distance - radius, radius * 0.01f);
+        camera.far_plane = (distance + radius) * 1.01f;
+        camera.vp.view = glm::lookAt(camera.position, center, glm::vec3(0.0f, 1.0f, 0.0f));
+
+        update_projection(camera, render_size.width, render_size.height);
+    }
+
+    int render_thumbnails(const char* const* paths, int path_count, const Thumbnail_Settings* settings)
+    {
+        PROFILE_ZONE("render_thumbnails");
+
+        if (g_engine->window) {
+            error("Thumbnails can only be rendered by a headless engine.");
+            return 0;
+        }
+
+        if (path_count <= 0 || settings->angle_count <= 0 || settings->fovy <= 0.0f || settings->fovy >= 180.0f)
+            return 0;
+
+        const std::filesystem::path output_directory = settings->output_directory;
+
+        std::error_code ec;
+        std::filesystem::create_directories(output_directory, ec);
+        if (ec) {
+            error("Failed to create thumbnail directory {}.", output_directory.string());
+            return 0;
+        }
+
+        const auto batch_start = std::chrono::high_resolution_clock::now();
+
+        // Only the batch model is rendered. The scene is restored afterwards.
+        Entity_Storage scene_entities = std::move(g_engine->entities);
+        const perspective_camera scene_camera = g_engine->camera;
+        const bool occlusion_culling = g_engine->occlusion_culling;
+
+        g_engine->entities = {};
+        g_engine->camera.fovy = settings->fovy;
+
+        // Occlusion culling uses the depth of the previous frame which is of
+        // a different angle or model.
+        g_engine->occlusion_culling = false;
+
+        // Every model is released by rewinding to this mark so the same
+        // geometry blocks and bindless slots are reused for the whole batch.
+        const Model_Upload_Mark mark = get_model_upload_mark();
+
+        const int width = static_cast<int>(render_size.width);
+        const int height = static_cast<int>(render_size.height);
+        const std::size_t frame_bytes = std::size_t(width) * height * 4;
+
+        Vk_Buffer readback = create_readback_buffer(frame_bytes, 0);
+
+        // Each angle has its own pixels since they are encoded on worker
+        // threads while the next angles are rendered.
+        std::vector<std::vector<unsigned char>> images(settings->angle_count, std::vector<unsigned char>(frame_bytes));
+        std::vector<std::future<bool>> writes;
+
+        const auto import_async = [&](int index) {
+            return std::async(std::launch::async, [path = std::filesystem::path(paths[index]), flip = settings->flip_uvs]() {
+                Model_Import model_import;
+                import_model(model_import, path, flip);
+                return model_import;
+            });
+        };
+
+        const auto wait_for_writes = [&]() {
+            for (std::future<bool>& write : writes) {
+                if (!write.get())
+                    error("Failed to write thumbnail.");
+            }
+
+            writes.clear();
+        };
+
+        int rendered = 0;
+        std::future<Model_Import> next_import = import_async(0);
+
+        for (int i = 0; i < path_count; ++i) {
+            Model_Import model_import = next_import.get();
+
+            // Read the next model while this one is uploaded and rendered.
+            if (i + 1 < path_count)
+                next_import = import_async(i + 1);
+
+            Model_Old model{};
+            if (!load_model(model, model_import) || !upload_model(model)) {
+                error("Failed to load thumbnail model: {}.", paths[i]);
+
+                destroy_model(model);
+                rewind_model_uploads(mark);
+                continue;
+            }
+
+            // The previous model's images must be written before their
+            // pixels are overwritten.
+            wait_for_writes();
+
+            const uint32_t model_index = u32(g_engine->models.size());
+            g_engine->models.push_back(model);
+            gpu_draws.dirty = true;
+            create_entity(g_engine->entities, model_index, model.name);
+
+            const std::string name = std::filesystem::path(paths[i]).stem().string();
+
+            for (int angle = 0; angle < settings->angle_count; ++angle) {
+                const float azimuth = glm::two_pi<float>() * static_cast<float>(angle) / static_cast<float>(settings->angle_count);
+                frame_camera_to_bounds(g_engine->camera, model.bounds, azimuth, glm::radians(settings->elevation));
+
+                if (!begin_render())
+                    continue;
+
+                render();
+                present();
+
+                copy_frame_to_buffer(readback);
+                std::memcpy(images[angle].data(), readback.mapped, frame_bytes);
+
+                const std::filesystem::path path = output_directory / std::format("{}_{}.png", name, angle);
+                writes.push_back(std::async(std::launch::async, [&pixels = images[angle], path, width, height]() {
+                    return stbi_write_png(path.string().c_str(), width, height, 4, pixels.data(), width * 4) != 0;
+                }));
             }
+
+            wait_for_gpu();
+
+            clear_entities(g_engine->entities);
+            destroy_model(g_engine->models.back());
+            g_engine->models.pop_back();
+            gpu_draws.dirty = true;
+            rewind_model_uploads(mark);
+
+            ++rendered;
         }
 
-        // Remove model from list and memory
-        WaitForGPU();
+        wait_for_writes();
+        destroy_buffer(readback);
 
-        DestroyModel(engine->models[modelID]);
-        engine->models.erase(engine->models.begin() + modelID);
-#endif
+        g_engine->entities = std::move(scene_entities);
+
+        // The GPU copy of the instances holds the thumbnail entities.
+        g_engine->entities.all_changed = true;
+        g_engine->camera = scene_camera;
+        g_engine->occlusion_culling = occlusion_culling;
+
+        const auto batch_end = std::chrono::high_resolution_clock::now();
+        const float batch_duration = std::chrono::duration<float>(batch_end - batch_start).count();
+        info("Rendered thumbnails of {} models in {:.2f}s ({:.1f} models per minute).",
+            rendered, batch_duration, rendered * 60.0f / std::max(batch_duration, 0.001f));
+
+        return rendered;
+    }
+
+    void remove_model(int modelID)
+    {
+        assert(modelID >= 0 && modelID < static_cast<int>(g_engine->models.size()));
+
+        const uint32_t model_index = u32(modelID);
+
+        // Remove all instances which use the model and point the instances
+        // of the models after it at their new index.
+        remove_model_entities(g_engine->entities, model_index);
+
+        // The frames in flight may still be drawing the model so it is only
+        // destroyed once their fences have signalled.
+        const std::string name = g_engine->models[modelID].name;
+        destroy_model_deferred(std::move(g_engine->models[modelID]));
+        g_engine->models.erase(g_engine->models.begin() + modelID);
+        gpu_draws.dirty = true;
+
+        info("Model ({}) removed.", name);
     }
 
     void add_entity(int modelID, float x, float y, float z)
     {
-        Entity entity = create_entity(g_engine->entity_id++, modelID, g_engine->models[modelID].name);
+        create_entity(g_engine->entities, u32(modelID), g_engine->models[modelID].name);
+    }
+
+    void add_stress_test(int modelID, int count)
+    {
+        const Model_Old& model = g_engine->models[modelID];
+
+        // Leave room in instance memory for the instance uploads and draw
+        // commands of the GPU driven path.
+        const std::size_t capacity = g_engine->renderer->instance_allocator.frame_size / sizeof(glm::mat4);
+        const std::size_t max_count = capacity - capacity / 8 - get_entity_count(g_engine->entities);
+        if (static_cast<std::size_t>(count) > max_count) {
+            warn("Stress test clamped from {} to {} instances.", count, max_count);
+            count = static_cast<int>(max_count);
+        }
+
+        const glm::vec3 size = model.bounds.max - model.bounds.min;
+        const float spacing = std::max({ size.x, size.z, 1.0f }) * 1.5f;
+        const int columns = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(count))));
+
+        Entity_Storage& entities = g_engine->entities;
+        reserve_entities(entities, get_entity_count(entities) + count);
+        for (int i = 0; i < count; ++i) {
+            // Logging each entity would dominate the time taken.
+            const uint32_t index = create_entity(entities, u32(modelID), model.name, false);
+
+            const float x = (i % columns - columns / 2) * spacing;
+            const float z = (i / columns - columns / 2) * spacing;
+            set_transform(entities.local_transforms, index, glm::vec3(x, 0.0f, z), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f));
+        }
 
-        g_engine->entities.push_back(entity);
+        info("Added {} instances of {} for stress testing.", count, model.name);
     }
 
-    void remove_instance(int instanceID)
+    void run_transform_benchmark(int count, Transform_Benchmark_Result* result)
     {
-        assert(instanceID >= 0);
+        PROFILE_ZONE("run_transform_benchmark");
 
-        //#define FIND_BY_ID
-#if defined(FIND_BY_ID)
-        const auto it = std::find_if(engine->entities.begin(), engine->entities.end(), [&](Entity& instance)
-            {
-                return instance.id == instanceID;
-            });
+        // The fastest of several runs is kept to reduce noise from other
+        // threads.
+        constexpr int iterations = 16;
 
-        if (it == engine->entities.end())
-        {
-            logger::warning("Unable to find instance with ID of {} to remove", instanceID);
-            return;
+        const std::size_t object_count = static_cast<std::size_t>(std::max(count, 1));
+
+        std::mt19937 generator(1337);
+        std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+        std::uniform_real_distribution<float> rotation(-1.0f, 1.0f);
+        std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+
+        Transform_Components transforms;
+        std::vector<uint32_t> indices(object_count);
+        for (std::size_t i = 0; i < object_count; ++i) {
+            const glm::quat q(rotation(generator), rotation(generator), rotation(generator), rotation(generator));
+
+            add_transform(transforms,
+                glm::vec3(position(generator), position(generator), position(generator)),
+                glm::normalize(q),
+                glm::vec3(scale(generator), scale(generator), scale(generator)));
+
+            indices[i] = u32(i);
         }
 
-        g_engine->entities.erase(it);
-#else
-        g_engine->entities.erase(g_engine->entities.begin() + instanceID);
+        const Bounding_Box box{ glm::vec3(-1.0f), glm::vec3(1.0f) };
+
+        std::vector<glm::mat4> glm_matrices(object_count);
+        std::vector<glm::mat4> batch_matrices(object_count);
+        Cull_Bounds glm_bounds, batch_bounds;
+
+        const auto measure = [](const auto& func) {
+            float best = std::numeric_limits<float>::max();
+            for (int i = 0; i < iterations; ++i) {
+                const auto start = std::chrono::high_resolution_clock::now();
+                func();
+                const auto end = std::chrono::high_resolution_clock::now();
+
+                best = std::min(best, std::chrono::duration<float, std::milli>(end - start).count());
+            }
+
+            return best;
+        };
+
+        // A glm call per object followed by the single box version of
+        // add_bounds as the renderer did before the batch kernels.
+        const float glm_time = measure([&]() {
+            clear_bounds(glm_bounds);
+            for (std::size_t i = 0; i < object_count; ++i) {
+                glm_matrices[i] = glm::translate(glm::mat4(1.0f), get_position(transforms, i)) *
+                    glm::mat4_cast(get_rotation(transforms, i)) *
+                    glm::scale(glm::mat4(1.0f), get_scale(transforms, i));
+
+                add_bounds(glm_bounds, box, glm_matrices[i]);
+            }
+        });
+
+        const float batch_time = measure([&]() {
+            clear_bounds(batch_bounds);
+            compose_transforms(transforms, 0, object_count, batch_matrices.data());
+            add_bounds(batch_bounds, box, batch_matrices.data(), indices.data(), object_count);
+        });
+
+        float max_error = 0.0f;
+        for (std::size_t i = 0; i < object_count; ++i) {
+            for (int column = 0; column < 4; ++column) {
+                for (int row = 0; row < 4; ++row)
+                    max_error = std::max(max_error, std::abs(glm_matrices[i][column][row] - batch_matrices[i][column][row]));
+            }
+
+            max_error = std::max({ max_error,
+                std::abs(glm_bounds.min_x[i] - batch_bounds.min_x[i]),
+                std::abs(glm_bounds.min_y[i] - batch_bounds.min_y[i]),
+                std::abs(glm_bounds.min_z[i] - batch_bounds.min_z[i]),
+                std::abs(glm_bounds.max_x[i] - batch_bounds.max_x[i]),
+                std::abs(glm_bounds.max_y[i] - batch_bounds.max_y[i]),
+                std::abs(glm_bounds.max_z[i] - batch_bounds.max_z[i]) });
+        }
+
+        result->object_count = static_cast<int>(object_count);
+        result->glm_time = glm_time;
+        result->batch_time = batch_time;
+        result->max_error = max_error;
+
+        info("Transform benchmark of {} objects: glm {:.3f}ms, batched {:.3f}ms ({:.1f}x), max error {}.",
+            object_count, glm_time, batch_time, glm_time / std::max(batch_time, 0.0001f), max_error);
+    }
+
+    // Instances are addressed by id from outside the engine as the lazy sort
+    // in update_entity_transforms may move them to other indices at any
+    // update.
+    static uint32_t find_instance_index(int instanceID)
+    {
+        assert(instanceID >= 0);
+
+        const uint32_t index = find_entity(g_engine->entities, u32(instanceID));
+        assert(index != UINT32_MAX);
+
+        return index;
+    }
+
+    int find_instance(int instanceID)
+    {
+        if (instanceID < 0)
+            return -1;
+
+        const uint32_t index = find_entity(g_engine->entities, u32(instanceID));
+
+        return index != UINT32_MAX ? static_cast<int>(index) : -1;
+    }
+
+    void remove_instance(int instanceID)
+    {
+        // The last instance takes the place of the removed one.
+        remove_entity(g_engine->entities, find_instance_index(instanceID));
 
         info("Instance ({}) removed.", instanceID);
-#endif
+    }
+
+    bool set_instance_parent(int instanceID, int parentID)
+    {
+        const uint32_t parent = parentID >= 0 ? find_instance_index(parentID) : no_parent_entity;
+        if (!set_entity_parent(g_engine->entities, find_instance_index(instanceID), parent)) {
+            warn("Instance ({}) cannot be parented to one of its own descendants.", instanceID);
+            return false;
+        }
+
+        return true;
+    }
 
+    int get_instance_parent(int instanceID)
+    {
+        const Entity_Storage& entities = g_engine->entities;
+        const uint32_t parent = entities.parents[find_instance_index(instanceID)];
 
+        return parent != no_parent_entity ? static_cast<int>(entities.ids[parent]) : -1;
     }
 
     int get_instance_id(int instanceIndex)
     {
         assert(instanceIndex >= 0);
 
-        return g_engine->entities[instanceIndex].id;
+        return static_cast<int>(g_engine->entities.ids[instanceIndex]);
     }
 
     const char* get_instance_name(int instanceIndex)
     {
         assert(instanceIndex >= 0);
 
-        return g_engine->entities[instanceIndex].name.c_str();
+        return g_engine->entities.names[instanceIndex].c_str();
     }
 
-    void get_entity_matrix(int instance_index, float* matrix)
+    // Applies pending transform changes and returns the index of the instance
+    // afterwards as the update may reorder the entities.
+    static uint32_t update_transforms_and_find(int instanceID)
     {
-        assert(instance_index >= 0);
+        update_entity_transforms(g_engine->entities);
+
+        return find_instance_index(instanceID);
+    }
 
-        const Entity& entity = g_engine->entities[instance_index];
+    void get_entity_matrix(int instanceID, float* matrix)
+    {
+        // The matrix is in world space so pending changes are applied first.
+        const uint32_t index = update_transforms_and_find(instanceID);
+        const glm::mat4& transform = g_engine->entities.world_transforms[index];
 
-        matrix[0] = entity.matrix[0][0];
-        matrix[1] = entity.matrix[0][1];
-        matrix[2] = entity.matrix[0][2];
-        matrix[3] = entity.matrix[0][3];
+        matrix[0] = transform[0][0];
+        matrix[1] = transform[0][1];
+        matrix[2] = transform[0][2];
+        matrix[3] = transform[0][3];
 
-        matrix[4] = entity.matrix[1][0];
-        matrix[5] = entity.matrix[1][1];
-        matrix[6] = entity.matrix[1][2];
-        matrix[7] = entity.matrix[1][3];
+        matrix[4] = transform[1][0];
+        matrix[5] = transform[1][1];
+        matrix[6] = transform[1][2];
+        matrix[7] = transform[1][3];
 
-        matrix[8] = entity.matrix[2][0];
-        matrix[9] = entity.matrix[2][1];
-        matrix[10] = entity.matrix[2][2];
-        matrix[11] = entity.matrix[2][3];
+        matrix[8] = transform[2][0];
+        matrix[9] = transform[2][1];
+        matrix[10] = transform[2][2];
+        matrix[11] = transform[2][3];
 
-        matrix[12] = entity.matrix[3][0];
-        matrix[13] = entity.matrix[3][1];
-        matrix[14] = entity.matrix[3][2];
-        matrix[15] = entity.matrix[3][3];
+        matrix[12] = transform[3][0];
+        matrix[13] = transform[3][1];
+        matrix[14] = transform[3][2];
+        matrix[15] = transform[3][3];
     }
 
-    void set_entity_matrix(int instance_index, const float* matrix)
+    void set_entity_matrix(int instanceID, const float* matrix)
     {
-        Entity& entity = g_engine->entities[instance_index];
+        glm::mat4 transform;
+
+        transform[0][0] = matrix[0];
+        transform[0][1] = matrix[1];
+        transform[0][2] = matrix[2];
+        transform[0][3] = matrix[3];
 
-        entity.matrix[0][0] = matrix[0];
-        entity.matrix[0][1] = matrix[1];
-        entity.matrix[0][2] = matrix[2];
-        entity.matrix[0][3] = matrix[3];
+        transform[1][0] = matrix[4];
+        transform[1][1] = matrix[5];
+        transform[1][2] = matrix[6];
+        transform[1][3] = matrix[7];
 
-        entity.matrix[1][0] = matrix[4];
-        entity.matrix[1][1] = matrix[5];
-        entity.matrix[1][2] = matrix[6];
-        entity.matrix[1][3] = matrix[7];
+        transform[2][0] = matrix[8];
+        transform[2][1] = matrix[9];
+        transform[2][2] = matrix[10];
+        transform[2][3] = matrix[11];
 
-        entity.matrix[2][0] = matrix[8];
-        entity.matrix[2][1] = matrix[9];
-        entity.matrix[2][2] = matrix[10];
-        entity.matrix[2][3] = matrix[11];
+        transform[3][0] = matrix[12];
+        transform[3][1] = matrix[13];
+        transform[3][2] = matrix[14];
+        transform[3][3] = matrix[15];
 
-        entity.matrix[3][0] = matrix[12];
-        entity.matrix[3][1] = matrix[13];
-        entity.matrix[3][2] = matrix[14];
-        entity.matrix[3][3] = matrix[15];
+        const uint32_t index = update_transforms_and_find(instanceID);
+        set_entity_world_transform(g_engine->entities, index, transform);
     }
 
-    void set_instance_position(int instanceIndex, float x, float y, float z)
+    void set_instance_position(int instanceID, float x, float y, float z)
     {
-        assert(instanceIndex >= 0);
-
-        translate_entity(g_engine->entities[instanceIndex], glm::vec3(x, y, z));
+        translate_entity(g_engine->entities, find_instance_index(instanceID), glm::vec3(x, y, z));
     }
 
-    void set_instance_rotation(int instanceIndex, float x, float y, float z)
+    void set_instance_rotation(int instanceID, float x, float y, float z)
     {
-        assert(instanceIndex >= 0);
-
-        rotate_entity(g_engine->entities[instanceIndex], glm::vec3(x, y, z));
+        rotate_entity(g_engine->entities, find_instance_index(instanceID), glm::vec3(x, y, z));
     }
 
 
-    void set_instance_scale(int instanceIndex, float scale)
+    void set_instance_scale(int instanceID, float scale)
     {
-        assert(instanceIndex >= 0);
-
-        scale_entity(g_engine->entities[instanceIndex], scale);
+        scale_entity(g_engine->entities, find_instance_index(instanceID), scale);
     }
 
-    void set_instance_scale(int instanceIndex, float x, float y, float z)
+    void set_instance_scale(int instanceID, float x, float y, float z)
     {
-        assert(instanceIndex >= 0);
-
-        scale_entity(g_engine->entities[instanceIndex], glm::vec3(x, y, z));
+        scale_entity(g_engine->entities, find_instance_index(instanceID), glm::vec3(x, y, z));
     }
 
 
     void set_environment_map(const char* path)
     {
-        assert(!g_engine->using_skybox);
+        Model_Old environment{};
 
-        // todo: continue from here
-        bool model_loaded = load_model(skybox_model, path, true);
+        bool model_loaded = load_model(environment, path, true);
         if (!model_loaded) {
-            error("Failed to load environment model/texture: {}.", skybox_model.path);
+            error("Failed to load environment model/texture: {}.", environment.path);
             return;
         }
 
-        upload_model_to_gpu(skybox_model, material_ds_layout, material_ds_binding);
+        upload_model_to_gpu(environment, material_ds_layout, material_ds_binding);
+
+        // The previous environment is kept alive until the frames drawing it
+        // have finished.
+        if (g_engine->using_skybox)
+            destroy_model_deferred(std::move(skybox_model));
 
+        skybox_model = std::move(environment);
 
         g_engine->using_skybox = true;
     }
@@ -919,6 +3115,11 @@ namespace engine {
         g_engine->camera = create_camera({ 0.0f, 2.0f, -2.0f }, fovy, speed);
     }
 
+    void frame_camera_to_model(int modelID, float azimuth, float elevation)
+    {
+        frame_camera_to_bounds(g_engine->camera, g_engine->models[modelID].bounds, glm::radians(azimuth), glm::radians(elevation));
+    }
+
     void update_input()
     {
         perspective_camera& camera = g_engine->camera;
@@ -1002,6 +3203,11 @@ namespace engine {
 
     void enable_ui()
     {
+        if (!g_engine->window) {
+            warn("Unable to enable the UI without a window.");
+            return;
+        }
+
         const glm::u32vec2 size = get_window_size(g_engine->window);
 
         add_framebuffer_attachment(ui_pass,
@@ -1017,14 +3223,10 @@ namespace engine {
         for (std::size_t i = 0; i < get_swapchain_image_count(); ++i)
             viewport_ui.push_back(ImGui_ImplVulkan_AddTexture(g_framebuffer_sampler, viewport[i].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
 
-        // Create descriptor sets for g-buffer images for UI
-        for (std::size_t i = 0; i < positions.size(); ++i) {
-            positions_ui.push_back(ImGui_ImplVulkan_AddTexture(g_framebuffer_sampler, positions[i].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
-            normals_ui.push_back(ImGui_ImplVulkan_AddTexture(g_framebuffer_sampler, normals[i].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
-            colors_ui.push_back(ImGui_ImplVulkan_AddTexture(g_framebuffer_sampler, colors[i].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
-            speculars_ui.push_back(ImGui_ImplVulkan_AddTexture(g_framebuffer_sampler, speculars[i].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+        // The other g-buffer views are decoded by the lighting pass into the
+        // viewport image so only depth needs its own UI texture.
+        for (std::size_t i = 0; i < depths.size(); ++i)
             depths_ui.push_back(ImGui_ImplVulkan_AddTexture(g_framebuffer_sampler, depths[i].view, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL));
-        }
 
         ui_cmd_buffer = create_command_buffers();
     }
@@ -1036,13 +3238,24 @@ namespace engine {
 
     void begin_ui_pass()
     {
+        PROFILE_ZONE("begin_ui_pass");
+
+        if (!g_engine->ui_pass_enabled)
+            return;
+
         begin_command_buffer(ui_cmd_buffer);
+        ui_scope = begin_gpu_scope(gpu_profiler, ui_cmd_buffer, "UI");
         begin_render_pass(ui_cmd_buffer, ui_pass);
         begin_ui();
     }
 
     void end_ui_pass()
     {
+        PROFILE_ZONE("end_ui_pass");
+
+        if (!g_engine->ui_pass_enabled)
+            return;
+
 #if 0
         static float scale = 1.0f;
         //visualise_node(quad_tree->root_node, scale);
@@ -1064,29 +3277,40 @@ namespace engine {
 
         end_ui(ui_cmd_buffer);
         end_render_pass(ui_cmd_buffer);
+        end_gpu_scope(gpu_profiler, ui_cmd_buffer, ui_scope);
         end_command_buffer(ui_cmd_buffer);
     }
 
-    void* get_viewport_texture(Viewport_View view)
+    void set_viewport_view(Viewport_View view)
+    {
+        viewport_view = view;
+    }
+
+    void* get_viewport_texture()
     {
         const uint32_t current_image = get_frame_image_index();
 
-        if (view == Viewport_View::full)
-            return viewport_ui[current_image];
-        else if (view == Viewport_View::colors)
-            return colors_ui[current_image];
-        else if (view == Viewport_View::positions)
-            return positions_ui[current_image];
-        else if (view == Viewport_View::normals)
-            return normals_ui[current_image];
-        else if (view == Viewport_View::specular)
-            return speculars_ui[current_image];
-        else if (view == Viewport_View::depth)
+        if (viewport_view == Viewport_View::depth)
             return depths_ui[current_image];
 
         return viewport_ui[current_image];
     }
 
+    void set_render_size(int width, int height)
+    {
+        // Only the viewport and scissor change so resizing every frame while
+        // the window is being dragged costs nothing.
+        render_size.width = std::min(u32(std::max(width, 1)), framebuffer_size.width);
+        render_size.height = std::min(u32(std::max(height, 1)), framebuffer_size.height);
+    }
+
+    void get_viewport_uv(float* u, float* v)
+    {
+        const VkExtent2D extent = get_render_extent(composite_pass);
+        *u = static_cast<float>(extent.width) / static_cast<float>(framebuffer_size.width);
+        *v = static_cast<float>(extent.height) / static_cast<float>(framebuffer_size.height);
+    }
+
     int get_model_count()
     {
         return static_cast<int>(g_engine->models.size());
@@ -1094,7 +3318,7 @@ namespace engine {
 
     int get_instance_count()
     {
-        return static_cast<int>(g_engine->entities.size());
+        return static_cast<int>(get_entity_count(g_engine->entities));
     }
 
     const char* get_model_name(int modelID)
@@ -1127,10 +3351,30 @@ namespace engine {
 
     void get_memory_status(float* memoryUsage, unsigned int* maxMemory)
     {
+#if defined(_WIN32)
         const MEMORYSTATUSEX memoryStatus = get_windows_memory_status();
 
         *memoryUsage = memoryStatus.dwMemoryLoad / 100.0f;
         *maxMemory = static_cast<int>(memoryStatus.ullTotalPhys / 1'000'000'000);
+#elif defined(__linux__)
+        // Memory used by the page cache counts as free here while Windows
+        // counts it as used so the two loads are not directly comparable.
+        struct sysinfo memoryStatus{};
+        if (sysinfo(&memoryStatus) != 0 || memoryStatus.totalram == 0) {
+            *memoryUsage = 0.0f;
+            *maxMemory = 0;
+            return;
+        }
+
+        const uint64_t total = static_cast<uint64_t>(memoryStatus.totalram) * memoryStatus.mem_unit;
+        const uint64_t free = static_cast<uint64_t>(memoryStatus.freeram) * memoryStatus.mem_unit;
+
+        *memoryUsage = static_cast<float>(total - free) / static_cast<float>(total);
+        *maxMemory = static_cast<unsigned int>(total / 1'000'000'000);
+#else
+        *memoryUsage = 0.0f;
+        *maxMemory = 0;
+#endif
     }
 
     const char* display_file_explorer(const char* path)
@@ -1329,74 +3573,4 @@ namespace engine {
         dispatcher.dispatch<window_dropped_event>(dropped_window);
     }
 
-
-
-    // The viewport must resize before rendering to texture. If it were
-    // to resize within the UI functions then we would be attempting to
-    // recreate resources using a new size before submitting to the GPU
-    // which causes an error. Need to figure out how to do this properly.
-#if 0
-    if (resize_viewport)
-    {
-        VkExtent2D size{};
-        size.width = viewport_size.x;
-        size.height = viewport_size.y;
-
-        UpdateProjection(engine->camera, size.width, size.height);
-
-        WaitForGPU();
-
-        // TODO: You would think that resizing is easy.... Yet, there seems to
-        // be multiple issues such as stuttering, and image layout being 
-        // undefined. Needs to be fixed.
-#if 0
-        ResizeFramebuffer(offscreenPass, size);
-        ResizeFramebuffer(compositePass, size);
-
-        // TODO: update all image buffer descriptor sets
-        positions = AttachmentsToImages(offscreenPass.attachments, 0);
-        normals = AttachmentsToImages(offscreenPass.attachments, 1);
-        colors = AttachmentsToImages(offscreenPass.attachments, 2);
-        speculars = AttachmentsToImages(offscreenPass.attachments, 3);
-        depths = AttachmentsToImages(offscreenPass.attachments, 4);
-
-        viewport = AttachmentsToImages(compositePass.attachments, 0);
-
-        std::vector<VkDescriptorSetLayoutBinding> compositeBindings
-        {
-            { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT },
-            { 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT },
-            { 2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT },
-            { 3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT },
-            { 4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT },
-        };
-        UpdateBinding(compositeSets, compositeBindings[0], positions, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, gFramebufferSampler);
-        UpdateBinding(compositeSets, compositeBindings[1], normals, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, gFramebufferSampler);
-        UpdateBinding(compositeSets, compositeBindings[2], colors, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, gFramebufferSampler);
-        UpdateBinding(compositeSets, compositeBindings[3], speculars, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, gFramebufferSampler);
-        UpdateBinding(compositeSets, compositeBindings[4], depths, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, gFramebufferSampler);
-
-        // Create descriptor sets for g-buffer images for UI
-
-
-        // TODO: Causes stuttering for some reason
-        // This is related to the order, creating the textures the other way seemed
-        // to fix it...
-        for (auto& image : viewport)
-            RecreateUITexture(viewportUI, image.view, gFramebufferSampler);
-
-        for (std::size_t i = 0; i < GetSwapchainImageCount(); ++i)
-        {
-            RecreateUITexture(positionsUI, positions[i].view, gFramebufferSampler);
-            RecreateUITexture(normalsUI, normals[i].view, gFramebufferSampler);
-            RecreateUITexture(colorsUI, colors[i].view, gFramebufferSampler);
-            RecreateUITexture(specularsUI, speculars[i].view, gFramebufferSampler);
-            RecreateUITexture(depthsUI, depths[i].view, gFramebufferSampler, true);
-        }
-#endif
-
-        resize_viewport = false;
-    }
-#endif
-
 }
@@ -10,10 +10,16 @@
 #include <fstream>
 #include <sstream>
 #include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
 #include <optional>
 #include <array>
 #include <filesystem>
 #include <set>
+#include <unordered_map>
+#include <deque>
+#include <numeric>
 #include <expected>
 
 // ensures that external code that calls vulkan.h does not give us symbol
@@ -40,7 +46,9 @@
 
 #include <volk.h>
 #include <vk_mem_alloc.h>
+#if defined(MY_ENGINE_COMPILE_SHADERS)
 #include <shaderc/shaderc.h>
+#endif
 
 #include <GLFW/glfw3.h>
 #include <GLFW/glfw3native.h>
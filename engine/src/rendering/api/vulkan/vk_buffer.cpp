@@ -4,21 +4,23 @@
 #include "vk_renderer.h"
 
 namespace engine {
+    static VkDeviceSize align_up(VkDeviceSize size, VkDeviceSize alignment)
+    {
+        // Vulkan guarantees that all alignment limits are a power of two.
+        if (alignment == 0)
+            return size;
+
+        return (size + alignment - 1) & ~(alignment - 1);
+    }
+
     VkDeviceSize pad_uniform_buffer_size(VkDeviceSize original_size)
     {
         const vk_context& context = get_vulkan_context();
 
         // Get GPU minimum uniform buffer alignment
-        VkPhysicalDeviceProperties properties{};
-        vkGetPhysicalDeviceProperties(context.device->gpu, &properties);
+        const VkDeviceSize min_ubo_alignment = context.device->properties.limits.minUniformBufferOffsetAlignment;
 
-        VkDeviceSize minUboAlignment = properties.limits.minUniformBufferOffsetAlignment;
-
-        if (minUboAlignment < 0)
-            return original_size;
-
-        // TODO: Figure out how this works
-        return (original_size + minUboAlignment - 1) & ~(minUboAlignment - 1);
+        return align_up(original_size, min_ubo_alignment);
     }
 
     Vk_Buffer create_buffer(VkDeviceSize size, VkBufferUsageFlags type)
@@ -33,17 +35,20 @@ namespace engine {
 
         VmaAllocationCreateInfo alloc_info{};
         alloc_info.usage = VMA_MEMORY_USAGE_AUTO;
-        alloc_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+        alloc_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+            VMA_ALLOCATION_CREATE_MAPPED_BIT;
 
+        VmaAllocationInfo allocation_info{};
         vk_check(vmaCreateBuffer(rc.allocator,
             &buffer_info,
             &alloc_info,
             &buffer.buffer,
             &buffer.allocation,
-            nullptr));
+            &allocation_info));
 
         buffer.usage = buffer_info.usage;
-        buffer.size = u32(buffer_info.size);
+        buffer.size = buffer_info.size;
+        buffer.mapped = allocation_info.pMappedData;
 
         return buffer;
     }
@@ -51,7 +56,7 @@ namespace engine {
     Vk_Buffer create_uniform_buffer(VkDeviceSize buffer_size)
     {
         // Automatically align buffer to correct alignment
-        const VkDeviceSize size = static_cast<VkDeviceSize>(frames_in_flight) * pad_uniform_buffer_size(buffer_size);
+        const VkDeviceSize size = static_cast<VkDeviceSize>(max_frames_in_flight) * pad_uniform_buffer_size(buffer_size);
 
         Vk_Buffer buffer = create_buffer(size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
 
@@ -60,7 +65,7 @@ namespace engine {
 
     std::vector<Vk_Buffer> create_uniform_buffers(VkDeviceSize buffer_size)
     {
-        std::vector<Vk_Buffer> buffers(frames_in_flight);
+        std::vector<Vk_Buffer> buffers(max_frames_in_flight);
 
         for (Vk_Buffer& buffer : buffers) {
             buffer = create_uniform_buffer(buffer_size);
@@ -69,40 +74,32 @@ namespace engine {
         return buffers;
     }
 
-    // Maps/Fills an existing buffer with data.
+    // Fills an existing buffer with data. All host visible buffers are
+    // persistently mapped so this is nothing more than a memcpy.
     void set_buffer_data(std::vector<Vk_Buffer>& buffers, void* data)
     {
-        const vk_context& rc = get_vulkan_context();
-
         const uint32_t current_frame = get_frame_buffer_index();
 
-        void* allocation{};
-        vk_check(vmaMapMemory(rc.allocator, buffers[current_frame].allocation, &allocation));
-        std::memcpy(allocation, data, buffers[current_frame].size);
-        vmaUnmapMemory(rc.allocator, buffers[current_frame].allocation);
+        set_buffer_data(buffers[current_frame], data);
     }
 
     void set_buffer_data(Vk_Buffer& buffer, void* data)
     {
-        const vk_context& rc = get_vulkan_context();
+        assert(buffer.mapped && "Buffer is not host visible");
 
-        void* allocation{};
-        vk_check(vmaMapMemory(rc.allocator, buffer.allocation, &allocation));
-        std::memcpy(allocation, data, buffer.size);
-        vmaUnmapMemory(rc.allocator, buffer.allocation);
+        std::memcpy(buffer.mapped, data, buffer.size);
     }
 
 
     void set_buffer_data(Vk_Buffer& buffer, void* data, std::size_t size)
     {
-        const vk_context& rc = get_vulkan_context();
+        assert(buffer.mapped && "Buffer is not host visible");
+
         const uint32_t current_frame = get_frame_buffer_index();
 
-        char* allocation{};
-        vk_check(vmaMapMemory(rc.allocator, buffer.allocation, (void**)&allocation));
+        char* allocation = static_cast<char*>(buffer.mapped);
         allocation += pad_uniform_buffer_size(size) * current_frame;
         std::memcpy(allocation, data, size);
-        vmaUnmapMemory(rc.allocator, buffer.allocation);
     }
 
     // Creates and fills a buffer that is CPU accessible. A staging
@@ -123,15 +120,17 @@ namespace engine {
         alloc_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
             VMA_ALLOCATION_CREATE_MAPPED_BIT;
 
+        VmaAllocationInfo allocation_info{};
         vk_check(vmaCreateBuffer(rc.allocator,
             &buffer_info,
             &alloc_info,
             &buffer.buffer,
             &buffer.allocation,
-            nullptr));
+            &allocation_info));
 
         buffer.usage = buffer_info.usage;
         buffer.size = buffer_info.size;
+        buffer.mapped = allocation_info.pMappedData;
 
         set_buffer_data(buffer, data);
 
@@ -167,6 +166,39 @@ namespace engine {
         return buffer;
     }
 
+    // Creates a persistently mapped buffer that the GPU writes to and the CPU
+    // reads from. Unlike other host visible buffers this prefers cached memory
+    // as reading from write-combined memory is extremely slow.
+    Vk_Buffer create_readback_buffer(VkDeviceSize size, VkBufferUsageFlags type)
+    {
+        Vk_Buffer buffer{};
+
+        const vk_context& rc = get_vulkan_context();
+
+        VkBufferCreateInfo buffer_info{ VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+        buffer_info.size = size;
+        buffer_info.usage = type | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+        VmaAllocationCreateInfo alloc_info{};
+        alloc_info.usage = VMA_MEMORY_USAGE_AUTO;
+        alloc_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+            VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+        VmaAllocationInfo allocation_info{};
+        vk_check(vmaCreateBuffer(rc.allocator,
+            &buffer_info,
+            &alloc_info,
+            &buffer.buffer,
+            &buffer.allocation,
+            &allocation_info));
+
+        buffer.usage = buffer_info.usage;
+        buffer.size = buffer_info.size;
+        buffer.mapped = allocation_info.pMappedData;
+
+        return buffer;
+    }
+
     void destroy_buffer(Vk_Buffer& buffer)
     {
         const vk_context& rc = get_vulkan_context();
@@ -182,4 +214,64 @@ namespace engine {
             vmaDestroyBuffer(rc.allocator, buffer.buffer, buffer.allocation);
     }
 
+    // Creates a single persistently mapped buffer large enough to hold
+    // frame_size bytes for every frame in flight.
+    Vk_Frame_Allocator create_frame_allocator(VkDeviceSize frame_size, VkBufferUsageFlags type)
+    {
+        Vk_Frame_Allocator allocator{};
+
+        const vk_context& rc = get_vulkan_context();
+        const VkPhysicalDeviceLimits& limits = rc.device->properties.limits;
+
+        // Every allocation must satisfy the offset alignment of any descriptor
+        // type that the buffer may be bound as.
+        VkDeviceSize alignment = 16;
+        if (type & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
+            alignment = std::max(alignment, limits.minUniformBufferOffsetAlignment);
+        if (type & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+            alignment = std::max(alignment, limits.minStorageBufferOffsetAlignment);
+
+        allocator.alignment = alignment;
+        allocator.frame_size = align_up(frame_size, alignment);
+        allocator.buffer = create_buffer(allocator.frame_size * max_frames_in_flight, type);
+
+        return allocator;
+    }
+
+    void destroy_frame_allocator(Vk_Frame_Allocator& allocator)
+    {
+        destroy_buffer(allocator.buffer);
+    }
+
+    // Must only be called once the GPU has finished using the memory of the
+    // frame that is being reset i.e. after waiting on that frames fence.
+    void reset_frame_allocator(Vk_Frame_Allocator& allocator, uint32_t frame_index)
+    {
+        allocator.begin = allocator.frame_size * frame_index;
+        allocator.offset = allocator.begin;
+    }
+
+    bool allocate_frame_memory(Vk_Frame_Allocator& allocator, VkDeviceSize size, Vk_Buffer_Slice& slice)
+    {
+        slice = Vk_Buffer_Slice{};
+
+        const VkDeviceSize aligned_size = align_up(size, allocator.alignment);
+        if (allocator.offset + aligned_size > allocator.begin + allocator.frame_size) {
+            if (!allocator.out_of_memory_reported) {
+                error("Frame allocator out of memory ({} bytes requested, {} bytes per frame).", size, allocator.frame_size);
+                allocator.out_of_memory_reported = true;
+            }
+
+            return false;
+        }
+
+        slice.buffer = allocator.buffer.buffer;
+        slice.offset = allocator.offset;
+        slice.size = size;
+        slice.data = static_cast<char*>(allocator.buffer.mapped) + allocator.offset;
+
+        allocator.offset += aligned_size;
+
+        return true;
+    }
 }
@@ -10,6 +10,35 @@ namespace engine {
         VmaAllocation      allocation = nullptr;
         VkBufferUsageFlags usage;
         VkDeviceSize       size;
+
+        // Host visible buffers are persistently mapped for their entire
+        // lifetime. This is null for buffers that live in GPU only memory.
+        void*              mapped = nullptr;
+    };
+
+    // A sub-range of a buffer handed out by a frame allocator. The offset is
+    // what gets passed as a dynamic offset when binding a descriptor set.
+    struct Vk_Buffer_Slice
+    {
+        VkBuffer     buffer = nullptr;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        void*        data = nullptr;
+    };
+
+    // A linear allocator over a single persistently mapped buffer that is
+    // split into one region per frame in flight. Each frame simply bumps an
+    // offset and the region is reset once the GPU has finished with it.
+    struct Vk_Frame_Allocator
+    {
+        Vk_Buffer    buffer;
+        VkDeviceSize frame_size = 0;
+        VkDeviceSize alignment = 0;
+        VkDeviceSize begin = 0;
+        VkDeviceSize offset = 0;
+
+        // Running out is reported once rather than on every frame.
+        bool         out_of_memory_reported = false;
     };
 
     VkDeviceSize pad_uniform_buffer_size(VkDeviceSize original_size);
@@ -20,6 +49,7 @@ namespace engine {
 
     Vk_Buffer create_staging_buffer(void* data, VkDeviceSize size);
     Vk_Buffer create_gpu_buffer(VkDeviceSize size, VkBufferUsageFlags type);
+    Vk_Buffer create_readback_buffer(VkDeviceSize size, VkBufferUsageFlags type);
 
     void set_buffer_data(std::vector<Vk_Buffer>& buffers, void* data);
     void set_buffer_data(Vk_Buffer& buffer, void* data);
@@ -29,6 +59,13 @@ namespace engine {
     void destroy_buffer(Vk_Buffer& buffer);
     void destroy_buffers(std::vector<Vk_Buffer>& buffers);
 
+    Vk_Frame_Allocator create_frame_allocator(VkDeviceSize frame_size, VkBufferUsageFlags type);
+    void destroy_frame_allocator(Vk_Frame_Allocator& allocator);
+    void reset_frame_allocator(Vk_Frame_Allocator& allocator, uint32_t frame_index);
+
+    // Returns false and leaves slice empty if the frame's region is full.
+    // Callers must check the result before writing to the slice.
+    bool allocate_frame_memory(Vk_Frame_Allocator& allocator, VkDeviceSize size, Vk_Buffer_Slice& slice);
 
 }
 
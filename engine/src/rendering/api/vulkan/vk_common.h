@@ -3,8 +3,10 @@
 
 
 namespace engine {
-    // todo(zak): move this variable into the renderer
-    constexpr uint32_t frames_in_flight = 2;
+    // Per-frame resources are created for this many frames. The number of
+    // frames the CPU may actually queue ahead of the GPU is set at runtime
+    // using set_frame_in_flight_count.
+    constexpr uint32_t max_frames_in_flight = 3;
 
 #define vk_check(function)                                                  \
     if (function != VK_SUCCESS) {                                           \
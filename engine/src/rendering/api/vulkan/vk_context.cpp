@@ -9,7 +9,8 @@ namespace engine {
     static VkInstance create_instance(uint32_t version,
         std::string_view app_name,
         const std::vector<const char*>& req_layers,
-        std::vector<const char*>& req_extensions)
+        std::vector<const char*>& req_extensions,
+        bool with_surface)
     {
         VkInstance instance{};
 
@@ -55,12 +56,16 @@ namespace engine {
         }
 
         // get instance extensions
-        uint32_t glfw_count = 0;
-        const char* const* glfwExtensions = glfwGetRequiredInstanceExtensions(&glfw_count);
-
-        // convert glfw extensions to a vector and combine glfw extensions with requested extensions
-        std::vector<const char*> glfw_extensions(glfwExtensions, glfwExtensions + glfw_count);
-        req_extensions.insert(req_extensions.end(), glfw_extensions.begin(), glfw_extensions.end());
+        // A headless instance has no surface and therefore does not need the
+        // surface extensions glfw asks for.
+        if (with_surface) {
+            uint32_t glfw_count = 0;
+            const char* const* glfwExtensions = glfwGetRequiredInstanceExtensions(&glfw_count);
+
+            // convert glfw extensions to a vector and combine glfw extensions with requested extensions
+            std::vector<const char*> glfw_extensions(glfwExtensions, glfwExtensions + glfw_count);
+            req_extensions.insert(req_extensions.end(), glfw_extensions.begin(), glfw_extensions.end());
+        }
 
         if (!req_extensions.empty()) {
             info("Requesting a total of {} instance extensions.", req_extensions.size());
@@ -158,8 +163,14 @@ namespace engine {
                     graphics_queue_index = j;
 
                 // Check if the current queue can support our newly created surface.
-                vk_check(vkGetPhysicalDeviceSurfaceSupportKHR(gpus[i], j, surface,
-                    &present_supported));
+                // Without a surface nothing is presented so the graphics queue
+                // doubles as the present queue.
+                if (surface) {
+                    vk_check(vkGetPhysicalDeviceSurfaceSupportKHR(gpus[i], j, surface,
+                        &present_supported));
+                } else {
+                    present_supported = graphics_queue_index.has_value();
+                }
 
                 if (present_supported)
                     present_queue_index = j;
@@ -212,24 +223,29 @@ namespace engine {
             // is just as important since we cannot use a GPU that does not support
             // features that the engine needs.
 
-            // TODO: Need to handle case where there might be multiple Vulkan supported GPUs
-            // and that none of them are discrete.
+            // Prefer a discrete GPU but fall back to the first suitable one
+            // since machines such as CI runners may only expose integrated or
+            // software implementations.
+            std::size_t selected = 0;
             for (std::size_t i = 0; i < suitable_gpus.size(); ++i) {
                 if (suitable_gpus[i].properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-                    const GPUInfo& info = suitable_gpus[i];
-
-                    device->gpu = info.gpu;
-                    device->gpu_name = suitable_gpu_names[i];
-                    device->graphics_index = info.graphics_index;
-                    device->present_index = info.present_index;
-
+                    selected = i;
                     break;
                 }
             }
+
+            const GPUInfo& info = suitable_gpus[selected];
+
+            device->gpu = info.gpu;
+            device->gpu_name = suitable_gpu_names[selected];
+            device->graphics_index = info.graphics_index;
+            device->present_index = info.present_index;
         }
 
         info("Selected GPU: {}", device->gpu_name);
 
+        vkGetPhysicalDeviceProperties(device->gpu, &device->properties);
+
         // create a logical device from a physical device
         std::vector<VkDeviceQueueCreateInfo> queue_infos{};
         const std::set<uint32_t> unique_queues{ device->graphics_index, device->present_index };
@@ -271,7 +287,58 @@ namespace engine {
         device_info.pQueueCreateInfos = queue_infos.data();
         device_info.enabledExtensionCount = u32(device_extensions.size());
         device_info.ppEnabledExtensionNames = device_extensions.data();
-        device_info.pEnabledFeatures = &features;
+
+        // Query and enable optional features. These are not part of the
+        // requested features since the engine can run without them.
+        VkPhysicalDeviceVulkan12Features supported_features_12{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+        VkPhysicalDeviceFeatures2 supported_features{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+        supported_features.pNext = &supported_features_12;
+        vkGetPhysicalDeviceFeatures2(device->gpu, &supported_features);
+
+        VkPhysicalDeviceVulkan12Features enabled_features_12{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+        enabled_features_12.drawIndirectCount = supported_features_12.drawIndirectCount;
+
+        // Descriptor indexing features required for bindless materials.
+        const bool descriptor_indexing = supported_features_12.runtimeDescriptorArray &&
+            supported_features_12.descriptorBindingPartiallyBound &&
+            supported_features_12.descriptorBindingSampledImageUpdateAfterBind &&
+            supported_features_12.descriptorBindingUpdateUnusedWhilePending &&
+            supported_features.features.shaderSampledImageArrayDynamicIndexing;
+
+        enabled_features_12.runtimeDescriptorArray = descriptor_indexing;
+        enabled_features_12.descriptorBindingPartiallyBound = descriptor_indexing;
+        enabled_features_12.descriptorBindingSampledImageUpdateAfterBind = descriptor_indexing;
+        enabled_features_12.descriptorBindingUpdateUnusedWhilePending = descriptor_indexing;
+
+        VkPhysicalDeviceFeatures2 enabled_features{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+        enabled_features.pNext = &enabled_features_12;
+        enabled_features.features = features;
+        enabled_features.features.drawIndirectFirstInstance = supported_features.features.drawIndirectFirstInstance;
+        enabled_features.features.shaderSampledImageArrayDynamicIndexing |= descriptor_indexing;
+
+        device->draw_indirect_count = enabled_features_12.drawIndirectCount &&
+            enabled_features.features.drawIndirectFirstInstance;
+
+        if (!device->draw_indirect_count)
+            warn("GPU ({}): Indirect count drawing not supported.", device->gpu_name);
+
+        // The number of textures in a bindless array is limited by how many
+        // update after bind samplers a single stage can access.
+        VkPhysicalDeviceVulkan12Properties properties_12{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES };
+        VkPhysicalDeviceProperties2 properties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+        properties.pNext = &properties_12;
+        vkGetPhysicalDeviceProperties2(device->gpu, &properties);
+
+        device->descriptor_indexing = descriptor_indexing;
+        device->max_bindless_textures = std::min(properties_12.maxPerStageDescriptorUpdateAfterBindSamplers,
+            properties_12.maxDescriptorSetUpdateAfterBindSampledImages);
+
+        if (!device->descriptor_indexing)
+            warn("GPU ({}): Descriptor indexing not supported.", device->gpu_name);
+
+        // When using VkPhysicalDeviceFeatures2 the core features are passed
+        // through the pNext chain instead of pEnabledFeatures.
+        device_info.pNext = &enabled_features;
 
         vk_check(vkCreateDevice(device->gpu, &device_info, nullptr, &device->device));
 
@@ -341,8 +408,15 @@ namespace engine {
         if (vulkan_version & VK_API_VERSION_1_3)
             info("Requesting Vulkan version 1.3.");
 
+        // A null window creates a headless context without a surface.
+        const bool headless = window == nullptr;
+
         context.window = window;
-        context.instance = create_instance(vulkan_version, get_window_name(window), requested_layers, requested_extensions);
+        context.instance = create_instance(vulkan_version,
+            headless ? "Headless" : get_window_name(window),
+            requested_layers,
+            requested_extensions,
+            !headless);
         if (!context.instance) {
             error("Failed to create Vulkan instance.");
 
@@ -351,10 +425,12 @@ namespace engine {
 
         volkLoadInstanceOnly(context.instance);
 
-        context.surface = create_surface(context.instance, get_window_handle(window));
-        if (!context.surface) {
-            error("Failed to create Vulkan surface.");
-            return false;
+        if (!headless) {
+            context.surface = create_surface(context.instance, get_window_handle(window));
+            if (!context.surface) {
+                error("Failed to create Vulkan surface.");
+                return false;
+            }
         }
 
         context.device = create_device(context.instance, context.surface,
@@ -396,7 +472,8 @@ namespace engine {
         vkDestroyDevice(rc.device->device, nullptr);
         delete rc.device;
 
-        vkDestroySurfaceKHR(rc.instance, rc.surface, nullptr);
+        if (rc.surface)
+            vkDestroySurfaceKHR(rc.instance, rc.surface, nullptr);
 
         vkDestroyInstance(rc.instance, nullptr);
     }
@@ -10,6 +10,16 @@ namespace engine {
         std::string gpu_name;
         VkDevice device;
 
+        // Cached once at device creation so that hot paths such as uniform
+        // buffer alignment do not need to query the driver every call.
+        VkPhysicalDeviceProperties properties;
+
+        // Optional features that are only enabled when the GPU supports them.
+        // Systems that depend on these must provide a fallback path.
+        bool draw_indirect_count;
+        bool descriptor_indexing;
+        uint32_t max_bindless_textures;
+
         VkQueue graphics_queue;
         uint32_t graphics_index;
 
@@ -19,6 +29,7 @@ namespace engine {
 
     struct vk_context
     {
+        // Null for a headless context which has no surface.
         const Platform_Window* window;
 
         VkInstance      instance;
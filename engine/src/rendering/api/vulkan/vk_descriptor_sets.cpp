@@ -17,11 +17,11 @@ namespace engine {
                 { VK_DESCRIPTOR_TYPE_SAMPLER, max_sizes },
                 { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, max_sizes },
                 { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, max_sizes },
-                //{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, max_sizes },
+                { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, max_sizes },
                 //{ VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, max_sizes },
                 //{ VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER, max_sizes },
                 { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, max_sizes },
-                //{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, max_sizes },
+                { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, max_sizes },
                 { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, max_sizes },
                 { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, max_sizes },
                 //{ VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, max_sizes }
@@ -92,6 +92,14 @@ namespace engine {
         return descriptor_sets;
     }
 
+    void free_descriptor_set(VkDescriptorSet descriptor_set)
+    {
+        const Vk_Renderer* r = get_vulkan_renderer();
+        const vk_context& rc = get_vulkan_context();
+
+        vk_check(vkFreeDescriptorSets(rc.device->device, r->descriptor_pool, 1, &descriptor_set));
+    }
+
     void update_binding(const std::vector<VkDescriptorSet>& descriptor_sets,
         const VkDescriptorSetLayoutBinding& binding,
         Vk_Buffer& buffer,
@@ -118,6 +126,31 @@ namespace engine {
     }
 
 
+    // Points each descriptor set at the region of a frame allocator that
+    // belongs to the frame in flight using that set.
+    void update_binding(const std::vector<VkDescriptorSet>& descriptor_sets,
+        const VkDescriptorSetLayoutBinding& binding,
+        const Vk_Frame_Allocator& allocator)
+    {
+        const vk_context& rc = get_vulkan_context();
+
+        for (std::size_t i = 0; i < get_swapchain_image_count(); ++i) {
+            VkDescriptorBufferInfo buffer_info{};
+            buffer_info.buffer = allocator.buffer.buffer;
+            buffer_info.offset = allocator.frame_size * (i % max_frames_in_flight);
+            buffer_info.range = allocator.frame_size;
+
+            VkWriteDescriptorSet write{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+            write.dstBinding = binding.binding;
+            write.dstSet = descriptor_sets[i];
+            write.descriptorCount = 1;
+            write.descriptorType = binding.descriptorType;
+            write.pBufferInfo = &buffer_info;
+
+            vkUpdateDescriptorSets(rc.device->device, 1, &write, 0, nullptr);
+        }
+    }
+
     void update_binding(VkDescriptorSet descriptor_set,
         const VkDescriptorSetLayoutBinding& binding,
         Vk_Image& buffer,
@@ -141,6 +174,30 @@ namespace engine {
         vkUpdateDescriptorSets(rc.device->device, 1, &write, 0, nullptr);
     }
 
+    // Binds a specific image view such as a single mip level of an image.
+    void update_binding(VkDescriptorSet descriptor_set,
+        const VkDescriptorSetLayoutBinding& binding,
+        VkImageView view,
+        VkImageLayout layout,
+        VkSampler sampler)
+    {
+        const vk_context& rc = get_vulkan_context();
+
+        VkDescriptorImageInfo image_info{};
+        image_info.imageLayout = layout;
+        image_info.imageView = view;
+        image_info.sampler = sampler;
+
+        VkWriteDescriptorSet write{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+        write.dstBinding = binding.binding;
+        write.dstSet = descriptor_set;
+        write.descriptorCount = 1;
+        write.descriptorType = binding.descriptorType;
+        write.pImageInfo = &image_info;
+
+        vkUpdateDescriptorSets(rc.device->device, 1, &write, 0, nullptr);
+    }
+
     void update_binding(const std::vector<VkDescriptorSet>& descriptor_sets,
         const VkDescriptorSetLayoutBinding& binding,
         Vk_Image& buffer,
@@ -169,7 +226,8 @@ namespace engine {
         const VkDescriptorSetLayoutBinding& binding,
         std::vector<Vk_Image>& buffer,
         VkImageLayout layout,
-        VkSampler sampler)
+        VkSampler sampler,
+        uint32_t array_element)
     {
         const vk_context& rc = get_vulkan_context();
 
@@ -182,6 +240,7 @@ namespace engine {
             VkWriteDescriptorSet write{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
             write.dstBinding = binding.binding;
             write.dstSet = descriptor_sets[i];
+            write.dstArrayElement = array_element;
             write.descriptorCount = 1;
             write.descriptorType = binding.descriptorType;
             write.pImageInfo = &buffer_info;
@@ -206,4 +265,143 @@ namespace engine {
             nullptr);
 
     }
-}
\ No newline at end of file
+
+    Vk_Bindless_Set create_bindless_set(uint32_t max_textures, uint32_t max_materials)
+    {
+        const vk_context& rc = get_vulkan_context();
+
+        Vk_Bindless_Set bindless{};
+        bindless.max_textures = max_textures;
+        bindless.max_materials = max_materials;
+
+        const std::vector<VkDescriptorPoolSize> pool_sizes{
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, max_textures },
+            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }
+        };
+
+        VkDescriptorPoolCreateInfo pool_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+        pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+        pool_info.poolSizeCount = u32(pool_sizes.size());
+        pool_info.pPoolSizes = pool_sizes.data();
+        pool_info.maxSets = 1;
+        vk_check(vkCreateDescriptorPool(rc.device->device, &pool_info, nullptr, &bindless.pool));
+
+        const std::array<VkDescriptorSetLayoutBinding, 2> bindings{ {
+            { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, max_textures, VK_SHADER_STAGE_FRAGMENT_BIT },
+            { 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT }
+        } };
+
+        // Only the slots that have been written are valid and slots that are
+        // not used by any pending draw may be written at any time.
+        const std::array<VkDescriptorBindingFlags, 2> binding_flags{
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+            VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+            VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT,
+            0
+        };
+
+        VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO };
+        flags_info.bindingCount = u32(binding_flags.size());
+        flags_info.pBindingFlags = binding_flags.data();
+
+        VkDescriptorSetLayoutCreateInfo layout_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+        layout_info.pNext = &flags_info;
+        layout_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+        layout_info.bindingCount = u32(bindings.size());
+        layout_info.pBindings = bindings.data();
+        vk_check(vkCreateDescriptorSetLayout(rc.device->device, &layout_info, nullptr, &bindless.layout));
+
+        VkDescriptorSetAllocateInfo allocate_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+        allocate_info.descriptorPool = bindless.pool;
+        allocate_info.descriptorSetCount = 1;
+        allocate_info.pSetLayouts = &bindless.layout;
+        vk_check(vkAllocateDescriptorSets(rc.device->device, &allocate_info, &bindless.set));
+
+        // Materials are only ever appended and a material is written before
+        // any draw uses it so a persistently mapped buffer is enough.
+        const VkDeviceSize materials_size = sizeof(Vk_Bindless_Material) * max_materials;
+        bindless.materials = create_buffer(materials_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        std::memset(bindless.materials.mapped, 0, materials_size);
+
+        VkDescriptorBufferInfo buffer_info{};
+        buffer_info.buffer = bindless.materials.buffer;
+        buffer_info.offset = 0;
+        buffer_info.range = materials_size;
+
+        VkWriteDescriptorSet write{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+        write.dstBinding = 1;
+        write.dstSet = bindless.set;
+        write.descriptorCount = 1;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        write.pBufferInfo = &buffer_info;
+
+        vkUpdateDescriptorSets(rc.device->device, 1, &write, 0, nullptr);
+
+        return bindless;
+    }
+
+    void destroy_bindless_set(Vk_Bindless_Set& bindless)
+    {
+        const vk_context& rc = get_vulkan_context();
+
+        destroy_buffer(bindless.materials);
+        vkDestroyDescriptorSetLayout(rc.device->device, bindless.layout, nullptr);
+        vkDestroyDescriptorPool(rc.device->device, bindless.pool, nullptr);
+
+        bindless = {};
+    }
+
+    uint32_t add_bindless_texture(Vk_Bindless_Set& bindless, const Vk_Image& image)
+    {
+        const vk_context& rc = get_vulkan_context();
+
+        uint32_t index;
+        if (!bindless.free_textures.empty()) {
+            index = bindless.free_textures.back();
+            bindless.free_textures.pop_back();
+        } else if (bindless.texture_count < bindless.max_textures) {
+            index = bindless.texture_count++;
+        } else {
+            return UINT32_MAX;
+        }
+
+        VkDescriptorImageInfo image_info{};
+        image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        image_info.imageView = image.view;
+        image_info.sampler = image.sampler;
+
+        VkWriteDescriptorSet write{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+        write.dstBinding = 0;
+        write.dstSet = bindless.set;
+        write.dstArrayElement = index;
+        write.descriptorCount = 1;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        write.pImageInfo = &image_info;
+
+        vkUpdateDescriptorSets(rc.device->device, 1, &write, 0, nullptr);
+
+        return index;
+    }
+
+    void remove_bindless_texture(Vk_Bindless_Set& bindless, uint32_t index)
+    {
+        // The slot keeps pointing at the destroyed view until it is handed
+        // out again. This is fine since the set is partially bound and no
+        // material references it any more.
+        if (index == bindless.texture_count - 1)
+            --bindless.texture_count;
+        else
+            bindless.free_textures.push_back(index);
+    }
+
+    bool set_bindless_material(Vk_Bindless_Set& bindless, uint32_t material_id, const Vk_Bindless_Material& material)
+    {
+        if (material_id >= bindless.max_materials)
+            return false;
+
+        auto materials = static_cast<Vk_Bindless_Material*>(bindless.materials.mapped);
+        materials[material_id] = material;
+
+        return true;
+    }
+}
@@ -12,13 +12,58 @@ namespace engine {
 
     VkDescriptorSet allocate_descriptor_set(VkDescriptorSetLayout layout);
     std::vector<VkDescriptorSet> allocate_descriptor_sets(VkDescriptorSetLayout layout);
+    void free_descriptor_set(VkDescriptorSet descriptor_set);
 
     void update_binding(const std::vector<VkDescriptorSet>& descriptor_sets, const VkDescriptorSetLayoutBinding& binding, Vk_Buffer& buffer, std::size_t size);
+    void update_binding(const std::vector<VkDescriptorSet>& descriptor_sets, const VkDescriptorSetLayoutBinding& binding, const Vk_Frame_Allocator& allocator);
     void update_binding(VkDescriptorSet descriptor_set, const VkDescriptorSetLayoutBinding& binding, Vk_Image& buffer, VkImageLayout layout, VkSampler sampler);
+    void update_binding(VkDescriptorSet descriptor_set, const VkDescriptorSetLayoutBinding& binding, VkImageView view, VkImageLayout layout, VkSampler sampler);
     void update_binding(const std::vector<VkDescriptorSet>& descriptor_sets, const VkDescriptorSetLayoutBinding& binding, Vk_Image& buffer, VkImageLayout layout, VkSampler sampler);
-    void update_binding(const std::vector<VkDescriptorSet>& descriptor_sets, const VkDescriptorSetLayoutBinding& binding, std::vector<Vk_Image>& buffer, VkImageLayout layout, VkSampler sampler);
+    void update_binding(const std::vector<VkDescriptorSet>& descriptor_sets, const VkDescriptorSetLayoutBinding& binding, std::vector<Vk_Image>& buffer, VkImageLayout layout, VkSampler sampler, uint32_t array_element = 0);
 
     void bind_descriptor_set(const std::vector<VkCommandBuffer>& buffers, VkPipelineLayout layout, VkDescriptorSet descriptor_set);
+
+    // Texture indices of a material into the bindless texture array. Padded
+    // to match the std430 layout of a uvec4.
+    struct Vk_Bindless_Material
+    {
+        uint32_t albedo;
+        uint32_t normal;
+        uint32_t specular;
+        uint32_t padding;
+    };
+
+    // A single descriptor set holding every material texture in one large
+    // array along with a buffer of per material texture indices. Draws push
+    // the index of their material instead of binding a set per mesh. The set
+    // lives in its own update after bind pool so textures can be added while
+    // the set is in use by frames in flight.
+    struct Vk_Bindless_Set
+    {
+        VkDescriptorPool pool = nullptr;
+        VkDescriptorSetLayout layout = nullptr;
+        VkDescriptorSet set = nullptr;
+
+        Vk_Buffer materials;
+
+        uint32_t max_textures = 0;
+        uint32_t max_materials = 0;
+        uint32_t texture_count = 0;
+
+        // Removed slots below texture_count which are handed out again
+        // before the array grows.
+        std::vector<uint32_t> free_textures;
+    };
+
+    Vk_Bindless_Set create_bindless_set(uint32_t max_textures, uint32_t max_materials);
+    void destroy_bindless_set(Vk_Bindless_Set& bindless);
+
+    // Returns the array index of the texture or UINT32_MAX if the array is full.
+    uint32_t add_bindless_texture(Vk_Bindless_Set& bindless, const Vk_Image& image);
+
+    // No frame in flight may still be sampling the texture through the slot.
+    void remove_bindless_texture(Vk_Bindless_Set& bindless, uint32_t index);
+    bool set_bindless_material(Vk_Bindless_Set& bindless, uint32_t material_id, const Vk_Bindless_Material& material);
 }
 
 #endif
@@ -13,10 +13,7 @@ namespace engine {
         assert(anisotropic_level >= 1 && "Cannot use value less than 1");
 
         // get the maximum supported anisotropic filtering level
-        VkPhysicalDeviceProperties properties{};
-        vkGetPhysicalDeviceProperties(rc.device->gpu, &properties);
-
-        const float max_ansiotropic_level = properties.limits.maxSamplerAnisotropy;
+        const float max_ansiotropic_level = rc.device->properties.limits.maxSamplerAnisotropy;
 
         if (anisotropic_level <= max_ansiotropic_level)
             return anisotropic_level;
@@ -90,7 +87,8 @@ namespace engine {
         VkImageAspectFlags aspect_flags = 0;
         // todo: VK_IMAGE_USAGE_TRANSFER_DST_BIT was only added because of texture creation
         // todo: This needs to be looked at again.
-        if (usage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT || usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT) {
+        if (usage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT || usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT ||
+            usage & VK_IMAGE_USAGE_STORAGE_BIT) {
             aspect_flags = VK_IMAGE_ASPECT_COLOR_BIT;
         }
         else if (usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) {
@@ -115,6 +113,36 @@ namespace engine {
         return view;
     }
 
+    // Creates a view of a single mip level of a color image. Compute passes
+    // that write to each level of an image individually need one per level.
+    VkImageView create_image_mip_view(const Vk_Image& image, uint32_t mip_level)
+    {
+        VkImageView view{};
+
+        const vk_context& rc = get_vulkan_context();
+
+        VkImageViewCreateInfo view_info{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+        view_info.image = image.handle;
+        view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        view_info.format = image.format;
+        view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        view_info.subresourceRange.baseMipLevel = mip_level;
+        view_info.subresourceRange.levelCount = 1;
+        view_info.subresourceRange.baseArrayLayer = 0;
+        view_info.subresourceRange.layerCount = 1;
+
+        vk_check(vkCreateImageView(rc.device->device, &view_info, nullptr, &view));
+
+        return view;
+    }
+
+    void destroy_image_view(VkImageView view)
+    {
+        const vk_context& rc = get_vulkan_context();
+
+        vkDestroyImageView(rc.device->device, view, nullptr);
+    }
+
     Vk_Image create_image(VkExtent2D extent, VkFormat format, VkImageUsageFlags usage, uint32_t mip_levels)
     {
         Vk_Image image{};
@@ -168,6 +196,34 @@ namespace engine {
 
 
 
+    // Immediately transitions every mip level of a color image. Mostly used to
+    // move images that are only ever accessed by compute into the general
+    // layout once after creation.
+    void set_image_layout(const Vk_Image& image, VkImageLayout old_layout, VkImageLayout new_layout)
+    {
+        submit_to_gpu([&](VkCommandBuffer cmd_buffer) {
+            VkImageMemoryBarrier image_barrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+            image_barrier.image = image.handle;
+            image_barrier.oldLayout = old_layout;
+            image_barrier.newLayout = new_layout;
+            image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            image_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            image_barrier.subresourceRange.baseMipLevel = 0;
+            image_barrier.subresourceRange.levelCount = image.mip_levels;
+            image_barrier.subresourceRange.baseArrayLayer = 0;
+            image_barrier.subresourceRange.layerCount = 1;
+            image_barrier.srcAccessMask = 0;
+            image_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+            vkCmdPipelineBarrier(cmd_buffer,
+                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0, 0, nullptr, 0, nullptr, 1,
+                &image_barrier);
+        });
+    }
+
     std::vector<Vk_Image> create_color_images(VkExtent2D size)
     {
         std::vector<Vk_Image> images(get_swapchain_image_count());
@@ -280,9 +336,7 @@ namespace engine {
         const uint32_t mip_levels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
 
         // Get the highest anisotropy level for model textures
-        VkPhysicalDeviceProperties properties{};
-        vkGetPhysicalDeviceProperties(rc.device->gpu, &properties);
-        const float max_ansiotropic_level = properties.limits.maxSamplerAnisotropy;
+        const float max_ansiotropic_level = rc.device->properties.limits.maxSamplerAnisotropy;
 
         buffer = create_image({ width, height }, format, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, mip_levels);
         buffer.sampler = create_image_sampler(VK_FILTER_LINEAR, max_ansiotropic_level, static_cast<float>(mip_levels));
@@ -20,10 +20,14 @@ namespace engine {
     void destroy_image_sampler(VkSampler sampler);
 
     VkImageView create_image_views(VkImage image, VkFormat format, VkImageUsageFlags usage, uint32_t mip_levels);
+    VkImageView create_image_mip_view(const Vk_Image& image, uint32_t mip_level);
+    void destroy_image_view(VkImageView view);
     Vk_Image create_image(VkExtent2D extent, VkFormat format, VkImageUsageFlags usage, uint32_t mip_levels = 1);
     void destroy_image(Vk_Image& image);
     void destroy_images(std::vector<Vk_Image>& images);
 
+    void set_image_layout(const Vk_Image& image, VkImageLayout old_layout, VkImageLayout new_layout);
+
     std::vector<Vk_Image> create_color_images(VkExtent2D size);
     Vk_Image create_depth_image(VkExtent2D size);
 
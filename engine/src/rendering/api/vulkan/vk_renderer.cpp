@@ -6,6 +6,8 @@
 
 #include "vk_descriptor_sets.h"
 
+#include "utils/profiler.h"
+
 namespace engine {
     static Vk_Renderer* g_r = nullptr;
     static vk_context* g_rc = nullptr;
@@ -15,6 +17,10 @@ namespace engine {
 
     static vk_swapchain g_swapchain{};
 
+    // A headless renderer has no surface or swapchain. Frames are rendered
+    // into the offscreen attachments only and are never presented.
+    static bool g_headless = false;
+
     static VkCommandPool g_cmd_pool;
 
     static std::vector<vk_frame> g_frames;
@@ -28,9 +34,70 @@ namespace engine {
     // The current frame is used for obtaining the correct buffers in order.
     // The current image is used for obtaining the correct images in order
     //
+    // Size of the uniform memory available to each frame in flight.
+    static constexpr VkDeviceSize g_uniform_frame_size = 256 * 1024;
+
+    // Size of the instance memory available to each frame in flight. This is
+    // enough for 262144 model matrices.
+    static constexpr VkDeviceSize g_instance_frame_size = 16 * 1024 * 1024;
+
+    // Upper limits of the bindless material set. The texture count is further
+    // limited by what the GPU supports.
+    static constexpr uint32_t g_max_bindless_textures = 16384;
+    static constexpr uint32_t g_max_bindless_materials = 65536;
+
     static uint32_t g_buffer_index = 0;
+
+    // Swapchain image acquired for the current frame. Only the UI pass
+    // renders into it, every other per-image resource is indexed by the
+    // frame in flight.
     static uint32_t g_image_index = 0;
 
+    // Number of frames the CPU may record ahead of the GPU. More frames keep
+    // the GPU busy at the cost of input latency.
+    static uint32_t g_frames_in_flight = 2;
+
+    // Resources that recorded frames may still be using are destroyed once
+    // the frame they were retired in has completed on the GPU. Frames are
+    // numbered by submission and each frame in flight remembers the number
+    // of the last frame submitted with its fence.
+    struct Vk_Retired_Resource
+    {
+        uint64_t frame;
+        std::function<void()> destroy;
+    };
+
+    static std::deque<Vk_Retired_Resource> g_retired_resources;
+    static uint64_t g_submitted_frames = 0;
+    static std::array<uint64_t, max_frames_in_flight> g_frame_numbers{};
+
+    // Returns the most recent frame which, along with every frame before it,
+    // has completed. A frame in flight whose fence is still pending has not
+    // completed but any earlier frame that used the same fence must have.
+    static uint64_t get_completed_frame()
+    {
+        uint64_t completed = g_submitted_frames;
+
+        for (uint32_t i = 0; i < max_frames_in_flight; ++i) {
+            if (vkGetFenceStatus(g_rc->device->device, g_frames[i].submit_fence) != VK_SUCCESS)
+                completed = std::min(completed, g_frame_numbers[i] > 0 ? g_frame_numbers[i] - 1 : 0);
+        }
+
+        return completed;
+    }
+
+    static void destroy_retired_resources(uint64_t completed_frame)
+    {
+        // Resources are retired in frame order. Each one is removed before it
+        // is destroyed in case destroying it retires another resource.
+        while (!g_retired_resources.empty() && g_retired_resources.front().frame <= completed_frame) {
+            std::function<void()> destroy = std::move(g_retired_resources.front().destroy);
+            g_retired_resources.pop_front();
+
+            destroy();
+        }
+    }
+
 
     static VkExtent2D get_surface_size(const VkSurfaceCapabilitiesKHR& surface)
     {
@@ -55,19 +122,14 @@ namespace engine {
 
     static uint32_t find_suitable_image_count(VkSurfaceCapabilitiesKHR capabilities, buffer_mode mode)
     {
-        const uint32_t min = capabilities.minImageCount + 1;
-        const uint32_t max = capabilities.maxImageCount;
+        const uint32_t requested = mode == buffer_mode::triple_buffering ? 3 : 2;
 
-        // TODO: Need to check if requested is out of bounds 
-
-        uint32_t requested = 0;
-        if (mode == buffer_mode::double_buffering) {
-            return 2;
-        } else if (mode == buffer_mode::triple_buffering) {
-            return 3;
-        }
+        // A maximum of zero means there is no limit.
+        uint32_t count = std::max(requested, capabilities.minImageCount);
+        if (capabilities.maxImageCount > 0)
+            count = std::min(count, capabilities.maxImageCount);
 
-        return min;
+        return count;
     }
 
     static VkSurfaceFormatKHR find_suitable_surface_format()
@@ -89,12 +151,18 @@ namespace engine {
         std::vector<VkPresentModeKHR> modes(count);
         vk_check(vkGetPhysicalDeviceSurfacePresentModesKHR(g_rc->device->gpu, g_rc->surface, &count, modes.data()));
 
-        // TODO: Double check if checking for immediate mode is required
-        if (vsync == vsync_mode::disabled) {
-            const auto it = std::find(modes.begin(), modes.end(), VK_PRESENT_MODE_IMMEDIATE_KHR);
-            if (it != modes.end())
-                return VK_PRESENT_MODE_IMMEDIATE_KHR;
-        }
+        // FIFO is the only mode that is guaranteed to be supported.
+        VkPresentModeKHR requested = VK_PRESENT_MODE_FIFO_KHR;
+        if (vsync == vsync_mode::disabled)
+            requested = VK_PRESENT_MODE_IMMEDIATE_KHR;
+        else if (vsync == vsync_mode::mailbox)
+            requested = VK_PRESENT_MODE_MAILBOX_KHR;
+
+        if (std::find(modes.begin(), modes.end(), requested) != modes.end())
+            return requested;
+
+        if (requested != VK_PRESENT_MODE_FIFO_KHR)
+            warn("Requested present mode not supported. Falling back to vsync.");
 
         return VK_PRESENT_MODE_FIFO_KHR;
     }
@@ -121,7 +189,11 @@ namespace engine {
     // like to be created. It's important to remember that this is a request
     // and not guaranteed as the hardware may not support that number
     // of images.
-    static vk_swapchain create_swapchain()
+    //
+    // Passing the current swapchain as the old swapchain retires it and lets
+    // the presentation engine hand its images over to the new one without
+    // waiting for the GPU to finish with them.
+    static vk_swapchain create_swapchain(VkSwapchainKHR old_swapchain = VK_NULL_HANDLE)
     {
         vk_swapchain swapchain{};
 
@@ -146,6 +218,7 @@ namespace engine {
         swapchain_info.compositeAlpha   = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
         swapchain_info.presentMode      = present_mode;
         swapchain_info.clipped          = true;
+        swapchain_info.oldSwapchain     = old_swapchain;
 
         // Specify how the swapchain should manage images if we have different rendering 
         // and presentation queues for our gpu.
@@ -204,15 +277,21 @@ namespace engine {
         vkDestroySwapchainKHR(g_rc->device->device, swapchain.handle, nullptr);
     }
 
+    // Images of the old swapchain may still be waiting to be presented by
+    // frames in flight so it is only destroyed once those have completed.
     static void resize_swapchain(vk_swapchain& swapchain)
     {
-        destroy_swapchain(swapchain);
-        swapchain = create_swapchain();
+        vk_swapchain old_swapchain = swapchain;
+        swapchain = create_swapchain(old_swapchain.handle);
+
+        defer_destruction([old_swapchain]() mutable {
+            destroy_swapchain(old_swapchain);
+        });
     }
 
-    static std::vector<vk_frame> create_frames(uint32_t frames_in_flight)
+    static std::vector<vk_frame> create_frames(uint32_t frame_count)
     {
-        std::vector<vk_frame> frames(frames_in_flight);
+        std::vector<vk_frame> frames(frame_count);
 
         VkFenceCreateInfo fence_info{ VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
         fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
@@ -307,6 +386,20 @@ namespace engine {
 
             m_ShaderStageInfos.push_back(shaderInfo);
         }
+
+        specialization_constants.resize(m_ShaderStageInfos.size());
+    }
+
+    void Vk_Pipeline::set_specialization_constants(VkShaderStageFlagBits stage, const std::vector<uint32_t>& constants)
+    {
+        for (std::size_t i = 0; i < m_ShaderStageInfos.size(); ++i) {
+            if (m_ShaderStageInfos[i].stage == stage) {
+                specialization_constants[i] = constants;
+                return;
+            }
+        }
+
+        warn("Pipeline has no shader stage to specialize.");
     }
 
 
@@ -420,10 +513,40 @@ namespace engine {
         if (m_DepthStencilInfo.has_value())
             defaultDepthStencil = m_DepthStencilInfo.value();
 
+        // Pipelines are copied to create variants so any state that points
+        // into the pipeline must point into this copy.
+        defaultVertex.pVertexBindingDescriptions = bindingDescriptions.data();
+        defaultVertex.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+        VkPipelineColorBlendStateCreateInfo blendInfo = m_BlendInfo;
+        blendInfo.pAttachments = blends.data();
+
+        // Specialization constants are laid out one after another so that
+        // constant_id i is at offset i * 4.
+        std::vector<VkPipelineShaderStageCreateInfo> stages = m_ShaderStageInfos;
+        std::vector<VkSpecializationInfo> specialization_infos(stages.size());
+        std::vector<std::vector<VkSpecializationMapEntry>> map_entries(stages.size());
+
+        for (std::size_t i = 0; i < stages.size(); ++i) {
+            const std::vector<uint32_t>& constants = specialization_constants[i];
+            if (constants.empty())
+                continue;
+
+            for (uint32_t id = 0; id < constants.size(); ++id)
+                map_entries[i].push_back({ id, id * u32(sizeof(uint32_t)), sizeof(uint32_t) });
+
+            specialization_infos[i].mapEntryCount = u32(map_entries[i].size());
+            specialization_infos[i].pMapEntries = map_entries[i].data();
+            specialization_infos[i].dataSize = constants.size() * sizeof(uint32_t);
+            specialization_infos[i].pData = constants.data();
+
+            stages[i].pSpecializationInfo = &specialization_infos[i];
+        }
+
 
         VkGraphicsPipelineCreateInfo pipelineInfo{ VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
-        pipelineInfo.stageCount = u32(m_ShaderStageInfos.size());
-        pipelineInfo.pStages = m_ShaderStageInfos.data();
+        pipelineInfo.stageCount = u32(stages.size());
+        pipelineInfo.pStages = stages.data();
         pipelineInfo.pVertexInputState = &defaultVertex;
         pipelineInfo.pInputAssemblyState = &m_InputAssemblyInfo;
         pipelineInfo.pTessellationState = nullptr;
@@ -431,14 +554,14 @@ namespace engine {
         pipelineInfo.pRasterizationState = &m_RasterizationInfo;
         pipelineInfo.pMultisampleState = &defaultMultisample;
         pipelineInfo.pDepthStencilState = &defaultDepthStencil;
-        pipelineInfo.pColorBlendState = &m_BlendInfo;
+        pipelineInfo.pColorBlendState = &blendInfo;
         pipelineInfo.pDynamicState = &dynamicStateInfo;
         pipelineInfo.layout = m_Layout;
         pipelineInfo.renderPass = m_RenderPass->render_pass;
         pipelineInfo.subpass = 0;
 
         vk_check(vkCreateGraphicsPipelines(g_rc->device->device,
-            nullptr,
+            g_r->pipeline_cache,
             1,
             &pipelineInfo,
             nullptr,
@@ -447,9 +570,27 @@ namespace engine {
 
 
 
+    void create_pipelines(const std::vector<Vk_Pipeline*>& pipelines)
+    {
+        // Pipeline creation is where the driver compiles shaders into GPU
+        // code so each pipeline is created on its own thread. The pipeline
+        // cache is internally synchronized and is shared between all of them.
+        std::vector<std::future<void>> tasks;
+        tasks.reserve(pipelines.size());
+
+        for (Vk_Pipeline* pipeline : pipelines)
+            tasks.push_back(std::async(std::launch::async, [pipeline]() { pipeline->create_pipeline(); }));
+
+        for (std::future<void>& task : tasks)
+            task.wait();
+    }
+
     static void create_framebuffer(Vk_Render_Pass& rp)
     {
-        rp.handle.resize(get_swapchain_image_count());
+        // The UI pass renders straight into the swapchain images whose count
+        // is up to the presentation engine. Every other pass has one
+        // framebuffer for each frame in flight.
+        rp.handle.resize(rp.is_ui ? g_swapchain.images.size() : get_swapchain_image_count());
 
         for (std::size_t i = 0; i < rp.handle.size(); ++i) {
             std::vector<VkImageView> attachment_views;
@@ -596,6 +737,67 @@ namespace engine {
         create_framebuffer(rp);
     }
 
+    // Depth only render pass whose depth attachment is sampled by the lighting
+    // pass once rendering has finished.
+    void create_shadow_render_pass(Vk_Render_Pass& rp)
+    {
+        assert(rp.attachments.size() == 1 && is_depth(rp.attachments[0]));
+
+        VkAttachmentDescription description{};
+        description.format = rp.attachments[0].image[0].format;
+        description.samples = VK_SAMPLE_COUNT_1_BIT;
+        description.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        description.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        description.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        description.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+        VkAttachmentReference depth_reference{};
+        depth_reference.attachment = 0;
+        depth_reference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        // The previous frames lighting pass must finish reading the shadow
+        // map before it is cleared and written again.
+        std::array<VkSubpassDependency, 2> dependencies;
+        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[0].dstSubpass = 0;
+        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependencies[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+        dependencies[1].srcSubpass = 0;
+        dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+        VkSubpassDescription subpass{};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 0;
+        subpass.pDepthStencilAttachment = &depth_reference;
+
+        VkRenderPassCreateInfo render_pass_info{ VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
+        render_pass_info.attachmentCount = 1;
+        render_pass_info.pAttachments = &description;
+        render_pass_info.subpassCount = 1;
+        render_pass_info.pSubpasses = &subpass;
+        render_pass_info.dependencyCount = u32(dependencies.size());
+        render_pass_info.pDependencies = dependencies.data();
+
+        vk_check(vkCreateRenderPass(g_rc->device->device, &render_pass_info, nullptr,
+            &rp.render_pass));
+
+        rp.is_ui = false;
+
+        //////////////////////////////////////////////////////////////////////////
+        create_framebuffer(rp);
+    }
+
     void create_composite_render_pass(Vk_Render_Pass& rp)
     {
         // attachment descriptions
@@ -844,12 +1046,29 @@ namespace engine {
 
     void resize_framebuffer(Vk_Render_Pass& fb, VkExtent2D extent)
     {
-        std::vector<vk_framebuffer_attachment> old_attachments = fb.attachments;
+        // Frames in flight may still be rendering into the old framebuffers
+        // and attachments so they are destroyed once those have completed.
+        std::vector<VkFramebuffer> old_handles = std::move(fb.handle);
+        fb.handle.clear();
+
+        // The UI pass renders into the swapchain images so its attachments
+        // are only used to describe the render pass and are kept as is.
+        std::vector<vk_framebuffer_attachment> old_attachments;
+        if (!fb.is_ui) {
+            old_attachments = std::move(fb.attachments);
+            fb.attachments.clear();
+
+            for (auto& attachment : old_attachments)
+                add_framebuffer_attachment(fb, attachment.usage, attachment.image[0].format, extent);
+        }
 
-        destroy_framebuffer(fb);
+        defer_destruction([old_handles, old_attachments]() mutable {
+            for (VkFramebuffer handle : old_handles)
+                vkDestroyFramebuffer(g_rc->device->device, handle, nullptr);
 
-        for (auto& attachment : old_attachments)
-            add_framebuffer_attachment(fb, attachment.usage, attachment.image[0].format, extent);
+            for (auto& attachment : old_attachments)
+                destroy_images(attachment.image);
+        });
 
         fb.width = extent.width;
         fb.height = extent.height;
@@ -859,20 +1078,111 @@ namespace engine {
 
     std::vector<VkCommandBuffer> create_command_buffers()
     {
-        std::vector<VkCommandBuffer> cmdBuffers(frames_in_flight);
+        std::vector<VkCommandBuffer> cmdBuffers(max_frames_in_flight);
 
         VkCommandBufferAllocateInfo allocate_info{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
         allocate_info.commandPool = g_cmd_pool;
         allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
         allocate_info.commandBufferCount = 1;
 
-        for (std::size_t i = 0; i < frames_in_flight; ++i)
+        for (std::size_t i = 0; i < max_frames_in_flight; ++i)
             vk_check(vkAllocateCommandBuffers(g_rc->device->device, &allocate_info, &cmdBuffers[i]));
 
         return cmdBuffers;
     }
 
 
+    VkExtent2D get_render_extent(const Vk_Render_Pass& fb)
+    {
+        if (fb.render_extent.width == 0 || fb.render_extent.height == 0)
+            return { fb.width, fb.height };
+
+        return {
+            std::min(fb.render_extent.width, fb.width),
+            std::min(fb.render_extent.height, fb.height)
+        };
+    }
+
+    // Secondary command buffers do not inherit dynamic state so this must be
+    // set in every command buffer that draws within a render pass.
+    static void set_viewport_and_scissor(VkCommandBuffer buffer, const Vk_Render_Pass& fb)
+    {
+        const VkExtent2D extent = get_render_extent(fb);
+
+        VkViewport viewport{};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = static_cast<float>(extent.width);
+        viewport.height = static_cast<float>(extent.height);
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+
+        VkRect2D scissor{};
+        scissor.offset = { 0, 0 };
+        scissor.extent = extent;
+
+        vkCmdSetViewport(buffer, 0, 1, &viewport);
+        vkCmdSetScissor(buffer, 0, 1, &scissor);
+    }
+
+    Vk_Command_Worker create_command_worker()
+    {
+        Vk_Command_Worker worker{};
+
+        VkCommandPoolCreateInfo pool_info{ VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+        pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        pool_info.queueFamilyIndex = g_rc->device->graphics_index;
+
+        vk_check(vkCreateCommandPool(g_rc->device->device, &pool_info, nullptr, &worker.pool));
+
+        VkCommandBufferAllocateInfo allocate_info{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+        allocate_info.commandPool = worker.pool;
+        allocate_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocate_info.commandBufferCount = max_frames_in_flight;
+
+        worker.buffers.resize(max_frames_in_flight);
+        vk_check(vkAllocateCommandBuffers(g_rc->device->device, &allocate_info, worker.buffers.data()));
+
+        return worker;
+    }
+
+    void destroy_command_worker(Vk_Command_Worker& worker)
+    {
+        vkDestroyCommandPool(g_rc->device->device, worker.pool, nullptr);
+
+        worker.buffers.clear();
+    }
+
+    static uint32_t get_framebuffer_index(const Vk_Render_Pass& fb)
+    {
+        return fb.is_ui ? g_image_index : g_buffer_index;
+    }
+
+    void begin_secondary_command_buffer(const std::vector<VkCommandBuffer>& buffers, const Vk_Render_Pass& fb)
+    {
+        vk_check(vkResetCommandBuffer(buffers[g_buffer_index], 0));
+
+        VkCommandBufferInheritanceInfo inheritance_info{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+        inheritance_info.renderPass = fb.render_pass;
+        inheritance_info.subpass = 0;
+        inheritance_info.framebuffer = fb.handle[get_framebuffer_index(fb)];
+
+        VkCommandBufferBeginInfo begin_info{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        begin_info.pInheritanceInfo = &inheritance_info;
+        vk_check(vkBeginCommandBuffer(buffers[g_buffer_index], &begin_info));
+
+        set_viewport_and_scissor(buffers[g_buffer_index], fb);
+    }
+
+    void execute_command_buffers(std::vector<VkCommandBuffer>& buffers, const std::vector<VkCommandBuffer>& secondary_buffers)
+    {
+        if (secondary_buffers.empty())
+            return;
+
+        vkCmdExecuteCommands(buffers[g_buffer_index], u32(secondary_buffers.size()), secondary_buffers.data());
+    }
+
     void begin_command_buffer(const std::vector<VkCommandBuffer>& cmdBuffer)
     {
         vk_check(vkResetCommandBuffer(cmdBuffer[g_buffer_index], 0));
@@ -891,24 +1201,12 @@ namespace engine {
     void begin_render_pass(const std::vector<VkCommandBuffer>& cmdBuffer, 
         const Vk_Render_Pass& fb,
         const VkClearColorValue& clear_color,
-        const VkClearDepthStencilValue& depth_stencil)
+        const VkClearDepthStencilValue& depth_stencil,
+        VkSubpassContents contents)
     {
-        VkViewport viewport{};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = static_cast<float>(fb.width);
-        viewport.height = static_cast<float>(fb.height);
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
-
-        VkRect2D scissor{};
-        scissor.offset = { 0, 0 };
-        scissor.extent = { fb.width, fb.height };
-
         VkRect2D render_area{};
         render_area.offset = { 0, 0 };
-        render_area.extent.width = fb.width;
-        render_area.extent.height = fb.height;
+        render_area.extent = get_render_extent(fb);
 
         // TODO: Make a static array of clear values to be used
         // Maybe when attachments are being created this can be done there
@@ -925,15 +1223,14 @@ namespace engine {
 
         VkRenderPassBeginInfo begin_info{ VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
         begin_info.renderPass = fb.render_pass;
-        begin_info.framebuffer = fb.handle[g_image_index];
+        begin_info.framebuffer = fb.handle[get_framebuffer_index(fb)];
         begin_info.renderArea = render_area;
         begin_info.clearValueCount = u32(clearValues.size());
         begin_info.pClearValues = clearValues.data();
 
-        vkCmdSetViewport(cmdBuffer[g_buffer_index], 0, 1, &viewport);
-        vkCmdSetScissor(cmdBuffer[g_buffer_index], 0, 1, &scissor);
+        set_viewport_and_scissor(cmdBuffer[g_buffer_index], fb);
 
-        vkCmdBeginRenderPass(cmdBuffer[g_buffer_index], &begin_info, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdBeginRenderPass(cmdBuffer[g_buffer_index], &begin_info, contents);
     }
 
     void end_render_pass(std::vector<VkCommandBuffer>& buffers)
@@ -969,6 +1266,69 @@ namespace engine {
         return pipeline_layout;
     }
 
+    // Pipeline cache data is only valid for the GPU and driver that wrote it.
+    // The header is compared against the current device before the data is
+    // handed to the driver so that a driver update or a different GPU simply
+    // results in a cold start.
+    static bool is_pipeline_cache_compatible(const std::vector<char>& data)
+    {
+        if (data.size() < sizeof(VkPipelineCacheHeaderVersionOne))
+            return false;
+
+        VkPipelineCacheHeaderVersionOne header{};
+        std::memcpy(&header, data.data(), sizeof(header));
+
+        const VkPhysicalDeviceProperties& properties = g_rc->device->properties;
+
+        return header.headerSize >= sizeof(header) &&
+            header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+            header.vendorID == properties.vendorID &&
+            header.deviceID == properties.deviceID &&
+            std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    }
+
+    bool load_pipeline_cache(const std::filesystem::path& path)
+    {
+        std::vector<char> data;
+
+        std::ifstream file(path, std::ios::binary);
+        if (file.is_open())
+            data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+        if (!data.empty() && !is_pipeline_cache_compatible(data)) {
+            warn("Pipeline cache {} was created by a different GPU or driver and will be rebuilt.", path.string());
+            data.clear();
+        }
+
+        VkPipelineCacheCreateInfo cache_info{ VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+        cache_info.initialDataSize = data.size();
+        cache_info.pInitialData = data.data();
+
+        vk_check(vkCreatePipelineCache(g_rc->device->device, &cache_info, nullptr, &g_r->pipeline_cache));
+
+        return !data.empty();
+    }
+
+    void save_pipeline_cache(const std::filesystem::path& path)
+    {
+        if (!g_r->pipeline_cache)
+            return;
+
+        std::size_t size = 0;
+        vk_check(vkGetPipelineCacheData(g_rc->device->device, g_r->pipeline_cache, &size, nullptr));
+
+        std::vector<char> data(size);
+        vk_check(vkGetPipelineCacheData(g_rc->device->device, g_r->pipeline_cache, &size, data.data()));
+
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            warn("Failed to save pipeline cache to {}.", path.string());
+            return;
+        }
+
+        file.write(data.data(), size);
+    }
+
     void destroy_pipeline(VkPipeline pipeline)
     {
         vkDestroyPipeline(g_rc->device->device, pipeline, nullptr);
@@ -1085,7 +1445,11 @@ namespace engine {
             extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 
 
-        std::vector<const char*> device_extensions { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+        g_headless = window == nullptr;
+
+        std::vector<const char*> device_extensions;
+        if (!g_headless)
+            device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 
 
         VkPhysicalDeviceFeatures features{};
@@ -1119,12 +1483,22 @@ namespace engine {
 
         g_buffering = buffering_mode;
         g_vsync = sync_mode;
-        g_swapchain = create_swapchain();
+        if (!g_headless)
+            g_swapchain = create_swapchain();
 
         renderer->descriptor_pool = create_descriptor_pool();
+        if (renderer->ctx.device->descriptor_indexing) {
+            const uint32_t max_textures = std::min(g_max_bindless_textures, renderer->ctx.device->max_bindless_textures);
+            renderer->bindless = create_bindless_set(max_textures, g_max_bindless_materials);
+        }
+#if defined(MY_ENGINE_COMPILE_SHADERS)
         renderer->compiler = create_shader_compiler();
+#endif
+        renderer->uniform_allocator = create_frame_allocator(g_uniform_frame_size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+        renderer->instance_allocator = create_frame_allocator(g_instance_frame_size,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
 
-        g_frames = create_frames(frames_in_flight);
+        g_frames = create_frames(max_frames_in_flight);
 
         create_command_pool();
 
@@ -1137,16 +1511,28 @@ namespace engine {
     {
         info("Terminating Vulkan renderer.");
 
+        // The GPU is idle by now so nothing retired is still in use.
+        destroy_retired_resources(UINT64_MAX);
+
         destroy_command_pool();
+        vkDestroyPipelineCache(renderer->ctx.device->device, renderer->pipeline_cache, nullptr);
+        destroy_geometry_buffer(renderer->geometry);
+        destroy_frame_allocator(renderer->instance_allocator);
+        destroy_frame_allocator(renderer->uniform_allocator);
+        if (renderer->bindless.set)
+            destroy_bindless_set(renderer->bindless);
         vkDestroyDescriptorPool(renderer->ctx.device->device, renderer->descriptor_pool, nullptr);
+#if defined(MY_ENGINE_COMPILE_SHADERS)
         destroy_shader_compiler(renderer->compiler);
+#endif
         destroy_upload_context(renderer->submit);
 
         destroy_debug_callback(renderer->messenger);
 
         destroy_frames(g_frames);
 
-        destroy_swapchain(g_swapchain);
+        if (!g_headless)
+            destroy_swapchain(g_swapchain);
 
         destroy_vulkan_context(renderer->ctx);
 
@@ -1159,6 +1545,8 @@ namespace engine {
     // used for copying data from staging buffers into GPU local buffers.
     void submit_to_gpu(const std::function<void(VkCommandBuffer)>& submit_func)
     {
+        PROFILE_ZONE("submit_to_gpu");
+
         VkCommandBufferBeginInfo begin_info{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
         begin_info.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
@@ -1187,6 +1575,38 @@ namespace engine {
 
 
 
+    // Returns a slice of uniform memory that is valid until the end of the
+    // current frame. Must be called after get_next_swapchain_image().
+    bool allocate_uniform_memory(VkDeviceSize size, Vk_Buffer_Slice& slice)
+    {
+        return allocate_frame_memory(g_r->uniform_allocator, size, slice);
+    }
+
+    // Returns a slice of instance memory for the current frame along with the
+    // index of its first element which should be passed as the firstInstance
+    // of the draw call. Sizes are rounded up to the instance stride so that
+    // every slice starts on an element boundary. This also allows the same
+    // memory to be viewed as smaller element types such as draw commands.
+    //
+    // Safe to call from multiple threads as instance data is written by the
+    // threads that record the geometry pass.
+    bool allocate_instance_memory(VkDeviceSize size, Vk_Buffer_Slice& slice, uint32_t& first_instance)
+    {
+        static std::mutex mutex;
+        std::lock_guard<std::mutex> lock(mutex);
+
+        Vk_Frame_Allocator& allocator = g_r->instance_allocator;
+
+        const VkDeviceSize stride = sizeof(glm::mat4);
+        first_instance = 0;
+        if (!allocate_frame_memory(allocator, ((size + stride - 1) / stride) * stride, slice))
+            return false;
+
+        first_instance = u32((slice.offset - allocator.begin) / sizeof(glm::mat4));
+
+        return true;
+    }
+
     Vk_Renderer* get_vulkan_renderer()
     {
         return g_r;
@@ -1204,12 +1624,48 @@ namespace engine {
 
     uint32_t get_frame_image_index()
     {
-        return g_image_index;
+        // A frame's attachments are no longer in use once its fence has been
+        // waited on, regardless of which swapchain image it presents to.
+        return g_buffer_index;
     }
 
     uint32_t get_swapchain_image_count()
     {
-        return static_cast<uint32_t>(g_swapchain.images.size());
+        // Per-image resources are created once for every frame in flight so
+        // they do not depend on how many images the swapchain has.
+        return max_frames_in_flight;
+    }
+
+    VkExtent2D get_swapchain_extent()
+    {
+        if (g_swapchain.images.empty())
+            return {};
+
+        return g_swapchain.images[0].extent;
+    }
+
+    uint32_t get_frame_in_flight_count()
+    {
+        return g_frames_in_flight;
+    }
+
+    void set_frame_in_flight_count(uint32_t count)
+    {
+        g_frames_in_flight = std::clamp(count, 1u, max_frames_in_flight);
+
+        // Every frame must have finished so that restarting from the first
+        // frame does not skip a fence that is still pending.
+        g_buffer_index = 0;
+    }
+
+    void wait_for_frame()
+    {
+        vk_check(vkWaitForFences(g_rc->device->device, 1, &g_frames[g_buffer_index].submit_fence, VK_TRUE, UINT64_MAX));
+    }
+
+    bool is_headless()
+    {
+        return g_headless;
     }
 
     void recreate_swapchain(buffer_mode bufferMode, vsync_mode vsync)
@@ -1217,8 +1673,10 @@ namespace engine {
         g_buffering = bufferMode;
         g_vsync = vsync;
 
-        destroy_swapchain(g_swapchain);
-        g_swapchain = create_swapchain();
+        if (g_headless)
+            return;
+
+        resize_swapchain(g_swapchain);
     }
 
     bool get_next_swapchain_image()
@@ -1226,6 +1684,20 @@ namespace engine {
         // Wait for the GPU to finish all work before getting the next image
         vk_check(vkWaitForFences(g_rc->device->device, 1, &g_frames[g_buffer_index].submit_fence, VK_TRUE, UINT64_MAX));
 
+        if (!g_retired_resources.empty())
+            destroy_retired_resources(get_completed_frame());
+
+        // The GPU is no longer reading this frames uniform memory so it can be
+        // handed out again.
+        reset_frame_allocator(g_r->uniform_allocator, g_buffer_index);
+        reset_frame_allocator(g_r->instance_allocator, g_buffer_index);
+
+        if (g_headless) {
+            vk_check(vkResetFences(g_rc->device->device, 1, &g_frames[g_buffer_index].submit_fence));
+
+            return true;
+        }
+
         // Keep attempting to acquire the next frame.
         VkResult result = vkAcquireNextImageKHR(g_rc->device->device,
             g_swapchain.handle,
@@ -1241,24 +1713,19 @@ namespace engine {
         // required. However, at the moment, attempting to render when the swapchain
         // is suboptimal results in a command buffer crash.
         if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
-    #if 1
-            // When resizing the swapchain, the acquired semaphore does not get
-            // signaled as no queue submissions takes place. This is an issue since
-            // vkAcquireNextImageKHR expects the acquired semaphore to be in an
-            // signaled state. As a temporary solution we create a dummy queue 
-            // submit that signals the acquired semaphore.
+            // A suboptimal image has still been acquired and its semaphore will
+            // be signaled even though no work is submitted for it. The
+            // semaphore must be waited on before it can be used again so a
+            // dummy submit consumes it. No image is acquired when out of date.
             // This issue is mentioned here: https://github.com/KhronosGroup/Vulkan-Docs/issues/1059
-            VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-            VkSubmitInfo submit_info{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
-            submit_info.waitSemaphoreCount = 1;
-            submit_info.pWaitSemaphores = &g_frames[g_buffer_index].image_ready;
-            submit_info.pWaitDstStageMask = &waitStage;
-            vk_check(vkQueueSubmit(g_rc->device->graphics_queue, 1, &submit_info, VK_NULL_HANDLE));
-    #endif
-
-            // Wait for all GPU operations to complete before destroy and recreating
-            // any resources.
-            wait_for_gpu();
+            if (result == VK_SUBOPTIMAL_KHR) {
+                VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+                VkSubmitInfo submit_info{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
+                submit_info.waitSemaphoreCount = 1;
+                submit_info.pWaitSemaphores = &g_frames[g_buffer_index].image_ready;
+                submit_info.pWaitDstStageMask = &waitStage;
+                vk_check(vkQueueSubmit(g_rc->device->graphics_queue, 1, &submit_info, VK_NULL_HANDLE));
+            }
 
             resize_swapchain(g_swapchain);
 
@@ -1280,21 +1747,31 @@ namespace engine {
         for (std::size_t i = 0; i < buffers.size(); ++i)
             buffers[i] = cmdBuffers[i][g_buffer_index];
 
+        // Nothing is acquired or presented when headless so the submission
+        // only needs to signal the frame's fence.
         const VkPipelineStageFlags waitState = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
         VkSubmitInfo submit_info{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
-        submit_info.waitSemaphoreCount = 1;
+        submit_info.waitSemaphoreCount = g_headless ? 0 : 1;
         submit_info.pWaitSemaphores = &g_frames[g_buffer_index].image_ready;
         submit_info.pWaitDstStageMask = &waitState;
         submit_info.commandBufferCount = u32(buffers.size());
         submit_info.pCommandBuffers = buffers.data();
-        submit_info.signalSemaphoreCount = 1;
+        submit_info.signalSemaphoreCount = g_headless ? 0 : 1;
         submit_info.pSignalSemaphores = &g_frames[g_buffer_index].image_complete;
 
         vk_check(vkQueueSubmit(g_rc->device->graphics_queue, 1, &submit_info, g_frames[g_buffer_index].submit_fence));
+
+        g_frame_numbers[g_buffer_index] = ++g_submitted_frames;
     }
 
     bool present_swapchain_image()
     {
+        if (g_headless) {
+            g_buffer_index = (g_buffer_index + 1) % g_frames_in_flight;
+
+            return true;
+        }
+
         // TODO: This should be moved into its own function call. 
         // Once all framebuffers have been rendered to, we do a blit and then call 
         // present
@@ -1308,18 +1785,16 @@ namespace engine {
         present_info.pResults = nullptr;
         VkResult result = vkQueuePresentKHR(g_rc->device->graphics_queue, &present_info);
 
-        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
-            wait_for_gpu();
+        // The frame has been submitted even if it could not be presented so
+        // the next frame moves onto the next frame in flight either way.
+        g_buffer_index = (g_buffer_index + 1) % g_frames_in_flight;
 
+        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
             resize_swapchain(g_swapchain);
 
             return false;
         }
 
-        // Once the image has been shown onto the window, we can move onto the next
-        // frame, and so we increment the frame index.
-        g_buffer_index = (g_buffer_index + 1) % frames_in_flight;
-
         return true;
     }
 
@@ -1332,13 +1807,9 @@ namespace engine {
     void bind_descriptor_set(std::vector<VkCommandBuffer>& buffers,
         VkPipelineLayout layout, 
         const std::vector<VkDescriptorSet>& descriptorSets, 
-        std::vector<uint32_t> sizes)
+        const std::vector<uint32_t>& dynamic_offsets)
     {
-        std::vector<uint32_t> sz(sizes);
-        for (std::size_t i = 0; i < sz.size(); ++i)
-            sz[i] = static_cast<uint32_t>(pad_uniform_buffer_size(sizes[i])) * g_buffer_index;
-
-        vkCmdBindDescriptorSets(buffers[g_buffer_index], VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &descriptorSets[g_buffer_index], static_cast<uint32_t>(sz.size()), sz.data());
+        vkCmdBindDescriptorSets(buffers[g_buffer_index], VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &descriptorSets[g_buffer_index], u32(dynamic_offsets.size()), dynamic_offsets.data());
     }
 
     void bind_pipeline(std::vector<VkCommandBuffer>& buffers, const Vk_Pipeline& pipeline)
@@ -1346,10 +1817,9 @@ namespace engine {
         vkCmdBindPipeline(buffers[g_buffer_index], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.m_Pipeline);
     }
 
-    void render(const std::vector<VkCommandBuffer>& buffers, VkPipelineLayout layout, uint32_t index_count, const glm::mat4& matrix)
+    void render(const std::vector<VkCommandBuffer>& buffers, uint32_t index_count, uint32_t instance_count, uint32_t first_index, int32_t vertex_offset, uint32_t first_instance)
     {
-        vkCmdPushConstants(buffers[g_buffer_index], layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &matrix);
-        vkCmdDrawIndexed(buffers[g_buffer_index], index_count, 1, 0, 0, 0);
+        vkCmdDrawIndexed(buffers[g_buffer_index], index_count, instance_count, first_index, vertex_offset, first_instance);
     }
 
     void render(const std::vector<VkCommandBuffer>& buffers, uint32_t index_count)
@@ -1362,9 +1832,134 @@ namespace engine {
         vkCmdDraw(buffers[g_buffer_index], 3, 1, 0, 0);
     }
 
+    // Draws using commands that have been written to a buffer by the GPU. The
+    // number of draws actually executed is read from the count buffer.
+    void render_indirect_count(const std::vector<VkCommandBuffer>& buffers,
+        VkBuffer draw_buffer,
+        VkDeviceSize draw_offset,
+        VkBuffer count_buffer,
+        VkDeviceSize count_offset,
+        uint32_t max_draw_count,
+        uint32_t stride)
+    {
+        vkCmdDrawIndexedIndirectCount(buffers[g_buffer_index],
+            draw_buffer,
+            draw_offset,
+            count_buffer,
+            count_offset,
+            max_draw_count,
+            stride);
+    }
+
+    VkPipeline create_compute_pipeline(VkPipelineLayout layout, const vk_shader& shader)
+    {
+        VkPipeline pipeline{};
+
+        VkPipelineShaderStageCreateInfo stage_info{ VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+        stage_info.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        stage_info.module = shader.handle;
+        stage_info.pName = "main";
+
+        VkComputePipelineCreateInfo pipeline_info{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+        pipeline_info.stage = stage_info;
+        pipeline_info.layout = layout;
+
+        vk_check(vkCreateComputePipelines(g_rc->device->device, g_r->pipeline_cache, 1, &pipeline_info, nullptr, &pipeline));
+
+        return pipeline;
+    }
+
+    void bind_compute_pipeline(std::vector<VkCommandBuffer>& buffers, VkPipeline pipeline)
+    {
+        vkCmdBindPipeline(buffers[g_buffer_index], VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    }
+
+    void bind_compute_descriptor_set(std::vector<VkCommandBuffer>& buffers,
+        VkPipelineLayout layout,
+        const std::vector<VkDescriptorSet>& descriptorSets,
+        const std::vector<uint32_t>& dynamic_offsets)
+    {
+        vkCmdBindDescriptorSets(buffers[g_buffer_index], VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &descriptorSets[g_buffer_index], u32(dynamic_offsets.size()), dynamic_offsets.data());
+    }
+
+    void bind_compute_descriptor_set(std::vector<VkCommandBuffer>& buffers, VkPipelineLayout layout, VkDescriptorSet descriptor_set)
+    {
+        vkCmdBindDescriptorSets(buffers[g_buffer_index], VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &descriptor_set, 0, nullptr);
+    }
+
+    void push_constants(std::vector<VkCommandBuffer>& buffers, VkPipelineLayout layout, VkShaderStageFlags stages, uint32_t size, const void* data)
+    {
+        vkCmdPushConstants(buffers[g_buffer_index], layout, stages, 0, size, data);
+    }
+
+    void dispatch(std::vector<VkCommandBuffer>& buffers, uint32_t group_count_x, uint32_t group_count_y, uint32_t group_count_z)
+    {
+        vkCmdDispatch(buffers[g_buffer_index], group_count_x, group_count_y, group_count_z);
+    }
+
+    // A global memory barrier. Used to make compute shader results visible to
+    // later stages such as indirect draws and vertex shaders.
+    void memory_barrier(std::vector<VkCommandBuffer>& buffers,
+        VkPipelineStageFlags src_stage,
+        VkAccessFlags src_access,
+        VkPipelineStageFlags dst_stage,
+        VkAccessFlags dst_access)
+    {
+        VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+        barrier.srcAccessMask = src_access;
+        barrier.dstAccessMask = dst_access;
+
+        vkCmdPipelineBarrier(buffers[g_buffer_index], src_stage, dst_stage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    // Copies a single mip level of a color image into a buffer with the texels
+    // tightly packed.
+    void copy_image_to_buffer(std::vector<VkCommandBuffer>& buffers,
+        const Vk_Image& image,
+        uint32_t mip_level,
+        VkImageLayout layout,
+        VkBuffer buffer,
+        VkDeviceSize offset)
+    {
+        VkBufferImageCopy region{};
+        region.bufferOffset = offset;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = mip_level;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent.width = std::max(image.extent.width >> mip_level, 1u);
+        region.imageExtent.height = std::max(image.extent.height >> mip_level, 1u);
+        region.imageExtent.depth = 1;
+
+        vkCmdCopyImageToBuffer(buffers[g_buffer_index], image.handle, layout, buffer, 1, &region);
+    }
+
+    void copy_buffer(std::vector<VkCommandBuffer>& buffers,
+        VkBuffer source,
+        VkBuffer destination,
+        const std::vector<VkBufferCopy>& regions)
+    {
+        if (regions.empty())
+            return;
+
+        vkCmdCopyBuffer(buffers[g_buffer_index], source, destination, u32(regions.size()), regions.data());
+    }
+
     void wait_for_gpu()
     {
         vk_check(vkDeviceWaitIdle(g_rc->device->device));
+
+        // Anything retired while a frame is being recorded may still be used
+        // once that frame is submitted.
+        destroy_retired_resources(g_submitted_frames);
+    }
+
+    void defer_destruction(std::function<void()> destroy)
+    {
+        // The frame currently being recorded is submitted as the next frame.
+        g_retired_resources.push_back({ g_submitted_frames + 1, std::move(destroy) });
     }
 
     static VkBool32 debug_callback(VkDebugUtilsMessageSeverityFlagBitsEXT       messageSeverity,
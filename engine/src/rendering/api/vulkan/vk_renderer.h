@@ -8,7 +8,9 @@
 #include "vk_context.h"
 #include "vk_buffer.h"
 #include "vk_image.h"
+#include "vk_descriptor_sets.h"
 #include "vk_shader.h"
+#include "vk_vertex_array.h"
 
 #include "rendering/vertex.h"
 #include "rendering/entity.h"
@@ -51,6 +53,11 @@ namespace engine {
         uint32_t width;
         uint32_t height;
 
+        // The area that is rendered to which may be smaller than the
+        // attachments so that resizing does not reallocate them. Zero renders
+        // to the whole framebuffer.
+        VkExtent2D render_extent{};
+
         VkRenderPass render_pass;
 
         std::vector<VkClearValue> clear_values;
@@ -98,8 +105,11 @@ namespace engine {
         void enable_multisampling(VkSampleCountFlagBits samples);
         void set_color_blend(uint32_t blend_count); // temp
 
-        void create_pipeline();
+        // Values for the constant_id 0..n specialization constants of a stage
+        // set by set_shader_pipeline. All constants must be 32-bit.
+        void set_specialization_constants(VkShaderStageFlagBits stage, const std::vector<uint32_t>& constants);
 
+        void create_pipeline();
 
         VkPipelineLayout m_Layout;
         VkPipeline m_Pipeline;
@@ -112,6 +122,7 @@ namespace engine {
 
         std::optional<VkPipelineVertexInputStateCreateInfo> m_VertexInputInfo;
         std::vector<VkPipelineShaderStageCreateInfo> m_ShaderStageInfos;
+        std::vector<std::vector<uint32_t>> specialization_constants;
         VkPipelineInputAssemblyStateCreateInfo m_InputAssemblyInfo;
         VkPipelineRasterizationStateCreateInfo m_RasterizationInfo;
         std::optional<VkPipelineMultisampleStateCreateInfo> m_MultisampleInfo;
@@ -119,6 +130,14 @@ namespace engine {
         VkPipelineColorBlendStateCreateInfo m_BlendInfo;
     };
 
+    struct Vk_Command_Worker
+    {
+        VkCommandPool pool;
+
+        // A secondary command buffer for each frame in flight.
+        std::vector<VkCommandBuffer> buffers;
+    };
+
     struct vk_upload_context
     {
         VkFence         Fence;
@@ -131,10 +150,32 @@ namespace engine {
         vk_context ctx;
 
         vk_upload_context submit;
+#if defined(MY_ENGINE_COMPILE_SHADERS)
         shader_compiler compiler;
+#endif
 
         VkDescriptorPool descriptor_pool;
 
+        // Material textures when the GPU supports descriptor indexing. The
+        // set is null otherwise and every mesh binds its own material set.
+        Vk_Bindless_Set bindless;
+
+        // Per-frame uniform data such as the camera and scene information is
+        // sub-allocated from this persistently mapped buffer.
+        Vk_Frame_Allocator uniform_allocator;
+
+        // Per-instance data (model matrices) for instanced draw calls. Each
+        // frame's region is bound as a storage buffer and indexed using the
+        // firstInstance parameter of the draw.
+        Vk_Frame_Allocator instance_allocator;
+
+        // Shared vertex and index buffers that all model meshes live in.
+        vk_geometry_buffer geometry;
+
+        // Compiled pipelines persisted to disk between runs so that pipeline
+        // creation at startup can skip driver shader compilation.
+        VkPipelineCache pipeline_cache;
+
         VkDebugUtilsMessengerEXT messenger;
     };
 
@@ -143,25 +184,49 @@ namespace engine {
 
     void submit_to_gpu(const std::function<void(VkCommandBuffer)>& submit_func);
 
+    bool allocate_uniform_memory(VkDeviceSize size, Vk_Buffer_Slice& slice);
+    bool allocate_instance_memory(VkDeviceSize size, Vk_Buffer_Slice& slice, uint32_t& first_instance);
+
     Vk_Renderer* get_vulkan_renderer();
     vk_context& get_vulkan_context();
     uint32_t get_frame_buffer_index(); // in order
-    uint32_t get_frame_image_index(); // out of order
-    uint32_t get_swapchain_image_count();
+    uint32_t get_frame_image_index(); // slot of the per-image resources
+    uint32_t get_swapchain_image_count(); // number of per-image slots
+    VkExtent2D get_swapchain_extent();
+
+    // The number of frames the CPU may record ahead of the GPU which is at
+    // most max_frames_in_flight. Must only be changed once the GPU is idle.
+    uint32_t get_frame_in_flight_count();
+    void set_frame_in_flight_count(uint32_t count);
+
+    // Waits until the GPU has finished the frame that will be rendered next
+    // without acquiring an image. Waiting before input is sampled means the
+    // input is as fresh as possible once recording begins.
+    void wait_for_frame();
+
+    // True when the renderer was created without a window. There is no
+    // swapchain and the UI render pass cannot be created.
+    bool is_headless();
 
     void recreate_swapchain(buffer_mode buffer_mode, vsync_mode vsync);
 
     void add_framebuffer_attachment(Vk_Render_Pass& fb, VkImageUsageFlags usage, VkFormat format, VkExtent2D extent);
 
     void create_offscreen_render_pass(Vk_Render_Pass& rp);
+    void create_shadow_render_pass(Vk_Render_Pass& rp);
     void create_composite_render_pass(Vk_Render_Pass& rp);
     void create_skybox_render_pass(Vk_Render_Pass& rp);
     void create_ui_render_pass(Vk_Render_Pass& rp);
 
     void destroy_render_pass(Vk_Render_Pass& fb);
 
+    // Reallocates the attachments of fb at the new size. The old ones are
+    // destroyed once the frames in flight have finished with them.
     void resize_framebuffer(Vk_Render_Pass& fb, VkExtent2D extent);
 
+    // The render extent clamped to the framebuffer.
+    VkExtent2D get_render_extent(const Vk_Render_Pass& fb);
+
 
     std::vector<VkCommandBuffer> create_command_buffers();
 
@@ -172,15 +237,31 @@ namespace engine {
     void begin_render_pass(const std::vector<VkCommandBuffer>& cmd_buffer,
         const Vk_Render_Pass& fb,
         const VkClearColorValue& clear_color = { 0.0f, 0.0f, 0.0f, 1.0f },
-        const VkClearDepthStencilValue& depth_stencil = { 0.0f, 0 });
+        const VkClearDepthStencilValue& depth_stencil = { 0.0f, 0 },
+        VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
     void end_render_pass(std::vector<VkCommandBuffer>& buffers);
 
+    // Secondary command buffers that are recorded on a worker thread. Command
+    // pools must only be used by one thread at a time so each worker owns its
+    // own pool.
+    Vk_Command_Worker create_command_worker();
+    void destroy_command_worker(Vk_Command_Worker& worker);
+    void begin_secondary_command_buffer(const std::vector<VkCommandBuffer>& buffers, const Vk_Render_Pass& fb);
+    void execute_command_buffers(std::vector<VkCommandBuffer>& buffers, const std::vector<VkCommandBuffer>& secondary_buffers);
+
     VkPipelineLayout create_pipeline_layout(const std::vector<VkDescriptorSetLayout>& descriptor_sets,
         uint32_t push_constant_size = 0,
         VkShaderStageFlags push_constant_shader_stages = 0);
     void destroy_pipeline(VkPipeline pipeline);
     void destroy_pipeline_layout(VkPipelineLayout layout);
 
+    // Creates all pipelines in parallel.
+    void create_pipelines(const std::vector<Vk_Pipeline*>& pipelines);
+
+    // Returns true if a compatible cache was loaded from disk.
+    bool load_pipeline_cache(const std::filesystem::path& path);
+    void save_pipeline_cache(const std::filesystem::path& path);
+
     bool get_next_swapchain_image();
     void submit_gpu_work(const std::vector<std::vector<VkCommandBuffer>>& cmd_buffers);
     bool present_swapchain_image();
@@ -189,16 +270,54 @@ namespace engine {
     void bind_descriptor_set(std::vector<VkCommandBuffer>& buffers,
         VkPipelineLayout layout,
         const std::vector<VkDescriptorSet>& descriptorSets,
-        std::vector<uint32_t> sizes);
+        const std::vector<uint32_t>& dynamic_offsets);
     void bind_pipeline(std::vector<VkCommandBuffer>& buffers, const Vk_Pipeline& pipeline);
-    void render(const std::vector<VkCommandBuffer>& buffers, VkPipelineLayout layout, uint32_t index_count, const glm::mat4& matrix);
+    void render(const std::vector<VkCommandBuffer>& buffers, uint32_t index_count, uint32_t instance_count, uint32_t first_index, int32_t vertex_offset, uint32_t first_instance);
     void render(const std::vector<VkCommandBuffer>& buffers, uint32_t index_count);
     void render(const std::vector<VkCommandBuffer>& buffers);
+    void render_indirect_count(const std::vector<VkCommandBuffer>& buffers,
+        VkBuffer draw_buffer,
+        VkDeviceSize draw_offset,
+        VkBuffer count_buffer,
+        VkDeviceSize count_offset,
+        uint32_t max_draw_count,
+        uint32_t stride);
+
+    // Compute
+    VkPipeline create_compute_pipeline(VkPipelineLayout layout, const vk_shader& shader);
+    void bind_compute_pipeline(std::vector<VkCommandBuffer>& buffers, VkPipeline pipeline);
+    void bind_compute_descriptor_set(std::vector<VkCommandBuffer>& buffers,
+        VkPipelineLayout layout,
+        const std::vector<VkDescriptorSet>& descriptorSets,
+        const std::vector<uint32_t>& dynamic_offsets);
+    void bind_compute_descriptor_set(std::vector<VkCommandBuffer>& buffers, VkPipelineLayout layout, VkDescriptorSet descriptor_set);
+    void push_constants(std::vector<VkCommandBuffer>& buffers, VkPipelineLayout layout, VkShaderStageFlags stages, uint32_t size, const void* data);
+    void dispatch(std::vector<VkCommandBuffer>& buffers, uint32_t group_count_x, uint32_t group_count_y = 1, uint32_t group_count_z = 1);
+    void memory_barrier(std::vector<VkCommandBuffer>& buffers,
+        VkPipelineStageFlags src_stage,
+        VkAccessFlags src_access,
+        VkPipelineStageFlags dst_stage,
+        VkAccessFlags dst_access);
+    void copy_image_to_buffer(std::vector<VkCommandBuffer>& buffers,
+        const Vk_Image& image,
+        uint32_t mip_level,
+        VkImageLayout layout,
+        VkBuffer buffer,
+        VkDeviceSize offset);
+    void copy_buffer(std::vector<VkCommandBuffer>& buffers,
+        VkBuffer source,
+        VkBuffer destination,
+        const std::vector<VkBufferCopy>& regions);
 
     // Indicates to the GPU to wait for all commands to finish before continuing.
     // Often used when create or destroying resources in device local memory.
     void wait_for_gpu();
 
+    // Destroys the resource once every frame that may be using it, including
+    // the one currently being recorded, has completed on the GPU. Must only be
+    // called from the thread that submits frames.
+    void defer_destruction(std::function<void()> destroy);
+
     const auto attachments_to_images = [](const std::vector<vk_framebuffer_attachment>& attachments, uint32_t index)
     {
         std::vector<Vk_Image> images(attachments[index].image.size());
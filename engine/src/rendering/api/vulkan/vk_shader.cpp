@@ -4,7 +4,10 @@
 #include "vk_common.h"
 #include "vk_renderer.h"
 
+#include "../../shaders/shaders.h"
+
 namespace engine {
+#if defined(MY_ENGINE_COMPILE_SHADERS)
     static shaderc_shader_kind vulkan_to_shaderc_type(VkShaderStageFlagBits type)
     {
         switch (type) {
@@ -38,54 +41,262 @@ namespace engine {
     }
 
 
+    // Bump whenever the compile options change so that SPIR-V compiled with
+    // the old options is no longer picked up from the cache.
+    static constexpr uint64_t shader_cache_version = 1;
+
     shader_compiler create_shader_compiler()
     {
-        shader_compiler compiler{};
+        return {};
+    }
+
+    void destroy_shader_compiler(shader_compiler& compiler)
+    {
+        if (compiler.options)
+            shaderc_compile_options_release(compiler.options);
+        if (compiler.compiler)
+            shaderc_compiler_release(compiler.compiler);
+
+        compiler.options = nullptr;
+        compiler.compiler = nullptr;
+    }
+
+    void set_shader_cache_directory(const std::filesystem::path& directory)
+    {
+        Vk_Renderer* renderer = get_vulkan_renderer();
+
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+        if (ec) {
+            warn("Failed to create shader cache directory {}: {}", directory.string(), ec.message());
+            return;
+        }
+
+        renderer->compiler.cache_directory = directory;
+    }
+
+    static void initialize_shader_compiler(shader_compiler& compiler)
+    {
+        if (compiler.compiler)
+            return;
 
         // TODO: Check for potential initialization errors.
         compiler.compiler = shaderc_compiler_initialize();
         compiler.options = shaderc_compile_options_initialize();
 
         shaderc_compile_options_set_optimization_level(compiler.options, shaderc_optimization_level_performance);
+    }
+
+    // Written before the SPIR-V in each cache file so that a file truncated
+    // or corrupted by an interrupted write is detected and recompiled.
+    struct spirv_cache_header
+    {
+        uint32_t magic;
+        uint32_t word_count;
+        uint64_t hash;
+    };
+
+    static constexpr uint32_t spirv_cache_magic = 0x56505343; // "CSPV"
 
-        return compiler;
+    // 64-bit FNV-1a.
+    static uint64_t hash_bytes(uint64_t hash, const void* data, std::size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (std::size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+
+        return hash;
     }
 
-    void destroy_shader_compiler(shader_compiler& compiler)
+    static constexpr uint64_t fnv_offset_basis = 14695981039346656037ull;
+
+    // Hash of the shader source, stage and cache version.
+    static uint64_t get_shader_key(VkShaderStageFlagBits type, const std::string& code)
     {
-        shaderc_compile_options_release(compiler.options);
-        shaderc_compiler_release(compiler.compiler);
+        uint64_t hash = hash_bytes(fnv_offset_basis, code.data(), code.size());
+        hash = hash_bytes(hash, &type, sizeof(type));
+        hash = hash_bytes(hash, &shader_cache_version, sizeof(shader_cache_version));
+
+        return hash;
     }
 
-    static vk_shader create_shader(VkShaderStageFlagBits type, const std::string& code)
+    static std::vector<uint32_t> load_cached_spirv(const std::filesystem::path& path)
     {
-        vk_shader shader{};
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file.is_open())
+            return {};
+
+        const std::streamsize size = file.tellg();
+        if (size <= static_cast<std::streamsize>(sizeof(spirv_cache_header)))
+            return {};
+
+        spirv_cache_header header{};
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+        const std::streamsize spirv_size = size - static_cast<std::streamsize>(sizeof(header));
+        if (!file || header.magic != spirv_cache_magic ||
+            spirv_size != static_cast<std::streamsize>(header.word_count) * static_cast<std::streamsize>(sizeof(uint32_t)))
+            return {};
+
+        std::vector<uint32_t> spirv(header.word_count);
+        file.read(reinterpret_cast<char*>(spirv.data()), spirv_size);
+
+        // A SPIR-V module always begins with the magic number.
+        if (!file || spirv[0] != 0x07230203 ||
+            hash_bytes(fnv_offset_basis, spirv.data(), spirv.size() * sizeof(uint32_t)) != header.hash)
+            return {};
+
+        return spirv;
+    }
+
+    // Writes to a temporary file which is then renamed over the cache file so
+    // that an interrupted write never leaves a partial file behind. Shaders
+    // may be created on several threads so each uses its own temporary file.
+    static void save_cached_spirv(const std::filesystem::path& path, const std::vector<uint32_t>& spirv)
+    {
+        const std::size_t spirv_size = spirv.size() * sizeof(uint32_t);
 
-        const Vk_Renderer* renderer = get_vulkan_renderer();
+        spirv_cache_header header{};
+        header.magic = spirv_cache_magic;
+        header.word_count = u32(spirv.size());
+        header.hash = hash_bytes(fnv_offset_basis, spirv.data(), spirv_size);
 
-        shaderc_compilation_result_t result;
-        shaderc_compilation_status status;
+        std::filesystem::path temp_path = path;
+        temp_path += std::format(".{:x}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
 
-        result = shaderc_compile_into_spv(renderer->compiler.compiler,
+        {
+            std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(spirv.data()), spirv_size);
+            file.close();
+
+            if (!file) {
+                warn("Failed to write shader cache file {}.", temp_path.string());
+                std::error_code ec;
+                std::filesystem::remove(temp_path, ec);
+                return;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(temp_path, path, ec);
+        if (ec) {
+            warn("Failed to save shader cache file {}: {}", path.string(), ec.message());
+            std::filesystem::remove(temp_path, ec);
+        }
+    }
+
+    static std::vector<uint32_t> compile_spirv(VkShaderStageFlagBits type, const std::string& code, const char* name)
+    {
+        shader_compiler& compiler = get_vulkan_renderer()->compiler;
+        initialize_shader_compiler(compiler);
+
+        shaderc_compilation_result_t result = shaderc_compile_into_spv(compiler.compiler,
             code.data(),
             code.size(),
             vulkan_to_shaderc_type(type),
-            "",
+            name,
             "main",
-            renderer->compiler.options);
-        status = shaderc_result_get_compilation_status(result);
+            compiler.options);
 
-        if (status != shaderc_compilation_status_success) {
+        if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success) {
             error("Failed to compile shader {}.", shaderc_result_get_error_message(result));
+            shaderc_result_release(result);
+            return {};
+        }
+
+        const uint32_t* bytes = reinterpret_cast<const uint32_t*>(shaderc_result_get_bytes(result));
+        std::vector<uint32_t> spirv(bytes, bytes + shaderc_result_get_length(result) / sizeof(uint32_t));
+        shaderc_result_release(result);
+
+        return spirv;
+    }
+
+    // Reads a shader source and replaces each #include line with the file it
+    // names, relative to the including file. The expanded source is what the
+    // cache is keyed on so that editing an included file recompiles every
+    // shader using it.
+    static bool load_shader_source(const std::filesystem::path& path, std::string& source)
+    {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            warn("Failed to open shader source {}.", path.string());
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.starts_with("#include \"")) {
+                const std::size_t name_end = line.find('"', 10);
+                if (name_end != std::string::npos) {
+                    if (!load_shader_source(path.parent_path() / line.substr(10, name_end - 10), source))
+                        return false;
+                    continue;
+                }
+            }
+
+            source += line;
+            source += '\n';
+        }
+
+        return true;
+    }
+
+    static std::vector<uint32_t> compile_shader_source(VkShaderStageFlagBits type, const char* name)
+    {
+        std::string code;
+        if (!load_shader_source(get_shader_source_directory() / name, code))
             return {};
+
+        const std::filesystem::path& cache_directory = get_vulkan_renderer()->compiler.cache_directory;
+
+        std::filesystem::path cache_path;
+        std::vector<uint32_t> spirv;
+
+        if (!cache_directory.empty()) {
+            cache_path = cache_directory / std::format("{:016x}.spv", get_shader_key(type, code));
+            spirv = load_cached_spirv(cache_path);
+        }
+
+        if (spirv.empty()) {
+            spirv = compile_spirv(type, code, name);
+            if (spirv.empty())
+                return {};
+
+            if (!cache_path.empty())
+                save_cached_spirv(cache_path, spirv);
+        }
+
+        return spirv;
+    }
+#endif
+
+    static vk_shader create_shader(VkShaderStageFlagBits type, const Shader_Binary& binary)
+    {
+        vk_shader shader{};
+
+        const uint32_t* code = binary.spirv;
+        std::size_t code_size = binary.size;
+
+#if defined(MY_ENGINE_COMPILE_SHADERS)
+        const std::vector<uint32_t> spirv = compile_shader_source(type, binary.name);
+        if (!spirv.empty()) {
+            code = spirv.data();
+            code_size = spirv.size() * sizeof(uint32_t);
+        } else {
+            warn("Using the SPIR-V of {} built with the engine.", binary.name);
         }
+#endif
 
         // create shader module
         VkShaderModuleCreateInfo module_info{ VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
-        module_info.codeSize = u32(shaderc_result_get_length(result));
-        module_info.pCode = reinterpret_cast<const uint32_t*>(shaderc_result_get_bytes(result));
+        module_info.codeSize = code_size;
+        module_info.pCode = code;
 
-        vk_check(vkCreateShaderModule(renderer->ctx.device->device, &module_info, nullptr,
+        vk_check(vkCreateShaderModule(get_vulkan_renderer()->ctx.device->device, &module_info, nullptr,
             &shader.handle));
         shader.type = type;
 
@@ -100,13 +311,18 @@ namespace engine {
         vkDestroyShaderModule(rc.device->device, shader.handle, nullptr);
     }
 
-    vk_shader create_vertex_shader(const std::string& code)
+    vk_shader create_vertex_shader(const Shader_Binary& binary)
+    {
+        return create_shader(VK_SHADER_STAGE_VERTEX_BIT, binary);
+    }
+
+    vk_shader create_pixel_shader(const Shader_Binary& binary)
     {
-        return create_shader(VK_SHADER_STAGE_VERTEX_BIT, code);
+        return create_shader(VK_SHADER_STAGE_FRAGMENT_BIT, binary);
     }
 
-    vk_shader create_pixel_shader(const std::string& code)
+    vk_shader create_compute_shader(const Shader_Binary& binary)
     {
-        return create_shader(VK_SHADER_STAGE_FRAGMENT_BIT, code);
+        return create_shader(VK_SHADER_STAGE_COMPUTE_BIT, binary);
     }
 }
\ No newline at end of file
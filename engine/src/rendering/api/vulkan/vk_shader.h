@@ -2,11 +2,21 @@
 #define MY_ENGINE_VULKAN_SHADER_H
 
 namespace engine {
+    struct Shader_Binary;
+
+#if defined(MY_ENGINE_COMPILE_SHADERS)
+    // shaderc is only initialized the first time a shader is not found in the
+    // shader cache so that a warm start never pays for the compiler.
     struct shader_compiler
     {
         shaderc_compiler_t compiler = nullptr;
         shaderc_compile_options_t options = nullptr;
+
+        // Directory where compiled SPIR-V is stored, keyed by a hash of the
+        // shader source and compile options. Empty disables the cache.
+        std::filesystem::path cache_directory;
     };
+#endif
 
     struct vk_shader
     {
@@ -14,11 +24,17 @@ namespace engine {
         VkShaderStageFlagBits type;
     };
 
-
+#if defined(MY_ENGINE_COMPILE_SHADERS)
     shader_compiler create_shader_compiler();
     void destroy_shader_compiler(shader_compiler& compiler);
-    vk_shader create_vertex_shader(const std::string& code);
-    vk_shader create_pixel_shader(const std::string& code);
+    void set_shader_cache_directory(const std::filesystem::path& directory);
+#endif
+
+    // Builds with MY_ENGINE_COMPILE_SHADERS compile the binary's source file
+    // and only use the embedded SPIR-V if that fails.
+    vk_shader create_vertex_shader(const Shader_Binary& binary);
+    vk_shader create_pixel_shader(const Shader_Binary& binary);
+    vk_shader create_compute_shader(const Shader_Binary& binary);
     void destroy_shader(vk_shader& shader);
 }
 
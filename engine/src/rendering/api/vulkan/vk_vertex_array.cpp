@@ -55,4 +55,222 @@ namespace engine {
         vkCmdBindVertexBuffers(buffers[current_frame], 0, 1, &vertexArray.vertex_buffer.buffer, &offset);
         vkCmdBindIndexBuffer(buffers[current_frame], vertexArray.index_buffer.buffer, offset, VK_INDEX_TYPE_UINT32);
     }
+
+    // Default number of elements in a geometry block. Meshes larger than this
+    // get a block of their own.
+    static constexpr uint32_t block_vertex_count = 1024 * 1024;
+    static constexpr uint32_t block_index_count = 4 * 1024 * 1024;
+
+    static vk_geometry_block create_geometry_block(uint32_t vertex_capacity, uint32_t index_capacity)
+    {
+        vk_geometry_block block{};
+        block.vertex_capacity = vertex_capacity;
+        block.index_capacity = index_capacity;
+        block.arrays.vertex_buffer = create_gpu_buffer(vertex_capacity * sizeof(vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+        block.arrays.index_buffer = create_gpu_buffer(index_capacity * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+
+        return block;
+    }
+
+    // Returns the offset of the first free span with room for count elements
+    // falling back to the end of the block or UINT32_MAX if neither fit.
+    static uint32_t find_geometry_space(const std::vector<vk_geometry_span>& spans, uint32_t used, uint32_t capacity, uint32_t count)
+    {
+        for (const vk_geometry_span& span : spans) {
+            if (span.count >= count)
+                return span.offset;
+        }
+
+        return used + count <= capacity ? used : UINT32_MAX;
+    }
+
+    // Free spans always end before the used count so an offset equal to it
+    // can only be the end of the block.
+    static void take_geometry_space(std::vector<vk_geometry_span>& spans, uint32_t& used, uint32_t offset, uint32_t count)
+    {
+        if (offset == used) {
+            used += count;
+            return;
+        }
+
+        auto it = std::find_if(spans.begin(), spans.end(), [offset](const vk_geometry_span& span) {
+            return span.offset == offset;
+        });
+
+        it->offset += count;
+        it->count -= count;
+        if (it->count == 0)
+            spans.erase(it);
+    }
+
+    static void give_back_geometry_space(std::vector<vk_geometry_span>& spans, uint32_t& used)
+    {
+        if (!spans.empty() && spans.back().offset + spans.back().count == used) {
+            used = spans.back().offset;
+            spans.pop_back();
+        }
+    }
+
+    static void release_geometry_space(std::vector<vk_geometry_span>& spans, uint32_t& used, uint32_t offset, uint32_t count)
+    {
+        auto it = std::lower_bound(spans.begin(), spans.end(), offset, [](const vk_geometry_span& span, uint32_t value) {
+            return span.offset < value;
+        });
+        it = spans.insert(it, { offset, count });
+
+        const auto next = std::next(it);
+        if (next != spans.end() && it->offset + it->count == next->offset) {
+            it->count += next->count;
+            spans.erase(next);
+        }
+
+        if (it != spans.begin()) {
+            const auto previous = std::prev(it);
+            if (previous->offset + previous->count == it->offset) {
+                previous->count += it->count;
+                spans.erase(it);
+            }
+        }
+
+        give_back_geometry_space(spans, used);
+    }
+
+    static void rewind_geometry_space(std::vector<vk_geometry_span>& spans, uint32_t& used, uint32_t mark)
+    {
+        // The block may already have shrunk below the mark if ranges from
+        // before it were freed since.
+        used = std::min(used, mark);
+
+        while (!spans.empty() && spans.back().offset >= used)
+            spans.pop_back();
+
+        if (!spans.empty())
+            spans.back().count = std::min(spans.back().count, used - spans.back().offset);
+
+        give_back_geometry_space(spans, used);
+    }
+
+    vk_geometry_range upload_geometry(vk_geometry_buffer& geometry, const std::vector<vertex>& vertices, const std::vector<uint32_t>& indices)
+    {
+        const uint32_t vertex_count = u32(vertices.size());
+        const uint32_t index_count = u32(indices.size());
+
+        if (vertex_count == 0 || index_count == 0)
+            return {};
+
+        // Find the first block with enough space for both the vertices and
+        // indices, otherwise create a new one.
+        uint32_t block_index = 0;
+        uint32_t vertex_offset = 0;
+        uint32_t first_index = 0;
+        for (; block_index < geometry.blocks.size(); ++block_index) {
+            const vk_geometry_block& block = geometry.blocks[block_index];
+
+            vertex_offset = find_geometry_space(block.free_vertices, block.vertex_count, block.vertex_capacity, vertex_count);
+            first_index = find_geometry_space(block.free_indices, block.index_count, block.index_capacity, index_count);
+
+            if (vertex_offset != UINT32_MAX && first_index != UINT32_MAX)
+                break;
+        }
+
+        if (block_index == geometry.blocks.size()) {
+            geometry.blocks.push_back(create_geometry_block(std::max(vertex_count, block_vertex_count),
+                std::max(index_count, block_index_count)));
+
+            vertex_offset = 0;
+            first_index = 0;
+        }
+
+        vk_geometry_block& block = geometry.blocks[block_index];
+
+        vk_geometry_range range{};
+        range.block = block_index;
+        range.vertex_offset = static_cast<int32_t>(vertex_offset);
+        range.first_index = first_index;
+        range.index_count = index_count;
+        range.vertex_count = vertex_count;
+
+        const VkDeviceSize vertices_size = vertices.size() * sizeof(vertex);
+        const VkDeviceSize indices_size = indices.size() * sizeof(uint32_t);
+
+        Vk_Buffer vertex_staging_buffer = create_staging_buffer((void*)vertices.data(), vertices_size);
+        Vk_Buffer index_staging_buffer = create_staging_buffer((void*)indices.data(), indices_size);
+
+        // The copy only touches unused parts of the block so it does not
+        // interfere with any frames still reading from the same buffers.
+        // Freed ranges are only handed out again once no frame uses them.
+        submit_to_gpu([&](VkCommandBuffer cmd_buffer) {
+            VkBufferCopy vertex_copy_info{}, index_copy_info{};
+            vertex_copy_info.dstOffset = vertex_offset * sizeof(vertex);
+            vertex_copy_info.size = vertices_size;
+            index_copy_info.dstOffset = first_index * sizeof(uint32_t);
+            index_copy_info.size = indices_size;
+
+            vkCmdCopyBuffer(cmd_buffer, vertex_staging_buffer.buffer,
+                block.arrays.vertex_buffer.buffer, 1,
+                &vertex_copy_info);
+            vkCmdCopyBuffer(cmd_buffer, index_staging_buffer.buffer,
+                block.arrays.index_buffer.buffer, 1,
+                &index_copy_info);
+            });
+
+        destroy_buffer(index_staging_buffer);
+        destroy_buffer(vertex_staging_buffer);
+
+        take_geometry_space(block.free_vertices, block.vertex_count, vertex_offset, vertex_count);
+        take_geometry_space(block.free_indices, block.index_count, first_index, index_count);
+
+        return range;
+    }
+
+    void free_geometry(vk_geometry_buffer& geometry, const vk_geometry_range& range)
+    {
+        // Meshes without geometry were never given a range.
+        if (range.index_count == 0)
+            return;
+
+        vk_geometry_block& block = geometry.blocks[range.block];
+        release_geometry_space(block.free_vertices, block.vertex_count, u32(range.vertex_offset), range.vertex_count);
+        release_geometry_space(block.free_indices, block.index_count, range.first_index, range.index_count);
+    }
+
+    void destroy_geometry_buffer(vk_geometry_buffer& geometry)
+    {
+        for (vk_geometry_block& block : geometry.blocks)
+            destroy_vertex_array(block.arrays);
+
+        geometry.blocks.clear();
+    }
+
+    vk_geometry_mark get_geometry_mark(const vk_geometry_buffer& geometry)
+    {
+        vk_geometry_mark mark{};
+        mark.vertex_counts.reserve(geometry.blocks.size());
+        mark.index_counts.reserve(geometry.blocks.size());
+
+        for (const vk_geometry_block& block : geometry.blocks) {
+            mark.vertex_counts.push_back(block.vertex_count);
+            mark.index_counts.push_back(block.index_count);
+        }
+
+        return mark;
+    }
+
+    void rewind_geometry(vk_geometry_buffer& geometry, const vk_geometry_mark& mark)
+    {
+        // Blocks created after the mark are emptied rather than destroyed so
+        // that the next uploads do not need to allocate them again.
+        for (std::size_t i = 0; i < geometry.blocks.size(); ++i) {
+            vk_geometry_block& block = geometry.blocks[i];
+            const bool marked = i < mark.vertex_counts.size();
+
+            rewind_geometry_space(block.free_vertices, block.vertex_count, marked ? mark.vertex_counts[i] : 0);
+            rewind_geometry_space(block.free_indices, block.index_count, marked ? mark.index_counts[i] : 0);
+        }
+    }
+
+    void bind_geometry_block(const std::vector<VkCommandBuffer>& buffers, const vk_geometry_buffer& geometry, uint32_t block)
+    {
+        bind_vertex_array(buffers, geometry.blocks[block].arrays);
+    }
 }
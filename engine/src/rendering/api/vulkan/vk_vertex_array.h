@@ -13,10 +13,76 @@ namespace engine {
         uint32_t  index_count;
     };
 
+    // The location of a single mesh within a shared geometry buffer.
+    struct vk_geometry_range
+    {
+        uint32_t block;
+        int32_t  vertex_offset;
+        uint32_t first_index;
+        uint32_t index_count;
+        uint32_t vertex_count;
+    };
+
+    // A run of unused vertices or indices within a block.
+    struct vk_geometry_span
+    {
+        uint32_t offset;
+        uint32_t count;
+    };
+
+    struct vk_geometry_block
+    {
+        vk_vertex_array arrays;
+
+        uint32_t vertex_capacity;
+        uint32_t vertex_count;
+        uint32_t index_capacity;
+        uint32_t index_count;
+
+        // Freed ranges below the counts sorted by offset. Neighbouring spans
+        // are merged and a span that reaches the end of the used part of the
+        // block is given back to the count instead.
+        std::vector<vk_geometry_span> free_vertices;
+        std::vector<vk_geometry_span> free_indices;
+    };
+
+    // Meshes are sub-allocated from a small number of large vertex/index
+    // buffer pairs (blocks) instead of each mesh owning its own buffers. Draws
+    // then only need to rebind buffers when moving to a different block and
+    // GPU generated draw commands can address any mesh using offsets alone.
+    // Freed ranges are reused first fit before the end of a block is.
+    struct vk_geometry_buffer
+    {
+        std::vector<vk_geometry_block> blocks;
+    };
+
+    // The allocation position within each block. Rewinding to a mark releases
+    // the end of every block past it while keeping the blocks themselves for
+    // reuse. Ranges allocated after the mark from freed space must have been
+    // freed individually.
+    struct vk_geometry_mark
+    {
+        std::vector<uint32_t> vertex_counts;
+        std::vector<uint32_t> index_counts;
+    };
+
     vk_vertex_array create_vertex_array(const std::vector<vertex>& vertices, const std::vector<uint32_t>& indices);
     void destroy_vertex_array(vk_vertex_array& vertexArray);
 
     void bind_vertex_array(const std::vector<VkCommandBuffer>& buffers, const vk_vertex_array& vertex_array);
+
+    vk_geometry_range upload_geometry(vk_geometry_buffer& geometry, const std::vector<vertex>& vertices, const std::vector<uint32_t>& indices);
+
+    // The GPU must no longer be reading the range.
+    void free_geometry(vk_geometry_buffer& geometry, const vk_geometry_range& range);
+    void destroy_geometry_buffer(vk_geometry_buffer& geometry);
+
+    vk_geometry_mark get_geometry_mark(const vk_geometry_buffer& geometry);
+
+    // The GPU must no longer be reading any of the released ranges.
+    void rewind_geometry(vk_geometry_buffer& geometry, const vk_geometry_mark& mark);
+
+    void bind_geometry_block(const std::vector<VkCommandBuffer>& buffers, const vk_geometry_buffer& geometry, uint32_t block);
 }
 
 #endif
@@ -130,23 +130,22 @@ namespace engine {
         frustum.bottom.z = matrix[2].w + matrix[2].y;
         frustum.bottom.w = matrix[3].w + matrix[3].y;
 
-        // todo: first part might not be required
-        frustum.near.x = matrix[0].w + matrix[0].z;
-        frustum.near.y = matrix[1].w + matrix[1].z;
-        frustum.near.z = matrix[2].w + matrix[2].z;
-        frustum.near.w = matrix[3].w + matrix[3].z;
-
-        frustum.far.x = matrix[0].w - matrix[0].z;
-        frustum.far.y = matrix[1].w - matrix[1].z;
-        frustum.far.z = matrix[2].w - matrix[2].z;
-        frustum.far.w = matrix[3].w - matrix[3].z;
-
-        frustum.left = glm::normalize(frustum.left);
-        frustum.right = glm::normalize(frustum.right);
-        frustum.top = glm::normalize(frustum.top);
-        frustum.bottom = glm::normalize(frustum.bottom);
-        frustum.near = glm::normalize(frustum.near);
-        frustum.far = glm::normalize(frustum.far);
+        // The engine uses a [0, 1] depth range with reversed Z which means the
+        // near plane is at z = w and the far plane is at z = 0.
+        frustum.near.x = matrix[0].w - matrix[0].z;
+        frustum.near.y = matrix[1].w - matrix[1].z;
+        frustum.near.z = matrix[2].w - matrix[2].z;
+        frustum.near.w = matrix[3].w - matrix[3].z;
+
+        frustum.far.x = matrix[0].z;
+        frustum.far.y = matrix[1].z;
+        frustum.far.z = matrix[2].z;
+        frustum.far.w = matrix[3].z;
+
+        // Planes are normalized by the length of their normal only so that
+        // the w component becomes the signed distance from the origin.
+        for (glm::vec4* plane : { &frustum.left, &frustum.right, &frustum.top, &frustum.bottom, &frustum.near, &frustum.far })
+            *plane /= glm::length(glm::vec3(*plane));
 
         return frustum;
     }
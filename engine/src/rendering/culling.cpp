@@ -0,0 +1,298 @@
+#include "pch.h"
+#include "culling.h"
+
+#include "simd.h"
+
+#include <bit>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MY_ENGINE_CULL_SSE
+#endif
+
+#if defined(MY_ENGINE_CULL_SSE)
+#include <immintrin.h>
+#endif
+
+namespace engine {
+    // A frustum plane along with which corner of a box lies furthest along
+    // the planes normal. Selecting the corner up front means the kernel only
+    // needs to test a single corner per plane.
+    struct Cull_Plane
+    {
+        glm::vec4 plane;
+        bool max_x;
+        bool max_y;
+        bool max_z;
+    };
+
+    static std::array<Cull_Plane, 6> get_cull_planes(const camera_frustum& frustum)
+    {
+        const std::array<glm::vec4, 6> planes{
+            frustum.left, frustum.right, frustum.top, frustum.bottom, frustum.near, frustum.far
+        };
+
+        std::array<Cull_Plane, 6> cull_planes{};
+        for (std::size_t i = 0; i < planes.size(); ++i) {
+            cull_planes[i].plane = planes[i];
+            cull_planes[i].max_x = planes[i].x >= 0.0f;
+            cull_planes[i].max_y = planes[i].y >= 0.0f;
+            cull_planes[i].max_z = planes[i].z >= 0.0f;
+        }
+
+        return cull_planes;
+    }
+
+    void clear_bounds(Cull_Bounds& bounds)
+    {
+        bounds.min_x.clear();
+        bounds.min_y.clear();
+        bounds.min_z.clear();
+        bounds.max_x.clear();
+        bounds.max_y.clear();
+        bounds.max_z.clear();
+    }
+
+    void add_bounds(Cull_Bounds& bounds, const Bounding_Box& box, const glm::mat4& matrix)
+    {
+        // Transforming the center and projecting the extents onto each world
+        // axis gives the tightest box that contains the transformed box
+        // without having to transform all eight corners.
+        const glm::vec3 center = (box.min + box.max) * 0.5f;
+        const glm::vec3 extent = (box.max - box.min) * 0.5f;
+
+        const glm::vec3 world_center = glm::vec3(matrix * glm::vec4(center, 1.0f));
+        const glm::vec3 world_extent = glm::abs(glm::vec3(matrix[0])) * extent.x +
+            glm::abs(glm::vec3(matrix[1])) * extent.y +
+            glm::abs(glm::vec3(matrix[2])) * extent.z;
+
+        const glm::vec3 min = world_center - world_extent;
+        const glm::vec3 max = world_center + world_extent;
+
+        bounds.min_x.push_back(min.x);
+        bounds.min_y.push_back(min.y);
+        bounds.min_z.push_back(min.z);
+        bounds.max_x.push_back(max.x);
+        bounds.max_y.push_back(max.y);
+        bounds.max_z.push_back(max.z);
+    }
+
+#if defined(MY_ENGINE_CULL_SSE)
+    // Loads the first three rows of every column of four matrices with one
+    // matrix per lane.
+    static void load_matrix_lanes(const glm::mat4* matrices, const uint32_t* indices, __m128 (&m)[4][3])
+    {
+        for (int column = 0; column < 4; ++column) {
+            __m128 r0 = _mm_loadu_ps(&matrices[indices[0]][column][0]);
+            __m128 r1 = _mm_loadu_ps(&matrices[indices[1]][column][0]);
+            __m128 r2 = _mm_loadu_ps(&matrices[indices[2]][column][0]);
+            __m128 r3 = _mm_loadu_ps(&matrices[indices[3]][column][0]);
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+            m[column][0] = r0;
+            m[column][1] = r1;
+            m[column][2] = r2;
+        }
+    }
+#endif
+
+    void add_bounds(Cull_Bounds& bounds, const Bounding_Box& box, const glm::mat4* matrices, const uint32_t* indices, std::size_t count)
+    {
+        if (count == 0)
+            return;
+
+        const glm::vec3 center = (box.min + box.max) * 0.5f;
+        const glm::vec3 extent = (box.max - box.min) * 0.5f;
+
+        const std::size_t offset = bounds.min_x.size();
+        bounds.min_x.resize(offset + count);
+        bounds.min_y.resize(offset + count);
+        bounds.min_z.resize(offset + count);
+        bounds.max_x.resize(offset + count);
+        bounds.max_y.resize(offset + count);
+        bounds.max_z.resize(offset + count);
+
+        float* const mins[3] = { &bounds.min_x[offset], &bounds.min_y[offset], &bounds.min_z[offset] };
+        float* const maxs[3] = { &bounds.max_x[offset], &bounds.max_y[offset], &bounds.max_z[offset] };
+
+        std::size_t i = 0;
+
+        if (count >= 8 && has_avx2()) {
+            const float box_center[3] = { center.x, center.y, center.z };
+            const float box_extent[3] = { extent.x, extent.y, extent.z };
+            i = add_bounds_avx2(box_center, box_extent, glm::value_ptr(matrices[0]), indices, count, mins, maxs);
+        }
+
+        // Same as the single box version with one box per lane. Each row of
+        // the world center and extent only needs that row of every column.
+#if defined(MY_ENGINE_CULL_SSE)
+        const __m128 sign_mask = _mm_set1_ps(-0.0f);
+        for (; i + 4 <= count; i += 4) {
+            __m128 m[4][3];
+            load_matrix_lanes(matrices, indices + i, m);
+
+            for (int row = 0; row < 3; ++row) {
+                __m128 world_center = m[3][row];
+                world_center = _mm_add_ps(world_center, _mm_mul_ps(m[0][row], _mm_set1_ps(center.x)));
+                world_center = _mm_add_ps(world_center, _mm_mul_ps(m[1][row], _mm_set1_ps(center.y)));
+                world_center = _mm_add_ps(world_center, _mm_mul_ps(m[2][row], _mm_set1_ps(center.z)));
+
+                __m128 world_extent = _mm_mul_ps(_mm_andnot_ps(sign_mask, m[0][row]), _mm_set1_ps(extent.x));
+                world_extent = _mm_add_ps(world_extent, _mm_mul_ps(_mm_andnot_ps(sign_mask, m[1][row]), _mm_set1_ps(extent.y)));
+                world_extent = _mm_add_ps(world_extent, _mm_mul_ps(_mm_andnot_ps(sign_mask, m[2][row]), _mm_set1_ps(extent.z)));
+
+                _mm_storeu_ps(mins[row] + i, _mm_sub_ps(world_center, world_extent));
+                _mm_storeu_ps(maxs[row] + i, _mm_add_ps(world_center, world_extent));
+            }
+        }
+#endif
+
+        // Remaining boxes or every box when SIMD is not available.
+        for (; i < count; ++i) {
+            const glm::mat4& matrix = matrices[indices[i]];
+
+            for (int row = 0; row < 3; ++row) {
+                const float world_center = matrix[3][row] + matrix[0][row] * center.x + matrix[1][row] * center.y + matrix[2][row] * center.z;
+                const float world_extent = std::abs(matrix[0][row]) * extent.x + std::abs(matrix[1][row]) * extent.y + std::abs(matrix[2][row]) * extent.z;
+
+                mins[row][i] = world_center - world_extent;
+                maxs[row][i] = world_center + world_extent;
+            }
+        }
+    }
+
+    static bool is_box_visible(const std::array<Cull_Plane, 6>& planes, const Cull_Bounds& bounds, std::size_t i)
+    {
+        for (const Cull_Plane& p : planes) {
+            const float x = p.max_x ? bounds.max_x[i] : bounds.min_x[i];
+            const float y = p.max_y ? bounds.max_y[i] : bounds.min_y[i];
+            const float z = p.max_z ? bounds.max_z[i] : bounds.min_z[i];
+
+            if (p.plane.x * x + p.plane.y * y + p.plane.z * z + p.plane.w < 0.0f)
+                return false;
+        }
+
+        return true;
+    }
+
+    uint32_t cull_bounds(const camera_frustum& frustum, const Cull_Bounds& bounds, std::vector<uint32_t>& visible)
+    {
+        const std::array<Cull_Plane, 6> planes = get_cull_planes(frustum);
+        const std::size_t count = bounds.min_x.size();
+
+        visible.resize(count);
+        uint32_t visible_count = 0;
+        std::size_t i = 0;
+
+        if (count >= 8 && has_avx2()) {
+            float plane_values[6][4];
+            for (std::size_t p = 0; p < planes.size(); ++p) {
+                for (int c = 0; c < 4; ++c)
+                    plane_values[p][c] = planes[p].plane[c];
+            }
+
+            const float* const mins[3] = { bounds.min_x.data(), bounds.min_y.data(), bounds.min_z.data() };
+            const float* const maxs[3] = { bounds.max_x.data(), bounds.max_y.data(), bounds.max_z.data() };
+            i = cull_bounds_avx2(plane_values, mins, maxs, count, visible.data(), visible_count);
+        }
+
+#if defined(MY_ENGINE_CULL_SSE)
+        for (; i + 4 <= count; i += 4) {
+            const __m128 min_x = _mm_loadu_ps(&bounds.min_x[i]);
+            const __m128 min_y = _mm_loadu_ps(&bounds.min_y[i]);
+            const __m128 min_z = _mm_loadu_ps(&bounds.min_z[i]);
+            const __m128 max_x = _mm_loadu_ps(&bounds.max_x[i]);
+            const __m128 max_y = _mm_loadu_ps(&bounds.max_y[i]);
+            const __m128 max_z = _mm_loadu_ps(&bounds.max_z[i]);
+
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (const Cull_Plane& p : planes) {
+                __m128 distance = _mm_mul_ps(_mm_set1_ps(p.plane.x), p.max_x ? max_x : min_x);
+                distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(p.plane.y), p.max_y ? max_y : min_y));
+                distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(p.plane.z), p.max_z ? max_z : min_z));
+                distance = _mm_add_ps(distance, _mm_set1_ps(p.plane.w));
+
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+            }
+
+            int mask = _mm_movemask_ps(inside);
+            while (mask) {
+                const int lane = std::countr_zero(static_cast<unsigned int>(mask));
+                visible[visible_count++] = static_cast<uint32_t>(i + lane);
+                mask &= mask - 1;
+            }
+        }
+#endif
+
+        // Remaining boxes or every box when SIMD is not available.
+        for (; i < count; ++i) {
+            if (is_box_visible(planes, bounds, i))
+                visible[visible_count++] = static_cast<uint32_t>(i);
+        }
+
+        visible.resize(visible_count);
+
+        return visible_count;
+    }
+
+    static bool is_box_occluded(const Cull_Depth_Buffer& depth, const Cull_Bounds& bounds, std::size_t i)
+    {
+        glm::vec2 uv_min(1.0f);
+        glm::vec2 uv_max(0.0f);
+        float closest = 0.0f;
+
+        for (int corner = 0; corner < 8; ++corner) {
+            const glm::vec4 position(
+                corner & 1 ? bounds.max_x[i] : bounds.min_x[i],
+                corner & 2 ? bounds.max_y[i] : bounds.min_y[i],
+                corner & 4 ? bounds.max_z[i] : bounds.min_z[i],
+                1.0f);
+
+            const glm::vec4 clip = depth.view_proj * position;
+
+            // Boxes that cross the camera plane cannot be projected.
+            if (clip.w <= 0.0f)
+                return false;
+
+            const glm::vec3 ndc = glm::vec3(clip) / clip.w;
+            uv_min = glm::min(uv_min, glm::vec2(ndc) * 0.5f + 0.5f);
+            uv_max = glm::max(uv_max, glm::vec2(ndc) * 0.5f + 0.5f);
+            closest = std::max(closest, ndc.z);
+        }
+
+        const auto to_texel = [](float uv, uint32_t size) {
+            return std::min(static_cast<uint32_t>(std::clamp(uv, 0.0f, 1.0f) * size), size - 1);
+        };
+
+        const uint32_t x_begin = to_texel(uv_min.x, depth.width);
+        const uint32_t y_begin = to_texel(uv_min.y, depth.height);
+        const uint32_t x_end = to_texel(uv_max.x, depth.width);
+        const uint32_t y_end = to_texel(uv_max.y, depth.height);
+
+        // The engine uses reversed Z so the box is hidden only if its closest
+        // point is farther (smaller) than every depth it covers.
+        for (uint32_t y = y_begin; y <= y_end; ++y) {
+            for (uint32_t x = x_begin; x <= x_end; ++x) {
+                if (closest >= depth.depths[y * depth.width + x])
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    uint32_t cull_occluded_bounds(const Cull_Depth_Buffer& depth, const Cull_Bounds& bounds, std::vector<uint32_t>& visible)
+    {
+        if (!depth.depths)
+            return u32(visible.size());
+
+        uint32_t visible_count = 0;
+        for (uint32_t index : visible) {
+            if (!is_box_occluded(depth, bounds, index))
+                visible[visible_count++] = index;
+        }
+
+        visible.resize(visible_count);
+
+        return visible_count;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef MY_ENGINE_CULLING_H
+#define MY_ENGINE_CULLING_H
+
+#include "camera.h"
+#include "model.h"
+
+namespace engine {
+    // World space bounding boxes stored as a structure of arrays so that the
+    // culling kernel can load the same component of several boxes at once.
+    struct Cull_Bounds
+    {
+        std::vector<float> min_x;
+        std::vector<float> min_y;
+        std::vector<float> min_z;
+        std::vector<float> max_x;
+        std::vector<float> max_y;
+        std::vector<float> max_z;
+    };
+
+    void clear_bounds(Cull_Bounds& bounds);
+
+    // Transforms a model space box by matrix and appends the resulting world
+    // space box.
+    void add_bounds(Cull_Bounds& bounds, const Bounding_Box& box, const glm::mat4& matrix);
+
+    // Appends the world space boxes of count objects sharing the same model
+    // space box where object i uses matrices[indices[i]]. Eight boxes are
+    // transformed at once with AVX2 or four with SSE when the CPU supports
+    // it.
+    void add_bounds(Cull_Bounds& bounds, const Bounding_Box& box, const glm::mat4* matrices, const uint32_t* indices, std::size_t count);
+
+    // Tests every box against the frustum and writes the indices of the boxes
+    // that are at least partially inside into visible. Returns the number of
+    // visible boxes.
+    uint32_t cull_bounds(const camera_frustum& frustum, const Cull_Bounds& bounds, std::vector<uint32_t>& visible);
+
+    // A level of the depth pyramid that has been read back to the CPU along
+    // with the view projection that the depth was rendered with.
+    struct Cull_Depth_Buffer
+    {
+        const float* depths = nullptr;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        glm::mat4 view_proj = glm::mat4(1.0f);
+    };
+
+    // Removes the boxes in visible that are completely hidden behind the depth
+    // buffer. Returns the number of boxes that remain visible.
+    uint32_t cull_occluded_bounds(const Cull_Depth_Buffer& depth, const Cull_Bounds& bounds, std::vector<uint32_t>& visible);
+}
+
+#endif
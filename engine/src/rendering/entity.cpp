@@ -2,71 +2,531 @@
 #include "entity.h"
 
 #include "api/vulkan/vk_renderer.h"
+#include "utils/profiler.h"
 
 namespace engine {
-    Entity create_entity(int id, int model_index, const std::string& name)
+    uint32_t create_entity(Entity_Storage& entities, uint32_t model_index, const std::string& name, bool log)
     {
-        Entity entity{};
-        entity.id = id;
-        entity.name = name;
-        entity.model_index = model_index;
-        entity.matrix = glm::mat4(1.0f);
+        const uint32_t id = entities.next_id++;
+        const uint32_t index = static_cast<uint32_t>(entities.ids.size());
 
-        info("Entity {} with ID ({}) created.", entity.name, entity.id);
+        add_transform(entities.local_transforms, glm::vec3(0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f));
+        entities.world_transforms.push_back(glm::mat4(1.0f));
+        entities.parents.push_back(no_parent_entity);
+        entities.first_children.push_back(UINT32_MAX);
+        entities.next_siblings.push_back(UINT32_MAX);
+        entities.previous_siblings.push_back(UINT32_MAX);
+        entities.model_indices.push_back(model_index);
+        entities.names.push_back(name);
+        entities.ids.push_back(id);
+        entities.dirty.push_back(0);
 
-        return entity;
+        if (entities.model_counts.size() <= model_index)
+            entities.model_counts.resize(model_index + 1, 0);
+        ++entities.model_counts[model_index];
+
+        mark_entity_dirty(entities, index);
+
+        if (entities.id_indices.size() <= id)
+            entities.id_indices.resize(id + 1, UINT32_MAX);
+        entities.id_indices[id] = index;
+
+        if (log)
+            info("Entity {} with ID ({}) created.", name, id);
+
+        return index;
+    }
+
+    // Swap and pop so that removal is constant time no matter where the
+    // entity is.
+    template <typename T>
+    static void remove_component(std::vector<T>& components, uint32_t index)
+    {
+        if (index + 1 != components.size())
+            components[index] = std::move(components.back());
+
+        components.pop_back();
+    }
+
+    // Calls func(child) for every direct child. func may move the child to
+    // another parent.
+    template <typename Func>
+    static void for_each_child(const Entity_Storage& entities, uint32_t index, Func func)
+    {
+        for (uint32_t id = entities.first_children[index]; id != UINT32_MAX;) {
+            const uint32_t child = find_entity(entities, id);
+            id = entities.next_siblings[child];
+
+            func(child);
+        }
+    }
+
+    // Adds the entity to the front of the children of parent.
+    static void link_child(Entity_Storage& entities, uint32_t index, uint32_t parent)
+    {
+        const uint32_t id = entities.ids[index];
+        const uint32_t next = entities.first_children[parent];
+
+        if (next != UINT32_MAX)
+            entities.previous_siblings[find_entity(entities, next)] = id;
+
+        entities.next_siblings[index] = next;
+        entities.previous_siblings[index] = UINT32_MAX;
+        entities.first_children[parent] = id;
+    }
+
+    // Removes the entity from the children of its parent.
+    static void unlink_child(Entity_Storage& entities, uint32_t index)
+    {
+        const uint32_t parent = entities.parents[index];
+        if (parent == no_parent_entity)
+            return;
+
+        const uint32_t previous = entities.previous_siblings[index];
+        const uint32_t next = entities.next_siblings[index];
+
+        if (previous != UINT32_MAX)
+            entities.next_siblings[find_entity(entities, previous)] = next;
+        else
+            entities.first_children[parent] = next;
+
+        if (next != UINT32_MAX)
+            entities.previous_siblings[find_entity(entities, next)] = previous;
+
+        entities.next_siblings[index] = UINT32_MAX;
+        entities.previous_siblings[index] = UINT32_MAX;
+    }
+
+    static void mark_entities_changed(Entity_Storage& entities, uint32_t first, uint32_t count)
+    {
+        if (entities.all_changed)
+            return;
+
+        if (entities.changed.size() + count > entities.ids.size()) {
+            entities.changed.clear();
+            entities.all_changed = true;
+            return;
+        }
+
+        for (uint32_t i = first; i < first + count; ++i)
+            entities.changed.push_back(i);
+    }
+
+    // Keeps the full matrix when translation, rotation and scale cannot
+    // express it so that shear is not lost.
+    static void set_local_matrix(Entity_Storage& entities, uint32_t index, const glm::mat4& matrix)
+    {
+        set_transform(entities.local_transforms, index, matrix);
+
+        const uint32_t id = entities.ids[index];
+        if (is_trs_matrix(matrix))
+            entities.local_matrices.erase(id);
+        else
+            entities.local_matrices[id] = matrix;
+    }
+
+    static glm::mat4 get_local_matrix(const Entity_Storage& entities, uint32_t index)
+    {
+        const auto it = entities.local_matrices.find(entities.ids[index]);
+        return it != entities.local_matrices.end() ? it->second : compose_transform(entities.local_transforms, index);
+    }
+
+    // Multiplies the local matrix of the entity by change if it has one.
+    // Returns false if the entity only has translation, rotation and scale.
+    static bool edit_local_matrix(Entity_Storage& entities, uint32_t index, const glm::mat4& change)
+    {
+        const auto it = entities.local_matrices.find(entities.ids[index]);
+        if (it == entities.local_matrices.end())
+            return false;
+
+        const glm::mat4 matrix = it->second * change;
+        set_local_matrix(entities, index, matrix);
+        mark_entity_dirty(entities, index);
+
+        return true;
+    }
+
+    void remove_entity(Entity_Storage& entities, uint32_t index)
+    {
+        assert(index < entities.ids.size());
+
+        const uint32_t parent = entities.parents[index];
+        unlink_child(entities, index);
+
+        // Folding the removed local transform into each child keeps the
+        // children where they are in the world.
+        const glm::mat4 local = get_local_matrix(entities, index);
+        for_each_child(entities, index, [&](uint32_t child) {
+            set_local_matrix(entities, child, local * get_local_matrix(entities, child));
+            entities.parents[child] = parent;
+
+            if (parent != no_parent_entity) {
+                link_child(entities, child, parent);
+            } else {
+                entities.next_siblings[child] = UINT32_MAX;
+                entities.previous_siblings[child] = UINT32_MAX;
+            }
+
+            mark_entity_dirty(entities, child);
+        });
+
+        const uint32_t last = static_cast<uint32_t>(entities.ids.size() - 1);
+        entities.id_indices[entities.ids[index]] = UINT32_MAX;
+        entities.local_matrices.erase(entities.ids[index]);
+        --entities.model_counts[entities.model_indices[index]];
+
+        if (index != last) {
+            entities.id_indices[entities.ids[last]] = index;
+            mark_entities_changed(entities, index, 1);
+
+            for_each_child(entities, last, [&](uint32_t child) {
+                entities.parents[child] = index;
+            });
+
+            // The moved entity may now come before its parent or after its
+            // children.
+            const uint32_t moved_parent = entities.parents[last];
+            if ((moved_parent != no_parent_entity && moved_parent > index) || entities.first_children[last] != UINT32_MAX)
+                entities.unordered = true;
+
+            if (entities.dirty[last])
+                entities.first_dirty = std::min(entities.first_dirty, index);
+        }
+
+        for_each_transform_array(entities.local_transforms, [index](std::vector<float>& component) {
+            remove_component(component, index);
+        });
+        remove_component(entities.world_transforms, index);
+        remove_component(entities.parents, index);
+        remove_component(entities.first_children, index);
+        remove_component(entities.next_siblings, index);
+        remove_component(entities.previous_siblings, index);
+        remove_component(entities.model_indices, index);
+        remove_component(entities.names, index);
+        remove_component(entities.ids, index);
+        remove_component(entities.dirty, index);
+    }
+
+    void remove_model_entities(Entity_Storage& entities, uint32_t model_index)
+    {
+        // Going backwards means the entity swapped into a removed slot has
+        // already been visited.
+        for (std::size_t i = entities.ids.size(); i-- > 0;) {
+            if (entities.model_indices[i] == model_index)
+                remove_entity(entities, static_cast<uint32_t>(i));
+            else if (entities.model_indices[i] > model_index)
+                --entities.model_indices[i];
+        }
+
+        if (model_index < entities.model_counts.size())
+            entities.model_counts.erase(entities.model_counts.begin() + model_index);
+
+        // Most model indices may have changed.
+        entities.changed.clear();
+        entities.all_changed = true;
+    }
+
+    void clear_entities(Entity_Storage& entities)
+    {
+        for_each_transform_array(entities.local_transforms, [](std::vector<float>& component) {
+            component.clear();
+        });
+        entities.world_transforms.clear();
+        entities.local_matrices.clear();
+        entities.parents.clear();
+        entities.first_children.clear();
+        entities.next_siblings.clear();
+        entities.previous_siblings.clear();
+        entities.model_indices.clear();
+        entities.model_counts.clear();
+        entities.names.clear();
+        entities.ids.clear();
+        entities.dirty.clear();
+        entities.id_indices.clear();
+        entities.first_dirty = UINT32_MAX;
+        entities.unordered = false;
+        entities.changed.clear();
+        entities.all_changed = true;
+    }
+
+    void reserve_entities(Entity_Storage& entities, std::size_t count)
+    {
+        for_each_transform_array(entities.local_transforms, [count](std::vector<float>& component) {
+            component.reserve(count);
+        });
+        entities.world_transforms.reserve(count);
+        entities.parents.reserve(count);
+        entities.first_children.reserve(count);
+        entities.next_siblings.reserve(count);
+        entities.previous_siblings.reserve(count);
+        entities.model_indices.reserve(count);
+        entities.names.reserve(count);
+        entities.ids.reserve(count);
+        entities.dirty.reserve(count);
+    }
+
+    uint32_t find_entity(const Entity_Storage& entities, uint32_t id)
+    {
+        return id < entities.id_indices.size() ? entities.id_indices[id] : UINT32_MAX;
+    }
+
+    bool set_entity_parent(Entity_Storage& entities, uint32_t index, uint32_t parent)
+    {
+        assert(index < entities.ids.size());
+
+        // Walking up from the new parent must never reach the entity.
+        for (uint32_t ancestor = parent; ancestor != no_parent_entity; ancestor = entities.parents[ancestor]) {
+            if (ancestor == index)
+                return false;
+        }
+
+        const uint32_t id = entities.ids[index];
+        const uint32_t parent_id = parent != no_parent_entity ? entities.ids[parent] : UINT32_MAX;
+
+        // The current world transforms are needed to keep the entity in
+        // place. Updating may reorder so the indices are looked up again.
+        update_entity_transforms(entities);
+        index = find_entity(entities, id);
+        parent = parent != no_parent_entity ? find_entity(entities, parent_id) : no_parent_entity;
+
+        unlink_child(entities, index);
+
+        entities.parents[index] = parent;
+        if (parent != no_parent_entity) {
+            link_child(entities, index, parent);
+            if (parent > index)
+                entities.unordered = true;
+        }
+
+        set_entity_world_transform(entities, index, entities.world_transforms[index]);
+
+        return true;
+    }
+
+    void set_entity_world_transform(Entity_Storage& entities, uint32_t index, const glm::mat4& transform)
+    {
+        const uint32_t parent = entities.parents[index];
+
+        set_local_matrix(entities, index, parent != no_parent_entity ?
+            glm::inverse(entities.world_transforms[parent]) * transform : transform);
+
+        mark_entity_dirty(entities, index);
+    }
+
+    template <typename T>
+    static void sort_component(std::vector<T>& components, const std::vector<uint32_t>& order)
+    {
+        std::vector<T> sorted;
+        sorted.reserve(components.size());
+        for (uint32_t i : order)
+            sorted.push_back(std::move(components[i]));
+
+        components = std::move(sorted);
+    }
+
+    // Restores the parent first order with a counting sort by depth. Entities
+    // of the same depth keep their relative order.
+    static void sort_entities(Entity_Storage& entities)
+    {
+        PROFILE_ZONE("sort_entities");
+
+        const uint32_t count = static_cast<uint32_t>(entities.ids.size());
+
+        // Depths are filled in by walking up to the nearest ancestor whose
+        // depth is known so every entity is visited a constant number of times.
+        std::vector<uint32_t> depths(count, UINT32_MAX);
+        std::vector<uint32_t> path;
+        uint32_t max_depth = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t node = i;
+            while (node != no_parent_entity && depths[node] == UINT32_MAX) {
+                path.push_back(node);
+                node = entities.parents[node];
+            }
+
+            uint32_t depth = node != no_parent_entity ? depths[node] + 1 : 0;
+            for (auto it = path.rbegin(); it != path.rend(); ++it)
+                depths[*it] = depth++;
+            path.clear();
+
+            max_depth = std::max(max_depth, depths[i]);
+        }
+
+        std::vector<uint32_t> offsets(max_depth + 2, 0);
+        for (uint32_t depth : depths)
+            ++offsets[depth + 1];
+        for (std::size_t i = 1; i < offsets.size(); ++i)
+            offsets[i] += offsets[i - 1];
+
+        std::vector<uint32_t> order(count);
+        std::vector<uint32_t> new_indices(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            const uint32_t new_index = offsets[depths[i]]++;
+            order[new_index] = i;
+            new_indices[i] = new_index;
+        }
+
+        for_each_transform_array(entities.local_transforms, [&order](std::vector<float>& component) {
+            sort_component(component, order);
+        });
+        sort_component(entities.world_transforms, order);
+        sort_component(entities.parents, order);
+        sort_component(entities.first_children, order);
+        sort_component(entities.next_siblings, order);
+        sort_component(entities.previous_siblings, order);
+        sort_component(entities.model_indices, order);
+        sort_component(entities.names, order);
+        sort_component(entities.ids, order);
+        sort_component(entities.dirty, order);
+
+        entities.first_dirty = UINT32_MAX;
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t& parent = entities.parents[i];
+            if (parent != no_parent_entity)
+                parent = new_indices[parent];
+
+            entities.id_indices[entities.ids[i]] = i;
+
+            if (entities.dirty[i])
+                entities.first_dirty = std::min(entities.first_dirty, i);
+        }
+
+        entities.unordered = false;
+        entities.changed.clear();
+        entities.all_changed = true;
     }
 
+    void update_entity_transforms(Entity_Storage& entities)
+    {
+        if (entities.unordered)
+            sort_entities(entities);
+
+        const uint32_t count = static_cast<uint32_t>(entities.ids.size());
+        const uint32_t first = entities.first_dirty;
+        entities.first_dirty = UINT32_MAX;
+        if (first >= count)
+            return;
+
+        PROFILE_ZONE("update_entity_transforms");
+
+        const uint32_t* parents = entities.parents.data();
+        glm::mat4* worlds = entities.world_transforms.data();
+        uint8_t* dirty = entities.dirty.data();
+
+        // Parents come first so by the time an entity is reached its parent's
+        // flag says whether the parent changed this update. Entities before
+        // the first dirty one cannot have a dirty parent.
+        for (uint32_t i = first; i < count; ++i) {
+            const uint32_t parent = parents[i];
+            if (parent != no_parent_entity)
+                dirty[i] |= dirty[parent];
+        }
+
+        // Runs of dirty entities are composed in batches and then multiplied
+        // by their parents in order. A parent is either before the run and
+        // final already or earlier in the same run.
+        for (uint32_t i = first; i < count;) {
+            if (!dirty[i]) {
+                ++i;
+                continue;
+            }
+
+            uint32_t end = i + 1;
+            while (end < count && dirty[end])
+                ++end;
+
+            compose_transforms(entities.local_transforms, i, end - i, worlds + i);
+            mark_entities_changed(entities, i, end - i);
 
-    void translate_entity(Entity& e, const glm::vec3& position)
+            if (!entities.local_matrices.empty()) {
+                for (uint32_t j = i; j < end; ++j) {
+                    const auto it = entities.local_matrices.find(entities.ids[j]);
+                    if (it != entities.local_matrices.end())
+                        worlds[j] = it->second;
+                }
+            }
+
+            apply_parent_transforms(parents, i, end - i, worlds);
+
+            i = end;
+        }
+
+        std::fill(entities.dirty.begin() + first, entities.dirty.end(), uint8_t(0));
+    }
+
+    void translate_entity(Entity_Storage& entities, uint32_t index, const glm::vec3& position)
     {
-        // ensure that before translating the matrix is an identity
-        //assert(e.matrix == glm::identity<glm::mat4>());
+        if (edit_local_matrix(entities, index, glm::translate(glm::mat4(1.0f), position)))
+            return;
+
+        Transform_Components& transforms = entities.local_transforms;
+        const glm::vec3 offset = get_rotation(transforms, index) * (get_scale(transforms, index) * position);
 
-        e.matrix = glm::translate(e.matrix, position);
+        set_transform(transforms, index, get_position(transforms, index) + offset,
+            get_rotation(transforms, index), get_scale(transforms, index));
+
+        mark_entity_dirty(entities, index);
     }
 
-    void rotate_entity(Entity& e, float deg, const glm::vec3& axis)
+    void rotate_entity(Entity_Storage& entities, uint32_t index, float deg, const glm::vec3& axis)
     {
-        e.matrix = glm::rotate(e.matrix, glm::radians(deg), axis);
+        // Multiplying the whole matrix rather than the rotation alone keeps
+        // the result the same as before for non-uniformly scaled entities.
+        // Such a result has shear and is then kept as a full matrix.
+        set_local_matrix(entities, index, glm::rotate(get_local_matrix(entities, index), glm::radians(deg), axis));
+        mark_entity_dirty(entities, index);
     }
 
-    void rotate_entity(Entity& e, const glm::vec3& axis)
+    void rotate_entity(Entity_Storage& entities, uint32_t index, const glm::vec3& axis)
     {
         if (axis.x > 0.0f)
-            e.matrix = glm::rotate(e.matrix, glm::radians(axis.x), glm::vec3(1.0f, 0.0f, 0.0f));
+            rotate_entity(entities, index, axis.x, glm::vec3(1.0f, 0.0f, 0.0f));
         if (axis.y > 0.0f)
-            e.matrix = glm::rotate(e.matrix, glm::radians(axis.y), glm::vec3(0.0f, 1.0f, 0.0f));
+            rotate_entity(entities, index, axis.y, glm::vec3(0.0f, 1.0f, 0.0f));
         if (axis.z > 0.0f)
-            e.matrix = glm::rotate(e.matrix, glm::radians(axis.z), glm::vec3(0.0f, 0.0f, 1.0f));
+            rotate_entity(entities, index, axis.z, glm::vec3(0.0f, 0.0f, 1.0f));
     }
 
-    void scale_entity(Entity& e, float scale)
+    void scale_entity(Entity_Storage& entities, uint32_t index, float scale)
     {
-        e.matrix = glm::scale(e.matrix, glm::vec3(scale));
+        scale_entity(entities, index, glm::vec3(scale));
     }
 
-    void scale_entity(Entity& e, const glm::vec3& axis)
+    void scale_entity(Entity_Storage& entities, uint32_t index, const glm::vec3& axis)
     {
-        e.matrix = glm::scale(e.matrix, axis);
+        if (edit_local_matrix(entities, index, glm::scale(glm::mat4(1.0f), axis)))
+            return;
+
+        Transform_Components& transforms = entities.local_transforms;
+
+        set_transform(transforms, index, get_position(transforms, index),
+            get_rotation(transforms, index), get_scale(transforms, index) * axis);
+
+        mark_entity_dirty(entities, index);
     }
 
-    void render_model(const Model_Old& model, const glm::mat4& matrix, const std::vector<VkCommandBuffer>& cmdBuffer, VkPipelineLayout pipelineLayout)
+    // Draws a single mesh for all of its instances. The instance matrices must
+    // already be written to instance memory starting at first_instance.
+    void render_mesh_instanced(const Mesh_Old& mesh, uint32_t instance_count, uint32_t first_instance, const std::vector<VkCommandBuffer>& cmdBuffer, VkPipelineLayout pipelineLayout)
     {
-        for (std::size_t i = 0; i < model.meshes.size(); ++i) {
-            bind_descriptor_set(cmdBuffer, pipelineLayout, model.meshes[i].descriptor_set);
-            bind_vertex_array(cmdBuffer, model.meshes[i].vertex_array);
-            render(cmdBuffer, pipelineLayout, model.meshes[i].vertex_array.index_count, matrix);
-        }
+        const vk_geometry_buffer& geometry = get_vulkan_renderer()->geometry;
+        const vk_geometry_range& range = mesh.geometry;
+
+        bind_descriptor_set(cmdBuffer, pipelineLayout, mesh.descriptor_set);
+        bind_geometry_block(cmdBuffer, geometry, range.block);
+        render(cmdBuffer, range.index_count, instance_count, range.first_index, range.vertex_offset, first_instance);
+    }
+
+    // Draws every mesh of a model once for all of its instances.
+    void render_model_instanced(const Model_Old& model, uint32_t instance_count, uint32_t first_instance, const std::vector<VkCommandBuffer>& cmdBuffer, VkPipelineLayout pipelineLayout)
+    {
+        for (const Mesh_Old& mesh : model.meshes)
+            render_mesh_instanced(mesh, instance_count, first_instance, cmdBuffer, pipelineLayout);
     }
 
     void render_model(const Model_Old& model, const std::vector<VkCommandBuffer>& cmdBuffer, VkPipelineLayout pipelineLayout)
     {
-        for (std::size_t i = 0; i < model.meshes.size(); ++i) {
-            bind_descriptor_set(cmdBuffer, pipelineLayout, model.meshes[i].descriptor_set);
-            bind_vertex_array(cmdBuffer, model.meshes[i].vertex_array);
-            render(cmdBuffer, model.meshes[i].vertex_array.index_count);
-        }
+        render_model_instanced(model, 1, 0, cmdBuffer, pipelineLayout);
     }
 }
 
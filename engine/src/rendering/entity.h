@@ -5,33 +5,139 @@
 
 #include "api/vulkan/vk_vertex_array.h"
 #include "model.h"
+#include "transforms.h"
 
 namespace engine {
 
-    // todo(zak): convert to using composition (ECS)
-    struct Entity
+    constexpr uint32_t no_parent_entity = UINT32_MAX;
+
+    // Entities are stored as one dense array per component so that each
+    // system only touches the components it needs. Element i of every array
+    // belongs to the same entity. Rendering walks the world transform and
+    // render components alone without pulling names into the cache.
+    //
+    // Removing an entity moves the last one into its place so the arrays stay
+    // dense. Indices therefore change on removal while ids never do.
+    //
+    // Parents are kept before their children so that world transforms are
+    // derived in a single forward pass. Removing or reparenting may break
+    // this order in which case the entities are sorted by depth during the
+    // next update, which also changes indices.
+    struct Entity_Storage
     {
-        // TODO: Some of these member variables a here as we need to be able
-        // to individually work with an instance. In the future, once instanced
-        // rendering is implemented then the only data that should be sent is
-        // the matrix.
-        uint32_t id;
-        std::string name;
+        // Transform components. Local transforms are relative to the parent
+        // and world transforms are derived from them by the update.
+        Transform_Components local_transforms;
+        std::vector<glm::mat4> world_transforms;
+
+        // Local transforms with shear keyed by id. Few entities have one so
+        // they are kept aside rather than as another dense array. For these
+        // entities local_transforms only holds the nearest translation,
+        // rotation and scale and the update uses the matrix instead.
+        std::unordered_map<uint32_t, glm::mat4> local_matrices;
+
+        // Hierarchy component. Parents are indices for the update while the
+        // children of an entity form a doubly linked list of ids so that the
+        // links stay valid when entities move.
+        std::vector<uint32_t> parents;
+        std::vector<uint32_t> first_children;
+        std::vector<uint32_t> next_siblings;
+        std::vector<uint32_t> previous_siblings;
+
+        // Render component and the number of entities using each model
+        std::vector<uint32_t> model_indices;
+        std::vector<uint32_t> model_counts;
+
+        // Name component
+        std::vector<std::string> names;
+
+        std::vector<uint32_t> ids;
 
-        uint32_t model_index;
+        // Entities whose local transform changed since the last update. Bytes
+        // rather than std::vector<bool> so the update does not unpack bits.
+        std::vector<uint8_t> dirty;
+        uint32_t first_dirty = UINT32_MAX;
+        bool unordered = false;
 
-        glm::mat4 matrix;
+        // Entities whose world transform or model changed since the renderer
+        // last copied them to the GPU. Indices may repeat or be past the end
+        // after removals. all_changed replaces the list once indices have
+        // been shuffled or it would hold more entries than there are entities.
+        std::vector<uint32_t> changed;
+        bool all_changed = true;
+
+        // Index of each id or UINT32_MAX once the entity has been removed.
+        std::vector<uint32_t> id_indices;
+        uint32_t next_id = 0;
     };
 
-    Entity create_entity(int id, int model_index, const std::string& name);
-    void translate_entity(Entity& e, const glm::vec3& position);
-    void rotate_entity(Entity& e, float deg, const glm::vec3& axis);
-    void rotate_entity(Entity& e, const glm::vec3& axis);
-    void scale_entity(Entity& e, float scale);
-    void scale_entity(Entity& e, const glm::vec3& axis);
+    // Returns the index of the new entity which starts out as a root.
+    uint32_t create_entity(Entity_Storage& entities, uint32_t model_index, const std::string& name, bool log = true);
+
+    // Children of the entity are attached to its parent and keep their world
+    // transform.
+    void remove_entity(Entity_Storage& entities, uint32_t index);
+
+    // Removes every entity using the model and moves the entities of the
+    // models after it down by one as the model is being removed.
+    void remove_model_entities(Entity_Storage& entities, uint32_t model_index);
+
+    // Removes every entity but keeps handing out new ids.
+    void clear_entities(Entity_Storage& entities);
+    void reserve_entities(Entity_Storage& entities, std::size_t count);
+
+    // Returns the index of the entity or UINT32_MAX if it does not exist.
+    uint32_t find_entity(const Entity_Storage& entities, uint32_t id);
+
+    inline std::size_t get_entity_count(const Entity_Storage& entities)
+    {
+        return entities.ids.size();
+    }
+
+    // Must be called after changing a local transform directly. The world
+    // transforms of the entity and its descendants are derived again by the
+    // next update.
+    inline void mark_entity_dirty(Entity_Storage& entities, uint32_t index)
+    {
+        entities.dirty[index] = 1;
+        entities.first_dirty = std::min(entities.first_dirty, index);
+    }
+
+    // Called by the renderer once it has copied the changed entities.
+    inline void clear_changed_entities(Entity_Storage& entities)
+    {
+        entities.changed.clear();
+        entities.all_changed = false;
+    }
+
+    // The entity keeps its world transform. Passing no_parent_entity makes it
+    // a root. Fails if the parent is the entity itself or one of its
+    // descendants. May update transforms and therefore reorder entities
+    // before attaching so indices must be looked up again afterwards.
+    bool set_entity_parent(Entity_Storage& entities, uint32_t index, uint32_t parent);
+
+    // Sets the local transform so that the entity ends up at the given world
+    // transform. World transforms must be up to date. Transforms with shear
+    // are kept as a full matrix.
+    void set_entity_world_transform(Entity_Storage& entities, uint32_t index, const glm::mat4& transform);
+
+    // Restores the parent first order if needed and recomputes the world
+    // transforms of dirty entities and their descendants in a single pass
+    // starting at the first dirty entity.
+    void update_entity_transforms(Entity_Storage& entities);
+
+    // Translation, rotation and scaling happen along the entity's own axes
+    // as if the local matrix was multiplied by them. Rotating a non-uniformly
+    // scaled entity therefore shears it and keeps a full local matrix.
+    void translate_entity(Entity_Storage& entities, uint32_t index, const glm::vec3& position);
+    void rotate_entity(Entity_Storage& entities, uint32_t index, float deg, const glm::vec3& axis);
+    void rotate_entity(Entity_Storage& entities, uint32_t index, const glm::vec3& axis);
+    void scale_entity(Entity_Storage& entities, uint32_t index, float scale);
+    void scale_entity(Entity_Storage& entities, uint32_t index, const glm::vec3& axis);
 
     // todo(zak): move this to either model.cpp or renderer.cpp
-    void render_model(const Model_Old& model, const glm::mat4& matrix, const std::vector<VkCommandBuffer>& cmdBuffer, VkPipelineLayout pipelineLayout);
+    void render_mesh_instanced(const Mesh_Old& mesh, uint32_t instance_count, uint32_t first_instance, const std::vector<VkCommandBuffer>& cmdBuffer, VkPipelineLayout pipelineLayout);
+    void render_model_instanced(const Model_Old& model, uint32_t instance_count, uint32_t first_instance, const std::vector<VkCommandBuffer>& cmdBuffer, VkPipelineLayout pipelineLayout);
     void render_model(const Model_Old& model, const std::vector<VkCommandBuffer>& cmdBuffer, VkPipelineLayout pipelineLayout);
 
 
@@ -0,0 +1,296 @@
+#include "pch.h"
+#include "frame_capture.h"
+
+#include "api/vulkan/vk_buffer.h"
+#include "utils/logging.h"
+#include "utils/profiler.h"
+
+#include <stb_image_write.h>
+
+namespace engine {
+    // Both the color and depth attachments are four bytes per pixel.
+    constexpr VkDeviceSize frame_capture_pixel_size = 4;
+
+    static bool is_slot_free(const Frame_Capture_Slot& slot)
+    {
+        if (slot.frame != UINT32_MAX)
+            return false;
+
+        return !slot.encode.valid() || slot.encode.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    void create_frame_capture(Frame_Capture& capture, uint32_t slot_count)
+    {
+        capture.slots = std::vector<Frame_Capture_Slot>(slot_count);
+    }
+
+    void destroy_frame_capture(Frame_Capture& capture)
+    {
+        for (Frame_Capture_Slot& slot : capture.slots) {
+            if (slot.encode.valid())
+                slot.encode.get();
+
+            if (slot.buffer.buffer)
+                destroy_buffer(slot.buffer);
+        }
+
+        capture = {};
+    }
+
+    bool begin_frame_capture(Frame_Capture& capture, const std::filesystem::path& path, uint32_t frame_count, bool depth)
+    {
+        if (is_frame_capturing(capture) || frame_count == 0 || capture.slots.empty())
+            return false;
+
+        capture.path = path;
+        capture.path.replace_extension(depth ? ".exr" : ".png");
+        capture.depth = depth;
+        capture.frame_count = frame_count;
+        capture.captured = 0;
+        capture.dropped = 0;
+
+        return true;
+    }
+
+    bool is_frame_capturing(const Frame_Capture& capture)
+    {
+        return capture.captured < capture.frame_count;
+    }
+
+    static std::filesystem::path get_capture_path(const Frame_Capture& capture, uint32_t index)
+    {
+        if (capture.frame_count == 1)
+            return capture.path;
+
+        std::filesystem::path path = capture.path;
+        path.replace_filename(std::format("{}_{:04}{}",
+            capture.path.stem().string(), index, capture.path.extension().string()));
+
+        return path;
+    }
+
+    void record_frame_capture(Frame_Capture& capture, std::vector<VkCommandBuffer>& buffers, const Vk_Image& image, VkExtent2D extent)
+    {
+        if (!is_frame_capturing(capture))
+            return;
+
+        auto it = std::find_if(capture.slots.begin(), capture.slots.end(), is_slot_free);
+        if (it == capture.slots.end()) {
+            ++capture.dropped;
+            return;
+        }
+
+        Frame_Capture_Slot& slot = *it;
+
+        const VkDeviceSize size = VkDeviceSize(extent.width) * extent.height * frame_capture_pixel_size;
+        if (slot.buffer.buffer && slot.buffer.size < size) {
+            destroy_buffer(slot.buffer);
+            slot.buffer = {};
+        }
+
+        if (!slot.buffer.buffer)
+            slot.buffer = create_readback_buffer(size, 0);
+
+        const uint32_t current_frame = get_frame_buffer_index();
+        const VkCommandBuffer cmd = buffers[current_frame];
+
+        slot.frame = current_frame;
+        slot.extent = extent;
+        slot.depth = capture.depth;
+        slot.path = get_capture_path(capture, capture.captured++);
+
+        const VkImageAspectFlags aspect = capture.depth ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+        const VkImageLayout layout = capture.depth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        // Depth is also sampled by the lighting pass which must have
+        // finished reading it before the layout can change.
+        const VkPipelineStageFlags write_stage = capture.depth ?
+            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT :
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+
+        VkImageMemoryBarrier barrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+        barrier.image = image.handle;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.subresourceRange.aspectMask = aspect;
+        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.layerCount = 1;
+        barrier.oldLayout = layout;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcAccessMask = capture.depth ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(cmd,
+            write_stage,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        VkBufferImageCopy region{};
+        region.imageSubresource.aspectMask = aspect;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = { extent.width, extent.height, 1 };
+        vkCmdCopyImageToBuffer(cmd, image.handle, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer.buffer, 1, &region);
+
+        // Makes the copy visible to the host once the frame's fence signals.
+        VkBufferMemoryBarrier host_barrier{ VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+        host_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        host_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        host_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        host_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        host_barrier.buffer = slot.buffer.buffer;
+        host_barrier.size = size;
+
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout = layout;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(cmd,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+            0, 0, nullptr, 1, &host_barrier, 1, &barrier);
+    }
+
+    template <typename T>
+    static void write_exr_value(std::vector<unsigned char>& data, T value)
+    {
+        const auto bytes = reinterpret_cast<const unsigned char*>(&value);
+        data.insert(data.end(), bytes, bytes + sizeof(T));
+    }
+
+    static void write_exr_attribute(std::vector<unsigned char>& data, std::string_view name, std::string_view type, uint32_t size)
+    {
+        data.insert(data.end(), name.begin(), name.end());
+        data.push_back(0);
+        data.insert(data.end(), type.begin(), type.end());
+        data.push_back(0);
+        write_exr_value(data, size);
+    }
+
+    // Writes an uncompressed single part scanline EXR with a single 32-bit
+    // float Z channel. This is all that is needed for depth and avoids
+    // pulling in an EXR library. Values are the raw reversed depth.
+    static bool write_depth_exr(const std::filesystem::path& path, const float* depths, uint32_t width, uint32_t height)
+    {
+        std::vector<unsigned char> data;
+        data.reserve(512 + (std::size_t(width) * 4 + 8) * height + std::size_t(height) * 8);
+
+        write_exr_value(data, uint32_t(20000630));
+        write_exr_value(data, uint32_t(2));
+
+        write_exr_attribute(data, "channels", "chlist", 19);
+        data.push_back('Z');
+        data.push_back(0);
+        write_exr_value(data, int32_t(2)); // FLOAT
+        write_exr_value(data, uint32_t(0)); // pLinear and reserved
+        write_exr_value(data, int32_t(1));
+        write_exr_value(data, int32_t(1));
+        data.push_back(0);
+
+        write_exr_attribute(data, "compression", "compression", 1);
+        data.push_back(0);
+
+        for (std::string_view window : { "dataWindow", "displayWindow" }) {
+            write_exr_attribute(data, window, "box2i", 16);
+            write_exr_value(data, int32_t(0));
+            write_exr_value(data, int32_t(0));
+            write_exr_value(data, int32_t(width - 1));
+            write_exr_value(data, int32_t(height - 1));
+        }
+
+        write_exr_attribute(data, "lineOrder", "lineOrder", 1);
+        data.push_back(0);
+
+        write_exr_attribute(data, "pixelAspectRatio", "float", 4);
+        write_exr_value(data, 1.0f);
+
+        write_exr_attribute(data, "screenWindowCenter", "v2f", 8);
+        write_exr_value(data, 0.0f);
+        write_exr_value(data, 0.0f);
+
+        write_exr_attribute(data, "screenWindowWidth", "float", 4);
+        write_exr_value(data, 1.0f);
+
+        data.push_back(0);
+
+        // Uncompressed files store one scanline per chunk.
+        const uint32_t row_size = width * 4;
+        uint64_t offset = data.size() + uint64_t(height) * 8;
+        for (uint32_t y = 0; y < height; ++y) {
+            write_exr_value(data, offset);
+            offset += 8 + row_size;
+        }
+
+        for (uint32_t y = 0; y < height; ++y) {
+            write_exr_value(data, int32_t(y));
+            write_exr_value(data, row_size);
+
+            const auto row = reinterpret_cast<const unsigned char*>(depths + std::size_t(y) * width);
+            data.insert(data.end(), row, row + row_size);
+        }
+
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open())
+            return false;
+
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+        return file.good();
+    }
+
+    static bool encode_frame_capture(const Frame_Capture_Slot& slot)
+    {
+        PROFILE_ZONE("encode_frame_capture");
+
+        const uint32_t width = slot.extent.width;
+        const uint32_t height = slot.extent.height;
+
+        bool written;
+        if (slot.depth)
+            written = write_depth_exr(slot.path, static_cast<const float*>(slot.buffer.mapped), width, height);
+        else
+            written = stbi_write_png(slot.path.string().c_str(), width, height, 4, slot.buffer.mapped, width * 4) != 0;
+
+        if (!written) {
+            error("Failed to write frame capture to {}.", slot.path.string());
+            return false;
+        }
+
+        info("Wrote frame capture to {}.", slot.path.string());
+
+        return true;
+    }
+
+    static void read_frame_capture(Frame_Capture_Slot& slot)
+    {
+        slot.frame = UINT32_MAX;
+
+        // Host visible memory is not guaranteed to be coherent.
+        vmaInvalidateAllocation(get_vulkan_context().allocator, slot.buffer.allocation, 0, VK_WHOLE_SIZE);
+
+        // The slot is not reused until its encode has finished so the
+        // worker can read straight from the mapped buffer.
+        slot.encode = std::async(std::launch::async, encode_frame_capture, std::cref(slot));
+    }
+
+    void read_frame_captures(Frame_Capture& capture)
+    {
+        const uint32_t current_frame = get_frame_buffer_index();
+
+        for (Frame_Capture_Slot& slot : capture.slots) {
+            if (slot.frame == current_frame)
+                read_frame_capture(slot);
+        }
+
+        if (capture.frame_count > 0 && !is_frame_capturing(capture) && capture.dropped > 0) {
+            warn("Frame capture dropped {} frames as encoding fell behind.", capture.dropped);
+            capture.dropped = 0;
+        }
+    }
+
+    void flush_frame_captures(Frame_Capture& capture)
+    {
+        for (Frame_Capture_Slot& slot : capture.slots) {
+            if (slot.frame != UINT32_MAX)
+                read_frame_capture(slot);
+        }
+    }
+}
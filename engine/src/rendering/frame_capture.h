@@ -0,0 +1,65 @@
+#ifndef MY_ENGINE_FRAME_CAPTURE_H
+#define MY_ENGINE_FRAME_CAPTURE_H
+
+#include "api/vulkan/vk_renderer.h"
+
+namespace engine {
+    // A host visible buffer that a single frame is copied into. The copy is
+    // read once the fence of the frame that recorded it has been waited on
+    // and is then encoded on a worker thread straight from the mapping.
+    struct Frame_Capture_Slot
+    {
+        Vk_Buffer buffer;
+        VkExtent2D extent{};
+
+        // The frame in flight whose commands copy into this slot or
+        // UINT32_MAX if no copy is pending.
+        uint32_t frame = UINT32_MAX;
+        bool depth = false;
+        std::filesystem::path path;
+
+        std::future<bool> encode;
+    };
+
+    struct Frame_Capture
+    {
+        // Buffers are only allocated the first time a slot is used and grow
+        // with the framebuffer so nothing is allocated until capturing.
+        std::vector<Frame_Capture_Slot> slots;
+
+        std::filesystem::path path;
+        bool depth = false;
+        uint32_t frame_count = 0;
+        uint32_t captured = 0;
+        uint32_t dropped = 0;
+    };
+
+    // Slots beyond the frames in flight let encoding fall behind by a few
+    // frames before frames are dropped instead of stalling the renderer.
+    void create_frame_capture(Frame_Capture& capture, uint32_t slot_count);
+
+    // Waits for any images that are still being encoded.
+    void destroy_frame_capture(Frame_Capture& capture);
+
+    // Depth is written as a single channel float EXR and colors as an RGBA
+    // PNG. The extension of path is replaced to match. A sequence inserts
+    // the frame number before the extension.
+    bool begin_frame_capture(Frame_Capture& capture, const std::filesystem::path& path, uint32_t frame_count, bool depth);
+    bool is_frame_capturing(const Frame_Capture& capture);
+
+    // Records a copy of the top left extent of the image into a free slot or
+    // drops the frame if every slot is still in use. Must be recorded outside
+    // of a render pass after the last write to the image. Colors must be in
+    // the shader read only layout and depth in the depth read only layout.
+    void record_frame_capture(Frame_Capture& capture, std::vector<VkCommandBuffer>& buffers, const Vk_Image& image, VkExtent2D extent);
+
+    // Starts encoding the copies the current frame in flight made the last
+    // time it was submitted. Must be called after waiting on the frame's fence.
+    void read_frame_captures(Frame_Capture& capture);
+
+    // Starts encoding every pending copy regardless of the frame that made
+    // it. Must only be called once the GPU is idle.
+    void flush_frame_captures(Frame_Capture& capture);
+}
+
+#endif
@@ -0,0 +1,183 @@
+#include "pch.h"
+#include "gpu_profiler.h"
+
+#include "utils/logging.h"
+
+namespace engine {
+    bool create_gpu_profiler(Gpu_Profiler& profiler, uint32_t max_scopes)
+    {
+        const vk_context& rc = get_vulkan_context();
+
+        uint32_t family_count = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(rc.device->gpu, &family_count, nullptr);
+        std::vector<VkQueueFamilyProperties> families(family_count);
+        vkGetPhysicalDeviceQueueFamilyProperties(rc.device->gpu, &family_count, families.data());
+
+        const uint32_t valid_bits = families[rc.device->graphics_index].timestampValidBits;
+        if (valid_bits == 0) {
+            warn("GPU ({}): Timestamp queries not supported.", rc.device->gpu_name);
+            return false;
+        }
+
+        profiler.timestamp_period = rc.device->properties.limits.timestampPeriod;
+        profiler.timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (uint64_t(1) << valid_bits) - 1;
+        profiler.max_scopes = max_scopes;
+        profiler.scopes.reserve(max_scopes);
+        profiler.results.resize(max_scopes * 2);
+
+        for (Gpu_Profiler_Frame& frame : profiler.frames) {
+            VkQueryPoolCreateInfo pool_info{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+            pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            pool_info.queryCount = max_scopes * 2;
+            vk_check(vkCreateQueryPool(rc.device->device, &pool_info, nullptr, &frame.pool));
+        }
+
+        return true;
+    }
+
+    void destroy_gpu_profiler(Gpu_Profiler& profiler)
+    {
+        const vk_context& rc = get_vulkan_context();
+
+        for (Gpu_Profiler_Frame& frame : profiler.frames)
+            vkDestroyQueryPool(rc.device->device, frame.pool, nullptr);
+
+        profiler = {};
+    }
+
+    static void add_gpu_timing(Gpu_Scope& scope, float milliseconds)
+    {
+        scope.history[scope.history_next] = milliseconds;
+        scope.history_next = (scope.history_next + 1) % gpu_profiler_history;
+        scope.history_count = std::min(scope.history_count + 1, gpu_profiler_history);
+    }
+
+    void read_gpu_timings(Gpu_Profiler& profiler)
+    {
+        Gpu_Profiler_Frame& frame = profiler.frames[get_frame_buffer_index()];
+        if (!frame.pool || frame.query_count == 0)
+            return;
+
+        const vk_context& rc = get_vulkan_context();
+
+        // Not waiting for the results means that a frame which was recorded
+        // but never submitted is simply skipped.
+        const VkResult result = vkGetQueryPoolResults(rc.device->device,
+            frame.pool,
+            0,
+            frame.query_count,
+            frame.query_count * sizeof(uint64_t),
+            profiler.results.data(),
+            sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT);
+
+        if (result == VK_SUCCESS) {
+            const float ticks_to_ms = profiler.timestamp_period / 1000000.0f;
+
+            for (std::size_t i = 0; i < frame.scopes.size(); ++i) {
+                const uint64_t begin = profiler.results[i * 2];
+                const uint64_t end = profiler.results[i * 2 + 1];
+                const uint64_t ticks = (end - begin) & profiler.timestamp_mask;
+
+                add_gpu_timing(profiler.scopes[frame.scopes[i]], static_cast<float>(ticks) * ticks_to_ms);
+            }
+        }
+
+        frame.scopes.clear();
+        frame.query_count = 0;
+    }
+
+    void reset_gpu_timings(Gpu_Profiler& profiler, std::vector<VkCommandBuffer>& buffers)
+    {
+        const uint32_t current_frame = get_frame_buffer_index();
+        Gpu_Profiler_Frame& frame = profiler.frames[current_frame];
+        if (!frame.pool)
+            return;
+
+        vkCmdResetQueryPool(buffers[current_frame], frame.pool, 0, profiler.max_scopes * 2);
+
+        frame.scopes.clear();
+        frame.query_count = 0;
+    }
+
+    uint32_t begin_gpu_scope(Gpu_Profiler& profiler, std::vector<VkCommandBuffer>& buffers, std::string_view name)
+    {
+        const uint32_t current_frame = get_frame_buffer_index();
+        Gpu_Profiler_Frame& frame = profiler.frames[current_frame];
+        if (!frame.pool || frame.query_count + 2 > profiler.max_scopes * 2)
+            return UINT32_MAX;
+
+        // Only a handful of scopes exist so a linear search is fine.
+        auto it = std::find_if(profiler.scopes.begin(), profiler.scopes.end(), [name](const Gpu_Scope& scope) {
+            return scope.name == name;
+        });
+
+        if (it == profiler.scopes.end()) {
+            if (profiler.scopes.size() >= profiler.max_scopes)
+                return UINT32_MAX;
+
+            profiler.scopes.push_back({ std::string(name) });
+            it = profiler.scopes.end() - 1;
+        }
+
+        const uint32_t query = frame.query_count;
+        frame.query_count += 2;
+        frame.scopes.push_back(u32(std::distance(profiler.scopes.begin(), it)));
+
+        vkCmdWriteTimestamp(buffers[current_frame], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.pool, query);
+
+        return query;
+    }
+
+    void end_gpu_scope(Gpu_Profiler& profiler, std::vector<VkCommandBuffer>& buffers, uint32_t query)
+    {
+        if (query == UINT32_MAX)
+            return;
+
+        const uint32_t current_frame = get_frame_buffer_index();
+        vkCmdWriteTimestamp(buffers[current_frame], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler.frames[current_frame].pool, query + 1);
+    }
+
+    Gpu_Scope_Stats get_gpu_scope_stats(const Gpu_Scope& scope)
+    {
+        Gpu_Scope_Stats stats{};
+        if (scope.history_count == 0)
+            return stats;
+
+        const uint32_t last = (scope.history_next + gpu_profiler_history - 1) % gpu_profiler_history;
+        stats.last = scope.history[last];
+        stats.min = scope.history[0];
+        stats.max = scope.history[0];
+
+        float total = 0.0f;
+        for (uint32_t i = 0; i < scope.history_count; ++i) {
+            stats.min = std::min(stats.min, scope.history[i]);
+            stats.max = std::max(stats.max, scope.history[i]);
+            total += scope.history[i];
+        }
+
+        stats.avg = total / static_cast<float>(scope.history_count);
+
+        return stats;
+    }
+
+    bool export_gpu_timings(const Gpu_Profiler& profiler, const std::filesystem::path& path)
+    {
+        std::ofstream file(path);
+        if (!file.is_open()) {
+            error("Failed to open {} for writing.", path.string());
+            return false;
+        }
+
+        file << "scope,last_ms,min_ms,avg_ms,max_ms,samples\n";
+        for (const Gpu_Scope& scope : profiler.scopes) {
+            const Gpu_Scope_Stats stats = get_gpu_scope_stats(scope);
+            file << std::format("{},{:.4f},{:.4f},{:.4f},{:.4f},{}\n",
+                scope.name, stats.last, stats.min, stats.avg, stats.max, scope.history_count);
+        }
+
+        info("Exported GPU timings to {}.", path.string());
+
+        return true;
+    }
+}
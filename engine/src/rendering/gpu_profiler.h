@@ -0,0 +1,82 @@
+#ifndef MY_ENGINE_GPU_PROFILER_H
+#define MY_ENGINE_GPU_PROFILER_H
+
+#include "api/vulkan/vk_renderer.h"
+
+namespace engine {
+    // Number of frames that the rolling minimum, average and maximum of each
+    // scope are computed over.
+    constexpr uint32_t gpu_profiler_history = 128;
+
+    // A named region of GPU work such as a render pass. Durations are in
+    // milliseconds.
+    struct Gpu_Scope
+    {
+        std::string name;
+
+        std::array<float, gpu_profiler_history> history{};
+        uint32_t history_count = 0;
+        uint32_t history_next = 0;
+    };
+
+    struct Gpu_Scope_Stats
+    {
+        float last;
+        float min;
+        float avg;
+        float max;
+    };
+
+    // Each frame in flight writes its timestamps into its own query pool.
+    // The results are read once the frame's fence has been waited on which
+    // means timings lag by the number of frames in flight but never stall.
+    struct Gpu_Profiler_Frame
+    {
+        VkQueryPool pool = nullptr;
+
+        // The scope of each begin and end query pair written this frame.
+        std::vector<uint32_t> scopes;
+        uint32_t query_count = 0;
+    };
+
+    struct Gpu_Profiler
+    {
+        std::array<Gpu_Profiler_Frame, max_frames_in_flight> frames;
+
+        // Reserved up front so that scope names remain at the same address.
+        std::vector<Gpu_Scope> scopes;
+        uint32_t max_scopes = 0;
+
+        // Nanoseconds per timestamp tick and the bits of a timestamp that
+        // are valid on the graphics queue.
+        float timestamp_period = 0.0f;
+        uint64_t timestamp_mask = 0;
+
+        std::vector<uint64_t> results;
+    };
+
+    // Returns false if the graphics queue does not support timestamps in
+    // which case every other function does nothing.
+    bool create_gpu_profiler(Gpu_Profiler& profiler, uint32_t max_scopes);
+    void destroy_gpu_profiler(Gpu_Profiler& profiler);
+
+    // Reads the timings the current frame in flight wrote the last time it
+    // was submitted. Must be called after waiting on the frame's fence.
+    void read_gpu_timings(Gpu_Profiler& profiler);
+
+    // Resets the queries of the current frame. Must be recorded outside of
+    // a render pass before any scope of the frame.
+    void reset_gpu_timings(Gpu_Profiler& profiler, std::vector<VkCommandBuffer>& buffers);
+
+    // Scopes must not be begun or ended within a render pass that executes
+    // secondary command buffers. Returns the query to pass to end.
+    uint32_t begin_gpu_scope(Gpu_Profiler& profiler, std::vector<VkCommandBuffer>& buffers, std::string_view name);
+    void end_gpu_scope(Gpu_Profiler& profiler, std::vector<VkCommandBuffer>& buffers, uint32_t query);
+
+    Gpu_Scope_Stats get_gpu_scope_stats(const Gpu_Scope& scope);
+
+    // Writes the rolling statistics of every scope as CSV.
+    bool export_gpu_timings(const Gpu_Profiler& profiler, const std::filesystem::path& path);
+}
+
+#endif
@@ -3,8 +3,10 @@
 
 #include "vertex.h"
 #include "api/vulkan/vk_image.h"
+#include "api/vulkan/vk_renderer.h"
 #include "filesystem/vfs.h"
 #include "utils/logging.h"
+#include "utils/profiler.h"
 
 
 namespace engine {
@@ -32,7 +34,8 @@ namespace engine {
         return paths;
     }
 
-    static bool load_mesh_texture(Model_Old& model, Mesh_Old& mesh, const std::vector<std::filesystem::path>& paths)
+    static bool load_mesh_texture(Model_Old& model, Mesh_Old& mesh, const std::vector<std::filesystem::path>& paths,
+        VkFormat format = VK_FORMAT_R8G8B8A8_SRGB)
     {
         std::vector<std::filesystem::path>& uniques = model.unique_texture_paths;
 
@@ -41,7 +44,7 @@ namespace engine {
             const auto it = std::find(uniques.begin(), uniques.end(), paths[i]);
 
             if (it == uniques.end()) {
-                std::optional<Vk_Image> texture = create_texture(paths[i].string());
+                std::optional<Vk_Image> texture = create_texture(paths[i].string(), false, format);
 
                 // TODO: Should return nullptr instead of object
                 if (!texture.has_value())
@@ -67,7 +70,8 @@ namespace engine {
     static void create_fallback_mesh_texture(Model_Old& model,
         Mesh_Old& mesh,
         unsigned char* texture,
-        const std::filesystem::path& path)
+        const std::filesystem::path& path,
+        VkFormat format = VK_FORMAT_R8G8B8A8_SRGB)
     {
 
         std::vector<std::filesystem::path>& uniques = model.unique_texture_paths;
@@ -76,7 +80,7 @@ namespace engine {
         const auto it = std::find(uniques.begin(), uniques.end(), path);
 
         if (it == uniques.end()) {
-            Vk_Image image = create_texture(texture, 1, 1, VK_FORMAT_R8G8B8A8_SRGB);
+            Vk_Image image = create_texture(texture, 1, 1, format);
             model.unique_textures.push_back(image);
             uniques.push_back(path);
             index = model.unique_textures.size() - 1;
@@ -110,7 +114,9 @@ namespace engine {
         defaultNormal[2] = (unsigned char)255;
         defaultNormal[3] = (unsigned char)255;
 
-        create_fallback_mesh_texture(model, mesh, defaultNormal, "albedo_normal");
+        // Normals are stored linearly so that (128, 128, 255) decodes to a
+        // flat normal.
+        create_fallback_mesh_texture(model, mesh, defaultNormal, "albedo_normal", VK_FORMAT_R8G8B8A8_UNORM);
     }
 
     void create_fallback_specular_texture(Model_Old& model, Mesh_Old& mesh)
@@ -131,6 +137,10 @@ namespace engine {
 
         mesh.name = ai_mesh->mName.C_Str();
 
+        // Generated by aiProcess_GenBoundingBoxes
+        mesh.bounds.min = glm::vec3(ai_mesh->mAABB.mMin.x, ai_mesh->mAABB.mMin.y, ai_mesh->mAABB.mMin.z);
+        mesh.bounds.max = glm::vec3(ai_mesh->mAABB.mMax.x, ai_mesh->mAABB.mMax.y, ai_mesh->mAABB.mMax.z);
+
         // walk through each of the mesh's vertices
         for (std::size_t i = 0; i < ai_mesh->mNumVertices; ++i) {
             vertex vertex{};
@@ -211,7 +221,7 @@ namespace engine {
                 warn("{} using fallback albedo texture.", model.name);
             }
 
-            if (normal_path.empty() || !load_mesh_texture(model, mesh, normal_path)) {
+            if (normal_path.empty() || !load_mesh_texture(model, mesh, normal_path, VK_FORMAT_R8G8B8A8_UNORM)) {
                 create_fallback_normal_texture(model, mesh);
                 warn("{} using fallback normal texture.", model.name);
             }
@@ -232,6 +242,13 @@ namespace engine {
             const aiMesh* assimp_mesh = scene->mMeshes[node->mMeshes[i]];
             Mesh_Old mesh = process_mesh(model, assimp_mesh, scene);
 
+            if (model.meshes.empty()) {
+                model.bounds = mesh.bounds;
+            } else {
+                model.bounds.min = glm::min(model.bounds.min, mesh.bounds.min);
+                model.bounds.max = glm::max(model.bounds.max, mesh.bounds.max);
+            }
+
             model.meshes.push_back(mesh);
         }
 
@@ -241,11 +258,12 @@ namespace engine {
         }
     }
 
-    bool load_model(Model_Old& model, const std::filesystem::path& path, bool flipUVs)
+    bool import_model(Model_Import& model_import, const std::filesystem::path& path, bool flipUVs)
     {
-        info("Loading mesh {}.", path.string());
+        PROFILE_ZONE("import_model");
 
-        Assimp::Importer importer;
+        model_import.path = path;
+        model_import.importer = std::make_unique<Assimp::Importer>();
 
         unsigned int flags = aiProcessPreset_TargetRealtime_Fast |
             aiProcess_FlipWindingOrder |
@@ -258,26 +276,40 @@ namespace engine {
         if (flipUVs)
             flags |= aiProcess_FlipUVs;
 
-        const aiScene* scene = importer.ReadFile(path.string(), flags);
+        model_import.scene = model_import.importer->ReadFile(path.string(), flags);
 
-        if (!scene) {
-            return false;
-        }
+        return model_import.scene != nullptr;
+    }
 
+    bool load_model(Model_Old& model, const Model_Import& model_import)
+    {
+        if (!model_import.scene)
+            return false;
 
         // TEMP: Set model original path so that textures know where
         // they should load the files from
-        model.path = path.string();
-        model.name = path.filename().string();
+        model.path = model_import.path.string();
+        model.name = model_import.path.filename().string();
 
         // Start processing from the root scene node
-        process_node(model, scene->mRootNode, scene);
+        process_node(model, model_import.scene->mRootNode, model_import.scene);
 
-        info("Successfully loaded model with {} meshes at path {}.", model.meshes.size(), path.string());
+        info("Successfully loaded model with {} meshes at path {}.", model.meshes.size(), model.path);
 
         return true;
     }
 
+    bool load_model(Model_Old& model, const std::filesystem::path& path, bool flipUVs)
+    {
+        info("Loading mesh {}.", path.string());
+
+        Model_Import model_import;
+        if (!import_model(model_import, path, flipUVs))
+            return false;
+
+        return load_model(model, model_import);
+    }
+
     bool create_model(Model_Old& model, const std::filesystem::path& path, const char* data, std::size_t len, bool flipUVs /*= true*/)
     {
         info("Creating mesh.");
@@ -315,25 +347,86 @@ namespace engine {
         return true;
     }
 
+    // The most recently handed out material id. Zero is reserved for draws
+    // that do not bind a material.
+    static uint32_t g_material_id = 0;
+
+    // Ids of destroyed meshes which are handed out again first so that the
+    // bindless material buffer does not fill up as models are replaced.
+    static std::vector<uint32_t> g_free_material_ids;
+
+    static uint32_t next_material_id()
+    {
+        if (!g_free_material_ids.empty()) {
+            const uint32_t id = g_free_material_ids.back();
+            g_free_material_ids.pop_back();
+
+            return id;
+        }
+
+        return ++g_material_id;
+    }
+
+    static void release_material_id(uint32_t id)
+    {
+        if (id != 0)
+            g_free_material_ids.push_back(id);
+    }
+
     void destroy_model(Model_Old& model)
     {
+        Vk_Renderer* renderer = get_vulkan_renderer();
+
+        for (uint32_t index : model.bindless_textures)
+            remove_bindless_texture(renderer->bindless, index);
+        model.bindless_textures.clear();
+
         destroy_images(model.unique_textures);
-        for (auto& mesh : model.meshes) {
-            destroy_vertex_array(mesh.vertex_array);
+
+        // Bindless meshes do not own a set.
+        for (Mesh_Old& mesh : model.meshes) {
+            if (mesh.descriptor_set)
+                free_descriptor_set(mesh.descriptor_set);
+
+            free_geometry(renderer->geometry, mesh.geometry);
+            release_material_id(mesh.material_id);
+
+            mesh.descriptor_set = nullptr;
+            mesh.geometry = {};
+            mesh.material_id = 0;
         }
     }
 
+    void destroy_model_deferred(Model_Old&& model)
+    {
+        // The vertex and index data on the CPU is no longer needed so only
+        // the handles are kept alive until the GPU is done with them.
+        for (Mesh_Old& mesh : model.meshes) {
+            mesh.vertices = {};
+            mesh.indices = {};
+        }
+
+        defer_destruction([model = std::move(model)]() mutable {
+            destroy_model(model);
+        });
+    }
+
     void upload_model_to_gpu(Model_Old& model, VkDescriptorSetLayout layout, std::vector<VkDescriptorSetLayoutBinding> bindings)
     {
+        PROFILE_ZONE("upload_model_to_gpu");
+
 
         // At this point, the model has been fully loaded onto the CPU and now we 
         // need to transfer this data onto the GPU.
         // 
         // Also setup the texture descriptor sets
 
+        Vk_Renderer* renderer = get_vulkan_renderer();
+
         for (auto& mesh : model.meshes) {
-            mesh.vertex_array = create_vertex_array(mesh.vertices, mesh.indices);
+            mesh.geometry = upload_geometry(renderer->geometry, mesh.vertices, mesh.indices);
             mesh.descriptor_set = allocate_descriptor_set(layout);
+            mesh.material_id = next_material_id();
 
             for (std::size_t j = 0; j < mesh.textures.size(); ++j) {
                 //assert(mesh.textures.size() == 3);
@@ -347,6 +440,87 @@ namespace engine {
         }
     }
 
+    bool upload_model_to_gpu(Model_Old& model, Vk_Bindless_Set& bindless)
+    {
+        PROFILE_ZONE("upload_model_to_gpu");
+
+        Vk_Renderer* renderer = get_vulkan_renderer();
+
+        // Each unique texture of the model only takes up a single slot no
+        // matter how many meshes use it.
+        // Slots are recorded as they are added so that destroying a model
+        // which failed part way releases exactly what it took.
+        std::vector<uint32_t>& texture_indices = model.bindless_textures;
+        texture_indices.reserve(model.unique_textures.size());
+        for (const Vk_Image& texture : model.unique_textures) {
+            const uint32_t index = add_bindless_texture(bindless, texture);
+
+            if (index == UINT32_MAX) {
+                error("Bindless texture array is full ({} textures).", bindless.max_textures);
+                return false;
+            }
+
+            texture_indices.push_back(index);
+        }
+
+        for (auto& mesh : model.meshes) {
+            if (mesh.textures.size() < 3) {
+                error("{} has a mesh without albedo, normal and specular textures.", model.name);
+                return false;
+            }
+
+            mesh.geometry = upload_geometry(renderer->geometry, mesh.vertices, mesh.indices);
+            mesh.descriptor_set = nullptr;
+            mesh.material_id = next_material_id();
+
+            Vk_Bindless_Material material{};
+            material.albedo = texture_indices[mesh.textures[0]];
+            material.normal = texture_indices[mesh.textures[1]];
+            material.specular = texture_indices[mesh.textures[2]];
+
+            if (!set_bindless_material(bindless, mesh.material_id, material)) {
+                error("Bindless material buffer is full ({} materials).", bindless.max_materials);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+
+    Model_Upload_Mark get_model_upload_mark()
+    {
+        const Vk_Renderer* renderer = get_vulkan_renderer();
+
+        Model_Upload_Mark mark{};
+        mark.geometry = get_geometry_mark(renderer->geometry);
+        mark.bindless_textures = renderer->bindless.texture_count;
+        mark.material_id = g_material_id;
+
+        return mark;
+    }
+
+    void rewind_model_uploads(const Model_Upload_Mark& mark)
+    {
+        Vk_Renderer* renderer = get_vulkan_renderer();
+
+        rewind_geometry(renderer->geometry, mark.geometry);
+
+        // Released texture slots keep pointing at destroyed views until they
+        // are handed out again. This is fine since the set is partially bound
+        // and no material references them.
+        Vk_Bindless_Set& bindless = renderer->bindless;
+        bindless.texture_count = std::min(bindless.texture_count, mark.bindless_textures);
+        std::erase_if(bindless.free_textures, [&](uint32_t index) {
+            return index >= bindless.texture_count;
+        });
+
+        g_material_id = std::min(g_material_id, mark.material_id);
+        std::erase_if(g_free_material_ids, [](uint32_t id) {
+            return id > g_material_id;
+        });
+    }
+
 
     mesh_primitive::mesh_primitive(const std::vector<vertex>& vertices, 
         const std::vector<std::uint32_t>& indices, 
@@ -3,11 +3,19 @@
 
 
 #include "api/vulkan/vk_vertex_array.h"
+#include "api/vulkan/vk_descriptor_sets.h"
 #include "material.h"
 
 // One material per mesh
 
 namespace engine {
+    // Axis aligned bounding box in model space.
+    struct Bounding_Box
+    {
+        glm::vec3 min = glm::vec3(0.0f);
+        glm::vec3 max = glm::vec3(0.0f);
+    };
+
     struct Mesh_Old
     {
         std::string name;
@@ -18,8 +26,14 @@ namespace engine {
         // A list of indices so we know we textures this mesh uses
         std::vector<uint32_t> textures;
 
-        vk_vertex_array vertex_array;
-        VkDescriptorSet descriptor_set;
+        Bounding_Box bounds;
+
+        vk_geometry_range geometry{};
+        VkDescriptorSet descriptor_set = nullptr;
+
+        // Unique identifier of the descriptor set used to sort draws by
+        // material. Zero until the mesh has been uploaded.
+        uint32_t material_id = 0;
     };
 
     struct Model_Old
@@ -30,8 +44,14 @@ namespace engine {
         std::vector<std::filesystem::path> unique_texture_paths;
         std::vector<Vk_Image> unique_textures;
 
+        // Slots of the unique textures in the bindless set if uploaded there.
+        std::vector<uint32_t> bindless_textures;
+
         std::vector<Mesh_Old> meshes;
         std::string name;
+
+        // Combined bounds of all meshes
+        Bounding_Box bounds;
     };
 
     struct texture
@@ -124,12 +144,50 @@ namespace engine {
 
 
 
+    // A model file that has been read and post-processed by assimp. Importing
+    // only touches the CPU so it can run on a worker thread while the GPU is
+    // busy. Textures are created when the import is loaded into a model.
+    struct Model_Import
+    {
+        std::filesystem::path path;
+        std::unique_ptr<Assimp::Importer> importer;
+        const aiScene* scene = nullptr;
+    };
+
+    bool import_model(Model_Import& model_import, const std::filesystem::path& path, bool flipUVs = true);
+    bool load_model(Model_Old& model, const Model_Import& model_import);
+
     bool load_model(Model_Old& model, const std::filesystem::path& path, bool flipUVs = true);
     bool create_model(Model_Old& model, const std::filesystem::path& path, const char* data, std::size_t len, bool flipUVs = true);
+    // Releases the GPU resources of the model immediately. The GPU must no
+    // longer be using the model.
     void destroy_model(Model_Old& model);
 
+    // Takes ownership of the model and destroys it once every frame that may
+    // have drawn it has finished. Does not wait on the GPU.
+    void destroy_model_deferred(Model_Old&& model);
+
     void upload_model_to_gpu(Model_Old& model, VkDescriptorSetLayout layout, std::vector<VkDescriptorSetLayoutBinding> bindings);
 
+    // Registers the textures of the model in the bindless set and writes a
+    // material record for each mesh instead of allocating descriptor sets.
+    bool upload_model_to_gpu(Model_Old& model, Vk_Bindless_Set& bindless);
+
+    // Geometry, bindless textures and material ids are handed out from
+    // renderer wide resources which grow linearly once nothing freed is left
+    // to reuse. A mark records the end of each so that everything past it can
+    // be trimmed at once. The models uploaded after it must have been
+    // destroyed and the GPU must be idle before rewinding.
+    struct Model_Upload_Mark
+    {
+        vk_geometry_mark geometry;
+        uint32_t bindless_textures;
+        uint32_t material_id;
+    };
+
+    Model_Upload_Mark get_model_upload_mark();
+    void rewind_model_uploads(const Model_Upload_Mark& mark);
+
 
     // temp
     void create_fallback_albedo_texture(Model_Old& model, Mesh_Old& mesh);
@@ -0,0 +1,130 @@
+#include "pch.h"
+#include "render_queue.h"
+
+#include "api/vulkan/vk_descriptor_sets.h"
+
+namespace engine {
+    void clear_render_queue(Render_Queue& queue)
+    {
+        queue.packets.clear();
+        queue.pipelines.clear();
+        queue.order.clear();
+    }
+
+    void add_draw(Render_Queue& queue, const Vk_Pipeline& pipeline, const Mesh_Old& mesh,
+        uint32_t instance_count, uint32_t first_instance, bool bind_material)
+    {
+        // Passes only ever use a handful of pipelines so a linear search is
+        // faster than a map.
+        auto it = std::find(queue.pipelines.begin(), queue.pipelines.end(), &pipeline);
+        if (it == queue.pipelines.end()) {
+            queue.pipelines.push_back(&pipeline);
+            it = queue.pipelines.end() - 1;
+        }
+
+        const uint64_t pipeline_id = static_cast<uint64_t>(std::distance(queue.pipelines.begin(), it));
+        const uint64_t material_id = bind_material ? mesh.material_id : 0;
+        const uint64_t block = mesh.geometry.block;
+
+        Draw_Packet packet{};
+        packet.key = (pipeline_id & 0xff) << 56 | (material_id & 0xffffffff) << 24 | (block & 0xffffff);
+        packet.pipeline = &pipeline;
+        packet.material = bind_material ? mesh.descriptor_set : nullptr;
+        packet.material_id = u32(material_id);
+        packet.geometry = mesh.geometry;
+        packet.instance_count = instance_count;
+        packet.first_instance = first_instance;
+
+        queue.packets.push_back(packet);
+    }
+
+    void sort_render_queue(Render_Queue& queue)
+    {
+        const std::size_t count = queue.packets.size();
+
+        queue.keys.resize(count);
+        queue.order.resize(count);
+        queue.scratch_keys.resize(count);
+        queue.scratch_order.resize(count);
+
+        for (std::size_t i = 0; i < count; ++i) {
+            queue.keys[i] = queue.packets[i].key;
+            queue.order[i] = u32(i);
+        }
+
+        // Sorting by 8 bits at a time keeps the histogram small enough to
+        // live in L1. Each pass is stable so the order of draws with the same
+        // key is preserved.
+        for (uint32_t shift = 0; shift < 64; shift += 8) {
+            std::array<uint32_t, 256> offsets{};
+            for (uint64_t key : queue.keys)
+                ++offsets[(key >> shift) & 0xff];
+
+            if (std::find(offsets.begin(), offsets.end(), u32(count)) != offsets.end())
+                continue;
+
+            uint32_t total = 0;
+            for (uint32_t& offset : offsets) {
+                const uint32_t bucket = offset;
+                offset = total;
+                total += bucket;
+            }
+
+            for (std::size_t i = 0; i < count; ++i) {
+                const uint32_t index = offsets[(queue.keys[i] >> shift) & 0xff]++;
+                queue.scratch_keys[index] = queue.keys[i];
+                queue.scratch_order[index] = queue.order[i];
+            }
+
+            queue.keys.swap(queue.scratch_keys);
+            queue.order.swap(queue.scratch_order);
+        }
+    }
+
+    uint32_t submit_render_queue(const Render_Queue& queue, std::vector<VkCommandBuffer>& buffers, VkPipelineLayout layout)
+    {
+        const vk_geometry_buffer& geometry = get_vulkan_renderer()->geometry;
+
+        const Vk_Pipeline* bound_pipeline = nullptr;
+        uint32_t bound_material = 0;
+        uint32_t bound_block = UINT32_MAX;
+        uint32_t skipped = 0;
+
+        for (uint32_t index : queue.order) {
+            const Draw_Packet& packet = queue.packets[index];
+
+            if (packet.pipeline != bound_pipeline) {
+                bind_pipeline(buffers, *packet.pipeline);
+                bound_pipeline = packet.pipeline;
+            } else {
+                ++skipped;
+            }
+
+            if (packet.material_id != 0 && packet.material_id != bound_material) {
+                if (packet.material)
+                    bind_descriptor_set(buffers, layout, packet.material);
+                else
+                    push_constants(buffers, layout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(uint32_t), &packet.material_id);
+                bound_material = packet.material_id;
+            } else if (packet.material_id != 0) {
+                ++skipped;
+            }
+
+            if (packet.geometry.block != bound_block) {
+                bind_geometry_block(buffers, geometry, packet.geometry.block);
+                bound_block = packet.geometry.block;
+            } else {
+                ++skipped;
+            }
+
+            render(buffers,
+                packet.geometry.index_count,
+                packet.instance_count,
+                packet.geometry.first_index,
+                packet.geometry.vertex_offset,
+                packet.first_instance);
+        }
+
+        return skipped;
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef MY_ENGINE_RENDER_QUEUE_H
+#define MY_ENGINE_RENDER_QUEUE_H
+
+#include "api/vulkan/vk_renderer.h"
+#include "model.h"
+
+namespace engine {
+    // A single instanced draw of a mesh along with all of the state that
+    // must be bound for it. A material id of zero skips the material which
+    // is the case for passes such as shadows that only need depth. Bindless
+    // materials have no set and push their id instead.
+    struct Draw_Packet
+    {
+        uint64_t key;
+
+        const Vk_Pipeline* pipeline;
+        VkDescriptorSet material;
+        uint32_t material_id;
+        vk_geometry_range geometry;
+
+        uint32_t instance_count;
+        uint32_t first_instance;
+    };
+
+    // Draws are collected into the queue, sorted by their key and recorded in
+    // that order so that draws sharing state end up next to each other and
+    // only the state that differs from the previous draw is bound.
+    //
+    // Key layout from the most significant bit:
+    //   8 bits  pipeline
+    //   32 bits material
+    //   24 bits geometry block
+    struct Render_Queue
+    {
+        std::vector<Draw_Packet> packets;
+
+        // Pipelines seen by this queue. The index of a pipeline is its key.
+        std::vector<const Vk_Pipeline*> pipelines;
+
+        // Packet indices in sorted order along with scratch memory for the
+        // radix sort.
+        std::vector<uint32_t> order;
+        std::vector<uint64_t> keys;
+        std::vector<uint64_t> scratch_keys;
+        std::vector<uint32_t> scratch_order;
+    };
+
+    void clear_render_queue(Render_Queue& queue);
+
+    void add_draw(Render_Queue& queue, const Vk_Pipeline& pipeline, const Mesh_Old& mesh,
+        uint32_t instance_count, uint32_t first_instance, bool bind_material = true);
+
+    // Sorts the draws by key using a least significant digit radix sort.
+    // Digits that are the same for every draw are skipped.
+    void sort_render_queue(Render_Queue& queue);
+
+    // Records the sorted draws. Returns the number of pipeline, material and
+    // vertex buffer binds that were skipped compared to binding every state
+    // for every draw.
+    uint32_t submit_render_queue(const Render_Queue& queue, std::vector<VkCommandBuffer>& buffers, VkPipelineLayout layout);
+}
+
+#endif
@@ -24,6 +24,10 @@ namespace engine {
     {
         disabled = 0,
         enabled = 1,
+
+        // Synchronized to the display but the most recent frame replaces any
+        // frame still queued instead of blocking the CPU.
+        mailbox = 2,
     };
 
 
@@ -16,23 +16,26 @@ layout(binding = 0) uniform model_view_projection {
     mat4 proj;
 } mvp;
 
-layout(push_constant) uniform constant
-{
-    mat4 model;
-} obj;
+// Per-instance model matrices. gl_InstanceIndex already includes the
+// firstInstance value of the draw call.
+layout(std430, binding = 1) readonly buffer instance_data {
+    mat4 models[];
+} instances;
 
 void main()
 {
+    const mat4 model = instances.models[gl_InstanceIndex];
+
     // Transform vertex from model to projection space
     // Model space -> World Space -> View Space -> Projection Space
-    gl_Position = mvp.proj * mvp.view * obj.model * vec4(position, 1.0);
+    gl_Position = mvp.proj * mvp.view * model * vec4(position, 1.0);
    
-    vertex_position = vec3(obj.model * vec4(position, 1.0));
+    vertex_position = vec3(model * vec4(position, 1.0));
 
     texture_coord = uv;
 
     // Calculate TBN matrix required for normal mapping
-    mat3 M = transpose(inverse(mat3(obj.model)));
+    mat3 M = transpose(inverse(mat3(model)));
     vertex_tangent = M * normalize(tangent);
     vertex_normal = M * normalize(normal);
 }
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include "pch.h"
+#include "shaders.h"
+
+// Each .inc file is written by the glslc custom build step of its shader in
+// engine.vcxproj as a C initializer list of SPIR-V words.
+
+namespace engine {
+    static const uint32_t geometry_vert[] =
+#include "geometry.vert.inc"
+    ;
+
+    static const uint32_t geometry_frag[] =
+#include "geometry.frag.inc"
+    ;
+
+    static const uint32_t geometry_bindless_frag[] =
+#include "geometry_bindless.frag.inc"
+    ;
+
+    static const uint32_t lighting_vert[] =
+#include "lighting.vert.inc"
+    ;
+
+    static const uint32_t lighting_frag[] =
+#include "lighting.frag.inc"
+    ;
+
+    static const uint32_t light_cull_comp[] =
+#include "light_cull.comp.inc"
+    ;
+
+    static const uint32_t skybox_vert[] =
+#include "skybox.vert.inc"
+    ;
+
+    static const uint32_t skybox_frag[] =
+#include "skybox.frag.inc"
+    ;
+
+    static const uint32_t cull_comp[] =
+#include "cull.comp.inc"
+    ;
+
+    static const uint32_t cull_finalize_comp[] =
+#include "cull_finalize.comp.inc"
+    ;
+
+    static const uint32_t depth_pyramid_comp[] =
+#include "depth_pyramid.comp.inc"
+    ;
+
+    const Shader_Binary geometry_vs_spirv = { "geometry.vert", geometry_vert, sizeof(geometry_vert) };
+    const Shader_Binary geometry_fs_spirv = { "geometry.frag", geometry_frag, sizeof(geometry_frag) };
+    const Shader_Binary geometry_bindless_fs_spirv = { "geometry_bindless.frag", geometry_bindless_frag, sizeof(geometry_bindless_frag) };
+    const Shader_Binary lighting_vs_spirv = { "lighting.vert", lighting_vert, sizeof(lighting_vert) };
+    const Shader_Binary lighting_fs_spirv = { "lighting.frag", lighting_frag, sizeof(lighting_frag) };
+    const Shader_Binary light_cull_cs_spirv = { "light_cull.comp", light_cull_comp, sizeof(light_cull_comp) };
+    const Shader_Binary skybox_vs_spirv = { "skybox.vert", skybox_vert, sizeof(skybox_vert) };
+    const Shader_Binary skybox_fs_spirv = { "skybox.frag", skybox_frag, sizeof(skybox_frag) };
+    const Shader_Binary cull_cs_spirv = { "cull.comp", cull_comp, sizeof(cull_comp) };
+    const Shader_Binary cull_finalize_cs_spirv = { "cull_finalize.comp", cull_finalize_comp, sizeof(cull_finalize_comp) };
+    const Shader_Binary depth_pyramid_cs_spirv = { "depth_pyramid.comp", depth_pyramid_comp, sizeof(depth_pyramid_comp) };
+
+#if defined(MY_ENGINE_COMPILE_SHADERS)
+    std::filesystem::path get_shader_source_directory()
+    {
+        return std::filesystem::path(__FILE__).parent_path() / "vulkan";
+    }
+#endif
+}
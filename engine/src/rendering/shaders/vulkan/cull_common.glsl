@@ -0,0 +1,79 @@
+// Shared declarations of the GPU culling compute shaders. The instances are
+// kept in device memory while the model table, draw commands and counts are
+// written each frame into instance memory. That memory is bound multiple
+// times, each binding being a different view of the same data.
+
+layout(local_size_x = 64) in;
+
+struct draw_command {
+    uint index_count;
+    uint instance_count;
+    uint first_index;
+    int  vertex_offset;
+    uint first_instance;
+    uint leader;
+    uint bucket;
+    uint bucket_first;
+};
+
+// leader is the draw whose instance count is used as the append counter of
+// the model or ~0 if the model has no meshes.
+struct model_data {
+    vec4 aabb_min;
+    vec4 aabb_max;
+    uint leader;
+    uint output_offset;
+    uint triangle_count;
+    uint padding[5];
+};
+
+layout(binding = 0) uniform cull_data {
+    vec4 planes[6];
+
+    // View projection that the depth pyramid was built with
+    mat4 view_proj;
+    vec4 pyramid_size;
+
+    // x: pyramid mip count, y: occlusion culling enabled, z: frame index
+    uvec4 params;
+} cull;
+
+layout(std430, binding = 1) readonly buffer instance_data {
+    mat4 matrices[];
+} instances;
+
+layout(std430, binding = 2) readonly buffer instance_model_data {
+    uint models[];
+} instance_models;
+
+layout(std430, binding = 3) readonly buffer model_table {
+    model_data models[];
+} models;
+
+layout(std430, binding = 4) buffer draw_data {
+    draw_command commands[];
+} draws;
+
+layout(std430, binding = 5) buffer count_data {
+    uint counts[];
+} draw_counts;
+
+layout(std430, binding = 6) writeonly buffer visible_data {
+    mat4 matrices[];
+} visible;
+
+// Number of occluded instances and triangles for each frame in flight
+layout(std430, binding = 7) buffer stats_data {
+    uint values[];
+} stats;
+
+layout(binding = 8) uniform sampler2D depth_pyramid;
+
+layout(push_constant) uniform constants {
+    uint instance_count;
+    uint first_model;
+    uint first_draw;
+    uint draw_count;
+    uint first_compacted;
+    uint first_count;
+} pc;
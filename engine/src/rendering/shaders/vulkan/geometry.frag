@@ -0,0 +1,15 @@
+// Texture access of the geometry pass. Each material either binds its own
+// descriptor set with one sampler per texture or, when the GPU supports
+// descriptor indexing, looks up its textures in a single bindless array.
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+layout(set = 1, binding = 0) uniform sampler2D albedoTexture;
+layout(set = 1, binding = 1) uniform sampler2D normalTexture;
+layout(set = 1, binding = 2) uniform sampler2D specularTexture;
+
+vec4 sample_albedo(vec2 uv) { return texture(albedoTexture, uv); }
+vec4 sample_normal(vec2 uv) { return texture(normalTexture, uv); }
+vec4 sample_specular(vec2 uv) { return texture(specularTexture, uv); }
+
+#include "geometry_main.glsl"
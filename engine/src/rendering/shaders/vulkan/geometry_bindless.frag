@@ -0,0 +1,25 @@
+// Texture access of the geometry pass. Each material either binds its own
+// descriptor set with one sampler per texture or, when the GPU supports
+// descriptor indexing, looks up its textures in a single bindless array.
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+#extension GL_GOOGLE_include_directive : require
+
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+// x = albedo, y = normal, z = specular texture index
+layout(std430, set = 1, binding = 1) readonly buffer material_data {
+    uvec4 materials[];
+};
+
+// The material index is the same for the entire draw so the array can be
+// indexed without nonuniformEXT.
+layout(push_constant) uniform material_constants {
+    uint material;
+};
+
+vec4 sample_albedo(vec2 uv) { return texture(textures[materials[material].x], uv); }
+vec4 sample_normal(vec2 uv) { return texture(textures[materials[material].y], uv); }
+vec4 sample_specular(vec2 uv) { return texture(textures[materials[material].z], uv); }
+
+#include "geometry_main.glsl"
@@ -0,0 +1,46 @@
+// Shared by the geometry fragment shaders after they declare how textures
+// are sampled.
+layout(location = 0) in vec2 texture_coord;
+layout(location = 1) in vec3 vertex_position;
+layout(location = 2) in vec3 vertex_normal;
+layout(location = 3) in vec3 vertex_tangent;
+
+// Set per pipeline so that disabled features are compiled out.
+layout(constant_id = 0) const bool NORMAL_MAPPING = true;
+
+// The G-buffer is kept compact to reduce bandwidth. The world position is
+// reconstructed from depth in the lighting pass, normals are octahedral
+// encoded into two channels and specular is stored in the albedo alpha.
+layout(location = 0) out vec2 out_normal;
+layout(location = 1) out vec4 out_color;
+
+vec2 sign_not_zero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 octahedral_encode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    return n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * sign_not_zero(n.xy);
+}
+
+void main()
+{
+    vec3 albedo = sample_albedo(texture_coord).rgb;
+    float specular = sample_specular(texture_coord).r;
+    out_color = vec4(albedo, specular);
+
+    vec3 N = normalize(vertex_normal);
+
+    if (NORMAL_MAPPING) {
+        // Create the bitangent
+        vec3 T = normalize(vertex_tangent);
+        vec3 B = cross(N, T);
+        mat3 TBN = mat3(T, B, N);
+
+        N = normalize(TBN * normalize(sample_normal(texture_coord).xyz * 2.0 - vec3(1.0)));
+    }
+
+	out_normal = octahedral_encode(N);
+}
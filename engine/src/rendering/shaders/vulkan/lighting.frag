@@ -0,0 +1,159 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "lighting_common.glsl"
+
+layout(std430, binding = 5) readonly buffer tile_data {
+    uint values[];
+} tiles;
+
+layout (binding = 6) uniform sampler2D samplerShadow[SHADOW_CASCADE_COUNT];
+
+layout (location = 0) in vec2 inUV;
+
+layout (location = 0) out vec4 outFragcolor;
+
+// Each combination is a separate pipeline so that disabled features are
+// compiled out. VIEWPORT_VIEW matches engine::Viewport_View and anything
+// other than zero outputs the selected G-buffer component instead of the
+// lit result.
+layout (constant_id = 0) const bool SHADOWS = true;
+layout (constant_id = 1) const int VIEWPORT_VIEW = 0;
+
+// Indexing with a constant avoids requiring non-uniform indexing of the
+// shadow map array as neighbouring pixels may select different cascades.
+float sample_shadow_map(int cascade, vec2 uv)
+{
+    switch (cascade) {
+        case 0: return texture(samplerShadow[0], uv).r;
+        case 1: return texture(samplerShadow[1], uv).r;
+        case 2: return texture(samplerShadow[2], uv).r;
+        default: return texture(samplerShadow[3], uv).r;
+    }
+}
+
+// Returns how much of the pixel is lit by the sun using a 3x3 PCF kernel in
+// the first cascade that contains the pixel.
+float calculate_shadow(vec3 world_pos, vec3 normal)
+{
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; ++i) {
+        // Offset along the normal by the cascades texel size to avoid acne
+        vec3 position = world_pos + normal * scene.shadowTexelSizes[i] * 1.5;
+        vec4 shadow_pos = scene.shadowMatrices[i] * vec4(position, 1.0);
+        vec3 coords = shadow_pos.xyz / shadow_pos.w;
+        vec2 uv = coords.xy * 0.5 + 0.5;
+
+        float margin = scene.shadowParams.y;
+        if (any(lessThan(uv, vec2(margin))) || any(greaterThan(uv, vec2(1.0 - margin))) || coords.z < 0.0 || coords.z > 1.0)
+            continue;
+
+        // Reversed Z so anything with a larger depth is closer to the sun.
+        float lit = 0.0;
+        for (int x = -1; x <= 1; ++x) {
+            for (int y = -1; y <= 1; ++y) {
+                float depth = sample_shadow_map(i, uv + vec2(x, y) * scene.shadowParams.y);
+                lit += coords.z >= depth ? 1.0 : 0.0;
+            }
+        }
+
+        return lit / 9.0;
+    }
+
+    return 1.0;
+}
+
+vec3 octahedral_decode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+
+    return normalize(n);
+}
+
+vec3 shade_point_lights(vec3 world_pos, vec3 normal, vec3 camera_dir)
+{
+    vec3 result = vec3(0.0);
+
+    const uvec2 tile_id = uvec2(gl_FragCoord.xy) / LIGHT_TILE_SIZE;
+    const uint tile = (tile_id.y * scene.lightInfo.z + tile_id.x) * (MAX_LIGHTS_PER_TILE + 1);
+    const uint count = tiles.values[tile];
+
+    for (uint i = 0; i < count; ++i) {
+        point_light light = lights[scene.lightInfo.x + tiles.values[tile + 1 + i]];
+
+        vec3 to_light = light.position.xyz - world_pos;
+        float distance = length(to_light);
+        vec3 light_dir = to_light / max(distance, 0.0001);
+
+        // Smooth falloff that reaches zero at the lights radius
+        float falloff = clamp(1.0 - pow(distance / light.position.w, 2.0), 0.0, 1.0);
+        float attenuation = falloff * falloff;
+
+        float diffuse_factor = max(dot(light_dir, normal), 0.0);
+        float specular_factor = pow(max(dot(normal, normalize(camera_dir + light_dir)), 0.0), scene.ambientSpecular.b);
+
+        result += (diffuse_factor + specular_factor) * attenuation * light.color.rgb * light.color.a;
+    }
+
+    return result;
+}
+
+void main()
+{
+	// Only part of the G-buffer may have been rendered to. inUV covers the
+	// rendered area so it is scaled to find the texels within it.
+	vec2 uv = inUV * scene.renderSize.zw;
+
+	// textures
+	vec4 albedo_spec = texture(samplerAlbedo, uv);
+	float depth = texture(samplerDepth, uv).r;
+
+	vec3 world_pos = reconstruct_position(inUV, depth);
+	vec3 normal = octahedral_decode(texture(samplerNormal, uv).rg);
+	vec3 albedo = albedo_spec.rgb;
+	float spec = albedo_spec.a;
+
+	// Debug views of the individual G-buffer components
+	if (VIEWPORT_VIEW == 1) {
+		outFragcolor = vec4(albedo, 1.0);
+		return;
+	} else if (VIEWPORT_VIEW == 2) {
+		outFragcolor = vec4(world_pos, 1.0);
+		return;
+	} else if (VIEWPORT_VIEW == 3) {
+		outFragcolor = vec4(normal, 1.0);
+		return;
+	} else if (VIEWPORT_VIEW == 4) {
+		outFragcolor = vec4(spec.rrr, 1.0);
+		return;
+	}
+	
+	vec3 lightColor = vec3(1.0);
+
+	//////////////// AMBIENT ////////////////
+	vec3 ambient = scene.ambientSpecular.rrr * lightColor;
+
+
+	//////////////// DIFFUSE ////////////////
+	vec3 light_dir = normalize(-scene.sunDirection);
+	float diffuse_factor = max(dot(light_dir, normal), 0.0);
+	vec3 diffuse = diffuse_factor * lightColor;
+
+	//////////////// SPECULAR ////////////////
+	vec3 camera_dir = normalize(scene.cameraPosition.xyz - world_pos);
+	vec3 halfway_dir = normalize(camera_dir + light_dir);
+	//vec3 light_reflect_dir = reflect(-scene.sunDirection, normal);
+
+	float specFactor = max(dot(normal, halfway_dir), 0.0);
+	vec3 specular = pow(specFactor, scene.ambientSpecular.b) * lightColor;
+
+	float shadow = SHADOWS && depth > 0.0 ? calculate_shadow(world_pos, normal) : 1.0;
+
+	vec3 result = (ambient + shadow * (diffuse + specular)) * albedo;
+
+	if (scene.lightInfo.y > 0 && depth > 0.0)
+		result += shade_point_lights(world_pos, normal, camera_dir) * albedo;
+
+	outFragcolor = vec4(result, 1.0);
+}
@@ -0,0 +1,65 @@
+// Shared declarations of the lighting pass and the light culling compute
+// shader. Both use the same descriptor set so that the tiles built by the
+// compute shader line up with the pixels that the lighting pass shades.
+
+#define LIGHT_TILE_SIZE 16
+#define MAX_LIGHTS_PER_TILE 255
+#define SHADOW_CASCADE_COUNT 4
+
+struct point_light {
+    // xyz = world position, w = radius
+    vec4 position;
+    // rgb = color, a = intensity
+    vec4 color;
+};
+
+//
+// Geometry Uniform Buffers
+// 
+layout (binding = 0) uniform sampler2D samplerNormal;
+layout (binding = 1) uniform sampler2D samplerAlbedo;
+layout (binding = 2) uniform sampler2D samplerDepth;
+
+layout(binding = 3) uniform scene_ubo
+{
+    // ambient Strength, specular strength, specular shininess, empty
+    vec4 ambientSpecular;
+    vec4 cameraPosition;
+
+	vec3 sunDirection;
+	vec3 sunPosition;
+
+    mat4 inverseViewProj;
+
+    // x = first light, y = light count, z = horizontal tile count
+    uvec4 lightInfo;
+
+    mat4 shadowMatrices[SHADOW_CASCADE_COUNT];
+    vec4 shadowTexelSizes;
+
+    // x = empty, y = 1 / shadow map size
+    vec4 shadowParams;
+
+    // xy = rendered size in pixels, zw = rendered fraction of the attachments
+    vec4 renderSize;
+} scene;
+
+// The lights of the current frame are sub-allocated from instance memory.
+layout(std430, binding = 4) readonly buffer light_data {
+    point_light lights[];
+};
+
+// Binding 5 holds, for every tile, the number of lights followed by
+// MAX_LIGHTS_PER_TILE light indices. It is declared by each shader as only
+// the compute shader writes to it.
+
+vec3 reconstruct_position(vec2 uv, float depth)
+{
+    // Nothing was rendered at the far plane (reversed Z) so there is no
+    // position to reconstruct.
+    if (depth == 0.0)
+        return vec3(0.0);
+
+    vec4 position = scene.inverseViewProj * vec4(uv * 2.0 - 1.0, depth, 1.0);
+    return position.xyz / position.w;
+}
@@ -0,0 +1,39 @@
+#include "pch.h"
+#include "simd.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+namespace engine {
+    static bool cpu_supports_avx2()
+    {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+
+        // AVX also needs the OS to save the upper halves of the registers
+        // which XGETBV reports once OSXSAVE is set.
+        __cpuid(info, 1);
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        const bool avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+            return false;
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+
+    bool has_avx2()
+    {
+        static const bool supported = avx2_kernels_built() && cpu_supports_avx2();
+        return supported;
+    }
+}
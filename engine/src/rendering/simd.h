@@ -0,0 +1,41 @@
+#ifndef MY_ENGINE_SIMD_H
+#define MY_ENGINE_SIMD_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace engine {
+    // Returns true if the CPU and OS support AVX2 and the kernels below were
+    // built with it. Checked once with cpuid.
+    bool has_avx2();
+
+    // False if simd_avx2.cpp was built without AVX2, in which case its
+    // kernels are empty.
+    bool avx2_kernels_built();
+
+    // AVX2 versions of the transform and culling kernels. They live in
+    // simd_avx2.cpp which is the only file built with /arch:AVX2 so they must
+    // only be called when has_avx2() returns true. The file does not include
+    // pch.h so that no inline function from another header is compiled with
+    // AVX2 and then picked by the linker for every caller. Matrices are
+    // passed as column major arrays of 16 floats.
+    //
+    // Functions returning a count process a multiple of eight objects and
+    // leave the rest to the caller's SSE and scalar paths.
+
+    // components are the ten arrays of Transform_Components in declaration
+    // order, already offset to the first object.
+    std::size_t compose_transforms_avx2(const float* const (&components)[10], std::size_t count, float* matrices);
+
+    void apply_parent_transforms_avx2(const uint32_t* parents, std::size_t first, std::size_t count, float* matrices);
+
+    std::size_t add_bounds_avx2(const float (&center)[3], const float (&extent)[3], const float* matrices, const uint32_t* indices,
+        std::size_t count, float* const (&mins)[3], float* const (&maxs)[3]);
+
+    // planes are the six frustum planes. Appends the indices of visible
+    // boxes to visible and increases visible_count.
+    std::size_t cull_bounds_avx2(const float (&planes)[6][4], const float* const (&mins)[3], const float* const (&maxs)[3],
+        std::size_t count, uint32_t* visible, uint32_t& visible_count);
+}
+
+#endif
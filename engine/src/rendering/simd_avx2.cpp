@@ -0,0 +1,225 @@
+#include "simd.h"
+
+// Built with /arch:AVX2. Compilers without the flag get empty kernels and
+// avx2_kernels_built() keeps has_avx2() false so they are never called.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace engine {
+#if defined(__AVX2__)
+    bool avx2_kernels_built()
+    {
+        return true;
+    }
+
+    // The arithmetic matches compose_lanes in transforms.cpp operation for
+    // operation and avoids FMA so that every path gives the same results.
+    std::size_t compose_transforms_avx2(const float* const (&components)[10], std::size_t count, float* matrices)
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 two = _mm256_set1_ps(2.0f);
+
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            const __m256 position_x = _mm256_loadu_ps(components[0] + i);
+            const __m256 position_y = _mm256_loadu_ps(components[1] + i);
+            const __m256 position_z = _mm256_loadu_ps(components[2] + i);
+            const __m256 rotation_x = _mm256_loadu_ps(components[3] + i);
+            const __m256 rotation_y = _mm256_loadu_ps(components[4] + i);
+            const __m256 rotation_z = _mm256_loadu_ps(components[5] + i);
+            const __m256 rotation_w = _mm256_loadu_ps(components[6] + i);
+            const __m256 scale_x = _mm256_loadu_ps(components[7] + i);
+            const __m256 scale_y = _mm256_loadu_ps(components[8] + i);
+            const __m256 scale_z = _mm256_loadu_ps(components[9] + i);
+
+            const __m256 xx = _mm256_mul_ps(rotation_x, rotation_x);
+            const __m256 yy = _mm256_mul_ps(rotation_y, rotation_y);
+            const __m256 zz = _mm256_mul_ps(rotation_z, rotation_z);
+            const __m256 xy = _mm256_mul_ps(rotation_x, rotation_y);
+            const __m256 xz = _mm256_mul_ps(rotation_x, rotation_z);
+            const __m256 yz = _mm256_mul_ps(rotation_y, rotation_z);
+            const __m256 wx = _mm256_mul_ps(rotation_w, rotation_x);
+            const __m256 wy = _mm256_mul_ps(rotation_w, rotation_y);
+            const __m256 wz = _mm256_mul_ps(rotation_w, rotation_z);
+
+            __m256 m[4][4];
+            m[0][0] = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(yy, zz))), scale_x);
+            m[0][1] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, wz)), scale_x);
+            m[0][2] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, wy)), scale_x);
+            m[0][3] = zero;
+
+            m[1][0] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), scale_y);
+            m[1][1] = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, zz))), scale_y);
+            m[1][2] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(yz, wx)), scale_y);
+            m[1][3] = zero;
+
+            m[2][0] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xz, wy)), scale_z);
+            m[2][1] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), scale_z);
+            m[2][2] = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, yy))), scale_z);
+            m[2][3] = zero;
+
+            m[3][0] = position_x;
+            m[3][1] = position_y;
+            m[3][2] = position_z;
+            m[3][3] = one;
+
+            // Each register holds the same element of eight matrices. Each
+            // half is transposed as four rows to give that column of four
+            // matrices.
+            for (int column = 0; column < 4; ++column) {
+                __m128 low[4], high[4];
+                for (int row = 0; row < 4; ++row) {
+                    low[row] = _mm256_castps256_ps128(m[column][row]);
+                    high[row] = _mm256_extractf128_ps(m[column][row], 1);
+                }
+
+                _MM_TRANSPOSE4_PS(low[0], low[1], low[2], low[3]);
+                _MM_TRANSPOSE4_PS(high[0], high[1], high[2], high[3]);
+
+                float* const first = matrices + i * 16 + column * 4;
+                for (int lane = 0; lane < 4; ++lane) {
+                    _mm_storeu_ps(first + lane * 16, low[lane]);
+                    _mm_storeu_ps(first + (lane + 4) * 16, high[lane]);
+                }
+            }
+        }
+
+        return i;
+    }
+
+    void apply_parent_transforms_avx2(const uint32_t* parents, std::size_t first, std::size_t count, float* matrices)
+    {
+        for (std::size_t i = first; i < first + count; ++i) {
+            const uint32_t parent = parents[i];
+            if (parent == UINT32_MAX)
+                continue;
+
+            // The parent's columns are repeated in both halves so that two
+            // result columns are computed at once. Both are computed before
+            // either is stored as the result replaces the child.
+            const float* a = matrices + static_cast<std::size_t>(parent) * 16;
+            const __m256 a0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a));
+            const __m256 a1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 4));
+            const __m256 a2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 8));
+            const __m256 a3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 12));
+
+            float* b = matrices + i * 16;
+            __m256 columns[2];
+            for (int pair = 0; pair < 2; ++pair) {
+                const float* low = b + pair * 8;
+                const float* high = low + 4;
+
+                const auto element = [&](int row) {
+                    return _mm256_setr_ps(low[row], low[row], low[row], low[row], high[row], high[row], high[row], high[row]);
+                };
+
+                __m256 result = _mm256_mul_ps(a0, element(0));
+                result = _mm256_add_ps(result, _mm256_mul_ps(a1, element(1)));
+                result = _mm256_add_ps(result, _mm256_mul_ps(a2, element(2)));
+                result = _mm256_add_ps(result, _mm256_mul_ps(a3, element(3)));
+                columns[pair] = result;
+            }
+
+            _mm256_storeu_ps(b, columns[0]);
+            _mm256_storeu_ps(b + 8, columns[1]);
+        }
+    }
+
+    std::size_t add_bounds_avx2(const float (&center)[3], const float (&extent)[3], const float* matrices, const uint32_t* indices,
+        std::size_t count, float* const (&mins)[3], float* const (&maxs)[3])
+    {
+        const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            // Offsets of the first float of each matrix. A gather then loads
+            // the same element of all eight matrices.
+            const __m256i offsets = _mm256_slli_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i)), 4);
+
+            for (int row = 0; row < 3; ++row) {
+                const __m256 m0 = _mm256_i32gather_ps(matrices + row, offsets, 4);
+                const __m256 m1 = _mm256_i32gather_ps(matrices + 4 + row, offsets, 4);
+                const __m256 m2 = _mm256_i32gather_ps(matrices + 8 + row, offsets, 4);
+                const __m256 m3 = _mm256_i32gather_ps(matrices + 12 + row, offsets, 4);
+
+                __m256 world_center = m3;
+                world_center = _mm256_add_ps(world_center, _mm256_mul_ps(m0, _mm256_set1_ps(center[0])));
+                world_center = _mm256_add_ps(world_center, _mm256_mul_ps(m1, _mm256_set1_ps(center[1])));
+                world_center = _mm256_add_ps(world_center, _mm256_mul_ps(m2, _mm256_set1_ps(center[2])));
+
+                __m256 world_extent = _mm256_mul_ps(_mm256_andnot_ps(sign_mask, m0), _mm256_set1_ps(extent[0]));
+                world_extent = _mm256_add_ps(world_extent, _mm256_mul_ps(_mm256_andnot_ps(sign_mask, m1), _mm256_set1_ps(extent[1])));
+                world_extent = _mm256_add_ps(world_extent, _mm256_mul_ps(_mm256_andnot_ps(sign_mask, m2), _mm256_set1_ps(extent[2])));
+
+                _mm256_storeu_ps(mins[row] + i, _mm256_sub_ps(world_center, world_extent));
+                _mm256_storeu_ps(maxs[row] + i, _mm256_add_ps(world_center, world_extent));
+            }
+        }
+
+        return i;
+    }
+
+    std::size_t cull_bounds_avx2(const float (&planes)[6][4], const float* const (&mins)[3], const float* const (&maxs)[3],
+        std::size_t count, uint32_t* visible, uint32_t& visible_count)
+    {
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            const __m256 min_x = _mm256_loadu_ps(mins[0] + i);
+            const __m256 min_y = _mm256_loadu_ps(mins[1] + i);
+            const __m256 min_z = _mm256_loadu_ps(mins[2] + i);
+            const __m256 max_x = _mm256_loadu_ps(maxs[0] + i);
+            const __m256 max_y = _mm256_loadu_ps(maxs[1] + i);
+            const __m256 max_z = _mm256_loadu_ps(maxs[2] + i);
+
+            // Only the corner furthest along the plane's normal is tested.
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (const float (&plane)[4] : planes) {
+                __m256 distance = _mm256_mul_ps(_mm256_set1_ps(plane[0]), plane[0] >= 0.0f ? max_x : min_x);
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(plane[1]), plane[1] >= 0.0f ? max_y : min_y));
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(plane[2]), plane[2] >= 0.0f ? max_z : min_z));
+                distance = _mm256_add_ps(distance, _mm256_set1_ps(plane[3]));
+
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+            }
+
+            // Scanning the lanes rather than using std::countr_zero keeps
+            // std headers out of this file.
+            const int mask = _mm256_movemask_ps(inside);
+            for (int lane = 0; lane < 8; ++lane) {
+                if (mask & (1 << lane))
+                    visible[visible_count++] = static_cast<uint32_t>(i + lane);
+            }
+        }
+
+        return i;
+    }
+#else
+    bool avx2_kernels_built()
+    {
+        return false;
+    }
+
+    std::size_t compose_transforms_avx2(const float* const (&)[10], std::size_t, float*)
+    {
+        return 0;
+    }
+
+    void apply_parent_transforms_avx2(const uint32_t*, std::size_t, std::size_t, float*)
+    {
+    }
+
+    std::size_t add_bounds_avx2(const float (&)[3], const float (&)[3], const float*, const uint32_t*,
+        std::size_t, float* const (&)[3], float* const (&)[3])
+    {
+        return 0;
+    }
+
+    std::size_t cull_bounds_avx2(const float (&)[6][4], const float* const (&)[3], const float* const (&)[3],
+        std::size_t, uint32_t*, uint32_t&)
+    {
+        return 0;
+    }
+#endif
+}
@@ -0,0 +1,264 @@
+#include "pch.h"
+#include "transforms.h"
+
+#include "simd.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MY_ENGINE_TRANSFORM_SSE
+#endif
+
+#if defined(MY_ENGINE_TRANSFORM_SSE)
+#include <immintrin.h>
+#endif
+
+namespace engine {
+    void add_transform(Transform_Components& transforms, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+    {
+        for_each_transform_array(transforms, [](std::vector<float>& component) {
+            component.push_back(0.0f);
+        });
+
+        set_transform(transforms, transforms.position_x.size() - 1, position, rotation, scale);
+    }
+
+    void set_transform(Transform_Components& transforms, std::size_t index, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+    {
+        transforms.position_x[index] = position.x;
+        transforms.position_y[index] = position.y;
+        transforms.position_z[index] = position.z;
+        transforms.rotation_x[index] = rotation.x;
+        transforms.rotation_y[index] = rotation.y;
+        transforms.rotation_z[index] = rotation.z;
+        transforms.rotation_w[index] = rotation.w;
+        transforms.scale_x[index] = scale.x;
+        transforms.scale_y[index] = scale.y;
+        transforms.scale_z[index] = scale.z;
+    }
+
+    void set_transform(Transform_Components& transforms, std::size_t index, const glm::mat4& matrix)
+    {
+        glm::vec3 scale(glm::length(glm::vec3(matrix[0])),
+            glm::length(glm::vec3(matrix[1])),
+            glm::length(glm::vec3(matrix[2])));
+
+        if (glm::determinant(glm::mat3(matrix)) < 0.0f)
+            scale.x = -scale.x;
+
+        // A zero scale leaves no rotation to recover from that axis.
+        const auto axis = [](const glm::vec4& column, float length) {
+            return length != 0.0f ? glm::vec3(column) / length : glm::vec3(0.0f);
+        };
+
+        const glm::mat3 rotation(axis(matrix[0], scale.x), axis(matrix[1], scale.y), axis(matrix[2], scale.z));
+
+        set_transform(transforms, index, glm::vec3(matrix[3]), glm::normalize(glm::quat_cast(rotation)), scale);
+    }
+
+    bool is_trs_matrix(const glm::mat4& matrix)
+    {
+        if (matrix[0][3] != 0.0f || matrix[1][3] != 0.0f || matrix[2][3] != 0.0f || matrix[3][3] != 1.0f)
+            return false;
+
+        // Relative to the axis lengths so that the tolerance does not depend
+        // on the scale.
+        const auto orthogonal = [](const glm::vec4& a, const glm::vec4& b) {
+            const glm::vec3 u(a), v(b);
+            return std::abs(glm::dot(u, v)) <= 1e-4f * glm::length(u) * glm::length(v);
+        };
+
+        return orthogonal(matrix[0], matrix[1]) && orthogonal(matrix[0], matrix[2]) && orthogonal(matrix[1], matrix[2]);
+    }
+
+    glm::vec3 get_position(const Transform_Components& transforms, std::size_t index)
+    {
+        return glm::vec3(transforms.position_x[index], transforms.position_y[index], transforms.position_z[index]);
+    }
+
+    glm::quat get_rotation(const Transform_Components& transforms, std::size_t index)
+    {
+        return glm::quat(transforms.rotation_w[index], transforms.rotation_x[index], transforms.rotation_y[index], transforms.rotation_z[index]);
+    }
+
+    glm::vec3 get_scale(const Transform_Components& transforms, std::size_t index)
+    {
+        return glm::vec3(transforms.scale_x[index], transforms.scale_y[index], transforms.scale_z[index]);
+    }
+
+    // The same arithmetic is instantiated for a single float and for SSE
+    // registers holding one object per lane so both paths give the same
+    // results. compose_transforms_avx2 repeats it for AVX2 registers.
+    static float add(float a, float b) { return a + b; }
+    static float sub(float a, float b) { return a - b; }
+    static float mul(float a, float b) { return a * b; }
+
+#if defined(MY_ENGINE_TRANSFORM_SSE)
+    static __m128 add(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+    static __m128 sub(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+    static __m128 mul(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+#endif
+
+    template <typename T>
+    struct Transform_Lanes
+    {
+        T position_x, position_y, position_z;
+        T rotation_x, rotation_y, rotation_z, rotation_w;
+        T scale_x, scale_y, scale_z;
+    };
+
+    // Writes m[column][row] of translation * rotation * scale. Matches
+    // glm::mat4_cast for the rotation.
+    template <typename T>
+    static void compose_lanes(const Transform_Lanes<T>& t, T zero, T one, T two, T (&m)[4][4])
+    {
+        const T xx = mul(t.rotation_x, t.rotation_x);
+        const T yy = mul(t.rotation_y, t.rotation_y);
+        const T zz = mul(t.rotation_z, t.rotation_z);
+        const T xy = mul(t.rotation_x, t.rotation_y);
+        const T xz = mul(t.rotation_x, t.rotation_z);
+        const T yz = mul(t.rotation_y, t.rotation_z);
+        const T wx = mul(t.rotation_w, t.rotation_x);
+        const T wy = mul(t.rotation_w, t.rotation_y);
+        const T wz = mul(t.rotation_w, t.rotation_z);
+
+        m[0][0] = mul(sub(one, mul(two, add(yy, zz))), t.scale_x);
+        m[0][1] = mul(mul(two, add(xy, wz)), t.scale_x);
+        m[0][2] = mul(mul(two, sub(xz, wy)), t.scale_x);
+        m[0][3] = zero;
+
+        m[1][0] = mul(mul(two, sub(xy, wz)), t.scale_y);
+        m[1][1] = mul(sub(one, mul(two, add(xx, zz))), t.scale_y);
+        m[1][2] = mul(mul(two, add(yz, wx)), t.scale_y);
+        m[1][3] = zero;
+
+        m[2][0] = mul(mul(two, add(xz, wy)), t.scale_z);
+        m[2][1] = mul(mul(two, sub(yz, wx)), t.scale_z);
+        m[2][2] = mul(sub(one, mul(two, add(xx, yy))), t.scale_z);
+        m[2][3] = zero;
+
+        m[3][0] = t.position_x;
+        m[3][1] = t.position_y;
+        m[3][2] = t.position_z;
+        m[3][3] = one;
+    }
+
+    template <typename T, typename Load>
+    static Transform_Lanes<T> load_lanes(const Transform_Components& transforms, std::size_t i, Load load)
+    {
+        Transform_Lanes<T> t;
+        t.position_x = load(&transforms.position_x[i]);
+        t.position_y = load(&transforms.position_y[i]);
+        t.position_z = load(&transforms.position_z[i]);
+        t.rotation_x = load(&transforms.rotation_x[i]);
+        t.rotation_y = load(&transforms.rotation_y[i]);
+        t.rotation_z = load(&transforms.rotation_z[i]);
+        t.rotation_w = load(&transforms.rotation_w[i]);
+        t.scale_x = load(&transforms.scale_x[i]);
+        t.scale_y = load(&transforms.scale_y[i]);
+        t.scale_z = load(&transforms.scale_z[i]);
+
+        return t;
+    }
+
+    glm::mat4 compose_transform(const Transform_Components& transforms, std::size_t index)
+    {
+        const Transform_Lanes<float> t = load_lanes<float>(transforms, index, [](const float* value) {
+            return *value;
+        });
+
+        float m[4][4];
+        compose_lanes(t, 0.0f, 1.0f, 2.0f, m);
+
+        glm::mat4 matrix;
+        for (int column = 0; column < 4; ++column) {
+            for (int row = 0; row < 4; ++row)
+                matrix[column][row] = m[column][row];
+        }
+
+        return matrix;
+    }
+
+#if defined(MY_ENGINE_TRANSFORM_SSE)
+    // Each register holds the same element of four matrices. Transposing the
+    // four rows of a column gives that column of each matrix.
+    static void store_matrices(__m128 (&m)[4][4], glm::mat4* matrices)
+    {
+        for (int column = 0; column < 4; ++column) {
+            _MM_TRANSPOSE4_PS(m[column][0], m[column][1], m[column][2], m[column][3]);
+
+            for (int lane = 0; lane < 4; ++lane)
+                _mm_storeu_ps(&matrices[lane][column][0], m[column][lane]);
+        }
+    }
+#endif
+
+    void compose_transforms(const Transform_Components& transforms, std::size_t first, std::size_t count, glm::mat4* matrices)
+    {
+        std::size_t i = 0;
+
+        if (count >= 8 && has_avx2()) {
+            const float* const components[10] = {
+                &transforms.position_x[first], &transforms.position_y[first], &transforms.position_z[first],
+                &transforms.rotation_x[first], &transforms.rotation_y[first], &transforms.rotation_z[first], &transforms.rotation_w[first],
+                &transforms.scale_x[first], &transforms.scale_y[first], &transforms.scale_z[first]
+            };
+
+            i = compose_transforms_avx2(components, count, glm::value_ptr(matrices[0]));
+        }
+
+#if defined(MY_ENGINE_TRANSFORM_SSE)
+        for (; i + 4 <= count; i += 4) {
+            const Transform_Lanes<__m128> t = load_lanes<__m128>(transforms, first + i, [](const float* value) {
+                return _mm_loadu_ps(value);
+            });
+
+            __m128 m[4][4];
+            compose_lanes(t, _mm_setzero_ps(), _mm_set1_ps(1.0f), _mm_set1_ps(2.0f), m);
+            store_matrices(m, matrices + i);
+        }
+#endif
+
+        // Remaining objects or every object when SIMD is not available.
+        for (; i < count; ++i)
+            matrices[i] = compose_transform(transforms, first + i);
+    }
+
+    void apply_parent_transforms(const uint32_t* parents, std::size_t first, std::size_t count, glm::mat4* matrices)
+    {
+        if (has_avx2()) {
+            apply_parent_transforms_avx2(parents, first, count, glm::value_ptr(matrices[0]));
+            return;
+        }
+
+        for (std::size_t i = first; i < first + count; ++i) {
+            const uint32_t parent = parents[i];
+            if (parent == UINT32_MAX)
+                continue;
+
+#if defined(MY_ENGINE_TRANSFORM_SSE)
+            // Each result column is the parent's columns weighted by a column
+            // of the child. Every column is computed before any is stored as
+            // the result replaces the child.
+            const glm::mat4& a = matrices[parent];
+            const __m128 a0 = _mm_loadu_ps(&a[0][0]);
+            const __m128 a1 = _mm_loadu_ps(&a[1][0]);
+            const __m128 a2 = _mm_loadu_ps(&a[2][0]);
+            const __m128 a3 = _mm_loadu_ps(&a[3][0]);
+
+            glm::mat4& b = matrices[i];
+            __m128 columns[4];
+            for (int column = 0; column < 4; ++column) {
+                __m128 result = _mm_mul_ps(a0, _mm_set1_ps(b[column][0]));
+                result = _mm_add_ps(result, _mm_mul_ps(a1, _mm_set1_ps(b[column][1])));
+                result = _mm_add_ps(result, _mm_mul_ps(a2, _mm_set1_ps(b[column][2])));
+                result = _mm_add_ps(result, _mm_mul_ps(a3, _mm_set1_ps(b[column][3])));
+                columns[column] = result;
+            }
+
+            for (int column = 0; column < 4; ++column)
+                _mm_storeu_ps(&b[column][0], columns[column]);
+#else
+            matrices[i] = matrices[parent] * matrices[i];
+#endif
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef MY_ENGINE_TRANSFORMS_H
+#define MY_ENGINE_TRANSFORMS_H
+
+namespace engine {
+    // Translations, rotations and scales of many objects stored as a
+    // structure of arrays so that the batch kernels can load the same
+    // component of several objects at once. Rotations are unit quaternions.
+    struct Transform_Components
+    {
+        std::vector<float> position_x;
+        std::vector<float> position_y;
+        std::vector<float> position_z;
+        std::vector<float> rotation_x;
+        std::vector<float> rotation_y;
+        std::vector<float> rotation_z;
+        std::vector<float> rotation_w;
+        std::vector<float> scale_x;
+        std::vector<float> scale_y;
+        std::vector<float> scale_z;
+    };
+
+    // Calls func with every component array so that callers can add, remove
+    // or reorder objects while keeping the arrays in step.
+    template <typename Func>
+    void for_each_transform_array(Transform_Components& transforms, Func func)
+    {
+        func(transforms.position_x);
+        func(transforms.position_y);
+        func(transforms.position_z);
+        func(transforms.rotation_x);
+        func(transforms.rotation_y);
+        func(transforms.rotation_z);
+        func(transforms.rotation_w);
+        func(transforms.scale_x);
+        func(transforms.scale_y);
+        func(transforms.scale_z);
+    }
+
+    void add_transform(Transform_Components& transforms, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+    void set_transform(Transform_Components& transforms, std::size_t index, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+
+    // Splits a matrix without shear or projection into its parts. Mirroring
+    // is folded into a negative x scale. Any shear is lost so callers that
+    // may pass one should check is_trs_matrix first.
+    void set_transform(Transform_Components& transforms, std::size_t index, const glm::mat4& matrix);
+
+    // Returns true if the matrix can be split into a translation, rotation and
+    // scale, that is its axes are orthogonal and it has no projection.
+    bool is_trs_matrix(const glm::mat4& matrix);
+
+    glm::vec3 get_position(const Transform_Components& transforms, std::size_t index);
+    glm::quat get_rotation(const Transform_Components& transforms, std::size_t index);
+    glm::vec3 get_scale(const Transform_Components& transforms, std::size_t index);
+
+    // Composes translation * rotation * scale of a single object.
+    glm::mat4 compose_transform(const Transform_Components& transforms, std::size_t index);
+
+    // Composes the matrices of count objects starting at first into
+    // matrices[0, count). Eight objects are composed at once with AVX2 or
+    // four with SSE when the CPU supports it.
+    void compose_transforms(const Transform_Components& transforms, std::size_t first, std::size_t count, glm::mat4* matrices);
+
+    // Multiplies every matrix in [first, first + count) whose parent is not
+    // UINT32_MAX by the matrix of its parent. Parents must come before their
+    // children and parents before first must already be final.
+    void apply_parent_transforms(const uint32_t* parents, std::size_t first, std::size_t count, glm::mat4* matrices);
+}
+
+#endif
@@ -40,7 +40,7 @@ namespace engine {
         init_info.Device = renderer->ctx.device->device;
         init_info.QueueFamily = renderer->ctx.device->graphics_index;
         init_info.Queue = renderer->ctx.device->graphics_queue;
-        init_info.PipelineCache = nullptr;
+        init_info.PipelineCache = renderer->pipeline_cache;
         init_info.DescriptorPool = renderer->descriptor_pool;
         init_info.Subpass = 0;
         init_info.MinImageCount = 2;
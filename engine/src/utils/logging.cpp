@@ -8,8 +8,14 @@ namespace engine {
     std::size_t logging::m_index = 0;
     std::size_t logging::m_capacity = 0;
 
+    // Messages are logged from worker threads such as frame capture encoding
+    // and parallel pipeline creation.
+    static std::mutex g_logs_mutex;
+
     void logging::add_log(log_type type, const std::string& data)
     {
+        std::lock_guard<std::mutex> lock(g_logs_mutex);
+
         // If we reach the end of the buffer then go back to the start
         if (m_index + 1 >= m_logs.size())
             m_index = 0;
@@ -37,6 +43,8 @@ namespace engine {
             return;
         }
 
+        std::lock_guard<std::mutex> lock(g_logs_mutex);
+
         for (std::size_t i = 0; i < m_capacity; ++i) {
             output << m_logs[i].data;
         }
@@ -46,16 +54,22 @@ namespace engine {
     {
         // todo: A check is required to make to ensure that 
         // index is not out of bounds
+        std::lock_guard<std::mutex> lock(g_logs_mutex);
+
         return m_logs[index];
     }
 
     std::size_t logging::size()
     {
+        std::lock_guard<std::mutex> lock(g_logs_mutex);
+
         return m_capacity;
     }
 
     void logging::clear()
     {
+        std::lock_guard<std::mutex> lock(g_logs_mutex);
+
         m_logs.clear();
         m_logs.resize(max_logs);
 
@@ -0,0 +1,196 @@
+#include "pch.h"
+#include "profiler.h"
+
+#include "logging.h"
+
+#include <atomic>
+
+namespace engine {
+    struct Profile_Event
+    {
+        const char* name;
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    // Events beyond this are dropped until the next capture.
+    constexpr uint32_t max_profile_events_per_thread = 16384;
+
+    // Only the owning thread writes events. The count is published with
+    // release semantics after the event itself has been written so that the
+    // exporting thread can read every event below it without a lock.
+    struct Profile_Thread_Buffer
+    {
+        std::array<Profile_Event, max_profile_events_per_thread> events;
+        std::atomic<uint32_t> count = 0;
+        std::atomic<uint32_t> capture = 0;
+        uint32_t dropped = 0;
+        bool in_use = false;
+    };
+
+    // The registry is only locked the first time a thread records an event
+    // and when the trace is written. Buffers of threads that have exited are
+    // handed to new threads since worker threads come and go every frame.
+    static std::mutex g_buffers_mutex;
+    static std::vector<std::unique_ptr<Profile_Thread_Buffer>> g_buffers;
+
+    // The current capture or zero when not capturing. Every capture gets a
+    // new id so that buffers can tell that their events are stale.
+    static std::atomic<uint32_t> g_capture = 0;
+    static uint32_t g_last_capture = 0;
+    static uint32_t g_capture_frames = 0;
+    static uint32_t g_captured_frames = 0;
+    static uint64_t g_capture_start = 0;
+    static std::filesystem::path g_capture_path;
+
+    struct Profile_Thread_Handle
+    {
+        Profile_Thread_Buffer* buffer = nullptr;
+
+        ~Profile_Thread_Handle()
+        {
+            if (!buffer)
+                return;
+
+            std::lock_guard<std::mutex> lock(g_buffers_mutex);
+            buffer->in_use = false;
+        }
+    };
+
+    static thread_local Profile_Thread_Handle g_thread_buffer;
+
+    static Profile_Thread_Buffer* get_thread_buffer()
+    {
+        if (g_thread_buffer.buffer)
+            return g_thread_buffer.buffer;
+
+        std::lock_guard<std::mutex> lock(g_buffers_mutex);
+
+        auto it = std::find_if(g_buffers.begin(), g_buffers.end(), [](const auto& buffer) {
+            return !buffer->in_use;
+        });
+
+        if (it == g_buffers.end()) {
+            g_buffers.push_back(std::make_unique<Profile_Thread_Buffer>());
+            it = g_buffers.end() - 1;
+        }
+
+        (*it)->in_use = true;
+        g_thread_buffer.buffer = it->get();
+
+        return g_thread_buffer.buffer;
+    }
+
+    uint64_t get_profiler_time()
+    {
+        const auto now = std::chrono::steady_clock::now().time_since_epoch();
+
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+    }
+
+    void add_profile_event(const char* name, uint64_t begin, uint64_t end)
+    {
+        const uint32_t capture = g_capture.load(std::memory_order_relaxed);
+        if (capture == 0)
+            return;
+
+        Profile_Thread_Buffer* buffer = get_thread_buffer();
+
+        if (buffer->capture.load(std::memory_order_relaxed) != capture) {
+            buffer->count.store(0, std::memory_order_relaxed);
+            buffer->dropped = 0;
+            buffer->capture.store(capture, std::memory_order_release);
+        }
+
+        const uint32_t count = buffer->count.load(std::memory_order_relaxed);
+        if (count >= max_profile_events_per_thread) {
+            ++buffer->dropped;
+            return;
+        }
+
+        buffer->events[count] = { name, begin, end };
+        buffer->count.store(count + 1, std::memory_order_release);
+    }
+
+    static void write_profile_capture(uint32_t capture)
+    {
+        std::ofstream file(g_capture_path);
+        if (!file.is_open()) {
+            error("Failed to open {} for writing.", g_capture_path.string());
+            return;
+        }
+
+        std::size_t event_count = 0;
+
+        // Timestamps are in microseconds relative to the start of the
+        // capture as expected by the trace event format.
+        file << "{\"traceEvents\":[\n";
+
+        std::lock_guard<std::mutex> lock(g_buffers_mutex);
+        for (std::size_t thread = 0; thread < g_buffers.size(); ++thread) {
+            const Profile_Thread_Buffer& buffer = *g_buffers[thread];
+            if (buffer.capture.load(std::memory_order_acquire) != capture)
+                continue;
+
+            const uint32_t count = buffer.count.load(std::memory_order_acquire);
+            for (uint32_t i = 0; i < count; ++i) {
+                const Profile_Event& e = buffer.events[i];
+                if (e.begin < g_capture_start)
+                    continue;
+
+                file << std::format("{}{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":0,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+                    event_count == 0 ? "" : ",\n",
+                    e.name,
+                    thread,
+                    static_cast<double>(e.begin - g_capture_start) / 1000.0,
+                    static_cast<double>(e.end - e.begin) / 1000.0);
+
+                ++event_count;
+            }
+
+            if (buffer.dropped > 0)
+                warn("Profiler dropped {} events on thread {}.", buffer.dropped, thread);
+        }
+
+        file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+        info("Wrote {} profile events over {} frames to {}.", event_count, g_captured_frames, g_capture_path.string());
+    }
+
+    void end_profile_frame()
+    {
+        const uint32_t capture = g_capture.load(std::memory_order_relaxed);
+        if (capture == 0)
+            return;
+
+        if (++g_captured_frames < g_capture_frames)
+            return;
+
+        g_capture.store(0, std::memory_order_relaxed);
+        write_profile_capture(capture);
+    }
+
+    bool begin_profile_capture(uint32_t frame_count, const std::filesystem::path& path)
+    {
+#if defined(MY_ENGINE_PROFILER)
+        if (is_profile_capturing() || frame_count == 0)
+            return false;
+
+        g_capture_frames = frame_count;
+        g_captured_frames = 0;
+        g_capture_path = path;
+        g_capture_start = get_profiler_time();
+        g_capture.store(++g_last_capture, std::memory_order_relaxed);
+
+        return true;
+#else
+        warn("Unable to capture profile as the profiler has been compiled out.");
+        return false;
+#endif
+    }
+
+    bool is_profile_capturing()
+    {
+        return g_capture.load(std::memory_order_relaxed) != 0;
+    }
+}
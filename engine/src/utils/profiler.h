@@ -0,0 +1,60 @@
+#ifndef MY_ENGINE_PROFILER_H
+#define MY_ENGINE_PROFILER_H
+
+// Define MY_ENGINE_DISABLE_PROFILER to compile out every profile zone. The
+// capture functions remain but record nothing.
+#if !defined(MY_ENGINE_DISABLE_PROFILER)
+#define MY_ENGINE_PROFILER
+#endif
+
+namespace engine {
+    // Nanoseconds from a steady clock. Only differences are meaningful.
+    uint64_t get_profiler_time();
+
+    // Records a completed zone into the calling thread's event buffer. The
+    // name must outlive the capture which in practice means a literal.
+    void add_profile_event(const char* name, uint64_t begin, uint64_t end);
+
+    // Marks the end of a frame. Once the requested number of frames have
+    // been captured the trace is written to disk.
+    void end_profile_frame();
+
+    // Captures frame_count frames and writes them as Chrome trace JSON which
+    // can be opened with chrome://tracing or Perfetto.
+    bool begin_profile_capture(uint32_t frame_count, const std::filesystem::path& path);
+    bool is_profile_capturing();
+
+    // Times the enclosing scope.
+    class Profile_Zone
+    {
+    public:
+        // Outside of a capture a zone costs a single relaxed atomic load.
+        explicit Profile_Zone(const char* name)
+            : m_name(name), m_begin(is_profile_capturing() ? get_profiler_time() : 0) {}
+
+        ~Profile_Zone()
+        {
+            if (m_begin)
+                add_profile_event(m_name, m_begin, get_profiler_time());
+        }
+
+        Profile_Zone(const Profile_Zone&) = delete;
+        Profile_Zone& operator=(const Profile_Zone&) = delete;
+    private:
+        const char* m_name;
+        uint64_t m_begin;
+    };
+}
+
+#define MY_ENGINE_PROFILE_CONCAT_(a, b) a##b
+#define MY_ENGINE_PROFILE_CONCAT(a, b) MY_ENGINE_PROFILE_CONCAT_(a, b)
+
+#if defined(MY_ENGINE_PROFILER)
+#define PROFILE_ZONE(name) ::engine::Profile_Zone MY_ENGINE_PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_FRAME() ::engine::end_profile_frame()
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_FRAME() ((void)0)
+#endif
+
+#endif
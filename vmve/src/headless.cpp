@@ -0,0 +1,84 @@
+#include "pch.h"
+#include "headless.h"
+
+#include "config.h"
+
+#include <chrono>
+#include <cstdio>
+
+// A different GPU or driver may round slightly differently so small
+// differences in a few pixels are not treated as a regression.
+constexpr int pixel_tolerance = 2;
+constexpr float max_differing_fraction = 0.001f;
+
+static int headless_error(const char* message)
+{
+    std::printf("%s\n", message);
+    engine::logging::output_to_file(app_crash_file);
+    engine::terminate();
+
+    return 2;
+}
+
+int run_headless(int argc, char* argv[])
+{
+    if (argc < 4) {
+        std::printf("Usage: vmve --headless <model> <reference.png> [frames] [width] [height]\n");
+        return 2;
+    }
+
+    const char* model_path = argv[2];
+    const char* reference_path = argv[3];
+    const int frame_count = argc > 4 ? std::max(std::atoi(argv[4]), 1) : 100;
+    const int width = argc > 5 ? std::atoi(argv[5]) : app_width;
+    const int height = argc > 6 ? std::atoi(argv[6]) : app_height;
+
+    if (!engine::initialize_headless(width, height))
+        return headless_error("Failed to initialize the headless engine.");
+
+    engine::create_camera(60.0f, 3.0f);
+
+    engine::load_model(model_path, false);
+    if (engine::get_model_count() == 0)
+        return headless_error("Failed to load the model.");
+
+    engine::add_entity(0, 0.0f, 0.0f, 0.0f);
+    engine::frame_camera_to_model(0, 45.0f, 30.0f);
+
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    for (int i = 0; i < frame_count && engine::update(); ++i) {
+        if (engine::begin_render()) {
+            engine::render();
+            engine::present();
+        }
+    }
+
+    const auto end = std::chrono::high_resolution_clock::now();
+    const float total_time = std::chrono::duration<float, std::milli>(end - start).count();
+
+    std::printf("%s: %d frames at %dx%d, %.3f ms per frame on %s\n", model_path, frame_count,
+        width, height, total_time / static_cast<float>(frame_count), engine::get_gpu_name());
+
+    if (!std::filesystem::exists(reference_path)) {
+        if (!engine::save_frame_pixels(reference_path))
+            return headless_error("Failed to write the reference image.");
+
+        std::printf("Wrote reference image %s\n", reference_path);
+        engine::terminate();
+
+        return 0;
+    }
+
+    engine::Image_Diff diff{};
+    if (!engine::compare_frame_pixels(reference_path, pixel_tolerance, &diff))
+        return headless_error("Failed to compare against the reference image.");
+
+    const bool matches = diff.differing_pixels <= static_cast<int>(static_cast<float>(diff.pixel_count) * max_differing_fraction);
+    std::printf("%s: %d of %d pixels differ, max channel difference %d\n", matches ? "Passed" : "Failed",
+        diff.differing_pixels, diff.pixel_count, diff.max_difference);
+
+    engine::terminate();
+
+    return matches ? 0 : 1;
+}
@@ -0,0 +1,14 @@
+#ifndef VMVE_HEADLESS_H
+#define VMVE_HEADLESS_H
+
+// Renders a model without a window, reports the average frame time and
+// compares the final frame against a reference image. Intended for
+// benchmarks and image regression tests on machines without a display.
+//
+//     vmve --headless <model> <reference.png> [frames] [width] [height]
+//
+// The reference image is written instead when it does not exist yet.
+// Returns 0 if the frame matches, 1 if it does not and 2 on any other error.
+int run_headless(int argc, char* argv[]);
+
+#endif
@@ -5,6 +5,7 @@
 #include "vmve.h"
 #include "ui/ui.h"
 #include "misc.h"
+#include "headless.h"
 
 // TODO: Engine should have its own keycodes
 #define KEY_F1 290
@@ -44,8 +45,11 @@ static void drop_callback(int path_count, const char* paths[]);
 bool not_full_screen = true;
 static bool camera_activated = false;
 
-int main()
+int main(int argc, char* argv[])
 {
+    if (argc > 1 && std::string_view(argv[1]) == "--headless")
+        return run_headless(argc, argv);
+
     // Main application start
     bool initialized = engine::initialize(app_title, app_width, app_height);
     if (!initialized) {
@@ -89,6 +93,7 @@ int main()
 
         if (engine::begin_render()) {
             // Main render pass that renders the scene geometry.
+            engine::set_viewport_view(get_viewport_view());
             engine::render();
 
             // Render all UI elements 
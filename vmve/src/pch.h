@@ -8,6 +8,7 @@
 #include <filesystem>
 #include <array>
 #include <expected>
+#include <random>
 
 #include <cassert>
 
@@ -28,6 +28,13 @@ static void display_renderer_stats(bool* open)
 
         static const char* gpu_name = engine::get_gpu_name();
         ImGui::Text("GPU: %s", gpu_name);
+
+        engine::Render_Stats stats{};
+        engine::get_render_stats(&stats);
+        ImGui::Text("Draw calls: %d", stats.draw_calls);
+        ImGui::Text("Visible: %d Culled: %d", stats.visible_count, stats.culled_count);
+        ImGui::Text("Occluded: %d (%d triangles)", stats.occluded_count, stats.occluded_triangles);
+        ImGui::Text("Shadow casters: %d", stats.shadow_casters);
     }
     ImGui::End();
 }
@@ -76,25 +83,14 @@ void center_panel(const std::string& title, bool* is_open, ImGuiWindowFlags flag
         // when the viewport window resizes.
 
 
-        // change viewport view based on various settings
-        engine::Viewport_View viewport_view = engine::Viewport_View::full;
-        if (lighting)
-            viewport_view = engine::Viewport_View::full;
-        else
-            viewport_view = engine::Viewport_View::colors;
-
-        if (positions)
-            viewport_view = engine::Viewport_View::positions;
-        else if (normals)
-            viewport_view = engine::Viewport_View::normals;
-        else if (speculars)
-            viewport_view = engine::Viewport_View::specular;
-        else if (depth)
-            viewport_view = engine::Viewport_View::depth;
+        // Render only as many pixels as the panel shows. The texture is only
+        // partially covered so the covered part is what gets displayed.
+        engine::set_render_size(viewport_width, viewport_height);
 
+        float viewport_u, viewport_v;
+        engine::get_viewport_uv(&viewport_u, &viewport_v);
 
-
-        ImGui::Image(engine::get_viewport_texture(viewport_view), ImVec2(viewport_width, viewport_height));
+        ImGui::Image(engine::get_viewport_texture(), ImVec2(viewport_width, viewport_height), ImVec2(0.0f, 0.0f), ImVec2(viewport_u, viewport_v));
 
         // todo(zak): move this into its own function
         float* view = engine::get_camera_view();
@@ -104,23 +100,23 @@ void center_panel(const std::string& title, bool* is_open, ImGuiWindowFlags flag
         proj[5] *= -1.0f;
 
         if (object_edit_mode) {
-            if (engine::get_instance_count() > 0 && guizmo_operation != -1) {
+            if (engine::find_instance(selectedInstanceID) >= 0 && guizmo_operation != -1) {
                 ImGuiIO& io = ImGui::GetIO();
 
                 float matrix[16];
-                engine::get_entity_matrix(selectedInstanceIndex, matrix);
+                engine::get_entity_matrix(selectedInstanceID, matrix);
 
                 const auto& operation = static_cast<ImGuizmo::OPERATION>(guizmo_operation);
 
                 ImGuizmo::SetDrawlist();
                 ImGuizmo::SetRect(ImGui::GetWindowPos().x, ImGui::GetWindowPos().y, viewport_width, viewport_height);
-                ImGuizmo::Manipulate(view, proj, operation, ImGuizmo::MODE::WORLD, matrix);
-
-                if (ImGuizmo::IsUsing()) {
-                    engine::set_entity_matrix(selectedInstanceIndex, matrix);
-                    //engine::set_instance_position(selectedInstanceIndex, matrixTranslation[0], matrixTranslation[1], matrixTranslation[2]);
-                    //engine::set_instance_rotation(selectedInstanceIndex, matrixRotation[0], matrixRotation[1], matrixRotation[2]);
-                    //engine::set_instance_scale(selectedInstanceIndex, matrixScale[0], matrixScale[1], matrixScale[2]);
+                // Manipulate only reports a change when the matrix was edited so
+                // holding the gizmo still does not mark the instance dirty.
+                if (ImGuizmo::Manipulate(view, proj, operation, ImGuizmo::MODE::WORLD, matrix)) {
+                    engine::set_entity_matrix(selectedInstanceID, matrix);
+                    //engine::set_instance_position(selectedInstanceID, matrixTranslation[0], matrixTranslation[1], matrixTranslation[2]);
+                    //engine::set_instance_rotation(selectedInstanceID, matrixRotation[0], matrixRotation[1], matrixRotation[2]);
+                    //engine::set_instance_scale(selectedInstanceID, matrixScale[0], matrixScale[1], matrixScale[2]);
                 }
                 
             }
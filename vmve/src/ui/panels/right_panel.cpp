@@ -21,16 +21,18 @@ void right_panel(const std::string& title, bool* is_open, ImGuiWindowFlags flags
 
         ImGui::Combo("Model", &modelID, modelNames.data(), modelNames.size());
 
-#if 0
         ImGui::Text("Models");
         ImGui::SameLine();
-        ImGui::Button(ICON_FA_PLUS);
-        ImGui::SameLine();
         ImGui::BeginDisabled(modelCount == 0);
-        if (ImGui::Button(ICON_FA_MINUS))
+        if (ImGui::Button(ICON_FA_MINUS " remove##model")) {
             engine::remove_model(modelID);
+
+            // Instances of the model are removed along with it.
+            modelCount = engine::get_model_count();
+            instanceCount = engine::get_instance_count();
+            modelID = std::max(std::min(modelID, modelCount - 1), 0);
+        }
         ImGui::EndDisabled();
-#endif
 
         // TODO: Add different entity types
         // TODO: Using only an icon for a button does not seem to register
@@ -44,16 +46,14 @@ void right_panel(const std::string& title, bool* is_open, ImGuiWindowFlags flags
         ImGui::SameLine();
 
         ImGui::BeginDisabled(instanceCount == 0);
-        if (ImGui::Button(ICON_FA_MINUS " remove")) {
-            engine::remove_instance(selectedInstanceIndex);
-
-            // NOTE: should not go below 0
-
-            // Decrement selected index if at boundary
-            if (instanceCount - 1 == selectedInstanceIndex && selectedInstanceIndex != 0)
-                --selectedInstanceIndex;
-
-            assert(selectedInstanceIndex >= 0);
+        if (ImGui::Button(ICON_FA_MINUS " remove") && engine::find_instance(selectedInstanceID) >= 0) {
+            const int index = engine::find_instance(selectedInstanceID);
+            engine::remove_instance(selectedInstanceID);
+
+            // Select the instance that took its place or the previous one if
+            // it was the last.
+            instanceCount = engine::get_instance_count();
+            selectedInstanceID = instanceCount > 0 ? engine::get_instance_id(std::min(index, instanceCount - 1)) : -1;
         }
 
         ImGui::EndDisabled();
@@ -81,14 +81,14 @@ void right_panel(const std::string& title, bool* is_open, ImGuiWindowFlags flags
                     char label[32];
                     sprintf_s(label, "%04d", engine::get_instance_id(i));
 
-                    bool isCurrentlySelected = (selectedInstanceIndex == i);
+                    bool isCurrentlySelected = (selectedInstanceID == engine::get_instance_id(i));
 
                     ImGui::PushID(label);
                     ImGui::TableNextRow();
 
                     ImGui::TableNextColumn();
                     if (ImGui::Selectable(label, isCurrentlySelected, ImGuiSelectableFlags_SpanAllColumns))
-                        selectedInstanceIndex = i;
+                        selectedInstanceID = engine::get_instance_id(i);
 
                     ImGui::TableNextColumn();
                     ImGui::TextUnformatted(engine::get_instance_name(i));
@@ -100,7 +100,15 @@ void right_panel(const std::string& title, bool* is_open, ImGuiWindowFlags flags
         }
 
 
-        if (engine::get_instance_count() > 0) {
+        // Removing a model removes its instances so the selection falls back
+        // to the first instance.
+        int selectedIndex = engine::find_instance(selectedInstanceID);
+        if (selectedIndex < 0 && engine::get_instance_count() > 0) {
+            selectedIndex = 0;
+            selectedInstanceID = engine::get_instance_id(0);
+        }
+
+        if (selectedIndex >= 0) {
             ImGui::BeginChild("Object Properties");
 
             if (ImGui::Button(ICON_FA_UP_DOWN_LEFT_RIGHT)) {
@@ -119,19 +127,21 @@ void right_panel(const std::string& title, bool* is_open, ImGuiWindowFlags flags
             }
 
 
-            ImGui::Text("ID: %04d", engine::get_instance_id(selectedInstanceIndex));
-            ImGui::Text("Name: %s", engine::get_instance_name(selectedInstanceIndex));
+            ImGui::Text("ID: %04d", selectedInstanceID);
+            ImGui::Text("Name: %s", engine::get_instance_name(selectedIndex));
 
 
             float matrix[16];
-            engine::get_entity_matrix(selectedInstanceIndex, matrix);
+            engine::get_entity_matrix(selectedInstanceID, matrix);
+
+            // The matrix is only written back when a widget changed it as
+            // writing marks the instance dirty and decomposing adds drift.
+            bool changed = false;
 
             float matrixTranslation[3], matrixRotation[3], matrixScale[3];
             ImGuizmo::DecomposeMatrixToComponents(matrix, matrixTranslation, matrixRotation, matrixScale);
-            if (ImGui::SliderFloat3("Translation", matrixTranslation, -200.0f, 200.0f))
-                engine::set_instance_position(selectedInstanceIndex, matrixTranslation[0], matrixTranslation[1], matrixTranslation[2]);
-            if (ImGui::SliderFloat3("Rotation", matrixRotation, -360.0f, 360.0f))
-                engine::set_instance_rotation(selectedInstanceIndex, matrixRotation[0], matrixRotation[1], matrixRotation[2]);
+            changed |= ImGui::SliderFloat3("Translation", matrixTranslation, -200.0f, 200.0f);
+            changed |= ImGui::SliderFloat3("Rotation", matrixRotation, -360.0f, 360.0f);
 
 
             static bool uniformScale = true;
@@ -140,21 +150,22 @@ void right_panel(const std::string& title, bool* is_open, ImGuiWindowFlags flags
                     // fixme(zak): we want to display a single slider but update all three
                     matrixScale[1] = matrixScale[0];
                     matrixScale[2] = matrixScale[0];
-
-                    engine::set_instance_scale(selectedInstanceIndex, matrixScale[0]);
+                    changed = true;
                 }
                 ImGui::SameLine();
                 if (ImGui::Button(ICON_FA_LOCK))
                     uniformScale = false;
             } else {
-                if (ImGui::SliderFloat3("Scale", matrixScale, 0.1f, 100.0f))
-                    engine::set_instance_scale(selectedInstanceIndex, matrixScale[0], matrixScale[1], matrixScale[2]);
+                changed |= ImGui::SliderFloat3("Scale", matrixScale, 0.1f, 100.0f);
                 ImGui::SameLine();
                 if (ImGui::Button(ICON_FA_UNLOCK))
                     uniformScale = true;
             }
-            ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, matrix);
-            engine::set_entity_matrix(selectedInstanceIndex, matrix);
+
+            if (changed) {
+                ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, matrix);
+                engine::set_entity_matrix(selectedInstanceID, matrix);
+            }
 
             ImGui::EndChild();
         }
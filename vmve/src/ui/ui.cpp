@@ -55,7 +55,7 @@ bool update_swapchain_vsync = false;
 bool first_non_fullscreen = true;
 bool first_fullscreen = !first_non_fullscreen;
 bool object_edit_mode = false;
-extern int selectedInstanceIndex = 0;
+extern int selectedInstanceID = -1;
 int guizmo_operation = -1;
 
 
@@ -64,9 +64,10 @@ bool settings_open = false;
 bool about_open = false;
 bool load_model_open = false;
 bool creator_open = false;
-//bool perf_profiler_open = false;
+bool perf_profiler_open = false;
 bool audio_window_open = false;
 bool console_window_open = false;
+bool stress_test_open = false;
 
 #if defined(_DEBUG)
 bool show_demo_window = false;
@@ -370,10 +371,41 @@ static void render_preferences_window(bool* open)
         break;
     case setting_options::rendering: {
 
-        static int swapchain_images = 3;
+        ImGui::Text("Rendering");
+
+        static std::array<const char*, 3> present_mode_names = { "VSync", "Mailbox", "Immediate" };
+        int present_mode = static_cast<int>(engine::get_present_mode());
+        if (ImGui::Combo("Present mode", &present_mode, present_mode_names.data(), static_cast<int>(present_mode_names.size()))) {
+            engine::set_present_mode(static_cast<engine::Present_Mode>(present_mode));
+            vsync = present_mode != static_cast<int>(engine::Present_Mode::immediate);
+        }
+        info_marker("Mailbox waits for the display without tearing but replaces queued frames to lower latency");
+
         static int current_buffer_mode = 0;
         static std::array<const char*, 2> buf_mode_names = { "Double Buffering", "Triple Buffering" };
-        ImGui::Combo("Buffer mode", &current_buffer_mode, buf_mode_names.data(), static_cast<int>(buf_mode_names.size()));
+        if (ImGui::Combo("Buffer mode", &current_buffer_mode, buf_mode_names.data(), static_cast<int>(buf_mode_names.size())))
+            engine::set_triple_buffering(current_buffer_mode == 1);
+        info_marker("Triple buffering lets the GPU keep rendering while the display is busy");
+
+        int frames_in_flight = engine::get_frames_in_flight();
+        if (ImGui::SliderInt("Frames in flight", &frames_in_flight, 1, 3))
+            engine::set_frames_in_flight(frames_in_flight);
+        info_marker("More frames in flight increase throughput while fewer reduce input latency");
+
+        static bool limit_frame_rate = false;
+        static int frame_limit = 60;
+        bool limit_changed = ImGui::Checkbox("Limit frame rate", &limit_frame_rate);
+        ImGui::BeginDisabled(!limit_frame_rate);
+        limit_changed |= ImGui::SliderInt("Frame limit", &frame_limit, 30, 360);
+        ImGui::EndDisabled();
+        if (limit_changed)
+            engine::set_frame_limit(limit_frame_rate ? static_cast<float>(frame_limit) : 0.0f);
+        info_marker("Caps the frame rate before input is read which keeps latency low");
+
+        static bool low_latency = false;
+        if (ImGui::Checkbox("Low latency", &low_latency))
+            engine::set_low_latency(low_latency);
+        info_marker("Waits for the GPU before reading input. Lowers latency when the GPU is the bottleneck");
 
         break;
     }
@@ -641,7 +673,6 @@ static void vmve_export_window(bool* open)
     ImGui::End();
 }
 
-#if 0
 static void perf_window(bool* open)
 {
     if (!*open)
@@ -651,18 +682,111 @@ static void perf_window(bool* open)
     
     ImGui::Begin(ICON_FA_CLOCK " Performance Profiler", open);
 
-    if (ImGui::CollapsingHeader("CPU Timers")) {
-        ImGui::Text("%.2fms - Applicaiton::Render", 15.41f);
-        ImGui::Text("%.2fms - GeometryPass::Render", 12.23f);
+    if (ImGui::CollapsingHeader("CPU Timers", ImGuiTreeNodeFlags_DefaultOpen)) {
+        static int capture_frames = 120;
+        const bool capturing = engine::is_capturing_cpu_profile();
+
+        ImGui::BeginDisabled(capturing);
+        ImGui::SliderInt("Frames", &capture_frames, 1, 1000);
+        if (ImGui::Button("Capture")) {
+            const std::string path = (std::filesystem::path(engine::get_app_directory()) / "cpu_profile.json").string();
+            engine::capture_cpu_profile(capture_frames, path.c_str());
+        }
+        ImGui::EndDisabled();
+
+        if (capturing)
+            ImGui::Text("Capturing %d frames...", capture_frames);
+        else
+            ImGui::TextDisabled("Captures are written to cpu_profile.json and can be opened in Perfetto.");
     }
 
-    if (ImGui::CollapsingHeader("GPU Timers")) {
-        ImGui::Text("%fms - VkQueueSubmit", 0.018f);
+    if (ImGui::CollapsingHeader("Viewport Capture", ImGuiTreeNodeFlags_DefaultOpen)) {
+        static const std::array<const char*, 6> views{ "Full", "Colors", "Positions", "Normals", "Specular", "Depth" };
+        static int view = 0;
+        static int sequence_frames = 60;
+        const bool capturing = engine::is_capturing_viewport();
+
+        ImGui::BeginDisabled(capturing);
+        ImGui::Combo("View", &view, views.data(), static_cast<int>(views.size()));
+        ImGui::SliderInt("Sequence frames", &sequence_frames, 1, 1000);
+
+        // The engine picks the extension based on the view.
+        const std::filesystem::path path = std::filesystem::path(engine::get_app_directory()) / "capture";
+        if (ImGui::Button("Screenshot"))
+            engine::capture_viewport(static_cast<engine::Viewport_View>(view), path.string().c_str(), 1);
+        ImGui::SameLine();
+        if (ImGui::Button("Record Sequence"))
+            engine::capture_viewport(static_cast<engine::Viewport_View>(view), path.string().c_str(), sequence_frames);
+        ImGui::EndDisabled();
+
+        if (capturing)
+            ImGui::Text("Capturing...");
+        else
+            ImGui::TextDisabled("Depth is written as EXR and every other view as PNG.");
+    }
+
+    if (ImGui::CollapsingHeader("GPU Timers", ImGuiTreeNodeFlags_DefaultOpen)) {
+        std::array<engine::Gpu_Timing, 16> timings{};
+        const int count = engine::get_gpu_timings(timings.data(), static_cast<int>(timings.size()));
+
+        if (count == 0)
+            ImGui::TextDisabled("No GPU timings available.");
+
+        if (count > 0 && ImGui::BeginTable("GPU Timers", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+            ImGui::TableSetupColumn("Pass");
+            ImGui::TableSetupColumn("Last (ms)");
+            ImGui::TableSetupColumn("Min (ms)");
+            ImGui::TableSetupColumn("Avg (ms)");
+            ImGui::TableSetupColumn("Max (ms)");
+            ImGui::TableHeadersRow();
+
+            float total = 0.0f;
+            for (int i = 0; i < count; ++i) {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Text("%s", timings[i].name);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", timings[i].last);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", timings[i].min);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", timings[i].avg);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", timings[i].max);
+
+                total += timings[i].avg;
+            }
+
+            ImGui::EndTable();
+
+            ImGui::Text("Total (avg): %.3fms", total);
+        }
+
+        static bool exported = false;
+        if (ImGui::Button("Export")) {
+            const std::string path = (std::filesystem::path(engine::get_app_directory()) / "gpu_timings.csv").string();
+            exported = engine::export_gpu_timings(path.c_str());
+        }
+
+        if (exported) {
+            ImGui::SameLine();
+            ImGui::TextColored(ImVec4(0.0f, 1.0f, 0.0f, 1.0f), "Exported to gpu_timings.csv");
+        }
+    }
+
+    if (ImGui::CollapsingHeader("Latency", ImGuiTreeNodeFlags_DefaultOpen)) {
+        engine::Latency_Stats latency{};
+        engine::get_latency_stats(&latency);
+
+        ImGui::Text("Input to present: %.2fms (avg %.2fms)", latency.input_to_present, latency.input_to_present_avg);
+        ImGui::Text("Frame wait: %.2fms", latency.frame_wait);
+        ImGui::Text("Limiter wait: %.2fms", latency.limiter_wait);
+        ImGui::Text("Frames in flight: %d", engine::get_frames_in_flight());
+        ImGui::TextDisabled("Time spent by the display after presenting is not included.");
     }
 
     ImGui::End();
 }
-#endif
 
 static void render_audio_window(bool* open)
 {
@@ -720,15 +844,331 @@ static void render_console_window(bool* open)
     ImGui::End();
 }
 
+// Benchmarks skip a few frames after every change before measuring so that
+// the results are not affected by resources being created.
+static constexpr int benchmark_warmup_frames = 10;
+static constexpr int benchmark_measure_frames = 60;
+
+struct Light_Benchmark_Result
+{
+    int light_count;
+    float frame_time;
+};
+
+// The light benchmark doubles the number of point lights from 1 to 4096 and
+// records the average frame time at each step.
+static constexpr int light_benchmark_steps = 13;
+
+static bool light_benchmark_running = false;
+static int light_benchmark_step = 0;
+static int light_benchmark_frame = 0;
+static float light_benchmark_total = 0.0f;
+static std::vector<Light_Benchmark_Result> light_benchmark_results;
+
+// Adds point lights at random positions around the camera.
+static void add_random_point_lights(int count)
+{
+    static std::mt19937 generator(1337);
+    std::uniform_real_distribution<float> offset(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> color(0.2f, 1.0f);
+
+    float x, y, z;
+    engine::get_camera_position(&x, &y, &z);
+
+    for (int i = 0; i < count; ++i) {
+        engine::add_point_light(x + offset(generator), y + offset(generator) * 0.1f, z + offset(generator),
+            color(generator), color(generator), color(generator), 10.0f, 1.0f);
+    }
+}
+
+static void update_light_benchmark()
+{
+    if (!light_benchmark_running)
+        return;
+
+    const int light_count = 1 << light_benchmark_step;
+
+    if (light_benchmark_frame == 0) {
+        engine::clear_point_lights();
+        add_random_point_lights(light_count);
+        light_benchmark_total = 0.0f;
+    } else if (light_benchmark_frame > benchmark_warmup_frames) {
+        light_benchmark_total += engine::get_frame_delta() * 1000.0f;
+    }
+
+    if (++light_benchmark_frame <= benchmark_warmup_frames + benchmark_measure_frames)
+        return;
+
+    light_benchmark_results.push_back({ light_count, light_benchmark_total / benchmark_measure_frames });
+    light_benchmark_frame = 0;
+
+    if (++light_benchmark_step == light_benchmark_steps) {
+        light_benchmark_running = false;
+        engine::clear_point_lights();
+    }
+}
+
+static void render_light_benchmark()
+{
+    update_light_benchmark();
+
+    ImGui::Text("Point lights: %d", engine::get_point_light_count());
+
+    static int light_count = 256;
+    ImGui::InputInt("Lights", &light_count, 16, 256);
+    light_count = std::clamp(light_count, 1, 4096);
+
+    ImGui::BeginDisabled(light_benchmark_running);
+    if (ImGui::Button(ICON_FA_LIGHTBULB " Add Lights"))
+        add_random_point_lights(light_count);
+    ImGui::SameLine();
+    if (ImGui::Button("Clear Lights"))
+        engine::clear_point_lights();
+    ImGui::SameLine();
+    if (ImGui::Button(ICON_FA_GAUGE " Run Light Benchmark")) {
+        light_benchmark_running = true;
+        light_benchmark_step = 0;
+        light_benchmark_frame = 0;
+        light_benchmark_results.clear();
+    }
+    ImGui::EndDisabled();
+
+    if (light_benchmark_running)
+        ImGui::Text("Benchmarking %d lights...", 1 << light_benchmark_step);
+    else
+        ImGui::TextDisabled("Disable vsync for accurate benchmark results.");
+
+    if (!light_benchmark_results.empty() && ImGui::BeginTable("Light Benchmark", 2, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("Lights");
+        ImGui::TableSetupColumn("Frame time (ms)");
+        ImGui::TableHeadersRow();
+
+        for (const Light_Benchmark_Result& result : light_benchmark_results) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%d", result.light_count);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", result.frame_time);
+        }
+
+        ImGui::EndTable();
+    }
+}
+
+struct Record_Benchmark_Result
+{
+    int thread_count;
+    float record_time;
+};
+
+// The recording benchmark doubles the number of recording threads from 1 to
+// 8 and records the average command recording time at each step.
+static constexpr int record_benchmark_steps = 4;
+
+static bool record_benchmark_running = false;
+static int record_benchmark_step = 0;
+static int record_benchmark_frame = 0;
+static int record_benchmark_threads = 0;
+static float record_benchmark_total = 0.0f;
+static std::vector<Record_Benchmark_Result> record_benchmark_results;
+
+static void update_record_benchmark()
+{
+    if (!record_benchmark_running)
+        return;
+
+    const int thread_count = 1 << record_benchmark_step;
+
+    if (record_benchmark_frame == 0) {
+        engine::set_record_threads(thread_count);
+        record_benchmark_total = 0.0f;
+    } else if (record_benchmark_frame > benchmark_warmup_frames) {
+        engine::Render_Stats stats{};
+        engine::get_render_stats(&stats);
+        record_benchmark_total += stats.record_time;
+    }
+
+    if (++record_benchmark_frame <= benchmark_warmup_frames + benchmark_measure_frames)
+        return;
+
+    record_benchmark_results.push_back({ thread_count, record_benchmark_total / benchmark_measure_frames });
+    record_benchmark_frame = 0;
+
+    if (++record_benchmark_step == record_benchmark_steps) {
+        record_benchmark_running = false;
+        engine::set_record_threads(record_benchmark_threads);
+    }
+}
+
+static void render_record_benchmark()
+{
+    update_record_benchmark();
+
+    int thread_count = engine::get_record_threads();
+    ImGui::BeginDisabled(record_benchmark_running);
+    if (ImGui::SliderInt("Recording threads", &thread_count, 1, 8))
+        engine::set_record_threads(thread_count);
+
+    if (ImGui::Button(ICON_FA_GAUGE " Run Recording Benchmark")) {
+        record_benchmark_running = true;
+        record_benchmark_step = 0;
+        record_benchmark_frame = 0;
+        record_benchmark_threads = thread_count;
+        record_benchmark_results.clear();
+    }
+    ImGui::EndDisabled();
+
+    if (record_benchmark_running)
+        ImGui::Text("Benchmarking %d threads...", 1 << record_benchmark_step);
+    else
+        ImGui::TextDisabled("Spawn enough instances to split the geometry pass across threads.");
+
+    if (!record_benchmark_results.empty() && ImGui::BeginTable("Recording Benchmark", 2, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("Threads");
+        ImGui::TableSetupColumn("Recording time (ms)");
+        ImGui::TableHeadersRow();
+
+        for (const Record_Benchmark_Result& result : record_benchmark_results) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%d", result.thread_count);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", result.record_time);
+        }
+
+        ImGui::EndTable();
+    }
+}
+
+static void render_transform_benchmark()
+{
+    static int object_count = 100000;
+    static std::vector<engine::Transform_Benchmark_Result> transform_benchmark_results;
+
+    ImGui::InputInt("Objects", &object_count, 1000, 10000);
+    object_count = std::clamp(object_count, 1, 1000000);
+
+    if (ImGui::Button(ICON_FA_GAUGE " Run Transform Benchmark")) {
+        engine::Transform_Benchmark_Result result{};
+        engine::run_transform_benchmark(object_count, &result);
+        transform_benchmark_results.push_back(result);
+    }
+
+    if (!transform_benchmark_results.empty() && ImGui::BeginTable("Transform Benchmark", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("Objects");
+        ImGui::TableSetupColumn("glm (ms)");
+        ImGui::TableSetupColumn("Batched (ms)");
+        ImGui::TableSetupColumn("Max error");
+        ImGui::TableHeadersRow();
+
+        for (const engine::Transform_Benchmark_Result& result : transform_benchmark_results) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%d", result.object_count);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", result.glm_time);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", result.batch_time);
+            ImGui::TableNextColumn();
+            ImGui::Text("%g", result.max_error);
+        }
+
+        ImGui::EndTable();
+    }
+}
+
+static void render_stress_test_window(bool* open)
+{
+    if (!*open)
+        return;
+
+    resize_and_center_next_window(ImVec2(800, 600));
+
+    ImGui::Begin(ICON_FA_GAUGE " Stress Test", open);
+
+    static int model_index = 0;
+    static int instance_count = 100000;
+    static bool gpu_culling = false;
+    static bool occlusion_culling = true;
+    static bool shadows = true;
+    static bool normal_mapping = true;
+
+    const int model_count = engine::get_model_count();
+    if (model_count == 0) {
+        ImGui::Text("Load a model to begin stress testing.");
+    } else {
+        model_index = std::clamp(model_index, 0, model_count - 1);
+
+        if (ImGui::BeginCombo("Model", engine::get_model_name(model_index))) {
+            for (int i = 0; i < model_count; ++i) {
+                if (ImGui::Selectable(engine::get_model_name(i), i == model_index))
+                    model_index = i;
+            }
+
+            ImGui::EndCombo();
+        }
+
+        ImGui::InputInt("Instances", &instance_count, 1000, 10000);
+        instance_count = std::max(instance_count, 1);
+
+        if (ImGui::Button(ICON_FA_CUBES " Spawn"))
+            engine::add_stress_test(model_index, instance_count);
+    }
+
+    if (ImGui::Checkbox("GPU culling", &gpu_culling)) {
+        if (!engine::set_gpu_culling(gpu_culling))
+            gpu_culling = false;
+    }
+
+    if (ImGui::Checkbox("Occlusion culling", &occlusion_culling))
+        engine::set_occlusion_culling(occlusion_culling);
+
+    if (ImGui::Checkbox("Shadows", &shadows))
+        engine::set_shadows(shadows);
+
+    if (ImGui::Checkbox("Normal mapping", &normal_mapping))
+        engine::set_normal_mapping(normal_mapping);
+
+    ImGui::Separator();
+
+    engine::Render_Stats stats{};
+    engine::get_render_stats(&stats);
+
+    ImGui::Text("Instances: %d", stats.instance_count);
+    ImGui::Text("Draw calls: %d", stats.draw_calls);
+    if (!gpu_culling)
+        ImGui::Text("Visible: %d Culled: %d", stats.visible_count, stats.culled_count);
+    ImGui::Text("Occluded: %d (%d triangles)", stats.occluded_count, stats.occluded_triangles);
+    ImGui::Text("Shadow casters: %d", stats.shadow_casters);
+    ImGui::Text("Binds skipped: %d", stats.binds_skipped);
+    ImGui::Text("Command recording: %.3fms", stats.record_time);
+    ImGui::Text("Frame time: %.3fms", engine::get_frame_delta() * 1000.0f);
+
+    ImGui::Separator();
+
+    render_record_benchmark();
+
+    ImGui::Separator();
+
+    render_light_benchmark();
+
+    ImGui::Separator();
+
+    render_transform_benchmark();
+
+    ImGui::End();
+}
+
 static void render_windows()
 {
     render_preferences_window(&settings_open);
     render_about_window(&about_open);
     load_model_window(&load_model_open);
     vmve_export_window(&creator_open);
-    //perf_window(&perf_profiler_open);
+    perf_window(&perf_profiler_open);
     render_audio_window(&audio_window_open);
     render_console_window(&console_window_open);
+    render_stress_test_window(&stress_test_open);
 
     // TODO: continue working on drag and drop model loading
     if (drop_load_model) {
@@ -842,6 +1282,20 @@ void configure_ui()
     engine::set_ui_font_texture();
 }
 
+engine::Viewport_View get_viewport_view()
+{
+    if (positions)
+        return engine::Viewport_View::positions;
+    if (normals)
+        return engine::Viewport_View::normals;
+    if (speculars)
+        return engine::Viewport_View::specular;
+    if (depth)
+        return engine::Viewport_View::depth;
+
+    return lighting ? engine::Viewport_View::full : engine::Viewport_View::colors;
+}
+
 void render_ui(bool fullscreen)
 {
     begin_docking();
@@ -30,7 +30,7 @@ extern bool update_swapchain_vsync;
 extern bool first_non_fullscreen;
 extern bool first_fullscreen;
 extern bool object_edit_mode;
-extern int selectedInstanceIndex;
+extern int selectedInstanceID;
 extern int guizmo_operation;
 
 
@@ -39,9 +39,10 @@ extern bool settings_open;
 extern bool about_open;
 extern bool load_model_open;
 extern bool creator_open;
-//extern bool perf_profiler_open;
+extern bool perf_profiler_open;
 extern bool audio_window_open;
 extern bool console_window_open;
+extern bool stress_test_open;
 
 #if defined(_DEBUG)
 extern bool show_demo_window;
@@ -84,6 +85,9 @@ void info_marker(const char* desc);
 void configure_ui();
 void render_ui(bool fullscreen);
 
+// The viewport view selected by the renderer settings.
+engine::Viewport_View get_viewport_view();
+
 
 
 void left_panel(const std::string& title, bool* is_open, ImGuiWindowFlags flags = ImGuiWindowFlags_None);